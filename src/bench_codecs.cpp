@@ -0,0 +1,479 @@
+/*
+ * Benchmark of the video codecs of --codecs on this machine: encodes the
+ * same clip at several bitrates with each codec, and measures the quality
+ * (luma PSNR against the original) and the CPU time of decoding it with
+ * the same elements that --decoder explicit uses. From these, prints the
+ * bitrate each codec needs for a given quality and what decoding it costs
+ * per megapixel, so the cheapest codec can be put first in --codecs.
+ *
+ * The clip is videotestsrc by default; --input URI uses a real recording,
+ * which gives much more realistic numbers for 360 video.
+ *
+ * Usage: ./bench_codecs [--codecs VP8,VP9,H264] [--size 1920x960]
+ *                       [--frames 150] [--bitrates 500,1000,2000,4000,8000]
+ *                       [--psnr 38] [--input URI]
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "codecs.h"
+
+static const gchar *codec_list = "VP8,VP9,H264";
+static const gchar *size = "1920x960";
+static gint frames = 150;
+static const gchar *bitrate_list = "500,1000,2000,4000,8000";
+static gdouble target_psnr = 38.0;
+static const gchar *input_uri = nullptr;
+static gint decoder_threads = 0;
+
+static GOptionEntry entries[] = {
+    {"codecs", 0, 0, G_OPTION_ARG_STRING, &codec_list,
+     "Codecs to compare (default: VP8,VP9,H264)", "LIST"},
+    {"size", 0, 0, G_OPTION_ARG_STRING, &size,
+     "Frame size (default: 1920x960)", "WxH"},
+    {"frames", 0, 0, G_OPTION_ARG_INT, &frames,
+     "Length of the clip at 30 fps (default: 150)", "N"},
+    {"bitrates", 0, 0, G_OPTION_ARG_STRING, &bitrate_list,
+     "Encoder bitrates to try (default: 500,1000,2000,4000,8000)", "KBPS,..."},
+    {"psnr", 0, 0, G_OPTION_ARG_DOUBLE, &target_psnr,
+     "Quality to compare the codecs at (default: 38)", "DB"},
+    {"input", 0, 0, G_OPTION_ARG_STRING, &input_uri,
+     "Use this video instead of videotestsrc, e.g. file:///path/clip.mp4", "URI"},
+    {"decoder-threads", 0, 0, G_OPTION_ARG_INT, &decoder_threads,
+     "Decoder threads, 0 = decoder's default", "N"},
+    {nullptr},
+};
+
+static gint width, height;
+
+/**
+ * One encoded clip, kept in memory so that decoding can be timed alone.
+ */
+struct EncodedClip
+{
+    GstCaps *caps = nullptr;
+    std::vector<GstBuffer *> buffers;
+    guint64 bytes = 0;
+
+    ~EncodedClip()
+    {
+        for (GstBuffer *buffer : buffers)
+            gst_buffer_unref(buffer);
+        if (caps)
+            gst_caps_unref(caps);
+    }
+};
+
+/**
+ * One bitrate of one codec.
+ */
+struct Result
+{
+    double kbps;       /* actual, from the encoded size */
+    double psnr;       /* dB */
+    double cpu_ms;     /* decoding CPU time per frame, all threads */
+};
+
+static double cpu_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * The raw clip: exactly `frames` I420 frames of the benchmark size.
+ */
+static gchar *source_description(void)
+{
+    return g_strdup_printf("%s%s ! videoconvert ! videoscale ! videorate ! "
+                           "video/x-raw,format=I420,width=%d,height=%d,framerate=30/1 ! "
+                           "identity eos-after=%d",
+                           input_uri ? "uridecodebin uri=" : "videotestsrc pattern=ball horizontal-speed=4",
+                           input_uri ? input_uri : "", width, height, frames);
+}
+
+static GstElement *launch(const gchar *description)
+{
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+
+    if (error)
+    {
+        g_printerr("Can't create %s: %s\n", description, error->message);
+        g_error_free(error);
+        if (pipeline)
+            gst_object_unref(pipeline);
+        return nullptr;
+    }
+    return pipeline;
+}
+
+/**
+ * Print the pipeline's error, if it stopped because of one.
+ */
+static gboolean check_error(GstElement *pipeline)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    gboolean ok = TRUE;
+
+    if (msg)
+    {
+        GError *error = nullptr;
+        gst_message_parse_error(msg, &error, NULL);
+        g_printerr("%s: %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), error->message);
+        g_error_free(error);
+        gst_message_unref(msg);
+        ok = FALSE;
+    }
+    gst_object_unref(bus);
+    return ok;
+}
+
+static gboolean encode(const VideoCodec *codec, guint kbps, EncodedClip *clip)
+{
+    gchar *source = source_description();
+    gchar *enc = g_strdup_printf(codec->enc, kbps);
+    gchar *description = g_strdup_printf("%s ! %s ! appsink name=out sync=false",
+                                         source, enc);
+    GstElement *pipeline = launch(description);
+    GstSample *sample;
+
+    g_free(description);
+    g_free(enc);
+    g_free(source);
+    if (!pipeline)
+        return FALSE;
+
+    GstElement *out = gst_bin_get_by_name(GST_BIN(pipeline), "out");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    while ((sample = gst_app_sink_pull_sample(GST_APP_SINK(out))))
+    {
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        if (!clip->caps)
+            clip->caps = gst_caps_ref(gst_sample_get_caps(sample));
+        clip->bytes += gst_buffer_get_size(buffer);
+        clip->buffers.push_back(gst_buffer_ref(buffer));
+        gst_sample_unref(sample);
+    }
+    gboolean ok = check_error(pipeline) && !clip->buffers.empty();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(out);
+    gst_object_unref(pipeline);
+    return ok;
+}
+
+/**
+ * appsrc ! [parser !] decoder ! SINK, fed with the encoded clip.
+ */
+static GstElement *create_decoder(const VideoCodec *codec, const EncodedClip &clip,
+                                  const gchar *sink)
+{
+    gchar *threads = decoder_threads > 0
+                         ? g_strdup_printf(" %s=%d", codec->dec_threads, decoder_threads)
+                         : g_strdup("");
+    gchar *description = g_strdup_printf("appsrc name=src format=time ! %s%s%s%s ! %s",
+                                         codec->parse ? codec->parse : "",
+                                         codec->parse ? " ! " : "", codec->dec,
+                                         threads, sink);
+    GstElement *pipeline = launch(description);
+
+    g_free(description);
+    g_free(threads);
+    if (pipeline)
+    {
+        GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+        g_object_set(src, "caps", clip.caps, "max-bytes", (guint64)0, NULL);
+        gst_object_unref(src);
+    }
+    return pipeline;
+}
+
+static void push_clip(GstElement *pipeline, const EncodedClip &clip)
+{
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+
+    for (GstBuffer *buffer : clip.buffers)
+        gst_app_src_push_buffer(GST_APP_SRC(src), gst_buffer_ref(buffer));
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    gst_object_unref(src);
+}
+
+/**
+ * Decoding CPU time per frame, the best of three runs. The clip is already
+ * in memory and goes to a fakesink, so nearly all of it is the decoder.
+ */
+static double time_decoding(const VideoCodec *codec, const EncodedClip &clip)
+{
+    double best = -1;
+
+    for (int run = 0; run < 3; run++)
+    {
+        GstElement *pipeline = create_decoder(codec, clip, "fakesink sync=false");
+        if (!pipeline)
+            return -1;
+
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        double start = cpu_time_ms();
+        push_clip(pipeline, clip);
+
+        GstBus *bus = gst_element_get_bus(pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                     (GstMessageType)(GST_MESSAGE_EOS |
+                                                                      GST_MESSAGE_ERROR));
+        double ms = cpu_time_ms() - start;
+        gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+        if (msg)
+            gst_message_unref(msg);
+        gst_object_unref(bus);
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+
+        if (!ok)
+        {
+            g_printerr("Decoding %s failed\n", codec->name);
+            return -1;
+        }
+        if (best < 0 || ms < best)
+            best = ms;
+    }
+    return best / clip.buffers.size();
+}
+
+/**
+ * Squared error of the luma planes.
+ */
+static double luma_error(GstSample *decoded, GstSample *original)
+{
+    GstVideoInfo info_a, info_b;
+    GstVideoFrame a, b;
+    double sum = 0;
+
+    if (!gst_video_info_from_caps(&info_a, gst_sample_get_caps(decoded)) ||
+        !gst_video_info_from_caps(&info_b, gst_sample_get_caps(original)) ||
+        !gst_video_frame_map(&a, &info_a, gst_sample_get_buffer(decoded), GST_MAP_READ))
+        return -1;
+    if (!gst_video_frame_map(&b, &info_b, gst_sample_get_buffer(original), GST_MAP_READ))
+    {
+        gst_video_frame_unmap(&a);
+        return -1;
+    }
+
+    const guint8 *pa = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA(&a, 0);
+    const guint8 *pb = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA(&b, 0);
+    const gint sa = GST_VIDEO_FRAME_PLANE_STRIDE(&a, 0);
+    const gint sb = GST_VIDEO_FRAME_PLANE_STRIDE(&b, 0);
+    for (gint y = 0; y < height; y++)
+    {
+        guint64 row = 0;
+        for (gint x = 0; x < width; x++)
+        {
+            gint d = pa[y * sa + x] - pb[y * sb + x];
+            row += d * d;
+        }
+        sum += row;
+    }
+
+    gst_video_frame_unmap(&b);
+    gst_video_frame_unmap(&a);
+    return sum;
+}
+
+/**
+ * Luma PSNR of the whole decoded clip against the original, which is
+ * generated again frame by frame instead of being kept in memory.
+ */
+static double measure_psnr(const VideoCodec *codec, const EncodedClip &clip)
+{
+    gchar *source = source_description();
+    gchar *description = g_strdup_printf("%s ! appsink name=out sync=false", source);
+    GstElement *original = launch(description);
+    GstElement *decoded = create_decoder(codec, clip,
+                                         "videoconvert ! video/x-raw,format=I420 ! "
+                                         "appsink name=out sync=false");
+    double sum = 0;
+    guint64 count = 0;
+
+    g_free(description);
+    g_free(source);
+    if (!original || !decoded)
+    {
+        if (original)
+            gst_object_unref(original);
+        if (decoded)
+            gst_object_unref(decoded);
+        return -1;
+    }
+
+    GstElement *out_a = gst_bin_get_by_name(GST_BIN(decoded), "out");
+    GstElement *out_b = gst_bin_get_by_name(GST_BIN(original), "out");
+    gst_element_set_state(decoded, GST_STATE_PLAYING);
+    gst_element_set_state(original, GST_STATE_PLAYING);
+    push_clip(decoded, clip);
+
+    for (;;)
+    {
+        GstSample *a = gst_app_sink_pull_sample(GST_APP_SINK(out_a));
+        GstSample *b = a ? gst_app_sink_pull_sample(GST_APP_SINK(out_b)) : nullptr;
+        double error = a && b ? luma_error(a, b) : -1;
+
+        if (a)
+            gst_sample_unref(a);
+        if (b)
+            gst_sample_unref(b);
+        if (error < 0)
+            break;
+        sum += error;
+        count++;
+    }
+    if (count != clip.buffers.size())
+        g_printerr("%s: compared %" G_GUINT64_FORMAT " of %u frames\n",
+                   codec->name, count, (guint)clip.buffers.size());
+
+    gst_element_set_state(decoded, GST_STATE_NULL);
+    gst_element_set_state(original, GST_STATE_NULL);
+    gst_object_unref(out_a);
+    gst_object_unref(out_b);
+    gst_object_unref(decoded);
+    gst_object_unref(original);
+
+    if (count == 0)
+        return -1;
+    double mse = sum / ((double)count * width * height);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+/**
+ * Interpolate bitrate and CPU time at the target PSNR, on a log scale of
+ * bitrate. Returns FALSE if the target is outside the measured range.
+ */
+static gboolean at_target(const std::vector<Result> &results, Result *target)
+{
+    for (size_t i = 1; i < results.size(); i++)
+    {
+        const Result &lo = results[i - 1], &hi = results[i];
+        if (lo.psnr <= target_psnr && target_psnr <= hi.psnr && hi.psnr > lo.psnr)
+        {
+            double t = (target_psnr - lo.psnr) / (hi.psnr - lo.psnr);
+            target->kbps = exp(log(lo.kbps) + t * (log(hi.kbps) - log(lo.kbps)));
+            target->cpu_ms = lo.cpu_ms + t * (hi.cpu_ms - lo.cpu_ms);
+            target->psnr = target_psnr;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean have_elements(const VideoCodec *codec)
+{
+    gchar *enc = g_strdup(codec->enc);
+    *strchr(enc, ' ') = '\0'; // the launch line starts with the factory name
+    const gchar *names[] = {enc, codec->depay, codec->parse, codec->dec};
+    gboolean ok = TRUE;
+
+    for (const gchar *name : names)
+    {
+        GstElementFactory *factory = name ? gst_element_factory_find(name) : nullptr;
+        if (name && !factory)
+        {
+            g_printerr("%s: missing %s, skipped\n", codec->name, name);
+            ok = FALSE;
+        }
+        if (factory)
+            gst_object_unref(factory);
+    }
+    g_free(enc);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("- compare video codecs");
+    GError *error = nullptr;
+    std::vector<const VideoCodec *> codecs;
+    std::vector<guint> bitrates;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (sscanf(size, "%dx%d", &width, &height) != 2 || width < 16 || height < 16 ||
+        frames < 1 || !parse_codec_list(codec_list, &codecs))
+    {
+        g_printerr("Invalid options, see --help\n");
+        return 1;
+    }
+    gchar **kbps = g_strsplit(bitrate_list, ",", -1);
+    for (gchar **k = kbps; *k; k++)
+    {
+        if (atoi(*k) > 0)
+            bitrates.push_back(atoi(*k));
+    }
+    g_strfreev(kbps);
+    std::sort(bitrates.begin(), bitrates.end());
+
+    const double megapixels = width * height / 1e6;
+    g_print("%dx%d, %d frames at 30 fps, %s\n\n", width, height, frames,
+            input_uri ? input_uri : "videotestsrc");
+    g_print("codec    kbit/s   PSNR dB   decode ms/frame   ms/megapixel\n");
+
+    std::vector<std::pair<const VideoCodec *, Result>> summary;
+    for (const VideoCodec *codec : codecs)
+    {
+        std::vector<Result> results;
+
+        if (!have_elements(codec))
+            continue;
+        for (guint rate : bitrates)
+        {
+            EncodedClip clip;
+            Result result;
+
+            if (!encode(codec, rate, &clip))
+            {
+                g_printerr("%s: encoding at %u kbit/s failed\n", codec->name, rate);
+                continue;
+            }
+            result.kbps = clip.bytes * 8.0 * 30 / clip.buffers.size() / 1000;
+            result.psnr = measure_psnr(codec, clip);
+            result.cpu_ms = time_decoding(codec, clip);
+            if (result.psnr < 0 || result.cpu_ms < 0)
+                continue;
+
+            g_print("%-6s %8.0f %9.2f %17.2f %14.2f\n", codec->name, result.kbps,
+                    result.psnr, result.cpu_ms, result.cpu_ms / megapixels);
+            results.push_back(result);
+        }
+
+        Result target;
+        if (at_target(results, &target))
+            summary.emplace_back(codec, target);
+        else
+            g_print("%-6s doesn't reach %.1f dB at the given bitrates\n",
+                    codec->name, target_psnr);
+    }
+
+    g_print("\nAt %.1f dB:\n", target_psnr);
+    for (const auto &entry : summary)
+        g_print("%-6s %8.0f kbit/s %8.2f ms/megapixel\n", entry.first->name,
+                entry.second.kbps, entry.second.cpu_ms / megapixels);
+
+    return 0;
+}
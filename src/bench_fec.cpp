@@ -0,0 +1,277 @@
+/*
+ * Benchmark of the error protection policies against a simulated lossy
+ * network, without GStreamer: a 30 fps video stream goes through a bursty
+ * (Gilbert-Elliott) loss model in phases that imitate a LAN, Wi-Fi, bad
+ * Wi-Fi and a long-haul link. For each policy it prints how many frames
+ * can't be repaired before the jitter buffer's deadline, and how much
+ * bandwidth the FEC and the retransmissions cost on top of the video.
+ *
+ * Policies, as the receiver can apply them: NACK/RTX only (--fec off), FEC
+ * offered without NACK (--fec full, the old fixed setting), FEC offered
+ * with NACK, and the adaptive LossController (--fec auto). Like the app,
+ * the adaptive policy switches NACK at once, but the FEC stays as it was
+ * negotiated at the start of the call; its later FEC decisions only apply
+ * to the next call. How much FEC the camera sends when it is
+ * negotiated is up to the camera, given here as a share of the media.
+ *
+ * Usage: ./bench_fec [kbit/s] [latency ms] [seed] [camera FEC %]
+ */
+
+#include "loss_control.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define FPS 30
+#define PACKET_BYTES 1200
+
+/**
+ * A stretch of network conditions. Loss is the average packet loss, which
+ * comes in bursts of burst packets on average.
+ */
+struct Phase
+{
+    const char *name;
+    int seconds;
+    double loss;
+    double burst;
+    double rtt_ms;
+};
+
+static const Phase phases[] = {
+    {"LAN", 120, 0.001, 1.0, 2},
+    {"Wi-Fi", 180, 0.03, 3.0, 30},
+    {"bad Wi-Fi", 120, 0.12, 4.0, 60},
+    {"long haul", 180, 0.015, 2.0, 250},
+};
+#define N_PHASES (int)(sizeof(phases) / sizeof(phases[0]))
+
+/**
+ * Two-state loss model: in the bad state half of the packets are lost, in
+ * the good state none.
+ */
+class Channel
+{
+public:
+    explicit Channel(unsigned seed) : rng(seed), bad(false), p_gb(0), p_bg(1) {}
+
+    void set(const Phase &phase)
+    {
+        const double bad_loss = 0.5;
+        const double bad_share = std::min(0.9, phase.loss / bad_loss);
+        // Bursts of `burst` lost packets mean about 2 * burst packets in
+        // the bad state.
+        p_bg = 1.0 / std::max(1.0, 2 * phase.burst);
+        p_gb = p_bg * bad_share / (1 - bad_share);
+        average_loss = phase.loss;
+    }
+
+    bool lose()
+    {
+        bad = random() < (bad ? 1 - p_bg : p_gb);
+        return bad && random() < 0.5;
+    }
+
+    /* Retransmissions come later, independently of the current burst. */
+    bool lose_later() { return random() < average_loss; }
+
+    double random() { return uniform(rng); }
+
+private:
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> uniform;
+    bool bad;
+    double p_gb, p_bg, average_loss;
+};
+
+struct Totals
+{
+    long frames = 0, frames_lost = 0;
+    long media = 0, fec = 0, rtx = 0;
+};
+
+enum Policy
+{
+    POLICY_NACK,
+    POLICY_FEC,
+    POLICY_FEC_NACK,
+    POLICY_ADAPTIVE,
+};
+
+static const char *policy_names[] = {"NACK/RTX only", "FEC, no NACK",
+                                     "FEC + NACK", "adaptive"};
+
+/**
+ * Send one frame of n packets with FEC parity packets (fec_percent of n,
+ * if FEC was negotiated) interleaved over groups of the frame, then repair
+ * with FEC and, if enabled, with retransmissions until the deadline.
+ * Returns false if the frame is lost.
+ */
+static bool send_frame(Channel &channel, int n, const ProtectionDecision &protection,
+                       double fec_percent, double rtt_ms, double latency_ms,
+                       Totals &totals, long *first_lost)
+{
+    const int parity = protection.fec ? (int)std::ceil(n * fec_percent / 100.0) : 0;
+    std::vector<bool> lost(n), parity_lost(parity);
+    std::vector<int> group_losses(parity, 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        lost[i] = channel.lose();
+        *first_lost += lost[i];
+    }
+    for (int j = 0; j < parity; j++)
+        parity_lost[j] = channel.lose();
+    totals.media += n;
+    totals.fec += parity;
+
+    // XOR parity: a group with at most one loss, parity included, is whole.
+    for (int i = 0; i < n && parity; i++)
+        group_losses[i % parity] += lost[i];
+    for (int j = 0; j < parity; j++)
+        group_losses[j] += parity_lost[j];
+
+    bool whole = true;
+    for (int i = 0; i < n; i++)
+    {
+        if (!lost[i] || (parity && group_losses[i % parity] <= 1))
+            continue;
+        bool repaired = false;
+        if (protection.nack)
+        {
+            // The gap is noticed after some reordering delay, then each
+            // request and retransmission takes a round trip.
+            for (double t = 20 + rtt_ms; t <= latency_ms && !repaired; t += rtt_ms)
+            {
+                totals.rtx++;
+                repaired = !channel.lose_later();
+            }
+        }
+        whole = whole && repaired;
+    }
+    return whole;
+}
+
+static void run(Policy policy, double kbps, double latency_ms, unsigned seed,
+                double fec_percent, Totals *per_phase)
+{
+    Channel channel(seed);
+    LossController controller(latency_ms);
+    const int n = std::max(1, (int)std::lround(kbps * 1000 / 8 / PACKET_BYTES / FPS));
+    uint64_t received = 0, lost = 0;
+    int switches = 0;
+    // The call is negotiated once, before anything is measured.
+    const bool negotiated_fec = controller.decision().fec;
+
+    for (int p = 0; p < N_PHASES; p++)
+    {
+        const Phase &phase = phases[p];
+        channel.set(phase);
+        for (int frame = 0; frame < phase.seconds * FPS; frame++)
+        {
+            ProtectionDecision protection;
+            switch (policy)
+            {
+            case POLICY_NACK:
+                protection = {false, true};
+                break;
+            case POLICY_FEC:
+                protection = {true, false};
+                break;
+            case POLICY_FEC_NACK:
+                protection = {true, true};
+                break;
+            case POLICY_ADAPTIVE:
+                protection = {negotiated_fec, controller.decision().nack};
+                break;
+            }
+
+            long first_lost = 0;
+            Totals &totals = per_phase[p];
+            totals.frames++;
+            if (!send_frame(channel, n, protection, fec_percent, phase.rtt_ms,
+                            latency_ms, totals, &first_lost))
+                totals.frames_lost++;
+            received += n - first_lost;
+            lost += first_lost;
+
+            // The app updates the controller every two seconds, with a
+            // somewhat noisy RTT.
+            if (policy == POLICY_ADAPTIVE && frame % (2 * FPS) == 2 * FPS - 1)
+            {
+                double rtt = phase.rtt_ms * (0.9 + 0.2 * channel.random());
+                if (controller.update(received, lost, rtt))
+                {
+                    switches++;
+                    printf("  %-9s %4ds: loss %5.2f%%, RTT %3.0f ms -> %s%s\n",
+                           phase.name, frame / FPS + 1, controller.loss() * 100,
+                           controller.rtt(),
+                           LossController::describe(controller.decision()),
+                           controller.decision().fec != negotiated_fec
+                               ? " (FEC from the next call)"
+                               : "");
+                }
+            }
+        }
+    }
+    if (policy == POLICY_ADAPTIVE)
+        printf("  %d switches\n\n", switches);
+}
+
+int main(int argc, char *argv[])
+{
+    const double kbps = argc > 1 ? atof(argv[1]) : 4000;
+    const double latency_ms = argc > 2 ? atof(argv[2]) : 200;
+    const unsigned seed = argc > 3 ? (unsigned)atoi(argv[3]) : 1;
+    const double fec_percent = argc > 4 ? atof(argv[4]) : 20;
+    Totals results[4][N_PHASES];
+
+    printf("%.0f kbit/s, %d fps, %d-byte packets, %.0f ms jitter buffer, "
+           "camera sends %.0f%% FEC when negotiated\n\n",
+           kbps, FPS, PACKET_BYTES, latency_ms, fec_percent);
+    printf("Adaptive decisions:\n");
+    for (int policy = 0; policy < 4; policy++)
+        run((Policy)policy, kbps, latency_ms, seed, fec_percent, results[policy]);
+
+    printf("%-20s", "frames lost");
+    for (int p = 0; p < N_PHASES; p++)
+        printf(" %12s", phases[p].name);
+    printf(" %12s\n", "total");
+    for (int policy = 0; policy < 4; policy++)
+    {
+        Totals all;
+        printf("%-20s", policy_names[policy]);
+        for (int p = 0; p < N_PHASES; p++)
+        {
+            const Totals &t = results[policy][p];
+            printf(" %11.2f%%", 100.0 * t.frames_lost / t.frames);
+            all.frames += t.frames;
+            all.frames_lost += t.frames_lost;
+        }
+        printf(" %11.2f%%\n", 100.0 * all.frames_lost / all.frames);
+    }
+
+    printf("\n%-20s", "overhead");
+    for (int p = 0; p < N_PHASES; p++)
+        printf(" %12s", phases[p].name);
+    printf(" %12s\n", "total");
+    for (int policy = 0; policy < 4; policy++)
+    {
+        Totals all;
+        printf("%-20s", policy_names[policy]);
+        for (int p = 0; p < N_PHASES; p++)
+        {
+            const Totals &t = results[policy][p];
+            printf(" %11.1f%%", 100.0 * (t.fec + t.rtx) / t.media);
+            all.media += t.media;
+            all.fec += t.fec;
+            all.rtx += t.rtx;
+        }
+        printf(" %11.1f%%\n", 100.0 * (all.fec + all.rtx) / all.media);
+    }
+    return 0;
+}
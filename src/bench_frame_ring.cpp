@@ -0,0 +1,221 @@
+/*
+ * Benchmark of the shared-memory frame ring, without GStreamer: a writer
+ * publishes synthetic 3840x1920 (4K) I420 frames as fast as it can, while
+ * 0..N reader processes read every byte of the newest frame each time. It
+ * prints the writer's frame rate and bandwidth; the writer never waits for
+ * the readers, so it only slows down as they take memory bandwidth. For
+ * each reader it prints the frames it got, skipped and lost to the writer
+ * lapping it, and the latency from publishing to done reading.
+ *
+ * With --attach it is a reader of a running receiver's ring instead, e.g.
+ * ./livesync_gstreamer --headless --frame-ring livesync, for some seconds.
+ *
+ * Usage: ./bench_frame_ring [frames] [max readers]
+ *        ./bench_frame_ring --attach /livesync-1 [seconds]
+ */
+
+#include "frame_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const int WIDTH = 3840, HEIGHT = 1920, SLOTS = 4;
+
+/**
+ * What a reader reports back to the benchmark.
+ */
+struct ReaderResult
+{
+    uint64_t frames;
+    uint64_t skipped;
+    uint64_t torn;     /* lapped while reading */
+    double p50_us;     /* publishing to done reading */
+    double p99_us;
+    uint64_t checksum; /* so that the reads aren't optimized away */
+};
+
+static double now_ms()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Read frames until the ring closes or nothing comes for timeout_ms.
+ */
+static ReaderResult read_frames(FrameRingReader &reader, int timeout_ms,
+                                double seconds)
+{
+    ReaderResult result = {};
+    std::vector<double> latencies;
+    FrameRingFrame frame;
+    const double end = now_ms() + seconds * 1000;
+
+    while (now_ms() < end && reader.next(&frame, timeout_ms) == FRAME_RING_FRAME)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < frame.format.size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, frame.data + i, sizeof(word));
+            sum += word;
+        }
+        if (!reader.valid(frame))
+        {
+            result.torn++;
+            continue;
+        }
+        result.checksum += sum;
+        result.frames++;
+        latencies.push_back((frame_ring_now() - frame.published) / 1000.0);
+    }
+
+    result.skipped = reader.skipped();
+    if (!latencies.empty())
+    {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50_us = latencies[latencies.size() / 2];
+        result.p99_us = latencies[latencies.size() * 99 / 100];
+    }
+    return result;
+}
+
+static void print_reader(const char *name, const ReaderResult &result)
+{
+    printf("  %-10s %8llu frames %8llu skipped %6llu torn %9.0f us p50 %9.0f us p99\n",
+           name, (unsigned long long)result.frames, (unsigned long long)result.skipped,
+           (unsigned long long)result.torn, result.p50_us, result.p99_us);
+}
+
+static int attach(const char *name, double seconds)
+{
+    FrameRingReader reader;
+
+    if (!reader.attach(name))
+    {
+        printf("No frame ring %s\n", name);
+        return 1;
+    }
+    ReaderResult result = read_frames(reader, 5000, seconds);
+    printf("%s, %.0f s: %.1f fps\n", name, seconds, result.frames / seconds);
+    print_reader("reader", result);
+    return 0;
+}
+
+/**
+ * A reader process: attach, tell the writer, read, report.
+ */
+static void run_reader(const std::string &name, int ready, int report)
+{
+    FrameRingReader reader;
+
+    while (!reader.attach(name))
+        usleep(1000);
+    char c = 1;
+    if (write(ready, &c, 1) != 1)
+        _exit(1);
+    ReaderResult result = read_frames(reader, 10000, 1e9);
+    if (write(report, &result, sizeof(result)) != sizeof(result))
+        _exit(1);
+    _exit(0);
+}
+
+/**
+ * Publish `frames` frames with `count` readers, and return the writer's
+ * frames per second.
+ */
+static double bench_readers(const std::vector<uint8_t> &source, int frames, int count)
+{
+    const std::string name = "/bench-frame-ring-" + std::to_string(getpid());
+    const int cw = WIDTH / 2, ch = HEIGHT / 2;
+    FrameRingWriter writer;
+    FrameRingFormat format = {};
+    int ready[2], report[2];
+
+    if (!writer.create(name, SLOTS, source.size()))
+    {
+        perror("Creating the frame ring");
+        exit(1);
+    }
+    strcpy(format.format, "I420");
+    format.width = WIDTH;
+    format.height = HEIGHT;
+    format.n_planes = 3;
+    format.offsets[1] = WIDTH * HEIGHT;
+    format.offsets[2] = format.offsets[1] + cw * ch;
+    format.strides[0] = WIDTH;
+    format.strides[1] = format.strides[2] = cw;
+    format.size = source.size();
+
+    if (pipe(ready) < 0 || pipe(report) < 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (fork() == 0)
+            run_reader(name, ready[1], report[1]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        char c;
+        if (read(ready[0], &c, 1) != 1)
+            exit(1);
+    }
+
+    const double start = now_ms();
+    for (int i = 0; i < frames; i++)
+    {
+        uint8_t *slot = writer.begin();
+        memcpy(slot, source.data(), source.size());
+        writer.commit(format, (int64_t)i * 1000000000 / 30);
+    }
+    const double fps = 1000.0 * frames / (now_ms() - start);
+    writer.close();
+
+    printf("%-8d %10.1f %10.2f\n", count, fps, fps * source.size() / 1e9);
+    for (int i = 0; i < count; i++)
+    {
+        ReaderResult result;
+        if (read(report[0], &result, sizeof(result)) != sizeof(result))
+            exit(1);
+        print_reader(("reader " + std::to_string(i + 1)).c_str(), result);
+    }
+    while (wait(nullptr) > 0)
+        ;
+    close(ready[0]);
+    close(ready[1]);
+    close(report[0]);
+    close(report[1]);
+    return fps;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && strcmp(argv[1], "--attach") == 0)
+        return attach(argv[2], argc > 3 ? atof(argv[3]) : 10.0);
+
+    const int frames = argc > 1 ? atoi(argv[1]) : 1000;
+    const int max_readers = argc > 2 ? atoi(argv[2]) : 4;
+    std::vector<uint8_t> source((size_t)WIDTH * HEIGHT * 3 / 2);
+
+    srand(1);
+    for (uint8_t &p : source)
+        p = (uint8_t)rand();
+
+    printf("%dx%d I420, %.1f MB a frame, %d slots, %d frames\n\n", WIDTH, HEIGHT,
+           source.size() / 1e6, SLOTS, frames);
+    printf("%-8s %10s %10s\n", "readers", "frames/s", "GB/s");
+    for (int count = 0; count <= max_readers; count++)
+        bench_readers(source, frames, count);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Benchmark of --output: the CPU it takes to deliver the same video at
+ * several sizes, decoding it once and scaling it for each output with the
+ * OutputLadder, against running a receiver per output that each decodes
+ * and scales it on its own.
+ *
+ * The clip is encoded once into memory, then pushed at 30 fps in real
+ * time, like a camera sends it, so the CPU load is what a receiver would
+ * have: it is printed in percent of one core, with the frames each output
+ * got and dropped.
+ *
+ * Usage: ./bench_ladder [--codec VP8] [--size 3840x1920] [--frames 150]
+ *                       [--bitrate 8000]
+ *                       [--outputs preview=320@5,view=1920x1080,analytics=full]
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#include "codecs.h"
+#include "output_ladder.h"
+
+static const gchar *codec_name = "VP8";
+static const gchar *size = "3840x1920";
+static gint frames = 150;
+static gint bitrate = 8000;
+static const gchar *output_list = "preview=320@5,view=1920x1080,analytics=full";
+
+static GOptionEntry entries[] = {
+    {"codec", 0, 0, G_OPTION_ARG_STRING, &codec_name,
+     "Codec of the clip (default: VP8)", "NAME"},
+    {"size", 0, 0, G_OPTION_ARG_STRING, &size,
+     "Frame size (default: 3840x1920)", "WxH"},
+    {"frames", 0, 0, G_OPTION_ARG_INT, &frames,
+     "Length of the clip at 30 fps (default: 150)", "N"},
+    {"bitrate", 0, 0, G_OPTION_ARG_INT, &bitrate,
+     "Encoder bitrate (default: 8000)", "KBPS"},
+    {"outputs", 0, 0, G_OPTION_ARG_STRING, &output_list,
+     "The outputs, like --output (default: preview=320@5,view=1920x1080,analytics=full)",
+     "NAME=SIZE[@FPS],..."},
+    {nullptr},
+};
+
+static gint width, height;
+
+static double cpu_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * One encoded clip, kept in memory so that encoding isn't measured.
+ */
+struct EncodedClip
+{
+    GstCaps *caps = nullptr;
+    std::vector<GstBuffer *> buffers;
+
+    ~EncodedClip()
+    {
+        for (GstBuffer *buffer : buffers)
+            gst_buffer_unref(buffer);
+        if (caps)
+            gst_caps_unref(caps);
+    }
+};
+
+static GstElement *launch(const gchar *description)
+{
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+
+    if (error)
+    {
+        g_printerr("Can't create %s: %s\n", description, error->message);
+        g_error_free(error);
+        if (pipeline)
+            gst_object_unref(pipeline);
+        return nullptr;
+    }
+    return pipeline;
+}
+
+static gboolean encode(const VideoCodec *codec, EncodedClip *clip)
+{
+    gchar *enc = g_strdup_printf(codec->enc, bitrate);
+    gchar *description = g_strdup_printf(
+        "videotestsrc pattern=ball horizontal-speed=4 num-buffers=%d ! "
+        "video/x-raw,format=I420,width=%d,height=%d,framerate=30/1 ! %s ! "
+        "appsink name=out sync=false",
+        frames, width, height, enc);
+    GstElement *pipeline = launch(description);
+    GstSample *sample;
+
+    g_free(description);
+    g_free(enc);
+    if (!pipeline)
+        return FALSE;
+
+    GstElement *out = gst_bin_get_by_name(GST_BIN(pipeline), "out");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    while ((sample = gst_app_sink_pull_sample(GST_APP_SINK(out))))
+    {
+        if (!clip->caps)
+            clip->caps = gst_caps_ref(gst_sample_get_caps(sample));
+        clip->buffers.push_back(gst_buffer_ref(gst_sample_get_buffer(sample)));
+        gst_sample_unref(sample);
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(out);
+    gst_object_unref(pipeline);
+    return !clip->buffers.empty();
+}
+
+/**
+ * A receiver: appsrc ! [parser !] decoder ! the outputs of a ladder.
+ */
+struct Receiver
+{
+    GstElement *pipeline;
+    GstElement *src;
+    std::unique_ptr<OutputLadder> outputs;
+
+    Receiver(const VideoCodec *codec, const EncodedClip &clip,
+             const std::vector<LadderRung> &rungs)
+    {
+        gchar *description = g_strdup_printf("appsrc name=src format=time ! %s%s%s",
+                                             codec->parse ? codec->parse : "",
+                                             codec->parse ? " ! " : "", codec->dec);
+        GstElement *decoder = gst_parse_bin_from_description(description, TRUE, NULL);
+
+        g_free(description);
+        g_assert_nonnull(decoder);
+        pipeline = gst_pipeline_new(NULL);
+        outputs.reset(new OutputLadder(rungs, LADDER_FRAMES));
+        gst_bin_add_many(GST_BIN(pipeline), decoder, outputs->element(), NULL);
+        gst_element_link(decoder, outputs->element());
+
+        src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+        g_object_set(src, "caps", clip.caps, "max-bytes", (guint64)0, NULL);
+    }
+
+    ~Receiver()
+    {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(src);
+        gst_object_unref(pipeline);
+    }
+
+    gboolean wait_eos()
+    {
+        GstBus *bus = gst_element_get_bus(pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                     (GstMessageType)(GST_MESSAGE_EOS |
+                                                                      GST_MESSAGE_ERROR));
+        gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+        if (msg)
+            gst_message_unref(msg);
+        gst_object_unref(bus);
+        return ok;
+    }
+};
+
+/**
+ * Push the clip into all the receivers at 30 fps, and return the CPU load
+ * in percent of one core.
+ */
+static double run(std::vector<std::unique_ptr<Receiver>> &receivers,
+                  const EncodedClip &clip)
+{
+    for (auto &receiver : receivers)
+        gst_element_set_state(receiver->pipeline, GST_STATE_PLAYING);
+
+    gint64 start = g_get_monotonic_time();
+    double cpu = cpu_time_ms();
+    for (gsize i = 0; i < clip.buffers.size(); i++)
+    {
+        gint64 due = start + (gint64)i * G_USEC_PER_SEC / 30;
+        gint64 now = g_get_monotonic_time();
+        if (due > now)
+            g_usleep(due - now);
+        for (auto &receiver : receivers)
+            gst_app_src_push_buffer(GST_APP_SRC(receiver->src),
+                                    gst_buffer_ref(clip.buffers[i]));
+    }
+    for (auto &receiver : receivers)
+        gst_app_src_end_of_stream(GST_APP_SRC(receiver->src));
+
+    gboolean ok = TRUE;
+    for (auto &receiver : receivers)
+        ok = receiver->wait_eos() && ok;
+    double wall_ms = (g_get_monotonic_time() - start) / 1000.0;
+    double cpu_ms = cpu_time_ms() - cpu;
+    return ok ? 100.0 * cpu_ms / wall_ms : -1;
+}
+
+static void print_outputs(const OutputLadder &outputs)
+{
+    for (guint rung = 0; rung < outputs.size(); rung++)
+    {
+        g_print("    %-12s %5" G_GUINT64_FORMAT " frames, %4" G_GUINT64_FORMAT " dropped\n",
+                outputs.rung(rung).name.c_str(), outputs.delivered(rung),
+                outputs.dropped(rung));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("- compare one decode with a receiver per output");
+    GError *error = nullptr;
+    std::vector<LadderRung> rungs;
+    gboolean valid = TRUE;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    gchar **specs = g_strsplit(output_list, ",", -1);
+    for (gchar **spec = specs; *spec; spec++)
+    {
+        LadderRung rung;
+        valid = parse_ladder_rung(*spec, &rung) && valid;
+        rungs.push_back(rung);
+    }
+    g_strfreev(specs);
+
+    const VideoCodec *codec = find_video_codec(codec_name);
+    if (!valid || !codec ||
+        sscanf(size, "%dx%d", &width, &height) != 2 || width < 16 || height < 16 ||
+        frames < 1 || bitrate < 1)
+    {
+        g_printerr("Invalid options, see --help\n");
+        return 1;
+    }
+
+    EncodedClip clip;
+    if (!encode(codec, &clip))
+    {
+        g_printerr("Encoding the clip with %s failed\n", codec->name);
+        return 1;
+    }
+    g_print("%dx%d %s at %d kbit/s, %u frames at 30 fps, %u outputs\n\n", width,
+            height, codec->name, bitrate, (guint)clip.buffers.size(),
+            (guint)rungs.size());
+
+    std::vector<std::unique_ptr<Receiver>> shared;
+    shared.emplace_back(new Receiver(codec, clip, rungs));
+    double shared_cpu = run(shared, clip);
+
+    std::vector<std::unique_ptr<Receiver>> separate;
+    for (const LadderRung &rung : rungs)
+        separate.emplace_back(new Receiver(codec, clip, {rung}));
+    double separate_cpu = run(separate, clip);
+
+    if (shared_cpu < 0 || separate_cpu < 0)
+    {
+        g_printerr("Decoding the clip failed\n");
+        return 1;
+    }
+
+    g_print("one decode, %u outputs:   %6.1f%% CPU\n", (guint)rungs.size(), shared_cpu);
+    print_outputs(*shared[0]->outputs);
+    g_print("%u receivers, one each:   %6.1f%% CPU\n", (guint)rungs.size(), separate_cpu);
+    for (auto &receiver : separate)
+        print_outputs(*receiver->outputs);
+    g_print("\nsaved: %.1f%% of a core, %.0f%%\n", separate_cpu - shared_cpu,
+            100.0 * (1.0 - shared_cpu / separate_cpu));
+    return 0;
+}
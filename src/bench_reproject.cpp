@@ -0,0 +1,151 @@
+/*
+ * Benchmark of the equirectangular reprojection engine, without GStreamer:
+ * renders a 1920x1080 view from a synthetic 3840x1920 (4K) I420 frame with
+ * the scalar and the SIMD kernels, and times rebuilding the remap tables.
+ * Then renders 1..N views of the same frame on N threads, like --view does,
+ * to show how the fan-out scales with cores.
+ *
+ * Usage: ./bench_reproject [frames] [max views]
+ */
+
+#include "reproject.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+struct Image
+{
+    std::vector<uint8_t> pixels;
+    PlanarImage planes;
+};
+
+static void alloc_image(Image &image, int width, int height)
+{
+    const int cw = width / 2, ch = height / 2;
+
+    image.pixels.resize((size_t)width * height + 2 * (size_t)cw * ch);
+    image.planes.width = width;
+    image.planes.height = height;
+    image.planes.data[0] = image.pixels.data();
+    image.planes.data[1] = image.planes.data[0] + (size_t)width * height;
+    image.planes.data[2] = image.planes.data[1] + (size_t)cw * ch;
+    image.planes.stride[0] = width;
+    image.planes.stride[1] = cw;
+    image.planes.stride[2] = cw;
+}
+
+static double now_ms()
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Time rendering the same view, so that only the sampling is measured.
+ */
+static double bench_frames(EquirectReprojector &reprojector, const Image &src,
+                           Image &dst, int frames)
+{
+    reprojector.process(src.planes, dst.planes); // builds the tables
+    const double start = now_ms();
+    for (int i = 0; i < frames; i++)
+        reprojector.process(src.planes, dst.planes);
+    return (now_ms() - start) / frames;
+}
+
+/**
+ * Render `count` different views of the same source, each on its own thread
+ * and with its own tables, and return the total views rendered per second.
+ */
+static double bench_views(const Image &src, const Viewport &view, int count,
+                          int frames)
+{
+    std::vector<std::thread> threads;
+    std::vector<Image> dst(count);
+    std::vector<EquirectReprojector> reprojectors(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        Viewport v = view;
+        v.yaw = -180.0f + 360.0f * i / count;
+        alloc_image(dst[i], v.width, v.height);
+        reprojectors[i].set_viewport(v);
+        reprojectors[i].process(src.planes, dst[i].planes);
+    }
+
+    const double start = now_ms();
+    for (int i = 0; i < count; i++)
+    {
+        threads.emplace_back([&, i]
+                             {
+                                 for (int f = 0; f < frames; f++)
+                                     reprojectors[i].process(src.planes, dst[i].planes);
+                             });
+    }
+    for (std::thread &t : threads)
+        t.join();
+    return 1000.0 * count * frames / (now_ms() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    const int frames = argc > 1 ? atoi(argv[1]) : 100;
+    const int max_views = argc > 2 ? atoi(argv[2])
+                                   : (int)std::thread::hardware_concurrency();
+    const Viewport view = {30.0f, 10.0f, 90.0f, 1920, 1080};
+    Image src, dst_scalar, dst_simd;
+
+    alloc_image(src, 3840, 1920);
+    alloc_image(dst_scalar, view.width, view.height);
+    alloc_image(dst_simd, view.width, view.height);
+    srand(1);
+    for (uint8_t &p : src.pixels)
+        p = (uint8_t)rand();
+
+    EquirectReprojector reprojector;
+    reprojector.set_viewport(view);
+
+    EquirectReprojector::force_scalar(true);
+    const double scalar_ms = bench_frames(reprojector, src, dst_scalar, frames);
+    EquirectReprojector::force_scalar(false);
+    const double simd_ms = bench_frames(reprojector, src, dst_simd, frames);
+
+    if (dst_scalar.pixels != dst_simd.pixels)
+    {
+        printf("ERROR: %s output differs from scalar output\n",
+               EquirectReprojector::simd_name());
+        return 1;
+    }
+
+    // Moving the view every frame, like holding down an arrow key.
+    Viewport moving = view;
+    const double start = now_ms();
+    for (int i = 0; i < frames; i++)
+    {
+        moving.yaw += 1.0f;
+        reprojector.set_viewport(moving);
+        reprojector.process(src.planes, dst_simd.planes);
+    }
+    const double moving_ms = (now_ms() - start) / frames;
+
+    printf("3840x1920 -> %dx%d, %d frames\n", view.width, view.height, frames);
+    printf("%-22s %8.2f ms/frame %8.1f fps\n", "scalar", scalar_ms, 1000.0 / scalar_ms);
+    printf("%-22s %8.2f ms/frame %8.1f fps\n", EquirectReprojector::simd_name(),
+           simd_ms, 1000.0 / simd_ms);
+    printf("%-22s %8.2f ms/frame %8.1f fps\n", "rebuild + render",
+           moving_ms, 1000.0 / moving_ms);
+
+    printf("\n%-8s %12s %10s\n", "views", "views/s", "speedup");
+    double single = 0.0;
+    for (int count = 1; count <= (max_views > 0 ? max_views : 1); count++)
+    {
+        const double rate = bench_views(src, view, count, frames);
+        if (count == 1)
+            single = rate;
+        printf("%-8d %12.1f %9.2fx\n", count, rate, rate / single);
+    }
+    return 0;
+}
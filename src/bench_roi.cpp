@@ -0,0 +1,266 @@
+/*
+ * Benchmark of --roi cropping: pushes the same decoded I420 frame through
+ * appsrc ! [videocrop] ! FrameSink, with a consumer that reads every byte
+ * it is given, three ways:
+ *
+ *   full       no crop, the consumer reads the whole frame
+ *   crop meta  videocrop adds a GstVideoCropMeta, the consumer reads the
+ *              region in place
+ *   crop copy  the consumer refuses the crop meta, so videocrop copies the
+ *              region into a new buffer first
+ *
+ * and prints the time per frame and the memory traffic of each: the bytes
+ * read and written per frame, and how much of the full frame's the crop
+ * saves.
+ *
+ * Usage: ./bench_roi [--size 3840x1920] [--frames 300] [--roi 0,0.35,1,0.3]
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+
+#include "frame_sink.h"
+#include "logger.h"
+#include "roi_crop.h"
+
+static const gchar *size = "3840x1920";
+static gint frames = 300;
+static const gchar *roi_spec = "0,0.35,1,0.3";
+
+static GOptionEntry entries[] = {
+    {"size", 0, 0, G_OPTION_ARG_STRING, &size,
+     "Frame size (default: 3840x1920)", "WxH"},
+    {"frames", 0, 0, G_OPTION_ARG_INT, &frames,
+     "Frames to push in each mode (default: 300)", "N"},
+    {"roi", 0, 0, G_OPTION_ARG_STRING, &roi_spec,
+     "Region, in fractions of the frame (default: 0,0.35,1,0.3)",
+     "LEFT,TOP,WIDTH,HEIGHT"},
+    {nullptr},
+};
+
+enum Mode
+{
+    MODE_FULL,
+    MODE_META,
+    MODE_COPY,
+};
+
+static const gchar *const mode_names[] = {"full", "crop meta", "crop copy"};
+
+struct Result
+{
+    double wall_ms;       /* per frame */
+    double cpu_ms;        /* per frame, all threads */
+    double read_bytes;    /* per frame, by the consumer */
+    guint64 with_meta;    /* frames, as RoiCrop counted them */
+    guint64 copied;
+    guint64 frame_bytes;  /* all frames, as RoiCrop counted them */
+    guint64 region_bytes;
+    guint64 checksum;     /* so that the reads aren't optimized away */
+};
+
+static double cpu_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double wall_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * A frame with something in every byte.
+ */
+static GstBuffer *create_frame(const GstVideoInfo *info)
+{
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(info), NULL);
+    GstMapInfo map;
+
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    for (gsize i = 0; i < map.size; i++)
+        map.data[i] = (guint8)(i * 7 + i / 4096);
+    gst_buffer_unmap(buffer, &map);
+    gst_buffer_add_video_meta(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+                              GST_VIDEO_INFO_FORMAT(info), GST_VIDEO_INFO_WIDTH(info),
+                              GST_VIDEO_INFO_HEIGHT(info));
+    return buffer;
+}
+
+/**
+ * Read every row of every plane of what the frame shows, like a consumer
+ * that looks at all its pixels would.
+ */
+static guint64 read_frame(const VideoFrame &frame, guint64 *bytes)
+{
+    const GstVideoFormatInfo *finfo = frame.info()->finfo;
+    guint64 sum = 0;
+
+    for (guint plane = 0; plane < frame.n_planes(); plane++)
+    {
+        // I420: one component per plane.
+        gint row_bytes = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH(finfo, plane, frame.width()) *
+                         GST_VIDEO_FORMAT_INFO_PSTRIDE(finfo, plane);
+        gint rows = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT(finfo, plane, frame.height());
+        const guint8 *row = frame.data(plane);
+
+        for (gint y = 0; y < rows; y++, row += frame.stride(plane))
+        {
+            for (gint x = 0; x < row_bytes; x++)
+                sum += row[x];
+        }
+        *bytes += (guint64)row_bytes * rows;
+    }
+    return sum;
+}
+
+static gboolean run(Mode mode, const GstVideoInfo *info, GstBuffer *frame,
+                    const RegionOfInterest &roi, Result *result)
+{
+    GstElement *pipeline = gst_pipeline_new(NULL);
+    GstElement *src = gst_element_factory_make("appsrc", NULL);
+    GstCaps *caps = gst_video_info_to_caps(info);
+    FrameSink sink;
+    RoiCrop crop(roi);
+    std::atomic<guint64> checksum(0), bytes(0), count(0);
+
+    g_object_set(src, "caps", caps, "format", GST_FORMAT_TIME, "max-bytes", (guint64)0,
+                 NULL);
+    gst_caps_unref(caps);
+    sink.set_crop_meta(mode == MODE_META);
+    sink.set_callback([&](const VideoFrameRef &f)
+                      {
+                          guint64 read = 0;
+                          checksum += read_frame(*f, &read);
+                          bytes += read;
+                          count++;
+                      });
+
+    gst_bin_add_many(GST_BIN(pipeline), src, sink.element(), NULL);
+    if (mode == MODE_FULL)
+    {
+        gst_element_link(src, sink.element());
+    }
+    else
+    {
+        gst_bin_add(GST_BIN(pipeline), crop.element());
+        gst_element_link_many(src, crop.element(), sink.element(), NULL);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    double wall = wall_time_ms();
+    double cpu = cpu_time_ms();
+    for (gint i = 0; i < frames; i++)
+    {
+        // The same pixels every time: a shallow copy, for its own timestamp.
+        GstBuffer *buffer = gst_buffer_copy(frame);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(i, GST_SECOND, 30);
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / 30;
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                 (GstMessageType)(GST_MESSAGE_EOS |
+                                                                  GST_MESSAGE_ERROR));
+    result->cpu_ms = (cpu_time_ms() - cpu) / frames;
+    result->wall_ms = (wall_time_ms() - wall) / frames;
+    gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS && count == (guint64)frames;
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+    {
+        GError *error = nullptr;
+        gst_message_parse_error(msg, &error, NULL);
+        g_printerr("%s: %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), error->message);
+        g_error_free(error);
+    }
+    if (msg)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    result->read_bytes = (double)bytes / frames;
+    result->checksum = checksum;
+    result->with_meta = crop.frames_with_meta();
+    result->copied = crop.frames_copied();
+    result->frame_bytes = crop.frame_bytes();
+    result->region_bytes = crop.region_bytes();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("- compare ways of cropping");
+    GError *error = nullptr;
+    RegionOfInterest roi;
+    GstVideoInfo info;
+    gint width, height;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (sscanf(size, "%dx%d", &width, &height) != 2 || width < 16 || height < 16 ||
+        frames < 1 || !parse_region_of_interest(roi_spec, &roi))
+    {
+        g_printerr("Invalid options, see --help\n");
+        return 1;
+    }
+    log_set_levels("warning");
+
+    gst_video_info_set_format(&info, GST_VIDEO_FORMAT_I420, width, height);
+    GST_VIDEO_INFO_FPS_N(&info) = 30;
+    GST_VIDEO_INFO_FPS_D(&info) = 1;
+    GstBuffer *frame = create_frame(&info);
+    const double frame_mb = GST_VIDEO_INFO_SIZE(&info) / 1e6;
+
+    g_print("%dx%d I420, region %s, %d frames\n\n", width, height, roi_spec, frames);
+    g_print("mode          ms/frame   CPU ms/frame   MB moved/frame   saved   meta/copied\n");
+
+    double full_mb = 0;
+    for (Mode mode : {MODE_FULL, MODE_META, MODE_COPY})
+    {
+        Result result;
+
+        if (!run(mode, &info, frame, roi, &result))
+        {
+            g_printerr("%s: the pipeline failed\n", mode_names[mode]);
+            continue;
+        }
+
+        // What the consumer reads, plus the copy's read and write of the
+        // region.
+        double moved = result.read_bytes;
+        if (mode != MODE_FULL)
+            moved += 2.0 * result.copied * result.region_bytes /
+                     (result.with_meta + result.copied) / frames;
+        moved /= 1e6;
+        if (mode == MODE_FULL)
+            full_mb = moved;
+
+        g_print("%-12s %9.3f %14.3f %16.2f %6.0f%% %7" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\n",
+                mode_names[mode], result.wall_ms, result.cpu_ms, moved,
+                full_mb > 0 ? 100.0 * (1.0 - moved / full_mb) : 0.0,
+                result.with_meta, result.copied);
+    }
+    g_print("\nframe: %.2f MB, at 30 fps the full frame is %.0f MB/s read\n",
+            frame_mb, frame_mb * 30);
+
+    gst_buffer_unref(frame);
+    return 0;
+}
@@ -0,0 +1,126 @@
+"""
+Compare the cost of receiving N cameras in one livesync_gstreamer process
+against running one livesync_gstreamer process per camera.
+
+For k = 1..N cameras, both setups are started, given time to connect and
+stream, and then sampled from /proc: CPU time (user + system) and memory
+(RSS, and PSS which doesn't count shared library pages once per process).
+The result is printed as a table, together with the cost of each extra camera.
+
+Example:
+  python3 bench_sessions.py --server https://192.168.1.100:443/rtc/socket.io \
+      --peer "LiveSYNC Camera 1" --peer "LiveSYNC Camera 2"
+"""
+
+import argparse
+import os
+import signal
+import subprocess
+import sys
+import time
+
+CLOCK_TICKS = os.sysconf('SC_CLK_TCK')
+
+
+def cpu_seconds(pid):
+    with open('/proc/%d/stat' % pid) as f:
+        # Fields after the command name, which may contain spaces.
+        fields = f.read().rsplit(')', 1)[1].split()
+    utime, stime = int(fields[11]), int(fields[12])
+    return (utime + stime) / CLOCK_TICKS
+
+
+def memory_kb(pid):
+    rss = pss = 0
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmRSS:'):
+                rss = int(line.split()[1])
+    try:
+        with open('/proc/%d/smaps_rollup' % pid) as f:
+            for line in f:
+                if line.startswith('Pss:'):
+                    pss = int(line.split()[1])
+    except OSError:
+        pss = rss
+    return rss, pss
+
+
+def start(args, peers):
+    cmd = [args.binary, '--server', args.server,
+           '--max-cameras', str(len(peers))]
+    for peer in peers:
+        cmd += ['--peer', peer]
+    # Keep stdin open, the app reads commands from it.
+    return subprocess.Popen(cmd, stdin=subprocess.PIPE,
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+
+
+def measure(args, groups):
+    procs = [start(args, peers) for peers in groups]
+    try:
+        time.sleep(args.warmup)
+        for p in procs:
+            if p.poll() is not None:
+                sys.exit('livesync_gstreamer exited early, check --server/--peer')
+        cpu0 = sum(cpu_seconds(p.pid) for p in procs)
+        t0 = time.monotonic()
+        time.sleep(args.duration)
+        cpu1 = sum(cpu_seconds(p.pid) for p in procs)
+        t1 = time.monotonic()
+        mem = [memory_kb(p.pid) for p in procs]
+    finally:
+        for p in procs:
+            p.send_signal(signal.SIGINT)
+        for p in procs:
+            try:
+                p.wait(5)
+            except subprocess.TimeoutExpired:
+                p.kill()
+    cpu_percent = 100.0 * (cpu1 - cpu0) / (t1 - t0)
+    return cpu_percent, sum(m[0] for m in mem), sum(m[1] for m in mem)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--server', required=True,
+                        help='Signalling server to connect to')
+    parser.add_argument('--peer', action='append', required=True,
+                        help='Camera to receive from, repeat for N cameras')
+    parser.add_argument('--binary', default='./livesync_gstreamer')
+    parser.add_argument('--warmup', type=float, default=15,
+                        help='Seconds to wait for streaming to start')
+    parser.add_argument('--duration', type=float, default=30,
+                        help='Seconds to sample CPU usage for')
+    args = parser.parse_args()
+
+    print('%-8s %-12s %8s %10s %10s' % ('cameras', 'setup', 'CPU %',
+                                         'RSS MiB', 'PSS MiB'))
+    results = {}
+    for k in range(1, len(args.peer) + 1):
+        peers = args.peer[:k]
+        for setup, groups in (('1 process', [peers]),
+                              ('k processes', [[p] for p in peers])):
+            if k == 1 and setup == 'k processes':
+                results[(k, setup)] = results[(k, '1 process')]
+            else:
+                results[(k, setup)] = measure(args, groups)
+            cpu, rss, pss = results[(k, setup)]
+            print('%-8d %-12s %8.1f %10.1f %10.1f' % (k, setup, cpu,
+                                                     rss / 1024.0, pss / 1024.0))
+
+    n = len(args.peer)
+    if n > 1:
+        print('\nCost of each extra camera:')
+        for setup in ('1 process', 'k processes'):
+            cpu1, rss1, pss1 = results[(1, setup)]
+            cpun, rssn, pssn = results[(n, setup)]
+            print('%-12s CPU %+.1f %%, RSS %+.1f MiB, PSS %+.1f MiB' % (
+                setup, (cpun - cpu1) / (n - 1),
+                (rssn - rss1) / 1024.0 / (n - 1),
+                (pssn - pss1) / 1024.0 / (n - 1)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,305 @@
+/*
+ * Benchmark of the signaling messages: decodes and encodes the call's
+ * messages (an ICE candidate, a video answer, a client count, a video offer)
+ * both the way livesync_gstreamer used to, with a json-glib tree for each,
+ * and with the signaling codec. Prints messages per second and heap
+ * allocations per message for each. Allocations are counted by wrapping
+ * glibc's malloc, so build it against glibc.
+ *
+ * Usage: ./bench_signaling [iterations]
+ */
+
+#include "signaling_codec.h"
+
+#include <json-glib/json-glib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+static unsigned long allocations = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    allocations++;
+    return __libc_realloc(pointer, size);
+}
+
+#define CAMERA "LiveSYNC Camera 1"
+#define RECEIVER "livesync-receiver"
+#define CANDIDATE "candidate:842163049 1 udp 1677729535 192.168.1.23 54400 typ srflx " \
+                  "raddr 10.0.0.5 rport 54400 generation 0 ufrag 4ZcD network-cost 999"
+
+/**
+ * An answer as the camera sends it, about the size of a real one.
+ */
+static std::string make_answer()
+{
+    std::string sdp =
+        "v=0\r\no=- 4611731400430051336 2 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n"
+        "a=group:BUNDLE 0\r\na=msid-semantic: WMS stream\r\n"
+        "m=video 9 UDP/TLS/RTP/SAVPF 96 97\r\nc=IN IP4 0.0.0.0\r\n"
+        "a=rtcp:9 IN IP4 0.0.0.0\r\na=ice-ufrag:4ZcD\r\n"
+        "a=ice-pwd:2XYNVzL6Y0SoNFyTigqBjQyk\r\na=ice-options:trickle\r\n"
+        "a=fingerprint:sha-256 7B:8B:F0:65:5F:78:E2:51:3B:AC:6F:F3:3F:46:1B:35:"
+        "DC:B8:5F:64:1A:24:C2:43:F0:A1:58:D0:A1:2C:19:08\r\n"
+        "a=setup:active\r\na=mid:0\r\na=sendonly\r\na=rtcp-mux\r\na=rtcp-rsize\r\n"
+        "a=rtpmap:96 VP8/90000\r\na=rtcp-fb:96 goog-remb\r\na=rtcp-fb:96 transport-cc\r\n"
+        "a=rtcp-fb:96 ccm fir\r\na=rtcp-fb:96 nack\r\na=rtcp-fb:96 nack pli\r\n"
+        "a=rtpmap:97 rtx/90000\r\na=fmtp:97 apt=96\r\n"
+        "a=ssrc-group:FID 3477216893 1722906744\r\n"
+        "a=ssrc:3477216893 cname:Hx3tK4SF8cGJhHZs\r\na=ssrc:3477216893 msid:stream video\r\n"
+        "a=ssrc:1722906744 cname:Hx3tK4SF8cGJhHZs\r\na=ssrc:1722906744 msid:stream video\r\n";
+    // The SDP escaped as JSON: its line breaks as \r\n.
+    std::string escaped;
+    for (char c : sdp)
+    {
+        if (c == '\r')
+            escaped += "\\r";
+        else if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return "{\"target\":\"" RECEIVER "\",\"source\":\"" CAMERA "\","
+           "\"sdp\":{\"type\":\"answer\",\"sdp\":\"" +
+           escaped + "\"}}";
+}
+
+static const std::string candidate_text =
+    "{\"target\":\"" RECEIVER "\",\"source\":\"" CAMERA "\",\"type\":\"new-ice-candidate\","
+    "\"candidate\":{\"candidate\":\"" CANDIDATE "\",\"sdpMid\":\"0\",\"sdpMLineIndex\":0}}";
+
+static const std::string count_text =
+    "{\"connected-clients\":0,\"max-connected-clients\":1,\"streaming-clients\":0,"
+    "\"max-streaming-clients\":1,\"source\":\"" CAMERA "\"}";
+
+static std::string answer_text;
+static std::string offer_sdp;
+static volatile unsigned long sink;
+
+/*
+ * The json-glib way, as main.cpp did it.
+ */
+
+static gchar *get_string_from_json_object(JsonObject *object)
+{
+    JsonNode *root = json_node_init_object(json_node_alloc(), object);
+    JsonGenerator *generator = json_generator_new();
+    json_generator_set_root(generator, root);
+    gchar *text = json_generator_to_data(generator, NULL);
+    g_object_unref(generator);
+    json_node_free(root);
+    return text;
+}
+
+static void glib_decode_candidate()
+{
+    JsonParser *parser = json_parser_new();
+    json_parser_load_from_data(parser, candidate_text.c_str(), -1, NULL);
+    JsonObject *object = json_node_get_object(json_parser_get_root(parser));
+    JsonObject *child = json_object_get_object_member(object, "candidate");
+    const gchar *source = json_object_get_string_member(object, "source");
+    const gchar *candidate = json_object_get_string_member(child, "candidate");
+    sink += strlen(source) + strlen(candidate) +
+            json_object_get_int_member(child, "sdpMLineIndex");
+    g_object_unref(parser);
+}
+
+static void glib_decode_answer()
+{
+    JsonParser *parser = json_parser_new();
+    json_parser_load_from_data(parser, answer_text.c_str(), -1, NULL);
+    JsonObject *object = json_node_get_object(json_parser_get_root(parser));
+    JsonObject *child = json_object_get_object_member(object, "sdp");
+    sink += strlen(json_object_get_string_member(object, "source")) +
+            strlen(json_object_get_string_member(child, "type")) +
+            strlen(json_object_get_string_member(child, "sdp"));
+    g_object_unref(parser);
+}
+
+static void glib_decode_count()
+{
+    JsonParser *parser = json_parser_new();
+    json_parser_load_from_data(parser, count_text.c_str(), -1, NULL);
+    JsonReader *reader = json_reader_new(json_parser_get_root(parser));
+    const char *members[] = {"connected-clients", "max-connected-clients",
+                             "streaming-clients", "max-streaming-clients"};
+    for (const char *member : members)
+    {
+        json_reader_read_member(reader, member);
+        sink += json_reader_get_int_value(reader);
+        json_reader_end_member(reader);
+    }
+    json_reader_read_member(reader, "source");
+    std::string source = json_reader_get_string_value(reader);
+    json_reader_end_member(reader);
+    sink += source.size();
+    g_object_unref(reader);
+    g_object_unref(parser);
+}
+
+static void glib_encode_candidate()
+{
+    JsonObject *ice = json_object_new();
+    json_object_set_string_member(ice, "candidate", CANDIDATE);
+    json_object_set_int_member(ice, "sdpMid", 0);
+    json_object_set_int_member(ice, "sdpMLineIndex", 0);
+
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "target", CAMERA);
+    json_object_set_string_member(msg, "source", RECEIVER);
+    json_object_set_string_member(msg, "type", "new-ice-candidate");
+    json_object_set_object_member(msg, "candidate", ice);
+
+    gchar *text = get_string_from_json_object(msg);
+    json_object_unref(msg);
+    // The emit takes a std::string.
+    std::string message = text;
+    sink += message.size();
+    g_free(text);
+}
+
+static void glib_encode_offer()
+{
+    JsonObject *sdp = json_object_new();
+    json_object_set_string_member(sdp, "type", "offer");
+    json_object_set_string_member(sdp, "sdp", offer_sdp.c_str());
+
+    JsonObject *msg = json_object_new();
+    json_object_set_string_member(msg, "target", CAMERA);
+    json_object_set_object_member(msg, "sdp", sdp);
+
+    gchar *text = get_string_from_json_object(msg);
+    json_object_unref(msg);
+    std::string message = text;
+    sink += message.size();
+    g_free(text);
+}
+
+/*
+ * The codec, as main.cpp does it now.
+ */
+
+static void codec_decode_candidate()
+{
+    static IceCandidateMessage message;
+    decode_ice_candidate(candidate_text, &message);
+    sink += message.source.size() + message.candidate.size() + message.mline_index;
+}
+
+static void codec_decode_answer()
+{
+    static SdpMessage message;
+    decode_sdp(answer_text, &message);
+    sink += message.source.size() + message.type.size() + message.sdp.size();
+}
+
+static void codec_decode_count()
+{
+    static ClientCountMessage message;
+    decode_client_count(count_text, &message);
+    sink += message.connected + message.max_connected + message.streaming +
+            message.max_streaming + message.source.size();
+}
+
+static void codec_encode_candidate()
+{
+    std::string message = encode_ice_candidate(CAMERA, RECEIVER, CANDIDATE, 0);
+    sink += message.size();
+}
+
+static void codec_encode_offer()
+{
+    std::string message = encode_sdp(CAMERA, "offer", offer_sdp.c_str());
+    sink += message.size();
+}
+
+/**
+ * Run a case, after a warm-up that fills the codec's reused strings, and
+ * print its rate and allocations per message.
+ */
+static double run(const char *name, void (*function)(), int iterations)
+{
+    for (int i = 0; i < 100; i++)
+        function();
+
+    unsigned long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        function();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    double rate = iterations / seconds;
+    printf("  %-9s %12.0f msg/s %10.1f allocs/msg\n", name, rate,
+           (double)(allocations - before) / iterations);
+    return rate;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    if (iterations < 1)
+    {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    answer_text = make_answer();
+    SdpMessage answer;
+    if (!decode_sdp(answer_text, &answer))
+    {
+        fprintf(stderr, "Bad test answer\n");
+        return 1;
+    }
+    offer_sdp = answer.sdp;
+
+    struct Case
+    {
+        const char *name;
+        size_t bytes;
+        void (*glib)();
+        void (*codec)();
+    } cases[] = {
+        {"decode 'new-ice-candidate'", candidate_text.size(), glib_decode_candidate,
+         codec_decode_candidate},
+        {"decode 'video-answer'", answer_text.size(), glib_decode_answer,
+         codec_decode_answer},
+        {"decode 'client-count'", count_text.size(), glib_decode_count,
+         codec_decode_count},
+        {"encode 'new-ice-candidate'", candidate_text.size(), glib_encode_candidate,
+         codec_encode_candidate},
+        {"encode 'video-offer'", answer_text.size(), glib_encode_offer,
+         codec_encode_offer},
+    };
+
+    printf("%d iterations\n", iterations);
+    for (const Case &c : cases)
+    {
+        printf("\n%s, %zu bytes:\n", c.name, c.bytes);
+        double glib = run("json-glib", c.glib, iterations);
+        double codec = run("codec", c.codec, iterations);
+        printf("  %.1fx faster\n", codec / glib);
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+/*
+ * Startup benchmark without a real camera or SignalingServer: runs a local
+ * stand-in for the SignalingServer and an emulated camera that sends
+ * videotestsrc in VP8 over webrtcbin, then starts livesync_gstreamer
+ * against them again and again. Each run ends at the app's first decoded
+ * frame; its startup timeline is collected, and the phases are summarised
+ * over all runs as time from the process start.
+ *
+ * With --commands, the run goes on after the first frame: commands are
+ * typed into the app one by one, and timed until they reach the camera,
+ * through the signaling or over the app's --control-channel.
+ *
+ * Options after -- are passed to the app, e.g. to compare --prewarm:
+ *
+ * Usage: ./bench_startup [--app ./livesync_gstreamer] [--iterations 10]
+ *                        [--port 8089] [--timeout 30] [--size 1280x640]
+ *                        [--bitrate 2000] [--commands 0] [-- app options]
+ */
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "camera_emulator.h"
+#include "signaling_standin.h"
+
+static const gchar *app_path = "./livesync_gstreamer";
+static gint iterations = 10;
+static gint port = 8089;
+static gint timeout = 30;
+static const gchar *size = "1280x640";
+static gint bitrate = 2000;
+static gint commands = 0;
+
+static GOptionEntry entries[] = {
+    {"app", 0, 0, G_OPTION_ARG_FILENAME, &app_path,
+     "The app to start (default: ./livesync_gstreamer)", "PATH"},
+    {"iterations", 0, 0, G_OPTION_ARG_INT, &iterations,
+     "How many times to start it (default: 10)", "N"},
+    {"port", 0, 0, G_OPTION_ARG_INT, &port,
+     "Port of the signaling stand-in on 127.0.0.1 (default: 8089)", "PORT"},
+    {"timeout", 0, 0, G_OPTION_ARG_INT, &timeout,
+     "Give up on a run after this long (default: 30)", "SECONDS"},
+    {"size", 0, 0, G_OPTION_ARG_STRING, &size,
+     "Size of the camera's video (default: 1280x640)", "WxH"},
+    {"bitrate", 0, 0, G_OPTION_ARG_INT, &bitrate,
+     "Bitrate of the camera's video (default: 2000)", "KBPS"},
+    {"commands", 0, 0, G_OPTION_ARG_INT, &commands,
+     "After the first frame, type this many camera commands into the app and time them to the camera (default: 0)", "N"},
+    {nullptr},
+};
+
+#define CAMERA_NAME "Bench Camera"
+// Between the --commands, in ms: longer than the app's control tick, so
+// that each command goes out at once rather than on the next tick.
+#define COMMAND_INTERVAL 250
+
+/**
+ * A phase of one run, in ms from the process start.
+ */
+struct Phase
+{
+    std::string name;
+    double time;
+};
+
+/**
+ * The app process of the current run.
+ */
+struct Run
+{
+    gint index = 0;
+    GPid pid = 0;
+    gint stdin_fd = -1;
+    gint64 spawn_time = 0;
+    GIOChannel *output = nullptr;
+    guint output_watch = 0;
+    guint timeout_source = 0;
+    gboolean in_timeline = FALSE;
+    gboolean done = FALSE;
+    std::vector<Phase> phases; /* as the app printed them, from its start */
+    gint commands_typed = 0;
+    gint64 command_time = 0; /* of the command on its way, 0 = none */
+    guint command_source = 0;
+};
+
+static GMainLoop *loop;
+static gchar **app_args = nullptr;
+static Run run;
+static std::vector<std::vector<Phase>> results;
+static gint failures = 0;
+static std::vector<double> command_times[CONTROL_TRANSPORTS];
+static gint commands_lost = 0;
+
+static gboolean start_run(gpointer user_data);
+static gboolean type_command(gpointer user_data);
+
+static double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    return values[(size_t)((values.size() - 1) * p / 100 + 0.5)];
+}
+
+/**
+ * The app's timeline counts from when it started running its own code; the
+ * time before that, from fork to main(), is the loading of the process.
+ */
+static void finish_run(gint64 now)
+{
+    const double wall = (now - run.spawn_time) / 1000.0;
+    const double loading = wall - run.phases.back().time;
+
+    std::vector<Phase> phases;
+    phases.push_back({"process loaded", loading});
+    for (const Phase &phase : run.phases)
+        phases.push_back({phase.name, phase.time + loading});
+    results.push_back(phases);
+
+    g_print("Run %d: first frame %.1f ms after starting the app\n", run.index, wall);
+    run.done = TRUE;
+    if (commands > 0)
+    {
+        if (run.timeout_source)
+            g_source_remove(run.timeout_source);
+        run.timeout_source = 0;
+        run.command_source = g_timeout_add(COMMAND_INTERVAL, type_command, NULL);
+        return;
+    }
+    kill(run.pid, SIGTERM);
+}
+
+/**
+ * Type the next command into the app, as a user or a joystick would. A
+ * command that hasn't reached the camera by then is lost.
+ */
+static gboolean type_command(gpointer user_data)
+{
+    static const gchar command[] = "zoom-delta 1\n";
+
+    if (run.command_time)
+        commands_lost++;
+    if (run.commands_typed == commands)
+    {
+        run.command_time = 0;
+        run.command_source = 0;
+        kill(run.pid, SIGTERM);
+        return G_SOURCE_REMOVE;
+    }
+
+    run.command_time = g_get_monotonic_time();
+    run.commands_typed++;
+    if (write(run.stdin_fd, command, strlen(command)) < 0)
+        g_printerr("Run %d: can't type into the app\n", run.index);
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * The camera got a command: how long it took from the app's stdin.
+ */
+static void on_command(const CameraCommand &command, ControlTransport transport,
+                       gint64 time)
+{
+    if (!run.command_time || g_strcmp0(command.op, "zoom-delta") != 0)
+        return;
+    command_times[transport].push_back((time - run.command_time) / 1000.0);
+    run.command_time = 0;
+}
+
+/**
+ * Read the app's output, looking for the startup timeline of the camera:
+ *   Camera 1 startup timeline (ms since start, step):
+ *       12.3    +12.3  connected to server
+ */
+static gboolean on_output(GIOChannel *channel, GIOCondition condition,
+                          gpointer user_data)
+{
+    gchar *line;
+    gsize length;
+
+    while (g_io_channel_read_line(channel, &line, &length, NULL, NULL) ==
+               G_IO_STATUS_NORMAL &&
+           line)
+    {
+        double time, step;
+        int consumed = 0;
+
+        if (g_str_has_prefix(line, "Camera 1 startup timeline"))
+        {
+            run.in_timeline = TRUE;
+        }
+        else if (run.in_timeline && !run.done &&
+                 sscanf(line, "%lf %lf %n", &time, &step, &consumed) == 2 &&
+                 consumed > 0)
+        {
+            std::string name = g_strstrip(line + consumed);
+            run.phases.push_back({name, time});
+            if (name == "first frame")
+                finish_run(g_get_monotonic_time());
+        }
+        g_free(line);
+    }
+
+    if (condition & (G_IO_HUP | G_IO_ERR))
+    {
+        run.output_watch = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_timeout(gpointer user_data)
+{
+    g_printerr("Run %d: no video in %d s, stopping it\n", run.index, timeout);
+    run.timeout_source = 0;
+    kill(run.pid, SIGTERM);
+    return G_SOURCE_REMOVE;
+}
+
+static void print_summary()
+{
+    // Every phase that was seen, with its times over all runs.
+    std::map<std::string, std::vector<double>> times, steps;
+    for (const std::vector<Phase> &phases : results)
+    {
+        double previous = 0;
+        for (const Phase &phase : phases)
+        {
+            times[phase.name].push_back(phase.time);
+            steps[phase.name].push_back(phase.time - previous);
+            previous = phase.time;
+        }
+    }
+
+    std::vector<std::pair<double, std::string>> order;
+    for (const auto &phase : times)
+        order.push_back({percentile(phase.second, 50), phase.first});
+    std::sort(order.begin(), order.end());
+
+    g_print("\n%d runs, %d without video\n", (gint)results.size(), failures);
+    if (results.empty())
+        return;
+    g_print("%-22s %6s %10s %10s %10s %10s\n", "phase (ms)", "runs",
+            "median", "p95", "max", "step");
+    for (const auto &phase : order)
+    {
+        const std::vector<double> &values = times[phase.second];
+        g_print("%-22s %6d %10.1f %10.1f %10.1f %+10.1f\n", phase.second.c_str(),
+                (gint)values.size(), phase.first, percentile(values, 95),
+                percentile(values, 100), percentile(steps[phase.second], 50));
+    }
+    g_print("Step is the median wait since the previous phase of the same run.\n");
+}
+
+static void print_command_summary()
+{
+    g_print("\n%-22s %6s %10s %10s %10s\n", "commands (ms)", "count", "median",
+            "p95", "max");
+    for (guint transport = 0; transport < CONTROL_TRANSPORTS; transport++)
+    {
+        const std::vector<double> &values = command_times[transport];
+        if (values.empty())
+            continue;
+        g_print("%-22s %6d %10.1f %10.1f %10.1f\n",
+                control_transport_names[transport], (gint)values.size(),
+                percentile(values, 50), percentile(values, 95),
+                percentile(values, 100));
+    }
+    g_print("From typing the command into the app to the camera; %d lost.\n",
+            commands_lost);
+}
+
+static void on_app_exit(GPid pid, gint status, gpointer user_data)
+{
+    g_spawn_close_pid(pid);
+    close(run.stdin_fd);
+    if (run.output_watch)
+        g_source_remove(run.output_watch);
+    g_io_channel_unref(run.output);
+    if (run.timeout_source)
+        g_source_remove(run.timeout_source);
+    if (run.command_source)
+        g_source_remove(run.command_source);
+    if (!run.done)
+        failures++;
+
+    if (run.index < iterations)
+        // Let the camera notice the hang-up and get ready again.
+        g_timeout_add(500, start_run, NULL);
+    else
+        g_main_loop_quit(loop);
+}
+
+static gboolean start_run(gpointer user_data)
+{
+    GError *error = nullptr;
+    gint stdout_fd;
+    gchar *server = g_strdup_printf("http://127.0.0.1:%d", port);
+    std::vector<gchar *> argv = {(gchar *)app_path, (gchar *)"--server", server,
+                                 (gchar *)"--peer", (gchar *)CAMERA_NAME,
+                                 (gchar *)"--headless"};
+    for (gchar **arg = app_args; arg && *arg; arg++)
+        argv.push_back(*arg);
+    argv.push_back(nullptr);
+
+    gint index = run.index + 1;
+    run = Run();
+    run.index = index;
+    run.spawn_time = g_get_monotonic_time();
+    // The app reads commands from stdin, so give it one of its own.
+    if (!g_spawn_async_with_pipes(NULL, argv.data(), NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                                  NULL, NULL, &run.pid, &run.stdin_fd, &stdout_fd,
+                                  NULL, &error))
+    {
+        g_printerr("Can't start %s: %s\n", app_path, error->message);
+        g_error_free(error);
+        g_free(server);
+        g_main_loop_quit(loop);
+        return G_SOURCE_REMOVE;
+    }
+    g_free(server);
+
+    run.output = g_io_channel_unix_new(stdout_fd);
+    g_io_channel_set_close_on_unref(run.output, TRUE);
+    g_io_channel_set_flags(run.output, G_IO_FLAG_NONBLOCK, NULL);
+    run.output_watch = g_io_add_watch(run.output,
+                                      (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR),
+                                      on_output, NULL);
+    run.timeout_source = g_timeout_add_seconds(timeout, on_timeout, NULL);
+    g_child_watch_add(run.pid, on_app_exit, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("[-- APP OPTIONS] - time the app's startup");
+    GError *error = nullptr;
+    gint width, height;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (sscanf(size, "%dx%d", &width, &height) != 2 || width < 16 || height < 16 ||
+        iterations < 1 || port <= 0 || port > 65535 || timeout < 1 || bitrate < 1 ||
+        commands < 0)
+    {
+        g_printerr("Invalid options, see --help\n");
+        return 1;
+    }
+    // What is left after -- is for the app. GLib keeps the -- when options
+    // follow it.
+    app_args = argv + 1;
+    if (g_strcmp0(app_args[0], "--") == 0)
+        app_args++;
+
+    loop = g_main_loop_new(NULL, FALSE);
+    SignalingStandIn *signaling = new SignalingStandIn();
+    CameraEmulator *camera = new CameraEmulator(signaling, CAMERA_NAME, width,
+                                                height, bitrate);
+    camera->on_command = on_command;
+    signaling->add_camera(camera);
+    if (!signaling->listen(port) || !camera->start())
+        return 1;
+
+    g_print("%d runs of %s, camera %dx%d at %d kbit/s\n", iterations, app_path,
+            width, height, bitrate);
+    g_idle_add(start_run, NULL);
+    g_main_loop_run(loop);
+
+    print_summary();
+    if (commands > 0)
+        print_command_summary();
+    // Mostly ICE candidates: compare with and without --ice-batch.
+    g_print("Signaling events from the app: %.1f per run\n",
+            (double)signaling->events_received() / iterations);
+
+    delete camera;
+    delete signaling;
+    g_main_loop_unref(loop);
+    return failures ? 2 : 0;
+}
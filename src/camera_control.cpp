@@ -0,0 +1,274 @@
+/*
+ * Continuous camera control: pan and zoom commands go to the camera at a
+ * fixed tick, with the updates in between merged, and the time from a
+ * command to the camera's reaction is measured.
+ */
+
+#include "camera_control.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// A measurement that has seen no reaction in this long is given up, in
+// microseconds: the camera may have ignored the command.
+#define CONTROL_TIMEOUT (5 * G_USEC_PER_SEC)
+
+// How much the samples of a frame have to differ from those of the
+// reference frame on average, out of 255, to count as a change. Above the
+// noise of a still picture in a compressed stream.
+#define CHANGE_THRESHOLD 8
+
+// How many frames from before a command have to match the one before them
+// for the picture to count as still, and the reaction to be timed from it.
+#define STILL_FRAMES 2
+
+PtzController::PtzController(guint rate, SendFunc send, gpointer user_data)
+    : interval_ms(1000 / MAX(rate, 1u)), send(send), user_data(user_data),
+      tick_source(0), next_kind(0), pan_x(0), pan_y(0), step_x(0), step_y(0),
+      zoom_step(0), update_count(0), sent_count(0)
+{
+    for (gboolean &w : waiting)
+        w = FALSE;
+}
+
+PtzController::~PtzController()
+{
+    if (tick_source)
+        g_source_remove(tick_source);
+}
+
+void PtzController::pan(double x, double y)
+{
+    pan_x = x;
+    pan_y = y;
+    waiting[PAN] = TRUE;
+    updated();
+}
+
+void PtzController::pan_tilt(double x, double y)
+{
+    step_x += x;
+    step_y += y;
+    waiting[PAN_TILT] = TRUE;
+    updated();
+}
+
+void PtzController::zoom(double delta)
+{
+    zoom_step += delta;
+    waiting[ZOOM] = TRUE;
+    updated();
+}
+
+/**
+ * Between ticks the update waits for the next one. With the timer
+ * stopped, it goes out now, and the ticks start from here.
+ */
+void PtzController::updated()
+{
+    update_count++;
+    if (tick_source)
+        return;
+    send_next();
+    tick_source = g_timeout_add(interval_ms, on_tick, this);
+}
+
+/**
+ * Send the next waiting command, in turns. Returns FALSE if none was.
+ */
+gboolean PtzController::send_next()
+{
+    for (guint i = 0; i < KINDS; i++)
+    {
+        guint kind = (next_kind + i) % KINDS;
+        if (!waiting[kind])
+            continue;
+
+        CameraCommand command = {nullptr, nullptr, 0, 0, 0};
+        switch (kind)
+        {
+        case PAN:
+            command.op = "pan-vector";
+            command.x = pan_x;
+            command.y = pan_y;
+            break;
+        case PAN_TILT:
+            command.op = "pan-tilt";
+            command.x = step_x;
+            command.y = step_y;
+            step_x = step_y = 0;
+            break;
+        case ZOOM:
+            command.op = "zoom-delta";
+            command.value = zoom_step;
+            zoom_step = 0;
+            break;
+        }
+        waiting[kind] = FALSE;
+        next_kind = (kind + 1) % KINDS;
+        sent_count++;
+        send(command, user_data);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+gboolean PtzController::on_tick(gpointer user_data)
+{
+    PtzController *self = (PtzController *)user_data;
+
+    if (self->send_next())
+        return G_SOURCE_CONTINUE;
+    self->tick_source = 0;
+    return G_SOURCE_REMOVE;
+}
+
+ControlLatency::ControlLatency(guint receive_latency_ms)
+    : receive_latency((gint64)receive_latency_ms * 1000), format_start(0),
+      frame_start(0), reference_start(0), frames_before(0), still(0),
+      window_commands(0), commands(0), window_moving(0), moving(0)
+{
+}
+
+gboolean ControlLatency::measuring() const
+{
+    gint64 previous = MAX(format_start.load(), frame_start.load());
+
+    return previous && g_get_monotonic_time() - previous < CONTROL_TIMEOUT;
+}
+
+void ControlLatency::command_sent()
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (measuring())
+        return;
+    window_commands++;
+    commands++;
+    format_start = now;
+    frame_start = now;
+}
+
+void ControlLatency::video_format_received()
+{
+    gint64 start = format_start.exchange(0);
+
+    if (!start)
+        return;
+    double ms = (g_get_monotonic_time() - start) / 1000.0;
+    window_format.record(ms);
+    format.record(ms);
+}
+
+/**
+ * Read a grid of samples of the frame's first component, e.g. luma.
+ */
+gboolean ControlLatency::sample(GstBuffer *buffer, const GstVideoInfo *info,
+                                guint8 samples[GRID * GRID])
+{
+    GstVideoFrame frame;
+
+    if (!gst_video_frame_map(&frame, (GstVideoInfo *)info, buffer, GST_MAP_READ))
+        return FALSE;
+
+    const guint8 *data = (const guint8 *)GST_VIDEO_FRAME_COMP_DATA(&frame, 0);
+    gint stride = GST_VIDEO_FRAME_COMP_STRIDE(&frame, 0);
+    gint pstride = GST_VIDEO_FRAME_COMP_PSTRIDE(&frame, 0);
+    gint width = GST_VIDEO_FRAME_COMP_WIDTH(&frame, 0);
+    gint height = GST_VIDEO_FRAME_COMP_HEIGHT(&frame, 0);
+    for (int row = 0; row < GRID; row++)
+    {
+        const guint8 *line = data + (gsize)((2 * row + 1) * height / (2 * GRID)) * stride;
+        for (int column = 0; column < GRID; column++)
+            samples[row * GRID + column] =
+                line[((2 * column + 1) * width / (2 * GRID)) * pstride];
+    }
+    gst_video_frame_unmap(&frame);
+    return TRUE;
+}
+
+gboolean ControlLatency::changed(const guint8 *samples, const guint8 *reference)
+{
+    guint difference = 0;
+
+    for (int i = 0; i < GRID * GRID; i++)
+        difference += abs(samples[i] - reference[i]);
+    return difference >= CHANGE_THRESHOLD * GRID * GRID;
+}
+
+void ControlLatency::frame(GstBuffer *buffer, const GstVideoInfo *info)
+{
+    gint64 start = frame_start.load();
+    guint8 samples[GRID * GRID];
+
+    if (!start)
+        return;
+    gint64 now = g_get_monotonic_time();
+    if (now - start >= CONTROL_TIMEOUT)
+    {
+        frame_start.compare_exchange_strong(start, 0);
+        return;
+    }
+    if (!sample(buffer, info, samples))
+        return;
+
+    if (reference_start != start)
+    {
+        reference_start = start;
+        frames_before = 0;
+        still = 0;
+    }
+
+    // Sent by the camera before the command: the picture before it.
+    if (now - start < receive_latency)
+    {
+        if (frames_before > 0)
+            still = changed(samples, reference) ? 0 : still + 1;
+        frames_before++;
+        memcpy(reference, samples, sizeof(reference));
+        return;
+    }
+
+    // Otherwise the next change may as well be the motion that was
+    // already there.
+    if (still < STILL_FRAMES)
+    {
+        if (frame_start.compare_exchange_strong(start, 0))
+        {
+            window_moving++;
+            moving++;
+        }
+        return;
+    }
+
+    if (!changed(samples, reference) || !frame_start.compare_exchange_strong(start, 0))
+        return;
+
+    double ms = (now - start) / 1000.0;
+    window_frame.record(ms);
+    frame_histogram.record(ms);
+}
+
+ControlLatencySummary ControlLatency::take_window()
+{
+    ControlLatencySummary summary;
+
+    summary.commands = window_commands.exchange(0);
+    summary.moving = window_moving.exchange(0);
+    summary.to_format = window_format.summarize();
+    summary.to_frame = window_frame.summarize();
+    window_format.reset();
+    window_frame.reset();
+    return summary;
+}
+
+ControlLatencySummary ControlLatency::total() const
+{
+    ControlLatencySummary summary;
+
+    summary.commands = commands;
+    summary.moving = moving;
+    summary.to_format = format.summarize();
+    summary.to_frame = frame_histogram.summarize();
+    return summary;
+}
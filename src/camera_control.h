@@ -0,0 +1,164 @@
+/*
+ * Continuous camera control: pan and zoom commands go to the camera at a
+ * fixed tick, with the updates in between merged, and the time from a
+ * command to the camera's reaction is measured.
+ */
+
+#ifndef LIVESYNC_CAMERA_CONTROL_H
+#define LIVESYNC_CAMERA_CONTROL_H
+
+#include "latency.h"
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <atomic>
+
+/**
+ * One command to the camera: op is e.g. "pan-vector", "pan-tilt",
+ * "zoom-delta" or "projection"; type goes with the projection, x and y
+ * with the pan commands, value with the zoom.
+ */
+struct CameraCommand
+{
+    const gchar *op;
+    const gchar *type; /* or nullptr */
+    double x;
+    double y;
+    double value;
+};
+
+/**
+ * Joystick-style control of one camera, on the main loop. A pan velocity
+ * replaces the previous one that hasn't been sent yet (latest wins), while
+ * pan-tilt and zoom steps add up, so that no movement is lost. Sends at
+ * most one command per tick, taking turns if several are waiting, which
+ * bounds the rate at the SignalingServer however fast the input comes.
+ * After a quiet tick the timer stops, and the next command goes out at
+ * once.
+ */
+class PtzController
+{
+public:
+    typedef void (*SendFunc)(const CameraCommand &command, gpointer user_data);
+
+    /* rate: commands per second at most. */
+    PtzController(guint rate, SendFunc send, gpointer user_data);
+    ~PtzController();
+
+    /* Pan at this velocity until told otherwise; 0, 0 stops. */
+    void pan(double x, double y);
+
+    /* Move by a step. */
+    void pan_tilt(double x, double y);
+    void zoom(double delta);
+
+    /* Updates given and commands sent so far. */
+    guint64 updates() const { return update_count; }
+    guint64 sent() const { return sent_count; }
+
+private:
+    PtzController(const PtzController &) = delete;
+    PtzController &operator=(const PtzController &) = delete;
+
+    enum Kind
+    {
+        PAN,
+        PAN_TILT,
+        ZOOM,
+        KINDS
+    };
+
+    static gboolean on_tick(gpointer user_data);
+    void updated();
+    gboolean send_next();
+
+    guint interval_ms;
+    SendFunc send;
+    gpointer user_data;
+    guint tick_source;
+    guint next_kind; /* where the turns continue */
+
+    gboolean waiting[KINDS];
+    double pan_x, pan_y;         /* latest velocity */
+    double step_x, step_y;       /* pan-tilt steps since the last send */
+    double zoom_step;            /* zoom steps since the last send */
+    guint64 update_count;
+    guint64 sent_count;
+};
+
+/**
+ * Percentiles of the control latency, in ms: to the camera's next
+ * 'video-format' message, and to the first decoded frame that differs
+ * from the picture before the command.
+ */
+struct ControlLatencySummary
+{
+    guint64 commands;
+    guint64 moving;  /* commands not timed to a frame change, the picture */
+                     /* wasn't still before them */
+    LatencySummary to_format;
+    LatencySummary to_frame;
+};
+
+/**
+ * Measures the round trip of camera commands. One measurement at a time:
+ * a command sent while one is under way isn't measured. Frames are only
+ * looked at while a command waits for its frame change, and compared from
+ * a grid of samples of their first plane, so a change in the picture is
+ * found without looking at all of it. The frames decoded within the
+ * receive latency of the command left the camera before it did, so they
+ * show the picture before the command: the change is timed only if that
+ * was still. While the camera pans or the scene moves, the next frame
+ * differs anyway, and the command is counted as not timed instead.
+ */
+class ControlLatency
+{
+public:
+    /* receive_latency_ms: the least time from the camera sending a frame
+     * to it being decoded here, i.e. the jitterbuffer's latency. */
+    explicit ControlLatency(guint receive_latency_ms);
+
+    /* On the main loop. */
+    void command_sent();
+    void video_format_received();
+
+    /* On the streaming thread, for each decoded frame while
+     * waiting_for_frame(). */
+    void frame(GstBuffer *buffer, const GstVideoInfo *info);
+    gboolean waiting_for_frame() const { return frame_start.load(std::memory_order_relaxed) != 0; }
+
+    /* Whether a command is being timed, i.e. command_sent() would not
+     * start another measurement. */
+    gboolean measuring() const;
+
+    /* Since the previous call, and since the start. */
+    ControlLatencySummary take_window();
+    ControlLatencySummary total() const;
+
+private:
+    ControlLatency(const ControlLatency &) = delete;
+    ControlLatency &operator=(const ControlLatency &) = delete;
+
+    static const int GRID = 8;
+
+    static gboolean sample(GstBuffer *buffer, const GstVideoInfo *info,
+                           guint8 samples[GRID * GRID]);
+    static gboolean changed(const guint8 *samples, const guint8 *reference);
+
+    gint64 receive_latency;           /* in microseconds */
+    std::atomic<gint64> format_start; /* of the command, 0 = not measuring */
+    std::atomic<gint64> frame_start;
+    gint64 reference_start;           /* streaming thread only: the command */
+    guint frames_before;              /* frames from before it so far */
+    guint still;                      /* of those, in a row like the one before */
+    guint8 reference[GRID * GRID];    /* the latest frame from before it */
+    std::atomic<guint64> window_commands;
+    std::atomic<guint64> commands;
+    std::atomic<guint64> window_moving;
+    std::atomic<guint64> moving;
+    LatencyHistogram window_format, format;
+    LatencyHistogram window_frame, frame_histogram;
+};
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * An emulated camera for benchmarks: answers livesync_gstreamer's offer
+ * like the LiveSYNC camera app does and sends it a videotestsrc stream in
+ * VP8 over a real webrtcbin connection on this machine.
+ */
+
+#include "camera_emulator.h"
+#include "signaling_standin.h"
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+/**
+ * A message on its way from a webrtcbin thread to the main loop.
+ */
+struct QueuedMessage
+{
+    SignalingStandIn *signaling;
+    guint client;
+    const gchar *event;
+    JsonObject *object;
+};
+
+/**
+ * A command from the control channel, on its way to the main loop.
+ */
+struct QueuedCommand
+{
+    CameraEmulator *camera;
+    CameraCommand command;
+    gint64 time;
+};
+
+CameraEmulator::CameraEmulator(SignalingStandIn *signaling, const gchar *name,
+                               gint width, gint height, guint kbps)
+    : signaling(signaling), peer_name(g_strdup(name)), width(width),
+      height(height), kbps(kbps), pipe(nullptr), webrtc(nullptr),
+      control(nullptr), caller(0), answered(0)
+{
+}
+
+CameraEmulator::~CameraEmulator()
+{
+    stop();
+    g_free(peer_name);
+}
+
+gboolean CameraEmulator::start()
+{
+    GError *error = nullptr;
+
+    if (pipe)
+        return TRUE;
+
+    // Like the camera: live VP8, a keyframe every second so that a new
+    // receiver doesn't wait long for one.
+    gchar *description = g_strdup_printf(
+        "webrtcbin name=webrtc bundle-policy=max-bundle "
+        "videotestsrc is-live=true pattern=ball ! "
+        "video/x-raw,width=%d,height=%d,framerate=30/1 ! videoconvert ! queue ! "
+        "vp8enc deadline=1 cpu-used=8 end-usage=cbr target-bitrate=%u000 "
+        "keyframe-max-dist=30 ! rtpvp8pay ! "
+        "application/x-rtp,media=video,encoding-name=VP8,payload=96 ! webrtc.",
+        width, height, kbps);
+    pipe = gst_parse_launch(description, &error);
+    g_free(description);
+    if (error)
+    {
+        g_printerr("Camera %s: can't build the pipeline: %s\n", peer_name,
+                   error->message);
+        g_error_free(error);
+        if (pipe)
+            gst_object_unref(pipe);
+        pipe = nullptr;
+        return FALSE;
+    }
+
+    webrtc = gst_bin_get_by_name(GST_BIN(pipe), "webrtc");
+    gst_object_unref(webrtc); // the pipeline keeps it
+    g_signal_connect(webrtc, "on-ice-candidate", G_CALLBACK(on_ice_candidate), this);
+
+    if (gst_element_set_state(pipe, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        g_printerr("Camera %s: can't start the pipeline\n", peer_name);
+        stop();
+        return FALSE;
+    }
+
+    // Ready for the receiver's --control-channel; it only opens if the
+    // offer has one.
+    control = create_control_channel(webrtc);
+    if (control)
+        g_signal_connect(control, "on-message-data", G_CALLBACK(on_control_message), this);
+
+    caller = 0;
+    signaling->announce(this);
+    return TRUE;
+}
+
+void CameraEmulator::stop()
+{
+    if (!pipe)
+        return;
+
+    close_control();
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+    pipe = nullptr;
+    webrtc = nullptr;
+    caller = 0;
+    signaling->announce(this);
+}
+
+/**
+ * The receiver calls: {"target": us, "sdp": {"type": "offer", "sdp": text}}.
+ * A new call while in one replaces it, as a camera that was left hanging
+ * would.
+ */
+void CameraEmulator::handle_offer(guint client, JsonObject *message)
+{
+    GstSDPMessage *sdp;
+
+    if (!pipe || !json_object_has_member(message, "sdp"))
+        return;
+    if (caller && caller != client)
+    {
+        // Each call needs a fresh webrtcbin.
+        stop();
+        if (!start())
+            return;
+    }
+
+    JsonObject *child = json_object_get_object_member(message, "sdp");
+    const gchar *text = json_object_get_string_member(child, "sdp");
+    if (gst_sdp_message_new_from_text(text, &sdp) != GST_SDP_OK)
+    {
+        g_printerr("Camera %s: can't parse the offer\n", peer_name);
+        return;
+    }
+    caller = client;
+    signaling->announce(this);
+
+    GstWebRTCSessionDescription *offer =
+        gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp);
+    GstPromise *promise = gst_promise_new_with_change_func(on_offer_set, this, NULL);
+    g_signal_emit_by_name(webrtc, "set-remote-description", offer, promise);
+    gst_webrtc_session_description_free(offer);
+}
+
+void CameraEmulator::on_offer_set(GstPromise *promise, gpointer user_data)
+{
+    CameraEmulator *self = (CameraEmulator *)user_data;
+
+    gst_promise_unref(promise);
+    promise = gst_promise_new_with_change_func(on_answer_created, self, NULL);
+    g_signal_emit_by_name(self->webrtc, "create-answer", NULL, promise);
+}
+
+void CameraEmulator::on_answer_created(GstPromise *promise, gpointer user_data)
+{
+    CameraEmulator *self = (CameraEmulator *)user_data;
+    GstWebRTCSessionDescription *answer = NULL;
+
+    if (gst_promise_wait(promise) != GST_PROMISE_RESULT_REPLIED)
+    {
+        gst_promise_unref(promise);
+        return;
+    }
+    gst_structure_get(gst_promise_get_reply(promise), "answer",
+                      GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+    gst_promise_unref(promise);
+    if (!answer)
+    {
+        g_printerr("Camera %s: can't answer the offer\n", self->peer_name);
+        return;
+    }
+
+    promise = gst_promise_new();
+    g_signal_emit_by_name(self->webrtc, "set-local-description", answer, promise);
+    gst_promise_interrupt(promise);
+    gst_promise_unref(promise);
+
+    gchar *text = gst_sdp_message_as_text(answer->sdp);
+    JsonObject *sdp = json_object_new();
+    json_object_set_string_member(sdp, "type", "answer");
+    json_object_set_string_member(sdp, "sdp", text);
+    g_free(text);
+    gst_webrtc_session_description_free(answer);
+
+    JsonObject *message = json_object_new();
+    json_object_set_string_member(message, "source", self->peer_name);
+    json_object_set_object_member(message, "sdp", sdp);
+    self->send("video-answer", message);
+    self->answered++;
+}
+
+/**
+ * {"source": receiver, "candidate": {"candidate": text, "sdpMLineIndex": n}},
+ * or with the app's --ice-batch {"source": receiver, "candidates": [...]},
+ * an array of them that may end with the end-of-candidates marker, an empty
+ * candidate. webrtcbin doesn't need the marker, so it is left out.
+ */
+void CameraEmulator::handle_ice_candidate(guint client, JsonObject *message)
+{
+    if (!pipe || client != caller)
+        return;
+
+    if (json_object_has_member(message, "candidates"))
+    {
+        JsonArray *candidates = json_object_get_array_member(message, "candidates");
+        for (guint i = 0; i < json_array_get_length(candidates); i++)
+        {
+            JsonObject *child = json_array_get_object_element(candidates, i);
+            const gchar *candidate = json_object_get_string_member(child, "candidate");
+            if (candidate && *candidate)
+                g_signal_emit_by_name(webrtc, "add-ice-candidate",
+                                      (guint)json_object_get_int_member(child, "sdpMLineIndex"),
+                                      candidate);
+        }
+        return;
+    }
+    if (!json_object_has_member(message, "candidate"))
+        return;
+
+    JsonObject *child = json_object_get_object_member(message, "candidate");
+    g_signal_emit_by_name(webrtc, "add-ice-candidate",
+                          (guint)json_object_get_int_member(child, "sdpMLineIndex"),
+                          json_object_get_string_member(child, "candidate"));
+}
+
+void CameraEmulator::on_ice_candidate(GstElement *webrtc, guint mline_index,
+                                      gchar *candidate, gpointer user_data)
+{
+    CameraEmulator *self = (CameraEmulator *)user_data;
+
+    JsonObject *ice = json_object_new();
+    json_object_set_string_member(ice, "candidate", candidate);
+    json_object_set_int_member(ice, "sdpMLineIndex", mline_index);
+
+    JsonObject *message = json_object_new();
+    json_object_set_string_member(message, "source", self->peer_name);
+    json_object_set_string_member(message, "type", "new-ice-candidate");
+    json_object_set_object_member(message, "candidate", ice);
+    self->send("new-ice-candidate", message);
+}
+
+/**
+ * The caller hung up or went away: be ready for the next call, with a new
+ * pipeline as a webrtcbin can't be negotiated from scratch again.
+ */
+void CameraEmulator::hang_up(guint client)
+{
+    if (!pipe || client != caller)
+        return;
+
+    close_control();
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+    pipe = nullptr;
+    webrtc = nullptr;
+    caller = 0;
+    start();
+}
+
+void CameraEmulator::close_control()
+{
+    if (!control)
+        return;
+    g_signal_handlers_disconnect_by_data(control, this);
+    g_object_unref(control);
+    control = nullptr;
+}
+
+static double get_number(JsonObject *object, const gchar *name)
+{
+    return json_object_has_member(object, name)
+               ? json_object_get_double_member(object, name)
+               : 0;
+}
+
+/**
+ * {"source": receiver, "op": op, "type": type, "x": x, "y": y, "value": v},
+ * all but op optional.
+ */
+void CameraEmulator::handle_command(guint client, JsonObject *message)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (!pipe || client != caller || !json_object_has_member(message, "op") ||
+        !on_command)
+        return;
+
+    CameraCommand command = {
+        json_object_get_string_member(message, "op"),
+        json_object_has_member(message, "type")
+            ? json_object_get_string_member(message, "type")
+            : nullptr,
+        get_number(message, "x"),
+        get_number(message, "y"),
+        get_number(message, "value"),
+    };
+    on_command(command, CONTROL_SIGNALING, now);
+}
+
+/**
+ * A command over the control channel, on a webrtcbin thread: acknowledge
+ * it at once, and tell the main loop.
+ */
+void CameraEmulator::on_control_message(GObject *channel, GBytes *data,
+                                        gpointer user_data)
+{
+    CameraEmulator *self = (CameraEmulator *)user_data;
+    gint64 now = g_get_monotonic_time();
+    guint8 ack[CONTROL_MESSAGE_MAX];
+    CameraCommand command;
+    guint16 sequence;
+    guint8 flags;
+    gsize size;
+    const guint8 *message = (const guint8 *)g_bytes_get_data(data, &size);
+
+    if (!decode_camera_command(message, size, &command, &sequence, &flags) ||
+        (flags & CONTROL_FLAG_ACK))
+        return;
+
+    GBytes *bytes = g_bytes_new(ack, encode_control_ack(message, ack));
+    g_signal_emit_by_name(channel, "send-data", bytes);
+    g_bytes_unref(bytes);
+
+    g_idle_add(report_command, new QueuedCommand{self, command, now});
+}
+
+gboolean CameraEmulator::report_command(gpointer user_data)
+{
+    QueuedCommand *queued = (QueuedCommand *)user_data;
+
+    if (queued->camera->on_command)
+        queued->camera->on_command(queued->command, CONTROL_DATA_CHANNEL,
+                                   queued->time);
+    delete queued;
+    return G_SOURCE_REMOVE;
+}
+
+void CameraEmulator::send(const gchar *event, JsonObject *object)
+{
+    QueuedMessage *message = new QueuedMessage{signaling, caller, event, object};
+    g_idle_add(send_queued, message);
+}
+
+gboolean CameraEmulator::send_queued(gpointer user_data)
+{
+    QueuedMessage *message = (QueuedMessage *)user_data;
+
+    const gchar *target = message->signaling->client_name(message->client);
+    if (target)
+    {
+        json_object_set_string_member(message->object, "target", target);
+        message->signaling->emit(message->client, message->event, message->object);
+    }
+    json_object_unref(message->object);
+    delete message;
+    return G_SOURCE_REMOVE;
+}
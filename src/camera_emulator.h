@@ -0,0 +1,85 @@
+/*
+ * An emulated camera for benchmarks: answers livesync_gstreamer's offer
+ * like the LiveSYNC camera app does and sends it a videotestsrc stream in
+ * VP8 over a real webrtcbin connection on this machine.
+ */
+
+#ifndef LIVESYNC_CAMERA_EMULATOR_H
+#define LIVESYNC_CAMERA_EMULATOR_H
+
+#include "control_channel.h"
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include <atomic>
+#include <functional>
+
+class SignalingStandIn;
+
+/**
+ * One camera, in one call at a time. Lives on the GLib main loop; the
+ * webrtcbin callbacks hop over to it before touching the signaling.
+ */
+class CameraEmulator
+{
+public:
+    /* kbps: the VP8 bitrate. */
+    CameraEmulator(SignalingStandIn *signaling, const gchar *name,
+                   gint width, gint height, guint kbps);
+    ~CameraEmulator();
+
+    const gchar *name() const { return peer_name; }
+
+    /* Start or stop the camera. A started camera is ready for a call, and
+     * the signaling is told so. start() returns FALSE if the pipeline
+     * can't be made, e.g. for a missing plugin. */
+    gboolean start();
+    void stop();
+
+    gboolean is_ready() const { return pipe != nullptr; }
+    gboolean is_free() const { return caller == 0; }
+
+    /* Offers answered so far. */
+    guint calls() const { return answered; }
+
+    /* From the signaling; client is the StandInClient id of the caller. */
+    void handle_offer(guint client, JsonObject *message);
+    void handle_ice_candidate(guint client, JsonObject *message);
+    void handle_command(guint client, JsonObject *message);
+    void hang_up(guint client);
+
+    /* A camera command arrived, through the signaling or over the control
+     * channel, at this monotonic time. Called on the main loop. Commands
+     * over the control channel are acknowledged, as the camera does. */
+    std::function<void(const CameraCommand &, ControlTransport, gint64)> on_command;
+
+private:
+    CameraEmulator(const CameraEmulator &) = delete;
+    CameraEmulator &operator=(const CameraEmulator &) = delete;
+
+    static void on_ice_candidate(GstElement *webrtc, guint mline_index,
+                                 gchar *candidate, gpointer user_data);
+    static void on_offer_set(GstPromise *promise, gpointer user_data);
+    static void on_answer_created(GstPromise *promise, gpointer user_data);
+    static gboolean send_queued(gpointer user_data);
+    static void on_control_message(GObject *channel, GBytes *data, gpointer user_data);
+    static gboolean report_command(gpointer user_data);
+
+    void close_control();
+
+    /* Thread-safe: queues the message for the main loop. */
+    void send(const gchar *event, JsonObject *object);
+
+    SignalingStandIn *signaling;
+    gchar *peer_name;
+    gint width, height;
+    guint kbps;
+    GstElement *pipe;
+    GstElement *webrtc;  /* owned by pipe */
+    GObject *control;    /* the call's control channel, or nullptr */
+    guint caller;        /* StandInClient id, 0 = free */
+    std::atomic<guint> answered; /* counted on a webrtcbin thread */
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Load generator for scale tests: a local stand-in for the SignalingServer
+ * with a fleet of emulated LiveSYNC cameras behind it, each answering
+ * offers and streaming videotestsrc in VP8 over its own webrtcbin. Point
+ * one or more livesync_gstreamer processes at it to see how the receiver
+ * copes with dozens of cameras, and with --flap, with bursts of cameras
+ * dropping out and reporting back in at once.
+ *
+ * Usage: ./camera_fleet [--cameras 10] [--port 8089] [--size 640x320]
+ *                       [--bitrate 500] [--flap SECONDS] [--flap-count N]
+ *
+ * and e.g.: ./livesync_gstreamer --server http://127.0.0.1:8089
+ *                                --max-cameras 10 --headless
+ */
+
+#include <gst/gst.h>
+#include <glib-unix.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "camera_emulator.h"
+#include "signaling_standin.h"
+
+static gint n_cameras = 10;
+static gint port = 8089;
+static const gchar *size = "640x320";
+static gint bitrate = 500;
+static gint flap_seconds = 0;
+static gint flap_count = 1;
+static gint report_seconds = 5;
+
+static GOptionEntry entries[] = {
+    {"cameras", 0, 0, G_OPTION_ARG_INT, &n_cameras,
+     "How many cameras to emulate (default: 10)", "N"},
+    {"port", 0, 0, G_OPTION_ARG_INT, &port,
+     "Port of the signaling stand-in on 127.0.0.1 (default: 8089)", "PORT"},
+    {"size", 0, 0, G_OPTION_ARG_STRING, &size,
+     "Size of each camera's video (default: 640x320)", "WxH"},
+    {"bitrate", 0, 0, G_OPTION_ARG_INT, &bitrate,
+     "Bitrate of each camera's video (default: 500)", "KBPS"},
+    {"flap", 0, 0, G_OPTION_ARG_INT, &flap_seconds,
+     "Every this often, drop cameras and bring them back a second later, 0 = never", "SECONDS"},
+    {"flap-count", 0, 0, G_OPTION_ARG_INT, &flap_count,
+     "How many cameras drop at once with --flap (default: 1)", "N"},
+    {"report", 0, 0, G_OPTION_ARG_INT, &report_seconds,
+     "Print the fleet's state this often (default: 5)", "SECONDS"},
+    {nullptr},
+};
+
+static GMainLoop *loop;
+static SignalingStandIn *signaling;
+static std::vector<CameraEmulator *> cameras;
+static std::mt19937 rng(1);
+
+static gboolean restart_camera(gpointer user_data)
+{
+    CameraEmulator *camera = (CameraEmulator *)user_data;
+
+    if (!camera->start())
+        g_printerr("%s didn't come back\n", camera->name());
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Drop some cameras, as a Wi-Fi outage or a power cut would, and bring
+ * them back a second later. The receivers see device-disconnected and then
+ * device-ready for each, all at once.
+ */
+static gboolean flap_cameras(gpointer user_data)
+{
+    std::vector<CameraEmulator *> ready;
+    for (CameraEmulator *camera : cameras)
+    {
+        if (camera->is_ready())
+            ready.push_back(camera);
+    }
+    std::shuffle(ready.begin(), ready.end(), rng);
+    if ((gint)ready.size() > flap_count)
+        ready.resize(flap_count);
+
+    g_print("Dropping %d camera(s)\n", (gint)ready.size());
+    for (CameraEmulator *camera : ready)
+    {
+        camera->stop();
+        g_timeout_add_seconds(1, restart_camera, camera);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean report(gpointer user_data)
+{
+    static guint64 last_received = 0, last_sent = 0;
+    gint ready = 0, in_call = 0;
+    guint calls = 0;
+
+    for (CameraEmulator *camera : cameras)
+    {
+        ready += camera->is_ready() ? 1 : 0;
+        in_call += camera->is_ready() && !camera->is_free() ? 1 : 0;
+        calls += camera->calls();
+    }
+    const guint64 received = signaling->events_received();
+    const guint64 sent = signaling->events_sent();
+    g_print("%d/%d cameras ready, %d in a call, %u offers answered; "
+            "signaling %.1f events/s in, %.1f out\n",
+            ready, (gint)cameras.size(), in_call, calls,
+            (double)(received - last_received) / report_seconds,
+            (double)(sent - last_sent) / report_seconds);
+    last_received = received;
+    last_sent = sent;
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_interrupt(gpointer user_data)
+{
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("- emulate many cameras");
+    GError *error = nullptr;
+    gint width, height;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (sscanf(size, "%dx%d", &width, &height) != 2 || width < 16 || height < 16 ||
+        n_cameras < 1 || port <= 0 || port > 65535 || bitrate < 1 ||
+        flap_seconds < 0 || flap_count < 1 || report_seconds < 1)
+    {
+        g_printerr("Invalid options, see --help\n");
+        return 1;
+    }
+
+    loop = g_main_loop_new(NULL, FALSE);
+    signaling = new SignalingStandIn();
+    if (!signaling->listen(port))
+        return 1;
+
+    for (gint i = 1; i <= n_cameras; i++)
+    {
+        gchar *name = g_strdup_printf("LiveSYNC Camera %d", i);
+        CameraEmulator *camera = new CameraEmulator(signaling, name, width, height,
+                                                    bitrate);
+        g_free(name);
+        signaling->add_camera(camera);
+        cameras.push_back(camera);
+        if (!camera->start())
+            return 1;
+    }
+    g_print("%d cameras, %dx%d at %d kbit/s, on ws://127.0.0.1:%d/socket.io/\n",
+            n_cameras, width, height, bitrate, port);
+
+    if (flap_seconds > 0)
+        g_timeout_add_seconds(flap_seconds, flap_cameras, NULL);
+    g_timeout_add_seconds(report_seconds, report, NULL);
+    g_unix_signal_add(SIGINT, on_interrupt, NULL);
+    g_unix_signal_add(SIGTERM, on_interrupt, NULL);
+    g_main_loop_run(loop);
+
+    for (CameraEmulator *camera : cameras)
+        delete camera;
+    delete signaling;
+    g_main_loop_unref(loop);
+    return 0;
+}
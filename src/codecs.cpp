@@ -0,0 +1,88 @@
+/*
+ * The video codecs we can receive: their RTP caps for the offer, and the
+ * elements that depayload, decode, record and (for benchmarks) encode them.
+ */
+
+#include "codecs.h"
+
+/**
+ * VP9 has no parser here: rtpvp9depay outputs whole frames with the
+ * keyframes marked, which is all vp9dec and webmmux need.
+ */
+static const VideoCodec video_codecs[] = {
+    {"VP8", 96, nullptr,
+     "rtpvp8depay", nullptr, "vp8dec", "threads", "webmmux", "webm",
+     "vp8enc deadline=1 cpu-used=8 end-usage=cbr target-bitrate=%u000"},
+    {"VP9", 98, nullptr,
+     "rtpvp9depay", nullptr, "vp9dec", "threads", "webmmux", "webm",
+     "vp9enc deadline=1 cpu-used=8 end-usage=cbr target-bitrate=%u000"},
+    {"H264", 102, "packetization-mode=(string)1,profile-level-id=(string)42e01f",
+     "rtph264depay", "h264parse", "avdec_h264", "max-threads", "matroskamux", "mkv",
+     "x264enc tune=zerolatency speed-preset=veryfast bitrate=%u"},
+};
+
+const VideoCodec *find_video_codec(const gchar *encoding_name)
+{
+    for (const VideoCodec &codec : video_codecs)
+    {
+        if (encoding_name && g_ascii_strcasecmp(codec.name, encoding_name) == 0)
+            return &codec;
+    }
+    return nullptr;
+}
+
+gboolean parse_codec_list(const gchar *list,
+                          std::vector<const VideoCodec *> *codecs)
+{
+    gchar **names = g_strsplit(list, ",", -1);
+    gboolean ok = TRUE;
+
+    codecs->clear();
+    for (gchar **name = names; *name && ok; name++)
+    {
+        const VideoCodec *codec = find_video_codec(g_strstrip(*name));
+        if (!codec)
+        {
+            g_printerr("Unknown codec %s, expected VP8, VP9 or H264\n", *name);
+            ok = FALSE;
+        }
+        else
+        {
+            for (const VideoCodec *other : *codecs)
+            {
+                if (other == codec)
+                {
+                    g_printerr("Codec %s is listed twice\n", codec->name);
+                    ok = FALSE;
+                }
+            }
+            codecs->push_back(codec);
+        }
+    }
+    g_strfreev(names);
+
+    if (ok && codecs->empty())
+    {
+        g_printerr("No codecs given\n");
+        ok = FALSE;
+    }
+    return ok;
+}
+
+GstCaps *create_codec_caps(const std::vector<const VideoCodec *> &codecs)
+{
+    GstCaps *caps = gst_caps_new_empty();
+
+    for (const VideoCodec *codec : codecs)
+    {
+        gchar *text = g_strdup_printf("application/x-rtp,media=video,encoding-name=%s,"
+                                      "payload=%u,clock-rate=90000%s%s",
+                                      codec->name, codec->payload_type,
+                                      codec->rtp_fields ? "," : "",
+                                      codec->rtp_fields ? codec->rtp_fields : "");
+        // Appended in order: webrtcbin offers them in the order of the caps.
+        gst_caps_append(caps, gst_caps_from_string(text));
+        g_free(text);
+    }
+    return caps;
+}
@@ -0,0 +1,42 @@
+/*
+ * The video codecs we can receive: their RTP caps for the offer, and the
+ * elements that depayload, decode, record and (for benchmarks) encode them.
+ */
+
+#ifndef LIVESYNC_CODECS_H
+#define LIVESYNC_CODECS_H
+
+#include <gst/gst.h>
+
+#include <vector>
+
+/**
+ * One video codec. Element names are GStreamer factory names; parse is
+ * nullptr when the depayloader's output can go straight to the decoder.
+ */
+struct VideoCodec
+{
+    const gchar *name;         /* RTP encoding-name, e.g. "VP8" */
+    guint payload_type;        /* in our offer, one per codec */
+    const gchar *rtp_fields;   /* extra RTP caps fields, or nullptr */
+    const gchar *depay;
+    const gchar *parse;
+    const gchar *dec;
+    const gchar *dec_threads;  /* decoder's thread count property */
+    const gchar *mux;          /* for recordings */
+    const gchar *extension;
+    const gchar *enc;          /* launch line with a %u for kbit/s */
+};
+
+/* The codec of an RTP encoding-name, case-insensitively, or nullptr. */
+const VideoCodec *find_video_codec(const gchar *encoding_name);
+
+/* Parse a comma-separated preference list like "VP9,VP8,H264". Returns
+ * FALSE, and prints why, on unknown or repeated codecs. */
+gboolean parse_codec_list(const gchar *list,
+                          std::vector<const VideoCodec *> *codecs);
+
+/* RTP caps offering the codecs in order of preference, one structure each. */
+GstCaps *create_codec_caps(const std::vector<const VideoCodec *> &codecs);
+
+#endif
@@ -0,0 +1,427 @@
+/*
+ * Camera control over a WebRTC data channel of the call: the commands go
+ * to the camera in a few bytes each, straight over the peer connection
+ * instead of through the SignalingServer, and the camera acknowledges them.
+ */
+
+#include "control_channel.h"
+#include "logger.h"
+
+#include <cstring>
+
+// After a command went unacknowledged, how long an unconfirmed channel is
+// left alone before a command tries it again, in microseconds.
+#define CONTROL_RETRY_INTERVAL (5 * G_USEC_PER_SEC)
+
+const gchar *const control_transport_names[CONTROL_TRANSPORTS] = {
+    "signaling",
+    "data channel",
+};
+
+// The opcodes are the index in this table; 0 isn't used.
+static const gchar *const control_ops[] = {
+    nullptr, "pan-vector", "pan-tilt", "zoom-delta", "projection", "up",
+    "down", "left", "right", "zoom-in", "zoom-out",
+};
+#define CONTROL_OPS (sizeof(control_ops) / sizeof(control_ops[0]))
+
+static const gchar *const projection_types[] = {"equirectangular", "rectilinear"};
+
+enum Payload
+{
+    PAYLOAD_NONE,
+    PAYLOAD_VECTOR,
+    PAYLOAD_VALUE,
+    PAYLOAD_TYPE
+};
+
+static Payload payload_of(guint8 opcode)
+{
+    switch (opcode)
+    {
+    case 1:
+    case 2:
+        return PAYLOAD_VECTOR;
+    case 3:
+        return PAYLOAD_VALUE;
+    case 4:
+        return PAYLOAD_TYPE;
+    default:
+        return PAYLOAD_NONE;
+    }
+}
+
+static void put_float(guint8 *out, double value)
+{
+    float f = (float)value;
+    guint32 bits;
+
+    memcpy(&bits, &f, sizeof(bits));
+    bits = GUINT32_TO_LE(bits);
+    memcpy(out, &bits, sizeof(bits));
+}
+
+static double get_float(const guint8 *in)
+{
+    guint32 bits;
+    float f;
+
+    memcpy(&bits, in, sizeof(bits));
+    bits = GUINT32_FROM_LE(bits);
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+gsize encode_camera_command(const CameraCommand &command, guint16 sequence,
+                            guint8 message[CONTROL_MESSAGE_MAX])
+{
+    guint8 opcode = 0;
+    gsize size = 4;
+
+    for (guint8 i = 1; i < CONTROL_OPS; i++)
+    {
+        if (g_strcmp0(command.op, control_ops[i]) == 0)
+            opcode = i;
+    }
+    if (!opcode)
+        return 0;
+
+    message[0] = opcode;
+    message[1] = 0;
+    message[2] = sequence & 0xff;
+    message[3] = sequence >> 8;
+    switch (payload_of(opcode))
+    {
+    case PAYLOAD_VECTOR:
+        put_float(message + 4, command.x);
+        put_float(message + 8, command.y);
+        size += 8;
+        break;
+    case PAYLOAD_VALUE:
+        put_float(message + 4, command.value);
+        size += 4;
+        break;
+    case PAYLOAD_TYPE:
+        if (g_strcmp0(command.type, projection_types[0]) == 0)
+            message[4] = 0;
+        else if (g_strcmp0(command.type, projection_types[1]) == 0)
+            message[4] = 1;
+        else
+            return 0;
+        size += 1;
+        break;
+    case PAYLOAD_NONE:
+        break;
+    }
+    return size;
+}
+
+gboolean decode_camera_command(const guint8 *message, gsize size,
+                               CameraCommand *command, guint16 *sequence,
+                               guint8 *flags)
+{
+    if (size < 4 || message[0] == 0 || message[0] >= CONTROL_OPS)
+        return FALSE;
+
+    *command = CameraCommand{control_ops[message[0]], nullptr, 0, 0, 0};
+    *flags = message[1];
+    *sequence = message[2] | (message[3] << 8);
+    if (*flags & CONTROL_FLAG_ACK)
+        return size == 4;
+
+    switch (payload_of(message[0]))
+    {
+    case PAYLOAD_VECTOR:
+        if (size != 12)
+            return FALSE;
+        command->x = get_float(message + 4);
+        command->y = get_float(message + 8);
+        break;
+    case PAYLOAD_VALUE:
+        if (size != 8)
+            return FALSE;
+        command->value = get_float(message + 4);
+        break;
+    case PAYLOAD_TYPE:
+        if (size != 5 || message[4] > 1)
+            return FALSE;
+        command->type = projection_types[message[4]];
+        break;
+    case PAYLOAD_NONE:
+        if (size != 4)
+            return FALSE;
+        break;
+    }
+    return TRUE;
+}
+
+gsize encode_control_ack(const guint8 *message, guint8 ack[CONTROL_MESSAGE_MAX])
+{
+    memcpy(ack, message, 4);
+    ack[1] |= CONTROL_FLAG_ACK;
+    return 4;
+}
+
+/**
+ * Ordered and reliable: a lost or overtaken pan velocity would leave the
+ * camera moving, and the steps are relative. The commands are small, so
+ * retransmissions are quick.
+ */
+GObject *create_control_channel(GstElement *webrtc)
+{
+    GObject *channel = nullptr;
+    GstStructure *options;
+
+    options = gst_structure_new("application/data-channel",
+                                "negotiated", G_TYPE_BOOLEAN, TRUE,
+                                "id", G_TYPE_INT, CONTROL_CHANNEL_ID,
+                                "ordered", G_TYPE_BOOLEAN, TRUE,
+                                NULL);
+    g_signal_emit_by_name(webrtc, "create-data-channel", CONTROL_CHANNEL_LABEL,
+                          options, &channel);
+    gst_structure_free(options);
+    return channel;
+}
+
+ControlChannel::ControlChannel(ResendFunc resend, gpointer user_data)
+    : resend(resend), user_data(user_data), channel(nullptr), open(FALSE),
+      confirmed(FALSE), next_sequence(0), answered(FALSE), check_source(0),
+      retry_time(0), count_sent(0), count_acknowledged(0), count_resent(0)
+{
+}
+
+ControlChannel::~ControlChannel()
+{
+    detach();
+}
+
+gboolean ControlChannel::attach(GstElement *webrtc)
+{
+    detach();
+    channel = create_control_channel(webrtc);
+    if (!channel)
+        return FALSE;
+
+    g_signal_connect(channel, "on-open", G_CALLBACK(on_open), this);
+    g_signal_connect(channel, "on-close", G_CALLBACK(on_close), this);
+    g_signal_connect(channel, "on-error", G_CALLBACK(on_error), this);
+    g_signal_connect(channel, "on-message-data", G_CALLBACK(on_message_data), this);
+    return TRUE;
+}
+
+void ControlChannel::detach()
+{
+    open = FALSE;
+    confirmed = FALSE;
+    retry_time = 0;
+    if (check_source)
+    {
+        g_source_remove(check_source);
+        check_source = 0;
+    }
+    {
+        std::lock_guard<std::mutex> guard(pending_lock);
+        pending.clear();
+        answered = FALSE;
+    }
+    if (!channel)
+        return;
+
+    g_signal_handlers_disconnect_by_data(channel, this);
+    g_object_unref(channel);
+    channel = nullptr;
+}
+
+gboolean ControlChannel::send(const CameraCommand &command)
+{
+    Pending sending;
+    gint64 now = g_get_monotonic_time();
+
+    if (!open || !channel)
+        return FALSE;
+    sending.size = encode_camera_command(command, next_sequence, sending.message);
+    if (!sending.size)
+        return FALSE;
+
+    std::lock_guard<std::mutex> guard(pending_lock);
+    sending.held = FALSE;
+    if (!confirmed)
+    {
+        if (now < retry_time)
+            return FALSE;
+        // One command tries the channel. Those after it wait behind it:
+        // through the SignalingServer they could overtake it.
+        sending.held = !pending.empty();
+    }
+    sending.sequence = next_sequence++;
+    sending.sent_time = now;
+    sending.op = command.op;
+    sending.type = command.type ? command.type : "";
+    sending.x = command.x;
+    sending.y = command.y;
+    sending.value = command.value;
+    pending.push_back(sending);
+    count_sent++;
+    if (!sending.held)
+        send_data(sending);
+    if (!check_source)
+        check_source = g_timeout_add(CONTROL_ACK_TIMEOUT_MS / 5, on_check, this);
+    return TRUE;
+}
+
+/**
+ * With pending_lock held, so that the channel gets the commands in order.
+ */
+void ControlChannel::send_data(const Pending &command)
+{
+    GBytes *bytes = g_bytes_new(command.message, command.size);
+    g_signal_emit_by_name(channel, "send-data", bytes);
+    g_bytes_unref(bytes);
+}
+
+/**
+ * On the main loop while commands wait for their acknowledgement. When
+ * the oldest has waited too long, the channel can't be relied on: it and
+ * those after it, which the ordered channel holds up behind it, are
+ * resent in order. If the camera never acknowledged a command in this
+ * call, it doesn't speak the channel, and it isn't tried again.
+ */
+gboolean ControlChannel::on_check(gpointer user_data)
+{
+    ControlChannel *self = (ControlChannel *)user_data;
+    gint64 now = g_get_monotonic_time();
+    std::deque<Pending> expired;
+    gboolean answered;
+
+    {
+        std::lock_guard<std::mutex> guard(self->pending_lock);
+        if (!self->pending.empty() &&
+            now - self->pending.front().sent_time < CONTROL_ACK_TIMEOUT_MS * 1000)
+            return G_SOURCE_CONTINUE;
+        expired.swap(self->pending);
+        answered = self->answered;
+        // Under the lock, so that a late acknowledgement can't confirm
+        // the channel again after this.
+        if (!expired.empty() && self->confirmed.exchange(FALSE))
+            LOG_WARNING(LOG_WEBRTC, "Control channel: no acknowledgement in %d ms, camera commands go through the SignalingServer",
+                        CONTROL_ACK_TIMEOUT_MS);
+    }
+    self->check_source = 0;
+    if (expired.empty())
+        return G_SOURCE_REMOVE;
+
+    if (answered)
+    {
+        self->retry_time = now + CONTROL_RETRY_INTERVAL;
+    }
+    else
+    {
+        LOG_INFO(LOG_WEBRTC, "Control channel: the camera doesn't acknowledge commands, they go through the SignalingServer");
+        self->retry_time = G_MAXINT64;
+    }
+    self->count_resent += expired.size();
+    LOG_DEBUG(LOG_WEBRTC, "Control channel: resending %zu commands through the SignalingServer",
+              expired.size());
+    for (const Pending &command : expired)
+    {
+        CameraCommand resent = {command.op.c_str(),
+                                command.type.empty() ? nullptr : command.type.c_str(),
+                                command.x, command.y, command.value};
+        self->resend(resent, self->user_data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void ControlChannel::on_open(GObject *channel, gpointer user_data)
+{
+    ControlChannel *self = (ControlChannel *)user_data;
+
+    LOG_INFO(LOG_WEBRTC, "Control channel open, waiting for the camera to acknowledge a command on it");
+    self->open = TRUE;
+}
+
+void ControlChannel::on_close(GObject *channel, gpointer user_data)
+{
+    ControlChannel *self = (ControlChannel *)user_data;
+
+    self->open = FALSE;
+    if (self->confirmed.exchange(FALSE))
+        LOG_INFO(LOG_WEBRTC, "Control channel closed, camera commands go through the SignalingServer");
+}
+
+void ControlChannel::on_error(GObject *channel, GError *error, gpointer user_data)
+{
+    ControlChannel *self = (ControlChannel *)user_data;
+
+    LOG_WARNING(LOG_WEBRTC, "Control channel error: %s, camera commands go through the SignalingServer",
+                error ? error->message : "unknown");
+    self->open = FALSE;
+    self->confirmed = FALSE;
+}
+
+/**
+ * An acknowledgement from the camera. The first one confirms the channel.
+ */
+void ControlChannel::on_message_data(GObject *channel, GBytes *data,
+                                     gpointer user_data)
+{
+    ControlChannel *self = (ControlChannel *)user_data;
+    CameraCommand command;
+    guint16 sequence;
+    guint8 flags;
+    gsize size;
+    const guint8 *message = (const guint8 *)g_bytes_get_data(data, &size);
+    gint64 sent = 0;
+
+    if (!decode_camera_command(message, size, &command, &sequence, &flags) ||
+        !(flags & CONTROL_FLAG_ACK))
+    {
+        LOG_DEBUG(LOG_WEBRTC, "Control channel: ignoring a message of %zu bytes", size);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(self->pending_lock);
+        for (auto it = self->pending.begin(); it != self->pending.end(); ++it)
+        {
+            if (it->sequence != sequence || it->held)
+                continue;
+            sent = it->sent_time;
+            self->pending.erase(it);
+            break;
+        }
+        // Too late: the command was resent already.
+        if (!sent)
+            return;
+        self->answered = TRUE;
+        if (self->open && !self->confirmed.exchange(TRUE))
+        {
+            LOG_INFO(LOG_WEBRTC, "Control channel acknowledged, camera commands go over it");
+            for (Pending &command : self->pending)
+            {
+                if (!command.held)
+                    continue;
+                command.held = FALSE;
+                command.sent_time = g_get_monotonic_time();
+                self->send_data(command);
+            }
+        }
+    }
+
+    double ms = (g_get_monotonic_time() - sent) / 1000.0;
+    self->window.record(ms);
+    self->lifetime.record(ms);
+    self->count_acknowledged++;
+}
+
+LatencySummary ControlChannel::take_window()
+{
+    LatencySummary summary = window.summarize();
+    window.reset();
+    return summary;
+}
+
+LatencySummary ControlChannel::total() const
+{
+    return lifetime.summarize();
+}
@@ -0,0 +1,158 @@
+/*
+ * Camera control over a WebRTC data channel of the call: the commands go
+ * to the camera in a few bytes each, straight over the peer connection
+ * instead of through the SignalingServer, and the camera acknowledges them.
+ */
+
+#ifndef LIVESYNC_CONTROL_CHANNEL_H
+#define LIVESYNC_CONTROL_CHANNEL_H
+
+#include "camera_control.h"
+#include "latency.h"
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+
+/**
+ * The ways a command can take to the camera.
+ */
+enum ControlTransport
+{
+    CONTROL_SIGNALING,
+    CONTROL_DATA_CHANNEL,
+    CONTROL_TRANSPORTS
+};
+
+extern const gchar *const control_transport_names[CONTROL_TRANSPORTS];
+
+/* The channel is negotiated out of band: both ends create it with this id
+ * and label before the offer, and there is no in-band open handshake. */
+#define CONTROL_CHANNEL_ID 1
+#define CONTROL_CHANNEL_LABEL "control"
+
+/* Wire format of a command, little-endian:
+ *   u8 opcode, u8 flags, u16 sequence, then by opcode
+ *   pan-vector, pan-tilt: f32 x, f32 y
+ *   zoom-delta:           f32 value
+ *   projection:           u8 type, 0 = equirectangular, 1 = rectilinear
+ *   others:               nothing
+ * The camera acknowledges a command by sending its first four bytes back
+ * with CONTROL_FLAG_ACK set. */
+#define CONTROL_MESSAGE_MAX 12
+#define CONTROL_FLAG_ACK 0x01
+
+/* A command the camera hasn't acknowledged in this long, in ms, is sent
+ * again through the SignalingServer. */
+#define CONTROL_ACK_TIMEOUT_MS 500
+
+/* Returns the size of the message, 0 if the command can't be encoded. */
+gsize encode_camera_command(const CameraCommand &command, guint16 sequence,
+                            guint8 message[CONTROL_MESSAGE_MAX]);
+
+/* Returns FALSE if the message isn't one. The strings of the command are
+ * static. */
+gboolean decode_camera_command(const guint8 *message, gsize size,
+                               CameraCommand *command, guint16 *sequence,
+                               guint8 *flags);
+
+/* Acknowledge a message from decode_camera_command(): returns its size. */
+gsize encode_control_ack(const guint8 *message, guint8 ack[CONTROL_MESSAGE_MAX]);
+
+/* Create the control channel on a webrtcbin, for either end of the call.
+ * Returns the channel (a reference), or nullptr without SCTP support. */
+GObject *create_control_channel(GstElement *webrtc);
+
+/**
+ * The receiver's end of the control channel of one camera, over its calls.
+ * The channel is negotiated, so it opens as soon as SCTP is up whether or
+ * not the camera speaks it: commands only go over it once the camera has
+ * acknowledged one. Until then a single command tries the channel, with
+ * those after it held back behind it. A command that isn't acknowledged in
+ * time is handed back to be resent, with those after it, and the channel
+ * has to be acknowledged again, or is given up on for the call if it never
+ * was. Sends on the main loop, and the held commands on the
+ * acknowledgement, which like the channel's signals comes on webrtcbin's
+ * threads. Times each command until it is acknowledged.
+ */
+class ControlChannel
+{
+public:
+    typedef void (*ResendFunc)(const CameraCommand &command, gpointer user_data);
+
+    /* resend: on the main loop, for each command that went unacknowledged. */
+    ControlChannel(ResendFunc resend, gpointer user_data);
+    ~ControlChannel();
+
+    /* Open the channel on a new call's webrtcbin, before the offer.
+     * Returns FALSE if it can't be created. */
+    gboolean attach(GstElement *webrtc);
+
+    /* The call ends: let go of the channel, and of the commands waiting
+     * for an acknowledgement. */
+    void detach();
+
+    gboolean is_open() const { return open; }
+
+    /* Open, and the camera acknowledged a command on it. */
+    gboolean is_confirmed() const { return confirmed; }
+
+    /* Returns FALSE if the command isn't for the channel: it isn't open or
+     * is given up on for now, or the command has no binary form. */
+    gboolean send(const CameraCommand &command);
+
+    /* Percentiles of the time to the acknowledgement, in ms, since the
+     * previous call and since the start. */
+    LatencySummary take_window();
+    LatencySummary total() const;
+
+    /* Commands sent, acknowledged, and handed back to be resent, so far. */
+    guint64 sent() const { return count_sent; }
+    guint64 acknowledged() const { return count_acknowledged; }
+    guint64 resent() const { return count_resent; }
+
+private:
+    ControlChannel(const ControlChannel &) = delete;
+    ControlChannel &operator=(const ControlChannel &) = delete;
+
+    /* A command sent, with its strings, until it is acknowledged. */
+    struct Pending
+    {
+        guint16 sequence;
+        gint64 sent_time;
+        gboolean held; /* not sent yet, behind the command trying the channel */
+        guint8 message[CONTROL_MESSAGE_MAX];
+        gsize size;
+        std::string op;
+        std::string type;
+        double x, y, value;
+    };
+
+    static void on_open(GObject *channel, gpointer user_data);
+    static void on_close(GObject *channel, gpointer user_data);
+    static void on_error(GObject *channel, GError *error, gpointer user_data);
+    static void on_message_data(GObject *channel, GBytes *data, gpointer user_data);
+    static gboolean on_check(gpointer user_data);
+    void send_data(const Pending &command);
+
+    ResendFunc resend;
+    gpointer user_data;
+    GObject *channel;
+    std::atomic<gboolean> open;
+    std::atomic<gboolean> confirmed;
+    guint16 next_sequence;
+    std::mutex pending_lock;
+    std::deque<Pending> pending; /* in the order sent */
+    gboolean answered;           /* a command was acknowledged in this call */
+    guint check_source;          /* while commands are pending */
+    gint64 retry_time;           /* don't try an unconfirmed channel before */
+    std::atomic<guint64> count_sent;
+    std::atomic<guint64> count_acknowledged;
+    guint64 count_resent;
+    LatencyHistogram window, lifetime;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Fixed-size in-memory ring of encoded video frames, for pre-event
+ * recording: keeps the last seconds of video so that a recording started by
+ * a trigger can begin before the trigger.
+ */
+
+#include "encoded_ring.h"
+
+#include <cstring>
+
+EncodedRing::EncodedRing(size_t capacity_bytes, size_t max_frames,
+                         int64_t max_age)
+    : arena(capacity_bytes), slots(max_frames > 0 ? max_frames : 1),
+      max_age(max_age), head(0), count(0), keyframe_count(0), write_pos(0),
+      used_bytes(0), evicted(0)
+{
+}
+
+void EncodedRing::clear()
+{
+    evicted += count;
+    head = 0;
+    count = 0;
+    keyframe_count = 0;
+    write_pos = 0;
+    used_bytes = 0;
+}
+
+int64_t EncodedRing::span() const
+{
+    if (count < 2 || slot(0).info.pts < 0 || slot(count - 1).info.pts < 0)
+        return 0;
+    return slot(count - 1).info.pts - slot(0).info.pts;
+}
+
+const uint8_t *EncodedRing::frame_data(size_t i) const
+{
+    return arena.data() + slot(i).offset;
+}
+
+const EncodedFrameInfo &EncodedRing::frame_info(size_t i) const
+{
+    return slot(i).info;
+}
+
+size_t EncodedRing::frame_size(size_t i) const
+{
+    return slot(i).size;
+}
+
+/**
+ * Find a contiguous free range for a frame. Frames are stored in order
+ * around the arena; a frame that doesn't fit before the end of the arena
+ * starts over at offset 0, leaving the tail unused for one lap.
+ */
+bool EncodedRing::find_space(size_t size, size_t *offset) const
+{
+    if (count == 0)
+    {
+        *offset = 0;
+        return size <= arena.size();
+    }
+
+    const size_t oldest = slot(0).offset;
+    if (write_pos > oldest)
+    {
+        // Not wrapped: free space after the newest and before the oldest.
+        if (write_pos + size <= arena.size())
+        {
+            *offset = write_pos;
+            return true;
+        }
+        *offset = 0;
+        return size <= oldest;
+    }
+
+    // Wrapped: free space is between the newest and the oldest.
+    *offset = write_pos;
+    return write_pos + size <= oldest;
+}
+
+/**
+ * Drop the oldest keyframe and the delta frames depending on it.
+ */
+void EncodedRing::evict_gop()
+{
+    do
+    {
+        const Slot &s = slot(0);
+        used_bytes -= s.size;
+        if (s.info.keyframe)
+            keyframe_count--;
+        head = (head + 1) % slots.size();
+        count--;
+        evicted++;
+    } while (count > 0 && !slot(0).info.keyframe);
+
+    if (count == 0)
+        clear();
+}
+
+bool EncodedRing::push(const uint8_t *data, size_t size,
+                       const EncodedFrameInfo &info)
+{
+    size_t offset;
+
+    if (size == 0 || size > arena.size() || (count == 0 && !info.keyframe))
+        return false;
+
+    // Keep at most max_age, but always the newest GOP.
+    while (keyframe_count > 1 && info.pts >= 0 && slot(0).info.pts >= 0 &&
+           info.pts - slot(0).info.pts > max_age)
+        evict_gop();
+
+    while (count == slots.size() || !find_space(size, &offset))
+    {
+        evict_gop();
+        // A GOP that doesn't fit the whole ring can't be kept.
+        if (count == 0 && !info.keyframe)
+            return false;
+    }
+
+    memcpy(arena.data() + offset, data, size);
+    slots[(head + count) % slots.size()] = {offset, size, info};
+    count++;
+    if (info.keyframe)
+        keyframe_count++;
+    write_pos = offset + size;
+    used_bytes += size;
+    return true;
+}
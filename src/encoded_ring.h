@@ -0,0 +1,87 @@
+/*
+ * Fixed-size in-memory ring of encoded video frames, for pre-event
+ * recording: keeps the last seconds of video so that a recording started by
+ * a trigger can begin before the trigger.
+ */
+
+#ifndef LIVESYNC_ENCODED_RING_H
+#define LIVESYNC_ENCODED_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Timing and flags of one encoded frame. Times are in nanoseconds, -1 if
+ * unknown.
+ */
+struct EncodedFrameInfo
+{
+    int64_t pts;
+    int64_t dts;
+    int64_t duration;
+    bool keyframe;
+};
+
+/**
+ * All memory is allocated up front: frame data goes into one byte arena,
+ * frame descriptors into a fixed array, so pushing a frame never allocates.
+ *
+ * The oldest frames are evicted when the arena or the descriptor array is
+ * full, or when they're older than max_age. Eviction is done a whole GOP at
+ * a time, so the ring always starts at a keyframe and can be written out as
+ * a playable stream. Delta frames before the first keyframe are dropped.
+ *
+ * Not thread safe.
+ */
+class EncodedRing
+{
+public:
+    EncodedRing(size_t capacity_bytes, size_t max_frames, int64_t max_age);
+
+    /* Append a frame. Returns false (and drops it) if it can't be stored:
+     * bigger than the whole arena, or a delta frame with no keyframe. */
+    bool push(const uint8_t *data, size_t size, const EncodedFrameInfo &info);
+
+    /* Number of frames, keyframes, bytes stored and the time they span. */
+    size_t frames() const { return count; }
+    size_t keyframes() const { return keyframe_count; }
+    size_t bytes() const { return used_bytes; }
+    int64_t span() const;
+
+    /* Frames are numbered in the order they were pushed: frame i has the
+     * number first_number() + i, which stays the same as older frames are
+     * evicted. */
+    uint64_t first_number() const { return evicted; }
+
+    /* Frame i (0 = oldest, always a keyframe) of frames(). */
+    const uint8_t *frame_data(size_t i) const;
+    const EncodedFrameInfo &frame_info(size_t i) const;
+    size_t frame_size(size_t i) const;
+
+    void clear();
+
+private:
+    struct Slot
+    {
+        size_t offset;
+        size_t size;
+        EncodedFrameInfo info;
+    };
+
+    const Slot &slot(size_t i) const { return slots[(head + i) % slots.size()]; }
+    bool find_space(size_t size, size_t *offset) const;
+    void evict_gop();
+
+    std::vector<uint8_t> arena;
+    std::vector<Slot> slots;
+    int64_t max_age;
+    size_t head;        // index of the oldest slot
+    size_t count;
+    size_t keyframe_count;
+    size_t write_pos;   // arena offset just after the newest frame
+    size_t used_bytes;
+    uint64_t evicted;   // frames ever evicted or cleared
+};
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * Pre-event recording: keeps the last seconds of the camera's encoded video
+ * in memory, and writes them to disk followed by the live video when an
+ * event is triggered.
+ */
+
+#include "event_recorder.h"
+#include "logger.h"
+#include "recorder.h"
+
+#include <atomic>
+#include <initializer_list>
+
+// Upper bound of the frame rate, for sizing the frame descriptors.
+#define MAX_FPS 120
+
+// Event files whose pipelines haven't been released yet.
+static std::atomic<guint> writers_closing(0);
+
+static gint64 to_ring_time(GstClockTime t)
+{
+    return GST_CLOCK_TIME_IS_VALID(t) ? (gint64)t : -1;
+}
+
+/**
+ * Timestamps in the event file start from zero at its first frame.
+ */
+static GstClockTime rebase(GstClockTime t, GstClockTime base)
+{
+    if (!GST_CLOCK_TIME_IS_VALID(t))
+        return GST_CLOCK_TIME_NONE;
+    return t > base ? t - base : 0;
+}
+
+EventRecorder *EventRecorder::create(const gchar *encoding_name,
+                                     const gchar *directory, const gchar *prefix,
+                                     GstClockTime pre_time, gsize capacity_bytes,
+                                     GstClockTime post_time)
+{
+    RecordingElements names;
+    GstElement *bin, *q, *depay, *parse = nullptr, *sink;
+    GstPad *pad;
+
+    if (!get_recording_elements(encoding_name, &names))
+    {
+        LOG_ERROR(LOG_MEDIA, "Can't record %s video", encoding_name);
+        return nullptr;
+    }
+
+    q = gst_element_factory_make("queue", NULL);
+    depay = gst_element_factory_make(names.depay, NULL);
+    if (names.parse)
+        parse = gst_element_factory_make(names.parse, NULL);
+    sink = gst_element_factory_make("appsink", NULL);
+    if (!q || !depay || (names.parse && !parse) || !sink)
+    {
+        LOG_ERROR(LOG_MEDIA, "Missing plugins for recording %s video, need %s%s%s",
+                  encoding_name, names.depay, names.parse ? " and " : "",
+                  names.parse ? names.parse : "");
+        for (GstElement *e : {q, depay, parse, sink})
+        {
+            if (e)
+                gst_object_unref(gst_object_ref_sink(e));
+        }
+        return nullptr;
+    }
+
+    g_object_set(q, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", GST_SECOND, NULL);
+    g_object_set(sink, "sync", FALSE, "enable-last-sample", FALSE, NULL);
+    if (parse)
+    {
+        // Matroska wants avc, one access unit per buffer.
+        GstCaps *caps = gst_caps_from_string("video/x-h264,stream-format=avc,alignment=au");
+        g_object_set(sink, "caps", caps, NULL);
+        gst_caps_unref(caps);
+    }
+
+    bin = gst_bin_new(NULL);
+    gst_object_ref_sink(bin);
+    gst_bin_add_many(GST_BIN(bin), q, depay, sink, NULL);
+    if (parse)
+    {
+        gst_bin_add(GST_BIN(bin), parse);
+        gst_element_link_many(q, depay, parse, sink, NULL);
+    }
+    else
+    {
+        gst_element_link_many(q, depay, sink, NULL);
+    }
+
+    pad = gst_element_get_static_pad(q, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+
+    EventRecorder *recorder = new EventRecorder(bin, names.mux,
+                                                names.extension, directory,
+                                                prefix, pre_time,
+                                                capacity_bytes, post_time);
+
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, recorder, NULL);
+
+    LOG_INFO(LOG_MEDIA, "Keeping the last %" GST_TIME_FORMAT " (at most %" G_GSIZE_FORMAT
+             " MiB) of video for events, written to %s",
+             GST_TIME_ARGS(pre_time), capacity_bytes / (1024 * 1024), directory);
+    return recorder;
+}
+
+EventRecorder::EventRecorder(GstElement *bin, const gchar *mux_name,
+                             const gchar *extension,
+                             const gchar *directory, const gchar *prefix,
+                             GstClockTime pre_time, gsize capacity_bytes,
+                             GstClockTime post_time)
+    : bin(bin), mux_name(mux_name), extension(extension),
+      directory(directory), prefix(prefix), post_time(post_time),
+      ring(capacity_bytes, (pre_time / GST_SECOND + 2) * MAX_FPS,
+           (gint64)pre_time),
+      caps(nullptr), writer(nullptr), base_time(0),
+      last_time(GST_CLOCK_TIME_NONE), stop_time(GST_CLOCK_TIME_NONE),
+      ring_next(0), live(FALSE), cancelled(FALSE)
+{
+}
+
+EventRecorder::~EventRecorder()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cancelled = TRUE;
+    }
+    if (ring_writer.joinable())
+        ring_writer.join();
+
+    // The camera's pipeline has stopped, so finish the file right away.
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (writer)
+            stop_writer();
+    }
+
+    if (caps)
+        gst_caps_unref(caps);
+    gst_object_unref(bin);
+}
+
+/**
+ * Called on the streaming thread for every encoded frame.
+ */
+GstFlowReturn EventRecorder::on_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    EventRecorder *self = (EventRecorder *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+
+    if (!sample)
+        return GST_FLOW_EOS;
+
+    self->add_frame(sample);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void EventRecorder::add_frame(GstSample *sample)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstCaps *sample_caps = gst_sample_get_caps(sample);
+    GstMapInfo map;
+    EncodedFrameInfo info;
+
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return;
+
+    info.pts = to_ring_time(GST_BUFFER_PTS(buffer));
+    info.dts = to_ring_time(GST_BUFFER_DTS(buffer));
+    info.duration = to_ring_time(GST_BUFFER_DURATION(buffer));
+    info.keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (sample_caps && (!caps || !gst_caps_is_equal(caps, sample_caps)))
+        gst_caps_replace(&caps, sample_caps);
+
+    // Copied into the preallocated arena, no allocation per frame.
+    ring.push(map.data, map.size, info);
+    gst_buffer_unmap(buffer, &map);
+
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+        last_time = GST_BUFFER_PTS(buffer);
+
+    if (writer && live)
+    {
+        write(buffer);
+        if (GST_CLOCK_TIME_IS_VALID(last_time) && last_time >= stop_time)
+            stop_writer();
+    }
+}
+
+void EventRecorder::trigger()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (!GST_CLOCK_TIME_IS_VALID(last_time))
+    {
+        LOG_INFO(LOG_MEDIA, "No video to record yet");
+        return;
+    }
+
+    stop_time = last_time + post_time;
+    if (writer)
+    {
+        LOG_INFO(LOG_MEDIA, "Event recording extended");
+        return;
+    }
+    if (ring.frames() == 0)
+    {
+        LOG_INFO(LOG_MEDIA, "No keyframe received yet, can't start an event recording");
+        return;
+    }
+    start_writer();
+}
+
+/**
+ * Create the event file's pipeline, and start writing the ring into it.
+ * Called with the lock held.
+ */
+void EventRecorder::start_writer()
+{
+    GstElement *src, *mux, *filesink;
+    GDateTime *now = g_date_time_new_now_local();
+    gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    gchar *location = g_strdup_printf("%s/%s-event-%s.%s", directory.c_str(),
+                                      prefix.c_str(), stamp, extension.c_str());
+    g_free(stamp);
+    g_date_time_unref(now);
+
+    writer = gst_pipeline_new(NULL);
+    src = gst_element_factory_make("appsrc", "src");
+    mux = gst_element_factory_make(mux_name.c_str(), NULL);
+    filesink = gst_element_factory_make("filesink", NULL);
+    g_assert_nonnull(src);
+    g_assert_nonnull(mux);
+    g_assert_nonnull(filesink);
+
+    // Unlimited queue, so that writing the ring all at once neither blocks
+    // nor drops.
+    g_object_set(src, "caps", caps, "format", GST_FORMAT_TIME, "is-live", FALSE,
+                 "max-bytes", (guint64)0, NULL);
+    g_object_set(filesink, "location", location, NULL);
+    gst_bin_add_many(GST_BIN(writer), src, mux, filesink, NULL);
+    gst_element_link_many(src, mux, filesink, NULL);
+    gst_element_set_state(writer, GST_STATE_PLAYING);
+
+    const EncodedFrameInfo &first = ring.frame_info(0);
+    base_time = first.dts >= 0 ? (GstClockTime)first.dts : (GstClockTime)first.pts;
+
+    LOG_INFO(LOG_MEDIA, "Event recording to %s, starting %" GST_TIME_FORMAT " before the trigger",
+             location, GST_TIME_ARGS(ring.span()));
+    g_free(location);
+
+    // Done with the previous file, if any.
+    if (ring_writer.joinable())
+        ring_writer.join();
+    ring_next = ring.first_number();
+    live = FALSE;
+    ring_writer = std::thread(&EventRecorder::write_ring, this,
+                              (GstElement *)gst_object_ref(src));
+}
+
+/**
+ * Frame i of the ring, for the event file. The only copies are made here,
+ * when an event happens. Called with the lock held.
+ */
+GstBuffer *EventRecorder::ring_buffer(size_t i) const
+{
+    const EncodedFrameInfo &info = ring.frame_info(i);
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, ring.frame_size(i), NULL);
+
+    gst_buffer_fill(buffer, 0, ring.frame_data(i), ring.frame_size(i));
+    GST_BUFFER_PTS(buffer) = rebase(info.pts >= 0 ? info.pts : GST_CLOCK_TIME_NONE, base_time);
+    GST_BUFFER_DTS(buffer) = rebase(info.dts >= 0 ? info.dts : GST_CLOCK_TIME_NONE, base_time);
+    GST_BUFFER_DURATION(buffer) = info.duration >= 0 ? info.duration : GST_CLOCK_TIME_NONE;
+    if (!info.keyframe)
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    return buffer;
+}
+
+/**
+ * Copy the ring into the event file, holding the lock for one frame at a
+ * time, until it has caught up with the newest frame; from then on the live
+ * frames go in from the streaming thread. On its own thread.
+ */
+void EventRecorder::write_ring(GstElement *src)
+{
+    guint64 lost = 0;
+
+    for (;;)
+    {
+        GstBuffer *buffer;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (cancelled)
+                break;
+            // Frames evicted before we got to them are lost, but the ring
+            // still starts at a keyframe.
+            if (ring_next < ring.first_number())
+            {
+                lost += ring.first_number() - ring_next;
+                ring_next = ring.first_number();
+            }
+            if (ring_next == ring.first_number() + ring.frames())
+            {
+                live = TRUE;
+                if (GST_CLOCK_TIME_IS_VALID(last_time) && last_time >= stop_time)
+                    stop_writer();
+                break;
+            }
+            buffer = ring_buffer(ring_next - ring.first_number());
+            ring_next++;
+        }
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+    }
+
+    if (lost > 0)
+        LOG_WARNING(LOG_MEDIA, "Event recording: %" G_GUINT64_FORMAT
+                    " frames left the ring before they were written", lost);
+    gst_object_unref(src);
+}
+
+/**
+ * Append a live frame to the event file. Called with the lock held.
+ */
+void EventRecorder::write(GstBuffer *buffer)
+{
+    GstElement *src = gst_bin_get_by_name(GST_BIN(writer), "src");
+
+    // Shares the memory, only the timestamps are our own.
+    buffer = gst_buffer_copy(buffer);
+    GST_BUFFER_PTS(buffer) = rebase(GST_BUFFER_PTS(buffer), base_time);
+    GST_BUFFER_DTS(buffer) = rebase(GST_BUFFER_DTS(buffer), base_time);
+    gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+    gst_object_unref(src);
+}
+
+/**
+ * End the event file; the pipeline is closed on the main loop. Called with
+ * the lock held.
+ */
+void EventRecorder::stop_writer()
+{
+    GstElement *src = gst_bin_get_by_name(GST_BIN(writer), "src");
+
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    gst_object_unref(src);
+    close_writer(writer);
+    writer = nullptr;
+}
+
+/**
+ * An event file being finished: its bus watch and a timeout, whichever
+ * comes first.
+ */
+struct WriterClosing
+{
+    GstElement *pipeline;
+    guint watch;
+    guint timer;
+};
+
+static void writer_closed(WriterClosing *closing)
+{
+    if (closing->watch)
+        g_source_remove(closing->watch);
+    if (closing->timer)
+        g_source_remove(closing->timer);
+    gst_element_set_state(closing->pipeline, GST_STATE_NULL);
+    gst_object_unref(closing->pipeline);
+    delete closing;
+    writers_closing--;
+}
+
+static gboolean on_writer_message(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    WriterClosing *closing = (WriterClosing *)user_data;
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+        LOG_WARNING(LOG_MEDIA, "Event recording failed");
+    else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS)
+        LOG_INFO(LOG_MEDIA, "Event recording closed");
+    else
+        return G_SOURCE_CONTINUE;
+    closing->watch = 0;
+    writer_closed(closing);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_writer_timeout(gpointer user_data)
+{
+    WriterClosing *closing = (WriterClosing *)user_data;
+
+    LOG_WARNING(LOG_MEDIA, "Timed out waiting for the event recording to close");
+    closing->timer = 0;
+    writer_closed(closing);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Release the pipeline once the muxer has finished the file, from a bus
+ * watch on the main loop. Any thread.
+ */
+void EventRecorder::close_writer(GstElement *pipeline)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    WriterClosing *closing = new WriterClosing{pipeline, 0, 0};
+
+    writers_closing++;
+    closing->watch = gst_bus_add_watch(bus, on_writer_message, closing);
+    closing->timer = g_timeout_add_seconds(5, on_writer_timeout, closing);
+    gst_object_unref(bus);
+}
+
+guint EventRecorder::closing()
+{
+    return writers_closing;
+}
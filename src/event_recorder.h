@@ -0,0 +1,93 @@
+/*
+ * Pre-event recording: keeps the last seconds of the camera's encoded video
+ * in memory, and writes them to disk followed by the live video when an
+ * event is triggered.
+ */
+
+#ifndef LIVESYNC_EVENT_RECORDER_H
+#define LIVESYNC_EVENT_RECORDER_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "encoded_ring.h"
+
+/**
+ * queue ! depayloader [! parser] ! appsink, in a bin with an RTP sink pad,
+ * to hang off a tee in front of the decoder. Every encoded frame is copied
+ * into a preallocated EncodedRing.
+ *
+ * trigger() starts a file with the ring's contents, from its oldest
+ * keyframe, and then keeps appending the live frames until post_time after
+ * the last trigger. The file is written by a separate appsrc ! muxer !
+ * filesink pipeline, so nothing in the camera's pipeline changes. Like the
+ * Recorder, the branch's queue leaks instead of stalling the live video.
+ *
+ * The ring is copied into the file by a thread of its own, a frame at a
+ * time, so that neither the trigger nor the streaming thread waits for it;
+ * the live frames follow once it has caught up.
+ */
+class EventRecorder
+{
+public:
+    /* Returns nullptr for unsupported encodings or missing plugins. */
+    static EventRecorder *create(const gchar *encoding_name,
+                                 const gchar *directory, const gchar *prefix,
+                                 GstClockTime pre_time, gsize capacity_bytes,
+                                 GstClockTime post_time);
+    ~EventRecorder();
+
+    /* The bin, to be added to a pipeline and linked to a tee. */
+    GstElement *element() const { return bin; }
+
+    /* Start an event file, or make the current one longer. Any thread. */
+    void trigger();
+
+    /* Event files still being finished, for waiting at exit. They are closed
+     * on the main loop. */
+    static guint closing();
+
+private:
+    EventRecorder(GstElement *bin, const gchar *mux_name,
+                  const gchar *extension, const gchar *directory,
+                  const gchar *prefix, GstClockTime pre_time,
+                  gsize capacity_bytes, GstClockTime post_time);
+    EventRecorder(const EventRecorder &) = delete;
+    EventRecorder &operator=(const EventRecorder &) = delete;
+
+    static GstFlowReturn on_new_sample(GstAppSink *appsink, gpointer user_data);
+    void add_frame(GstSample *sample);
+    void start_writer();
+    void write_ring(GstElement *src);
+    GstBuffer *ring_buffer(size_t i) const;
+    void write(GstBuffer *buffer);
+    void stop_writer();
+    static void close_writer(GstElement *pipeline);
+
+    GstElement *bin;
+    std::string mux_name;
+    std::string extension;
+    std::string directory;
+    std::string prefix;
+    GstClockTime post_time;
+
+    std::mutex lock; // protects the fields below
+    EncodedRing ring;
+    GstCaps *caps;           // of the encoded frames
+    GstElement *writer;      // pipeline of the event file, while writing
+    GstClockTime base_time;  // timestamp of the file's first frame
+    GstClockTime last_time;  // timestamp of the newest frame
+    GstClockTime stop_time;  // write until the live frames reach this
+    guint64 ring_next;       // number of the next ring frame to write
+    gboolean live;           // the ring is written, live frames go in directly
+    gboolean cancelled;      // stop writing the ring, the recorder is going
+
+    std::thread ring_writer; // writes the ring into the event file
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Frames for other processes: the decoded frames of a camera are written
+ * once into a shared-memory FrameRing, where any number of readers, e.g.
+ * computer vision workers, take them without the pipeline ever waiting.
+ */
+
+#include "frame_publisher.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <cstring>
+
+FramePublisher::FramePublisher(const gchar *name, guint slots)
+    : ring_name(name), slot_count(slots), failed(FALSE), count_published(0)
+{
+}
+
+/**
+ * (Re)create the ring for frames of this size.
+ */
+gboolean FramePublisher::open_ring(const GstVideoInfo *info)
+{
+    if (!ring.create(ring_name, slot_count, GST_VIDEO_INFO_SIZE(info)))
+    {
+        if (!failed)
+            LOG_WARNING(LOG_MEDIA, "Can't create frame ring %s: %s", name(),
+                        strerror(errno));
+        failed = TRUE;
+        return FALSE;
+    }
+
+    failed = FALSE;
+    LOG_INFO(LOG_MEDIA, "Frame ring %s: %u slots of %dx%d %s", name(), slot_count,
+             GST_VIDEO_INFO_WIDTH(info), GST_VIDEO_INFO_HEIGHT(info),
+             GST_VIDEO_INFO_NAME(info));
+    return TRUE;
+}
+
+void FramePublisher::publish(const VideoFrame &frame)
+{
+    GstVideoInfo packed;
+    gint rows[GST_VIDEO_MAX_PLANES] = {};
+
+    // The region of a cropped frame, without the strides' padding.
+    if (!gst_video_info_set_format(&packed, frame.format(), frame.width(), frame.height()) ||
+        GST_VIDEO_INFO_N_PLANES(&packed) > FRAME_RING_MAX_PLANES)
+        return;
+    if (ring.slot_size() < GST_VIDEO_INFO_SIZE(&packed) && !open_ring(&packed))
+        return;
+
+    FrameRingFormat format = {};
+    g_strlcpy(format.format, GST_VIDEO_INFO_NAME(&packed), sizeof(format.format));
+    format.width = GST_VIDEO_INFO_WIDTH(&packed);
+    format.height = GST_VIDEO_INFO_HEIGHT(&packed);
+    format.n_planes = GST_VIDEO_INFO_N_PLANES(&packed);
+    format.size = GST_VIDEO_INFO_SIZE(&packed);
+
+    // The first component of a plane tells its height.
+    for (gint component = GST_VIDEO_INFO_N_COMPONENTS(&packed) - 1; component >= 0;
+         component--)
+        rows[GST_VIDEO_INFO_COMP_PLANE(&packed, component)] =
+            GST_VIDEO_INFO_COMP_HEIGHT(&packed, component);
+
+    // The only copy of the pixels, straight into the slot.
+    guint8 *slot = ring.begin();
+    for (guint plane = 0; plane < format.n_planes; plane++)
+    {
+        const guint8 *src = frame.data(plane);
+        guint8 *dst = slot + GST_VIDEO_INFO_PLANE_OFFSET(&packed, plane);
+        gint stride = GST_VIDEO_INFO_PLANE_STRIDE(&packed, plane);
+        gsize row_bytes = MIN(stride, frame.stride(plane));
+
+        format.offsets[plane] = GST_VIDEO_INFO_PLANE_OFFSET(&packed, plane);
+        format.strides[plane] = stride;
+        for (gint y = 0; y < rows[plane]; y++)
+            memcpy(dst + (gsize)y * stride, src + (gsize)y * frame.stride(plane), row_bytes);
+    }
+    ring.commit(format, GST_CLOCK_TIME_IS_VALID(frame.pts()) ? (gint64)frame.pts() : -1);
+    count_published++;
+}
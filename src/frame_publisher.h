@@ -0,0 +1,51 @@
+/*
+ * Frames for other processes: the decoded frames of a camera are written
+ * once into a shared-memory FrameRing, where any number of readers, e.g.
+ * computer vision workers, take them without the pipeline ever waiting.
+ */
+
+#ifndef LIVESYNC_FRAME_PUBLISHER_H
+#define LIVESYNC_FRAME_PUBLISHER_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <atomic>
+#include <string>
+
+#include "frame_ring.h"
+#include "frame_sink.h"
+
+/**
+ * Copies decoded frames into a FrameRingWriter, planes packed, with their
+ * format and PTS. The ring is created with the first frame, and made again
+ * if a frame doesn't fit its slots; its readers then see it closed and
+ * attach again. publish() is called on the streaming thread.
+ */
+class FramePublisher
+{
+public:
+    /* name: shared memory name, e.g. "/livesync-1". */
+    FramePublisher(const gchar *name, guint slots);
+
+    const gchar *name() const { return ring_name.c_str(); }
+
+    void publish(const VideoFrame &frame);
+
+    /* Frames published so far, across rings. */
+    guint64 published() const { return count_published; }
+
+private:
+    FramePublisher(const FramePublisher &) = delete;
+    FramePublisher &operator=(const FramePublisher &) = delete;
+
+    gboolean open_ring(const GstVideoInfo *info);
+
+    std::string ring_name;
+    guint slot_count;
+    FrameRingWriter ring;
+    gboolean failed; /* creating the ring, logged once */
+    std::atomic<guint64> count_published;
+};
+
+#endif
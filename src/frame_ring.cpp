@@ -0,0 +1,290 @@
+/*
+ * Shared-memory frame ring: decoded frames published by one process into a
+ * fixed ring of slots in POSIX shared memory, for any number of reader
+ * processes, e.g. computer vision workers. Plain C++ without GStreamer, so
+ * that the readers only need frame_ring.h and frame_ring.cpp.
+ *
+ * The writer never waits for the readers. Every slot is a seqlock: its
+ * sequence number is 0 while the slot is being written, and the number of
+ * the frame in it once written. A reader takes the newest frame, reads it
+ * in place, and checks afterwards that the slot still has that number; if
+ * not, the writer has lapped it and it has to skip to a newer frame.
+ */
+
+#include "frame_ring.h"
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "the futex must be a plain 32-bit word");
+
+int64_t frame_ring_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Not FUTEX_PRIVATE_FLAG: the waiters are in other processes.
+ */
+static void wake_all(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static void wait_while(const std::atomic<uint32_t> *word, uint32_t value,
+                       int64_t timeout_ns)
+{
+    struct timespec ts, *timeout = nullptr;
+
+    if (timeout_ns >= 0)
+    {
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        timeout = &ts;
+    }
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, timeout, nullptr, 0);
+}
+
+FrameRingWriter::FrameRingWriter()
+    : header(nullptr), mapped_size(0), sequence(0)
+{
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+    close();
+}
+
+bool FrameRingWriter::create(const std::string &ring_name, unsigned slots,
+                             uint64_t size)
+{
+    close();
+    if (slots < 2 || slots > FRAME_RING_MAX_SLOTS || size == 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Slots on cache lines, pixels on their own pages.
+    const uint64_t slot_bytes = (size + 63) & ~(uint64_t)63;
+    const uint64_t data_offset = (sizeof(FrameRingHeader) + 4095) & ~(uint64_t)4095;
+    const size_t total = data_offset + slots * slot_bytes;
+
+    // A ring of the same name is left over from a writer that crashed.
+    shm_unlink(ring_name.c_str());
+    int fd = shm_open(ring_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0640);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, total) < 0)
+    {
+        int error = errno;
+        ::close(fd);
+        shm_unlink(ring_name.c_str());
+        errno = error;
+        return false;
+    }
+    void *memory = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(ring_name.c_str());
+        errno = error;
+        return false;
+    }
+
+    // The memory is zeroed: no frames yet, every slot empty.
+    header = new (memory) FrameRingHeader;
+    header->version = FRAME_RING_VERSION;
+    header->slot_count = slots;
+    header->slot_size = slot_bytes;
+    header->data_offset = data_offset;
+    header->magic.store(FRAME_RING_MAGIC, std::memory_order_release);
+
+    name = ring_name;
+    mapped_size = total;
+    sequence = 0;
+    return true;
+}
+
+void FrameRingWriter::close()
+{
+    if (!header)
+        return;
+
+    header->closed.store(1, std::memory_order_release);
+    header->notify.fetch_add(1, std::memory_order_release);
+    wake_all(&header->notify);
+    munmap(header, mapped_size);
+    // Readers that have it mapped keep it until they detach.
+    shm_unlink(name.c_str());
+    header = nullptr;
+}
+
+uint8_t *FrameRingWriter::begin()
+{
+    const unsigned index = (sequence + 1) % header->slot_count;
+
+    header->slots[index].sequence.store(0, std::memory_order_relaxed);
+    // Readers that see any of the new pixels see the 0 as well.
+    std::atomic_thread_fence(std::memory_order_release);
+    return (uint8_t *)header + header->data_offset + index * header->slot_size;
+}
+
+void FrameRingWriter::commit(const FrameRingFormat &format, int64_t pts)
+{
+    const uint64_t next = ++sequence;
+    FrameRingSlot &slot = header->slots[next % header->slot_count];
+
+    slot.pts = pts;
+    slot.published = frame_ring_now();
+    slot.format = format;
+    slot.sequence.store(next, std::memory_order_release);
+    header->latest.store(next, std::memory_order_release);
+    header->notify.fetch_add(1, std::memory_order_release);
+    wake_all(&header->notify);
+}
+
+FrameRingReader::FrameRingReader()
+    : header(nullptr), mapped_size(0), last(0), frames_skipped(0)
+{
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    detach();
+}
+
+bool FrameRingReader::attach(const std::string &name)
+{
+    struct stat st;
+
+    detach();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+
+    // Not ready yet if the magic isn't there.
+    const FrameRingHeader *ring = (const FrameRingHeader *)memory;
+    if (ring->magic.load(std::memory_order_acquire) != FRAME_RING_MAGIC ||
+        ring->version != FRAME_RING_VERSION || ring->slot_count < 2 ||
+        ring->slot_count > FRAME_RING_MAX_SLOTS ||
+        ring->data_offset + ring->slot_count * ring->slot_size > (uint64_t)st.st_size)
+    {
+        munmap(memory, st.st_size);
+        return false;
+    }
+
+    header = ring;
+    mapped_size = st.st_size;
+    last = 0;
+    return true;
+}
+
+void FrameRingReader::detach()
+{
+    if (!header)
+        return;
+    munmap((void *)header, mapped_size);
+    header = nullptr;
+}
+
+/**
+ * Copy out the slot's description, if it still has the frame.
+ */
+bool FrameRingReader::take(uint64_t sequence, FrameRingFrame *frame)
+{
+    const unsigned index = sequence % header->slot_count;
+    const FrameRingSlot &slot = header->slots[index];
+
+    if (slot.sequence.load(std::memory_order_acquire) != sequence)
+        return false;
+    frame->pts = slot.pts;
+    frame->published = slot.published;
+    frame->format = slot.format;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+        return false;
+    if (frame->format.n_planes > FRAME_RING_MAX_PLANES ||
+        frame->format.size > header->slot_size)
+    {
+        // Not from a writer of this version: skip it, not retry it.
+        last = sequence;
+        return false;
+    }
+
+    frame->sequence = sequence;
+    frame->data = (const uint8_t *)header + header->data_offset +
+                  index * header->slot_size;
+    if (last)
+        frames_skipped += sequence - last - 1;
+    last = sequence;
+    return true;
+}
+
+FrameRingStatus FrameRingReader::next(FrameRingFrame *frame, int timeout_ms)
+{
+    const int64_t deadline = timeout_ms < 0 ? -1 : frame_ring_now() + (int64_t)timeout_ms * 1000000;
+
+    if (!header)
+        return FRAME_RING_CLOSED;
+
+    for (;;)
+    {
+        if (header->closed.load(std::memory_order_acquire))
+            return FRAME_RING_CLOSED;
+
+        // Read before latest: a frame committed after it wakes us at once.
+        uint32_t notify = header->notify.load(std::memory_order_acquire);
+        uint64_t latest = header->latest.load(std::memory_order_acquire);
+        if (latest > last)
+        {
+            if (take(latest, frame))
+                return FRAME_RING_FRAME;
+            // Lapped while reading it, so there is a newer one already.
+            if (latest > last)
+                continue;
+        }
+
+        int64_t wait = -1;
+        if (deadline >= 0)
+        {
+            wait = deadline - frame_ring_now();
+            if (wait <= 0)
+                return FRAME_RING_TIMEOUT;
+        }
+        wait_while(&header->notify, notify, wait);
+    }
+}
+
+bool FrameRingReader::valid(const FrameRingFrame &frame) const
+{
+    if (!header)
+        return false;
+
+    // The pixels were read before the sequence is checked again.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->slots[frame.sequence % header->slot_count].sequence.load(
+               std::memory_order_relaxed) == frame.sequence;
+}
@@ -0,0 +1,172 @@
+/*
+ * Shared-memory frame ring: decoded frames published by one process into a
+ * fixed ring of slots in POSIX shared memory, for any number of reader
+ * processes, e.g. computer vision workers. Plain C++ without GStreamer, so
+ * that the readers only need frame_ring.h and frame_ring.cpp.
+ *
+ * The writer never waits for the readers. Every slot is a seqlock: its
+ * sequence number is 0 while the slot is being written, and the number of
+ * the frame in it once written. A reader takes the newest frame, reads it
+ * in place, and checks afterwards that the slot still has that number; if
+ * not, the writer has lapped it and it has to skip to a newer frame.
+ */
+
+#ifndef LIVESYNC_FRAME_RING_H
+#define LIVESYNC_FRAME_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define FRAME_RING_MAGIC 0x4c534652 /* "LSFR" */
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_MAX_SLOTS 16
+#define FRAME_RING_MAX_PLANES 4
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the ring's atomics must be lock-free to work across processes");
+
+/**
+ * The layout of a frame's pixels in its slot.
+ */
+struct FrameRingFormat
+{
+    char format[16]; /* GStreamer video format name, e.g. "I420" */
+    uint32_t width;
+    uint32_t height;
+    uint32_t n_planes;
+    uint32_t offsets[FRAME_RING_MAX_PLANES]; /* from the start of the slot */
+    uint32_t strides[FRAME_RING_MAX_PLANES];
+    uint64_t size; /* bytes used in the slot */
+};
+
+/**
+ * One slot. The fields after sequence are only valid while it stays the
+ * same.
+ */
+struct alignas(64) FrameRingSlot
+{
+    std::atomic<uint64_t> sequence;
+    int64_t pts;       /* ns in the stream, -1 if unknown */
+    int64_t published; /* ns on CLOCK_MONOTONIC, when the writer committed it */
+    FrameRingFormat format;
+};
+
+/**
+ * The start of the shared memory; the slots' pixels follow at data_offset,
+ * slot_size bytes each.
+ */
+struct FrameRingHeader
+{
+    std::atomic<uint32_t> magic; /* set last, once the ring is ready */
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t reserved;
+    uint64_t slot_size;
+    uint64_t data_offset;
+    std::atomic<uint64_t> latest; /* newest committed frame, 0 = none yet */
+    std::atomic<uint32_t> closed; /* the writer is gone, or replaced the ring */
+    std::atomic<uint32_t> notify; /* futex, bumped and woken for every frame */
+    FrameRingSlot slots[FRAME_RING_MAX_SLOTS];
+};
+
+/**
+ * The writing end. Not thread safe: one thread writes the frames.
+ */
+class FrameRingWriter
+{
+public:
+    FrameRingWriter();
+    ~FrameRingWriter();
+
+    /* Create the ring under a shared memory name like "/livesync-0",
+     * replacing one of the same name. Closes the current ring first, if
+     * any. Returns false and sets errno on failure. */
+    bool create(const std::string &name, unsigned slots, uint64_t slot_size);
+
+    /* Mark the ring closed for its readers and remove it. */
+    void close();
+
+    bool is_open() const { return header != nullptr; }
+    uint64_t slot_size() const { return header ? header->slot_size : 0; }
+
+    /* Write a frame in two steps: begin() returns the memory of the next
+     * slot, to write the pixels into, and commit() publishes them. */
+    uint8_t *begin();
+    void commit(const FrameRingFormat &format, int64_t pts);
+
+    /* Frames committed since create(). */
+    uint64_t published() const { return sequence; }
+
+private:
+    FrameRingWriter(const FrameRingWriter &) = delete;
+    FrameRingWriter &operator=(const FrameRingWriter &) = delete;
+
+    std::string name;
+    FrameRingHeader *header;
+    size_t mapped_size;
+    uint64_t sequence;
+};
+
+enum FrameRingStatus
+{
+    FRAME_RING_FRAME,
+    FRAME_RING_TIMEOUT,
+    FRAME_RING_CLOSED, /* attach again for the writer's next ring */
+};
+
+/**
+ * A frame in the ring, read in place.
+ */
+struct FrameRingFrame
+{
+    uint64_t sequence;
+    int64_t pts;
+    int64_t published;
+    FrameRingFormat format;
+    const uint8_t *data; /* the slot; planes at format.offsets */
+};
+
+/**
+ * The reading end: attaches to a ring by name and returns its newest
+ * frames. Readers come and go as they like, the writer doesn't know them.
+ */
+class FrameRingReader
+{
+public:
+    FrameRingReader();
+    ~FrameRingReader();
+
+    /* Map the ring read-only. Returns false if there is no ready ring of
+     * that name. */
+    bool attach(const std::string &name);
+    void detach();
+    bool attached() const { return header != nullptr; }
+
+    /* Wait up to timeout_ms (-1 = forever) for a frame newer than the last
+     * one returned. Frames in between are skipped, and counted. */
+    FrameRingStatus next(FrameRingFrame *frame, int timeout_ms);
+
+    /* Whether the writer hasn't reused the frame's slot yet: check it after
+     * reading the pixels, and drop what was read if it has. */
+    bool valid(const FrameRingFrame &frame) const;
+
+    /* Frames the writer published that this reader never got. */
+    uint64_t skipped() const { return frames_skipped; }
+
+private:
+    FrameRingReader(const FrameRingReader &) = delete;
+    FrameRingReader &operator=(const FrameRingReader &) = delete;
+
+    bool take(uint64_t sequence, FrameRingFrame *frame);
+
+    const FrameRingHeader *header;
+    size_t mapped_size;
+    uint64_t last;
+    uint64_t frames_skipped;
+};
+
+/* Nanoseconds on CLOCK_MONOTONIC, the clock of FrameRingFrame::published. */
+int64_t frame_ring_now();
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Headless frame delivery: hands decoded video frames from the pipeline to
+ * C++ code in the same process via appsink, without copying any pixels.
+ */
+
+#include "frame_sink.h"
+#include "logger.h"
+
+/**
+ * Find where the crop region starts in each plane, if there is one.
+ */
+VideoFrame::VideoFrame(GstSample *sample, const GstVideoFrame &frame)
+    : sample(sample), frame(frame), crop_width(GST_VIDEO_FRAME_WIDTH(&frame)),
+      crop_height(GST_VIDEO_FRAME_HEIGHT(&frame))
+{
+    const GstVideoFormatInfo *finfo = frame.info.finfo;
+    GstVideoCropMeta *crop = gst_buffer_get_video_crop_meta(frame.buffer);
+
+    for (gsize &offset : offsets)
+        offset = 0;
+    if (!crop)
+        return;
+
+    crop_width = crop->width;
+    crop_height = crop->height;
+    // The first component of a plane tells its subsampling and pixel size.
+    for (gint component = GST_VIDEO_FORMAT_INFO_N_COMPONENTS(finfo) - 1;
+         component >= 0; component--)
+    {
+        guint plane = GST_VIDEO_FORMAT_INFO_PLANE(finfo, component);
+        offsets[plane] =
+            (gsize)GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT(finfo, component, crop->y) *
+                GST_VIDEO_FRAME_PLANE_STRIDE(&frame, plane) +
+            (gsize)GST_VIDEO_FORMAT_INFO_SCALE_WIDTH(finfo, component, crop->x) *
+                GST_VIDEO_FORMAT_INFO_PSTRIDE(finfo, component);
+    }
+}
+
+/**
+ * Unmap the frame and drop our reference to the sample (and its buffer).
+ */
+VideoFrame::~VideoFrame()
+{
+    gst_video_frame_unmap(&frame);
+    gst_sample_unref(sample);
+}
+
+/**
+ * Map a sample's buffer for reading. Takes ownership of the sample.
+ */
+VideoFrameRef VideoFrame::map(GstSample *sample)
+{
+    GstVideoInfo info;
+    GstCaps *caps = gst_sample_get_caps(sample);
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    if (!caps || !buffer || !gst_video_info_from_caps(&info, caps))
+    {
+        LOG_WARNING(LOG_MEDIA, "Frame without raw video caps, dropping");
+        gst_sample_unref(sample);
+        return nullptr;
+    }
+
+    // Mapping system memory is just taking a pointer, there's no copy.
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ))
+    {
+        LOG_WARNING(LOG_MEDIA, "Failed to map video frame, dropping");
+        gst_sample_unref(sample);
+        return nullptr;
+    }
+
+    return VideoFrameRef(new VideoFrame(sample, frame));
+}
+
+FrameSink::FrameSink(guint max_buffers, const gchar *format)
+    : accept_crop_meta(TRUE)
+{
+    GstCaps *caps;
+    GstPad *pad;
+
+    sink = gst_element_factory_make("appsink", NULL);
+    g_assert_nonnull(sink);
+    gst_object_ref_sink(sink);
+
+    // Any raw format in system memory, so that the decoder's output goes
+    // through as is: no colour conversion and the buffers can be mapped.
+    // A fixed format needs a videoconvert in front of the sink.
+    caps = gst_caps_new_empty_simple("video/x-raw");
+    if (format)
+        gst_caps_set_simple(caps, "format", G_TYPE_STRING, format, NULL);
+    g_object_set(sink, "caps", caps, "max-buffers", max_buffers, "drop", TRUE,
+                 "sync", FALSE, "enable-last-sample", FALSE, NULL);
+    gst_caps_unref(caps);
+
+    pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, on_query, this, NULL);
+    gst_object_unref(pad);
+}
+
+FrameSink::~FrameSink()
+{
+    gst_object_unref(sink);
+}
+
+void FrameSink::set_callback(FrameCallback cb)
+{
+    GstAppSinkCallbacks callbacks = {};
+
+    callback = cb;
+    callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, this, NULL);
+}
+
+/**
+ * Called on the streaming thread for every frame in push mode.
+ */
+GstFlowReturn FrameSink::on_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+    FrameSink *self = (FrameSink *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+
+    if (!sample)
+        return GST_FLOW_EOS;
+
+    VideoFrameRef frame = VideoFrame::map(sample);
+    if (frame)
+        self->callback(frame);
+
+    return GST_FLOW_OK;
+}
+
+/**
+ * Answer the allocation query for appsink, which doesn't: the frames are
+ * mapped with GstVideoMeta, so any strides and offsets do, and a region
+ * marked with a GstVideoCropMeta is read in place (see RoiCrop).
+ */
+GstPadProbeReturn FrameSink::on_query(GstPad *pad, GstPadProbeInfo *info,
+                                      gpointer user_data)
+{
+    FrameSink *self = (FrameSink *)user_data;
+    GstQuery *query = GST_PAD_PROBE_INFO_QUERY(info);
+
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION)
+        return GST_PAD_PROBE_OK;
+
+    gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL);
+    if (self->accept_crop_meta)
+        gst_query_add_allocation_meta(query, GST_VIDEO_CROP_META_API_TYPE, NULL);
+    return GST_PAD_PROBE_HANDLED;
+}
+
+VideoFrameRef FrameSink::pull(GstClockTime timeout)
+{
+    GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), timeout);
+
+    if (!sample)
+        return nullptr;
+
+    return VideoFrame::map(sample);
+}
@@ -0,0 +1,102 @@
+/*
+ * Headless frame delivery: hands decoded video frames from the pipeline to
+ * C++ code in the same process via appsink, without copying any pixels.
+ */
+
+#ifndef LIVESYNC_FRAME_SINK_H
+#define LIVESYNC_FRAME_SINK_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+
+#include <functional>
+#include <memory>
+
+/**
+ * A decoded video frame, mapped read-only straight from its GstBuffer.
+ * The frame stays valid for as long as someone holds a reference to it, and
+ * holding one never blocks the streaming thread.
+ *
+ * A buffer with a GstVideoCropMeta is a frame of its region only: data(),
+ * width() and height() are those of the region, while info() and buffer()
+ * still describe the whole buffer.
+ */
+class VideoFrame
+{
+public:
+    ~VideoFrame();
+
+    const guint8 *data(guint plane) const { return (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA(&frame, plane) + offsets[plane]; }
+    gint stride(guint plane) const { return GST_VIDEO_FRAME_PLANE_STRIDE(&frame, plane); }
+    guint n_planes() const { return GST_VIDEO_FRAME_N_PLANES(&frame); }
+    gint width() const { return crop_width; }
+    gint height() const { return crop_height; }
+    GstVideoFormat format() const { return GST_VIDEO_FRAME_FORMAT(&frame); }
+    const GstVideoInfo *info() const { return &frame.info; }
+    GstClockTime pts() const { return GST_BUFFER_PTS(frame.buffer); }
+
+    /* The underlying buffer, e.g. for reading its metas. Not reffed. */
+    GstBuffer *buffer() const { return frame.buffer; }
+
+    /* Wrap a sample; returns nullptr if it can't be mapped as raw video. */
+    static std::shared_ptr<const VideoFrame> map(GstSample *sample);
+
+private:
+    VideoFrame(GstSample *sample, const GstVideoFrame &frame);
+    VideoFrame(const VideoFrame &) = delete;
+    VideoFrame &operator=(const VideoFrame &) = delete;
+
+    GstSample *sample;
+    GstVideoFrame frame;
+    gsize offsets[GST_VIDEO_MAX_PLANES]; /* of the crop region in each plane */
+    gint crop_width, crop_height;
+};
+
+typedef std::shared_ptr<const VideoFrame> VideoFrameRef;
+typedef std::function<void(const VideoFrameRef &frame)> FrameCallback;
+
+/**
+ * An appsink that delivers raw video frames, either pushed to a callback on
+ * the streaming thread, or pulled by the application from any thread.
+ *
+ * Only the newest frames are queued (max_buffers, older ones are dropped),
+ * so a slow consumer never back-pressures the decoder.
+ */
+class FrameSink
+{
+public:
+    /* format: a GStreamer video format name such as "I420", for consumers
+     * that need one, or nullptr to take what the decoder outputs. */
+    explicit FrameSink(guint max_buffers = 2, const gchar *format = nullptr);
+    ~FrameSink();
+
+    /* The appsink element, to be added to and linked in a pipeline. */
+    GstElement *element() const { return sink; }
+
+    /* Push mode. Must be set before the pipeline starts. The callback may
+     * keep the frame reference as long as it likes. */
+    void set_callback(FrameCallback callback);
+
+    /* Pull mode. Returns nullptr on timeout or end of stream. */
+    VideoFrameRef pull(GstClockTime timeout);
+
+    /* Whether the frames may come with a GstVideoCropMeta instead of being
+     * cropped upstream (default: TRUE). Must be set before the pipeline
+     * starts. */
+    void set_crop_meta(gboolean accept) { accept_crop_meta = accept; }
+
+private:
+    FrameSink(const FrameSink &) = delete;
+    FrameSink &operator=(const FrameSink &) = delete;
+
+    static GstFlowReturn on_new_sample(GstAppSink *appsink, gpointer user_data);
+    static GstPadProbeReturn on_query(GstPad *pad, GstPadProbeInfo *info,
+                                      gpointer user_data);
+
+    GstElement *sink;
+    FrameCallback callback;
+    gboolean accept_crop_meta;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * A small HTTP server on a local port or UNIX socket, for the stats and
+ * the snapshots: one request per connection, answered on one of the
+ * service's threads, and the connection closed.
+ */
+
+#include "http_server.h"
+#include "logger.h"
+
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+
+#include <cstring>
+
+// How long a client gets to send its request and take the response, in
+// seconds.
+#define HTTP_TIMEOUT 5
+
+// Requests served at the same time.
+#define HTTP_THREADS 2
+
+HttpServer::HttpServer(const gchar *what, const gchar *example, Handler handler)
+    : what(what), example(example), handler(handler), service(nullptr)
+{
+}
+
+HttpServer::~HttpServer()
+{
+    if (service)
+    {
+        g_socket_service_stop(service);
+        g_object_unref(service);
+    }
+}
+
+void HttpServer::respond(GOutputStream *out, const gchar *status, const gchar *type,
+                         gconstpointer body, gsize size)
+{
+    gchar *header = g_strdup_printf("HTTP/1.0 %s\r\n"
+                                    "Content-Type: %s\r\n"
+                                    "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "Connection: close\r\n\r\n",
+                                    status, type, size);
+    g_output_stream_write_all(out, header, strlen(header), NULL, NULL, NULL);
+    g_output_stream_write_all(out, body, size, NULL, NULL, NULL);
+    g_free(header);
+}
+
+void HttpServer::respond_text(GOutputStream *out, const gchar *status, const gchar *text)
+{
+    gchar *body = g_strdup_printf("%s\n", text);
+    respond(out, status, "text/plain", body, strlen(body));
+    g_free(body);
+}
+
+/**
+ * Serve one request, on one of the service's threads. The request is read
+ * only up to the end of its headers.
+ */
+gboolean HttpServer::on_run(GThreadedSocketService *service,
+                            GSocketConnection *connection,
+                            GObject *source_object, gpointer user_data)
+{
+    HttpServer *self = (HttpServer *)user_data;
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    GDataInputStream *lines;
+    gchar *request = nullptr, *line;
+
+    g_socket_set_timeout(g_socket_connection_get_socket(connection), HTTP_TIMEOUT);
+    lines = g_data_input_stream_new(in);
+    g_filter_input_stream_set_close_base_stream(G_FILTER_INPUT_STREAM(lines), FALSE);
+    while ((line = g_data_input_stream_read_line(lines, NULL, NULL, NULL)))
+    {
+        gboolean end = line[0] == '\0' || strcmp(line, "\r") == 0;
+        if (!request)
+            request = line;
+        else
+            g_free(line);
+        if (end)
+            break;
+    }
+    g_object_unref(lines);
+
+    // "GET /snapshot.jpg HTTP/1.1", without a query string.
+    gchar **parts = g_strsplit(request ? request : "", " ", 3);
+    if (g_strv_length(parts) >= 2)
+    {
+        parts[1][strcspn(parts[1], "?")] = '\0';
+        self->handler(parts[1], out);
+    }
+    else
+    {
+        self->handler("", out);
+    }
+
+    g_strfreev(parts);
+    g_free(request);
+    return TRUE;
+}
+
+GSocketService *HttpServer::create_service()
+{
+    if (!service)
+    {
+        service = g_threaded_socket_service_new(HTTP_THREADS);
+        g_signal_connect(service, "run", G_CALLBACK(on_run), this);
+    }
+    return service;
+}
+
+gboolean HttpServer::add_address(GSocketAddress *address, GSocketProtocol protocol,
+                                 const gchar *where)
+{
+    GError *error = nullptr;
+
+    gboolean ok = g_socket_listener_add_address(G_SOCKET_LISTENER(create_service()),
+                                                address, G_SOCKET_TYPE_STREAM,
+                                                protocol, NULL, NULL, &error);
+    if (!ok)
+    {
+        LOG_ERROR(LOG_APP, "Can't serve %s on %s: %s", what, where, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    g_socket_service_start(service);
+    return TRUE;
+}
+
+gboolean HttpServer::listen_tcp(guint16 port)
+{
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, port);
+    gchar *where = g_strdup_printf("port %u", port);
+
+    gboolean ok = add_address(address, G_SOCKET_PROTOCOL_TCP, where);
+    g_free(where);
+    g_object_unref(address);
+    g_object_unref(loopback);
+    if (ok)
+        LOG_INFO(LOG_APP, "Serving %s on http://127.0.0.1:%u%s", what, port, example);
+    return ok;
+}
+
+gboolean HttpServer::listen_unix(const gchar *path)
+{
+    GSocketAddress *address;
+    GStatBuf status;
+
+    // A socket file left by an earlier run would make bind() fail. Only
+    // that: any other file there is left alone, and bind() says why.
+    if (g_lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+        g_unlink(path);
+    address = g_unix_socket_address_new(path);
+
+    gboolean ok = add_address(address, G_SOCKET_PROTOCOL_DEFAULT, path);
+    g_object_unref(address);
+    if (ok)
+        LOG_INFO(LOG_APP, "Serving %s on UNIX socket %s", what, path);
+    return ok;
+}
@@ -0,0 +1,58 @@
+/*
+ * A small HTTP server on a local port or UNIX socket, for the stats and
+ * the snapshots: one request per connection, answered on one of the
+ * service's threads, and the connection closed.
+ */
+
+#ifndef LIVESYNC_HTTP_SERVER_H
+#define LIVESYNC_HTTP_SERVER_H
+
+#include <gio/gio.h>
+
+#include <functional>
+
+/**
+ * Reads the request line and the headers, and hands the path to the
+ * handler, which responds. A client gets a few seconds to send its request
+ * and take the response, so that stalled ones don't hold the threads.
+ */
+class HttpServer
+{
+public:
+    /* On one of the server's threads: answer the request with respond().
+     * path is without the query string, "" if the request is malformed. */
+    typedef std::function<void(const gchar *path, GOutputStream *out)> Handler;
+
+    /* what is served, and an example path, for the messages: e.g. "stats"
+     * and "/metrics". */
+    HttpServer(const gchar *what, const gchar *example, Handler handler);
+    ~HttpServer();
+
+    /* Serve on 127.0.0.1:port, or on a UNIX socket. Returns FALSE and
+     * logs why on failure. */
+    gboolean listen_tcp(guint16 port);
+    gboolean listen_unix(const gchar *path);
+
+    /* A whole response, with Connection: close. */
+    static void respond(GOutputStream *out, const gchar *status, const gchar *type,
+                        gconstpointer body, gsize size);
+    static void respond_text(GOutputStream *out, const gchar *status, const gchar *text);
+
+private:
+    HttpServer(const HttpServer &) = delete;
+    HttpServer &operator=(const HttpServer &) = delete;
+
+    GSocketService *create_service();
+    gboolean add_address(GSocketAddress *address, GSocketProtocol protocol,
+                         const gchar *where);
+    static gboolean on_run(GThreadedSocketService *service,
+                           GSocketConnection *connection,
+                           GObject *source_object, gpointer user_data);
+
+    const gchar *what;
+    const gchar *example;
+    Handler handler;
+    GSocketService *service;
+};
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Trickle ICE on the sending side: leaves out the local candidates that
+ * can't reach a camera (loopback, Docker bridges and veth pairs), and
+ * collects the rest for a short window so that they go to the camera in
+ * one signaling message, ending with an end-of-candidates marker.
+ */
+
+#include "ice_batcher.h"
+
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// Interfaces whose host candidates can't reach a camera: the loopback is
+// found by its flag, these by their names.
+static const gchar *useless_interfaces[] = {"docker", "br-", "veth", "virbr"};
+
+// Addresses of the useless interfaces, looked up when first needed.
+static std::mutex interfaces_lock;
+static std::vector<std::string> useless_addresses;
+static gboolean interfaces_known = FALSE;
+
+static void find_useless_addresses()
+{
+    struct ifaddrs *interfaces, *i;
+
+    useless_addresses.clear();
+    interfaces_known = TRUE;
+    if (getifaddrs(&interfaces) != 0)
+        return;
+
+    for (i = interfaces; i; i = i->ifa_next)
+    {
+        gboolean useless = (i->ifa_flags & IFF_LOOPBACK) != 0;
+        for (const gchar *prefix : useless_interfaces)
+            useless = useless || g_str_has_prefix(i->ifa_name, prefix);
+        if (!useless || !i->ifa_addr ||
+            (i->ifa_addr->sa_family != AF_INET && i->ifa_addr->sa_family != AF_INET6))
+            continue;
+
+        gchar host[NI_MAXHOST];
+        socklen_t length = i->ifa_addr->sa_family == AF_INET
+                               ? sizeof(struct sockaddr_in)
+                               : sizeof(struct sockaddr_in6);
+        if (getnameinfo(i->ifa_addr, length, host, sizeof(host), NULL, 0,
+                        NI_NUMERICHOST) != 0)
+            continue;
+        // Link-local IPv6 addresses come with their scope, "fe80::1%veth0".
+        gchar *scope = strchr(host, '%');
+        if (scope)
+            *scope = '\0';
+        useless_addresses.push_back(host);
+    }
+    freeifaddrs(interfaces);
+}
+
+/**
+ * Split "candidate:foundation component transport priority address port
+ * typ type ..." into its words, without the "a=" and "candidate:" prefix.
+ * Returns FALSE if there are too few.
+ */
+static gboolean split_candidate(const gchar *candidate, gchar ***words)
+{
+    if (g_str_has_prefix(candidate, "a="))
+        candidate += 2;
+    if (g_str_has_prefix(candidate, "candidate:"))
+        candidate += strlen("candidate:");
+
+    *words = g_strsplit(candidate, " ", -1);
+    if (g_strv_length(*words) < 8 || strcmp((*words)[6], "typ") != 0)
+    {
+        g_strfreev(*words);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean IceCandidateBatcher::is_useless(const gchar *candidate)
+{
+    gchar **words;
+    gboolean useless = FALSE;
+
+    if (!split_candidate(candidate, &words))
+        return FALSE;
+
+    const gchar *address = words[4];
+    if (strcmp(words[7], "host") == 0)
+    {
+        std::lock_guard<std::mutex> guard(interfaces_lock);
+        if (!interfaces_known)
+            find_useless_addresses();
+        useless = g_str_has_prefix(address, "127.") || strcmp(address, "::1") == 0 ||
+                  std::find(useless_addresses.begin(), useless_addresses.end(),
+                            address) != useless_addresses.end();
+    }
+    g_strfreev(words);
+    return useless;
+}
+
+IceCandidateBatcher::IceCandidateBatcher(guint window_ms, gboolean filter,
+                                         SendFunc send, gpointer user_data)
+    : window_ms(window_ms), filter(filter), send(send), user_data(user_data),
+      window_source(0), finish_source(0), count_gathered(0), count_filtered(0),
+      count_sent(0), count_messages(0)
+{
+}
+
+IceCandidateBatcher::~IceCandidateBatcher()
+{
+    if (window_source)
+        g_source_remove(window_source);
+    if (finish_source)
+        g_source_remove(finish_source);
+}
+
+/**
+ * Whether a candidate with the same component, transport, address, port
+ * and type was sent already, e.g. the same server reflexive address found
+ * from two host interfaces. With lock held.
+ */
+gboolean IceCandidateBatcher::seen(const gchar *candidate)
+{
+    gchar **words;
+
+    if (!split_candidate(candidate, &words))
+        return FALSE;
+
+    std::string key = std::string(words[1]) + " " + words[2] + " " + words[4] +
+                      " " + words[5] + " " + words[7];
+    g_strfreev(words);
+    if (std::find(keys.begin(), keys.end(), key) != keys.end())
+        return TRUE;
+    keys.push_back(key);
+    return FALSE;
+}
+
+void IceCandidateBatcher::add(guint mline_index, const gchar *candidate)
+{
+    count_gathered++;
+    if (filter && is_useless(candidate))
+    {
+        count_filtered++;
+        return;
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    if (filter && seen(candidate))
+    {
+        count_filtered++;
+        return;
+    }
+
+    if (window_ms == 0)
+    {
+        guard.unlock();
+        std::vector<IceCandidate> batch(1, IceCandidate{mline_index, candidate});
+        count_sent++;
+        count_messages++;
+        send(batch, user_data);
+        return;
+    }
+
+    pending.push_back(IceCandidate{mline_index, candidate});
+    if (!window_source && !finish_source)
+        window_source = g_timeout_add(window_ms, on_window, this);
+}
+
+void IceCandidateBatcher::finish()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (window_ms == 0 || finish_source)
+        return;
+    if (window_source)
+    {
+        g_source_remove(window_source);
+        window_source = 0;
+    }
+    finish_source = g_idle_add(on_finish, this);
+}
+
+void IceCandidateBatcher::reset()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (window_source)
+            g_source_remove(window_source);
+        if (finish_source)
+            g_source_remove(finish_source);
+        window_source = 0;
+        finish_source = 0;
+        pending.clear();
+        keys.clear();
+        count_gathered = 0;
+        count_filtered = 0;
+        count_sent = 0;
+        count_messages = 0;
+    }
+
+    // The interfaces may have changed since the previous call.
+    std::lock_guard<std::mutex> guard(interfaces_lock);
+    interfaces_known = FALSE;
+}
+
+/**
+ * Send what is waiting in one message, with the end-of-candidates marker
+ * last if end is set. On the main loop.
+ */
+void IceCandidateBatcher::flush(gboolean end)
+{
+    std::vector<IceCandidate> batch;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        batch.swap(pending);
+    }
+    count_sent += batch.size();
+    if (end)
+        batch.push_back(IceCandidate{0, ""});
+    if (batch.empty())
+        return;
+
+    count_messages++;
+    send(batch, user_data);
+}
+
+gboolean IceCandidateBatcher::on_window(gpointer user_data)
+{
+    IceCandidateBatcher *self = (IceCandidateBatcher *)user_data;
+
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->window_source = 0;
+    }
+    self->flush(FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean IceCandidateBatcher::on_finish(gpointer user_data)
+{
+    IceCandidateBatcher *self = (IceCandidateBatcher *)user_data;
+
+    {
+        std::lock_guard<std::mutex> guard(self->lock);
+        self->finish_source = 0;
+    }
+    self->flush(TRUE);
+    return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,83 @@
+/*
+ * Trickle ICE on the sending side: leaves out the local candidates that
+ * can't reach a camera (loopback, Docker bridges and veth pairs), and
+ * collects the rest for a short window so that they go to the camera in
+ * one signaling message, ending with an end-of-candidates marker.
+ */
+
+#ifndef LIVESYNC_ICE_BATCHER_H
+#define LIVESYNC_ICE_BATCHER_H
+
+#include "signaling_codec.h"
+
+#include <glib.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class IceCandidateBatcher
+{
+public:
+    /* Sends candidates to the camera. With a window, on the main loop,
+     * and the last batch of a gathering ends with the end-of-candidates
+     * marker (an empty candidate). Without one, each candidate right away,
+     * on the thread that found it. */
+    typedef void (*SendFunc)(const std::vector<IceCandidate> &batch,
+                             gpointer user_data);
+
+    /* window_ms: how long to collect candidates after the first one, 0 =
+     * send each as it comes, as single-candidate messages and without the
+     * marker. filter: leave out the host candidates of loopback, Docker
+     * and veth interfaces, and candidates already sent. */
+    IceCandidateBatcher(guint window_ms, gboolean filter, SendFunc send,
+                        gpointer user_data);
+    ~IceCandidateBatcher();
+
+    /* A candidate from webrtcbin's on-ice-candidate, on any thread. */
+    void add(guint mline_index, const gchar *candidate);
+
+    /* Gathering is complete: send what is waiting, and the marker. */
+    void finish();
+
+    /* Start over, for a new call or an ICE restart: drop what is waiting
+     * and forget what was sent. */
+    void reset();
+
+    /* Counts since the last reset(). */
+    guint gathered() const { return count_gathered; }
+    guint filtered() const { return count_filtered; }
+    guint sent() const { return count_sent; }
+    guint messages() const { return count_messages; }
+
+    /* Whether a candidate can't help the call: a host candidate on the
+     * loopback or on an interface named docker*, br-*, veth* or virbr*.
+     * The interfaces are looked up again after reset(). */
+    static gboolean is_useless(const gchar *candidate);
+
+private:
+    IceCandidateBatcher(const IceCandidateBatcher &) = delete;
+    IceCandidateBatcher &operator=(const IceCandidateBatcher &) = delete;
+
+    static gboolean on_window(gpointer user_data);
+    static gboolean on_finish(gpointer user_data);
+    void flush(gboolean end);
+    gboolean seen(const gchar *candidate);
+
+    guint window_ms;
+    gboolean filter;
+    SendFunc send;
+    gpointer user_data;
+
+    std::mutex lock;
+    std::vector<IceCandidate> pending;
+    std::vector<std::string> keys; /* of the candidates sent, for duplicates */
+    guint window_source;
+    guint finish_source;
+    std::atomic<guint> count_gathered;
+    std::atomic<guint> count_filtered;
+    std::atomic<guint> count_sent;
+    std::atomic<guint> count_messages;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Glass-to-glass latency: how long after the camera captured a frame it
+ * reaches our sink, from the sender's NTP time of each RTP packet.
+ */
+
+#include "latency.h"
+
+// Seconds from the NTP epoch (1900) to the Unix epoch (1970).
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+
+int LatencyHistogram::bucket(guint ms)
+{
+    if (ms < 128)
+        return ms;
+
+    int exponent = g_bit_nth_msf(ms, -1); // 7 for 128..255
+    if (exponent > 16)
+        return BUCKETS - 1;
+    int sub = (ms >> (exponent - 4)) & 15;
+    return 128 + (exponent - 7) * 16 + sub;
+}
+
+/**
+ * The middle of a bucket's range.
+ */
+double LatencyHistogram::bucket_value(int index)
+{
+    if (index < 128)
+        return index + 0.5;
+
+    int exponent = 7 + (index - 128) / 16;
+    int sub = (index - 128) % 16;
+    double width = (double)(1u << (exponent - 4));
+    return (16 + sub) * width + width / 2;
+}
+
+void LatencyHistogram::record(double ms)
+{
+    if (ms < 0)
+        ms = 0;
+    guint rounded = ms > 1e9 ? G_MAXUINT : (guint)ms;
+    counts[bucket(rounded)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<guint32> &c : counts)
+        c.store(0, std::memory_order_relaxed);
+}
+
+guint64 LatencyHistogram::count() const
+{
+    guint64 n = 0;
+    for (const std::atomic<guint32> &c : counts)
+        n += c.load(std::memory_order_relaxed);
+    return n;
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+    guint64 n = count(), seen = 0;
+    if (n == 0)
+        return 0.0;
+
+    // The smallest bucket below which at least p% of the samples are.
+    guint64 rank = (guint64)(p / 100.0 * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucket_value(i);
+    }
+    return bucket_value(BUCKETS - 1);
+}
+
+LatencySummary LatencyHistogram::summarize() const
+{
+    LatencySummary summary;
+    summary.count = count();
+    summary.p50 = percentile(50);
+    summary.p95 = percentile(95);
+    summary.p99 = percentile(99);
+    return summary;
+}
+
+gboolean LatencyMeter::enable_ntp_meta(GstElement *webrtc)
+{
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(webrtc), "rtpbin");
+    gboolean ok = FALSE;
+
+    if (rtpbin && g_object_class_find_property(G_OBJECT_GET_CLASS(rtpbin),
+                                               "add-reference-timestamp-meta"))
+    {
+        g_object_set(rtpbin, "add-reference-timestamp-meta", TRUE, NULL);
+        ok = TRUE;
+    }
+    if (rtpbin)
+        gst_object_unref(rtpbin);
+    return ok;
+}
+
+void LatencyMeter::watch(GstPad *pad)
+{
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_buffer, this, NULL);
+}
+
+/**
+ * Called on the streaming thread for every buffer; one meta lookup, one
+ * clock read and one histogram update.
+ */
+GstPadProbeReturn LatencyMeter::on_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                          gpointer user_data)
+{
+    static GstCaps *ntp_caps = gst_caps_new_empty_simple("timestamp/x-ntp");
+    LatencyMeter *self = (LatencyMeter *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstReferenceTimestampMeta *meta;
+
+    meta = gst_buffer_get_reference_timestamp_meta(buffer, ntp_caps);
+    if (!meta)
+    {
+        self->without_meta.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+
+    guint64 now = (guint64)g_get_real_time() * 1000 + NTP_UNIX_OFFSET * GST_SECOND;
+    double ms = ((gint64)(now - meta->timestamp)) / 1e6;
+    self->window.record(ms);
+    self->lifetime.record(ms);
+    return GST_PAD_PROBE_OK;
+}
+
+LatencySummary LatencyMeter::take_window()
+{
+    LatencySummary summary = window.summarize();
+    window.reset();
+    return summary;
+}
+
+LatencySummary LatencyMeter::total() const
+{
+    return lifetime.summarize();
+}
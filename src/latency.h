@@ -0,0 +1,90 @@
+/*
+ * Glass-to-glass latency: how long after the camera captured a frame it
+ * reaches our sink, from the sender's NTP time of each RTP packet.
+ */
+
+#ifndef LIVESYNC_LATENCY_H
+#define LIVESYNC_LATENCY_H
+
+#include <gst/gst.h>
+
+#include <atomic>
+
+/**
+ * Percentiles of one measurement window.
+ */
+struct LatencySummary
+{
+    guint64 count;
+    double p50;
+    double p95;
+    double p99;
+};
+
+/**
+ * Lock-free histogram of latencies in milliseconds: 1 ms buckets up to
+ * 128 ms, then 16 buckets per doubling (about 6% wide) up to 64 s.
+ * Recording is a couple of integer operations and one atomic increment.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() { reset(); }
+
+    void record(double ms);
+    void reset();
+    guint64 count() const;
+
+    /* p in 0..100; 0 if empty. */
+    double percentile(double p) const;
+
+    /* The count and the usual percentiles. */
+    LatencySummary summarize() const;
+
+private:
+    static const int BUCKETS = 128 + 10 * 16;
+
+    static int bucket(guint ms);
+    static double bucket_value(int index);
+
+    std::atomic<guint32> counts[BUCKETS];
+};
+
+/**
+ * Measures the latency of buffers going through the pads it watches. The
+ * sender's capture time comes from the GstReferenceTimestampMeta
+ * (timestamp/x-ntp) that rtpbin adds from RTCP sender reports, and is
+ * compared to our wall clock, so both ends need NTP-synchronised clocks.
+ */
+class LatencyMeter
+{
+public:
+    LatencyMeter() : without_meta(0) {}
+
+    /* Ask webrtcbin's rtpbin to attach sender NTP times to the buffers.
+     * Returns FALSE if this GStreamer is too old (needs 1.22). */
+    static gboolean enable_ntp_meta(GstElement *webrtc);
+
+    /* Measure every buffer that reaches this (sink) pad. */
+    void watch(GstPad *pad);
+
+    /* Percentiles since the previous call, and since the start. */
+    LatencySummary take_window();
+    LatencySummary total() const;
+
+    /* Buffers without a sender time, e.g. before the first RTCP SR. */
+    guint64 unmeasured() const { return without_meta; }
+
+private:
+    LatencyMeter(const LatencyMeter &) = delete;
+    LatencyMeter &operator=(const LatencyMeter &) = delete;
+
+    static GstPadProbeReturn on_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                       gpointer user_data);
+
+    LatencyHistogram window;
+    LatencyHistogram lifetime;
+    std::atomic<guint64> without_meta;
+};
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Levelled logger with a category per subsystem. Messages go into a
+ * lock-free ring and are written out by a background thread, so that
+ * logging from the signaling and streaming threads doesn't wait for the
+ * terminal.
+ */
+
+#include "logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// Power of two. With LOG_MESSAGE_MAX, 1 MB of messages in flight.
+#define RING_SLOTS 256
+
+// How long the writer sleeps when there is nothing to write, at most: a
+// wake-up from a logging thread may be missed, as it doesn't take the lock.
+#define WRITER_IDLE_MS 20
+
+static const gchar *category_names[LOG_CATEGORIES] = {
+    "app", "signaling", "webrtc", "media", "stats",
+};
+static const gchar *level_names[] = {"error", "warning", "info", "debug"};
+static const gchar level_letters[] = {'E', 'W', 'I', 'D'};
+
+/**
+ * A message in the ring. sequence tells whose turn the slot is: it equals
+ * the enqueue position when the slot is free for that position, and the
+ * position + 1 once the message is in (a bounded MPMC queue in the style of
+ * Dmitry Vyukov's, with a single reader).
+ */
+struct LogSlot
+{
+    std::atomic<size_t> sequence;
+    LogCategory category;
+    LogLevel level;
+    gint64 time;
+    size_t length;
+    gchar text[LOG_MESSAGE_MAX];
+};
+
+static gint levels[LOG_CATEGORIES] = {
+    LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO,
+};
+static const gint64 start_time = g_get_monotonic_time();
+
+static LogSlot ring[RING_SLOTS];
+static std::atomic<size_t> enqueue_pos(0);
+static size_t dequeue_pos = 0; // writer thread only
+static std::atomic<guint64> dropped(0);
+static guint64 dropped_reported = 0; // writer thread only
+
+static std::atomic<bool> async(false);
+static std::thread writer;
+static std::mutex lock; // the writer's sleep
+static std::condition_variable wake;
+static std::atomic<bool> writer_idle(false);
+static bool stopping = false;
+
+static gboolean parse_level(const gchar *text, gint *level)
+{
+    for (gint i = 0; i < (gint)G_N_ELEMENTS(level_names); i++)
+    {
+        if (g_ascii_strcasecmp(text, level_names[i]) == 0)
+        {
+            *level = i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean log_set_levels(const gchar *spec)
+{
+    gint parsed[LOG_CATEGORIES];
+    gchar **items = g_strsplit(spec, ",", -1);
+    gboolean ok = TRUE;
+
+    memcpy(parsed, levels, sizeof(parsed));
+    for (gchar **item = items; *item && ok; item++)
+    {
+        gchar *equals = strchr(*item, '=');
+        gint level = LOG_LEVEL_INFO;
+
+        if (!equals)
+        {
+            ok = parse_level(g_strstrip(*item), &level);
+            for (gint i = 0; ok && i < LOG_CATEGORIES; i++)
+                parsed[i] = level;
+            continue;
+        }
+
+        *equals = '\0';
+        ok = parse_level(g_strstrip(equals + 1), &level);
+        gint category = -1;
+        for (gint i = 0; i < LOG_CATEGORIES; i++)
+        {
+            if (g_ascii_strcasecmp(g_strstrip(*item), category_names[i]) == 0)
+                category = i;
+        }
+        ok = ok && category >= 0;
+        if (ok)
+            parsed[category] = level;
+    }
+    g_strfreev(items);
+
+    if (ok)
+        memcpy(levels, parsed, sizeof(levels));
+    return ok;
+}
+
+gboolean log_enabled(LogCategory category, LogLevel level)
+{
+    return (gint)level <= levels[category];
+}
+
+guint64 log_dropped()
+{
+    return dropped;
+}
+
+/**
+ * "  12.345 I signaling message", to stderr for errors and warnings. The
+ * line is written whole even if another thread writes at the same time.
+ */
+static void write_line(LogCategory category, LogLevel level, gint64 time,
+                       const gchar *text, size_t length)
+{
+    FILE *out = level <= LOG_LEVEL_WARNING ? stderr : stdout;
+
+    flockfile(out);
+    fprintf(out, "%8.3f %c %-9s ", (time - start_time) / 1e6,
+            level_letters[level], category_names[category]);
+    fwrite(text, 1, length, out);
+    fputc('\n', out);
+    funlockfile(out);
+}
+
+/**
+ * Format into text, which has room for LOG_MESSAGE_MAX bytes, and return
+ * the length. Too long a message ends in "...".
+ */
+static size_t format_message(gchar *text, const gchar *format, va_list args)
+{
+    gint length = g_vsnprintf(text, LOG_MESSAGE_MAX, format, args);
+
+    if (length < 0)
+        return 0;
+    if (length >= LOG_MESSAGE_MAX)
+    {
+        memcpy(text + LOG_MESSAGE_MAX - 4, "...", 4);
+        return LOG_MESSAGE_MAX - 1;
+    }
+    return length;
+}
+
+/**
+ * Claim the slot for the next message, or return nullptr if the ring is
+ * full.
+ */
+static LogSlot *claim_slot(size_t *pos)
+{
+    *pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        LogSlot *slot = &ring[*pos & (RING_SLOTS - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)*pos;
+
+        if (difference == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(*pos, *pos + 1,
+                                                  std::memory_order_relaxed))
+                return slot;
+        }
+        else if (difference < 0)
+        {
+            return nullptr;
+        }
+        else
+        {
+            *pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void log_message(LogCategory category, LogLevel level, const gchar *format, ...)
+{
+    va_list args;
+    size_t pos;
+
+    if (!log_enabled(category, level))
+        return;
+
+    if (!async)
+    {
+        gchar text[LOG_MESSAGE_MAX];
+        va_start(args, format);
+        size_t length = format_message(text, format, args);
+        va_end(args);
+
+        write_line(category, level, g_get_monotonic_time(), text, length);
+        return;
+    }
+
+    LogSlot *slot = claim_slot(&pos);
+    if (!slot)
+    {
+        dropped++;
+        return;
+    }
+    slot->category = category;
+    slot->level = level;
+    slot->time = g_get_monotonic_time();
+    va_start(args, format);
+    slot->length = format_message(slot->text, format, args);
+    va_end(args);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    if (writer_idle)
+        wake.notify_one();
+}
+
+/**
+ * Write out the messages in the ring, oldest first. Writer thread only.
+ */
+static gboolean drain()
+{
+    gboolean wrote = FALSE;
+
+    for (;;)
+    {
+        LogSlot *slot = &ring[dequeue_pos & (RING_SLOTS - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+            break;
+
+        write_line(slot->category, slot->level, slot->time, slot->text,
+                   slot->length);
+        slot->sequence.store(dequeue_pos + RING_SLOTS, std::memory_order_release);
+        dequeue_pos++;
+        wrote = TRUE;
+    }
+
+    guint64 now_dropped = dropped;
+    if (now_dropped != dropped_reported)
+    {
+        gchar text[64];
+        gint length = g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT
+                                 " messages dropped, the log can't keep up",
+                                 now_dropped - dropped_reported);
+        write_line(LOG_APP, LOG_LEVEL_WARNING, g_get_monotonic_time(), text, length);
+        dropped_reported = now_dropped;
+        wrote = TRUE;
+    }
+
+    if (wrote)
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return wrote;
+}
+
+static void run_writer()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!stopping)
+    {
+        guard.unlock();
+        gboolean wrote = drain();
+        guard.lock();
+        if (wrote || stopping)
+            continue;
+
+        writer_idle = true;
+        wake.wait_for(guard, std::chrono::milliseconds(WRITER_IDLE_MS));
+        writer_idle = false;
+    }
+    guard.unlock();
+    drain();
+}
+
+void log_start(gboolean use_async)
+{
+    if (!use_async || async)
+        return;
+
+    for (size_t i = 0; i < RING_SLOTS; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    stopping = false;
+    writer = std::thread(run_writer);
+    async = true;
+}
+
+void log_stop()
+{
+    if (!async)
+        return;
+
+    // Later messages are written as they come; the writer empties the ring.
+    async = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
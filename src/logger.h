@@ -0,0 +1,72 @@
+/*
+ * Levelled logger with a category per subsystem. Messages go into a
+ * lock-free ring and are written out by a background thread, so that
+ * logging from the signaling and streaming threads doesn't wait for the
+ * terminal.
+ */
+
+#ifndef LIVESYNC_LOGGER_H
+#define LIVESYNC_LOGGER_H
+
+#include <glib.h>
+
+enum LogLevel
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+enum LogCategory
+{
+    LOG_APP,       /* startup, options, shutdown */
+    LOG_SIGNALING, /* the SignalingServer connection and its messages */
+    LOG_WEBRTC,    /* negotiation, ICE, the pipeline */
+    LOG_MEDIA,     /* streaming threads: frames, probes, recording */
+    LOG_STATS,     /* periodic reports */
+    LOG_CATEGORIES
+};
+
+/* Set the levels from e.g. "info" or "debug,media=warning": a level for all
+ * categories and/or category=level pairs. Return FALSE if spec is invalid. */
+gboolean log_set_levels(const gchar *spec);
+
+/* Start the writer thread. Until then, and with log_start(FALSE), messages
+ * are written by the thread logging them, as g_print() would. */
+void log_start(gboolean async);
+
+/* Write out what is queued and stop the writer thread. */
+void log_stop();
+
+/* Whether a message would be written. Check it before building anything
+ * expensive that is only logged. */
+gboolean log_enabled(LogCategory category, LogLevel level);
+
+/* Log a message, unless its level is off for the category. Errors and
+ * warnings go to stderr, the rest to stdout; a line break is added. The
+ * message is formatted into the ring by the caller, without allocating, and
+ * truncated at LOG_MESSAGE_MAX bytes. When the ring is full the message is
+ * dropped; the number dropped is logged once there is room again. */
+void log_message(LogCategory category, LogLevel level, const gchar *format, ...)
+    G_GNUC_PRINTF(3, 4);
+
+/* Messages dropped so far because the ring was full. */
+guint64 log_dropped();
+
+#define LOG_MESSAGE_MAX 4096
+
+/* Check the level first, so that arguments aren't evaluated for nothing. */
+#define LOG_AT(category, level, ...)                     \
+    do                                                   \
+    {                                                    \
+        if (log_enabled(category, level))                \
+            log_message(category, level, __VA_ARGS__);   \
+    } while (0)
+
+#define LOG_ERROR(category, ...) LOG_AT(category, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARNING(category, ...) LOG_AT(category, LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_INFO(category, ...) LOG_AT(category, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(category, ...) LOG_AT(category, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Loss-aware error protection: chooses whether to request NACK/RTX
+ * retransmissions and whether to offer FEC, from the measured packet loss
+ * and RTT.
+ */
+
+#include "loss_control.h"
+
+// Updates with fewer packets than this are too noisy to use.
+#define MIN_PACKETS 50
+// Weight of the newest update in the smoothed loss and RTT.
+#define SMOOTHING 0.3
+// Updates a weaker decision must be the target before it is taken.
+#define HOLD_UPDATES 3
+// A weaker decision must also hold with this much more loss, so that loss
+// hovering around a threshold doesn't switch back and forth.
+#define DEAD_BAND 1.4
+
+LossController::LossController(double latency_ms)
+    : latency_ms(latency_ms), last_received(0), last_lost(0), measured(false),
+      smoothed_loss(0), smoothed_rtt(-1), weaker_updates(0)
+{
+    // Until there's a measurement, keep FEC available.
+    current = {true, true};
+}
+
+const char *LossController::describe(const ProtectionDecision &decision)
+{
+    if (decision.fec)
+        return decision.nack ? "FEC + NACK" : "FEC only";
+    return decision.nack ? "NACK/RTX only" : "no protection";
+}
+
+/**
+ * Fewer FEC first: FEC costs bandwidth all the time, retransmissions only
+ * for what was lost.
+ */
+static bool is_weaker(const ProtectionDecision &a, const ProtectionDecision &b)
+{
+    return a.fec < b.fec || (a.fec == b.fec && a.nack < b.nack);
+}
+
+/**
+ * The decision for a loss ratio and the current smoothed RTT, without
+ * hysteresis.
+ */
+ProtectionDecision LossController::target(double loss) const
+{
+    // A retransmission needs about one RTT, plus detecting the gap and
+    // some jitter; unknown RTT is assumed short, as on a LAN.
+    const bool rtx_in_time = smoothed_rtt < 0 || smoothed_rtt * 1.5 < latency_ms;
+    const double percent = loss * 100;
+
+    if (rtx_in_time)
+        return {percent >= 10, true};
+
+    // Retransmissions would come too late; only FEC repairs in time.
+    return {percent >= 0.5, false};
+}
+
+bool LossController::update(uint64_t received, uint64_t lost, double rtt_ms)
+{
+    if (received < last_received || lost < last_lost)
+    {
+        last_received = 0;
+        last_lost = 0;
+    }
+    const uint64_t new_received = received - last_received;
+    const uint64_t new_lost = lost - last_lost;
+    if (new_received + new_lost < MIN_PACKETS)
+        return false;
+    last_received = received;
+    last_lost = lost;
+
+    const double ratio = (double)new_lost / (new_received + new_lost);
+    smoothed_loss = measured ? smoothed_loss + SMOOTHING * (ratio - smoothed_loss)
+                             : ratio;
+    measured = true;
+    if (rtt_ms >= 0)
+        smoothed_rtt = smoothed_rtt < 0 ? rtt_ms
+                                        : smoothed_rtt + SMOOTHING * (rtt_ms - smoothed_rtt);
+
+    ProtectionDecision next = target(smoothed_loss);
+    const bool weaker = is_weaker(next, current);
+    if (weaker && !is_weaker(target(smoothed_loss * DEAD_BAND), current))
+        next = current;
+    if (next == current)
+    {
+        weaker_updates = 0;
+        return false;
+    }
+    if (weaker && ++weaker_updates < HOLD_UPDATES)
+        return false;
+
+    weaker_updates = 0;
+    current = next;
+    return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * Loss-aware error protection: chooses whether to request NACK/RTX
+ * retransmissions and whether to offer FEC, from the measured packet loss
+ * and RTT.
+ */
+
+#ifndef LIVESYNC_LOSS_CONTROL_H
+#define LIVESYNC_LOSS_CONTROL_H
+
+#include <cstdint>
+
+/**
+ * What to ask the camera for. A receiver can switch its retransmission
+ * requests at any time, but FEC is only offered in a negotiation; how much
+ * of it the camera then sends is up to the camera.
+ */
+struct ProtectionDecision
+{
+    bool fec;  /* offer ULP FEC with RED in the next call */
+    bool nack; /* request retransmissions */
+
+    bool operator==(const ProtectionDecision &o) const
+    {
+        return fec == o.fec && nack == o.nack;
+    }
+    bool operator!=(const ProtectionDecision &o) const { return !(*this == o); }
+};
+
+/**
+ * Fed periodically with the receiver's packet counters and RTT.
+ *
+ * Retransmissions are cheap (only the lost packets are sent again) but
+ * only help if they arrive within the jitter buffer's latency, so with a
+ * short RTT they handle moderate loss alone, and are a waste when the RTT
+ * is too long. FEC costs bandwidth all the time but repairs without a round
+ * trip, so it is worth offering when the loss is high or the RTT too long.
+ * Stronger protection is taken into use at once, weaker only after the
+ * loss has stayed low for a few updates, so that bursty Wi-Fi doesn't make
+ * it flap.
+ *
+ * Plain C++, no GStreamer, so that bench_fec can drive it with simulated
+ * loss.
+ */
+class LossController
+{
+public:
+    /* latency_ms: the jitter buffer's latency, the deadline for repairs. */
+    explicit LossController(double latency_ms);
+
+    /* Cumulative counters of the stream: packets received and lost (before
+     * any repair). Counters going backwards, as with a new call, restart
+     * the measurement. rtt_ms < 0 if not known. Returns true if the
+     * decision changed. */
+    bool update(uint64_t received, uint64_t lost, double rtt_ms);
+
+    const ProtectionDecision &decision() const { return current; }
+
+    /* Smoothed loss ratio and RTT, as used for the decision. */
+    double loss() const { return smoothed_loss; }
+    double rtt() const { return smoothed_rtt; }
+
+    /* E.g. "FEC + NACK" or "NACK/RTX only". */
+    static const char *describe(const ProtectionDecision &decision);
+
+private:
+    ProtectionDecision target(double loss) const;
+
+    double latency_ms;
+    uint64_t last_received;
+    uint64_t last_lost;
+    bool measured;        // smoothed_loss has a value
+    double smoothed_loss;
+    double smoothed_rtt;  // < 0 if not known
+    ProtectionDecision current;
+    int weaker_updates;   // how long a weaker decision has been the target
+};
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <gst/gst.h>
 #include <gst/sdp/sdp.h>
+#include <glib-unix.h>
 
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/webrtc.h>
@@ -31,8 +32,34 @@
 #define HIGHLIGHT(__O__) std::cout << "\e[1;31m" << __O__ << "\e[0m" << std::endl
 
 #include <string.h>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
 #include <cstring>
 #include <regex>
+#include <vector>
+
+#include "camera_control.h"
+#include "codecs.h"
+#include "control_channel.h"
+#include "event_recorder.h"
+#include "frame_publisher.h"
+#include "frame_sink.h"
+#include "ice_batcher.h"
+#include "latency.h"
+#include "logger.h"
+#include "loss_control.h"
+#include "output_ladder.h"
+#include "recorder.h"
+#include "roi_crop.h"
+#include "signaling_codec.h"
+#include "signaling_queue.h"
+#include "snapshot.h"
+#include "stats_exporter.h"
+#include "timeline.h"
+#include "view_output.h"
 
 enum AppState
 {
@@ -56,41 +83,265 @@ enum AppState
     PEER_CALL_ERROR,
 };
 
+/**
+ * One camera (peer) that we receive video from. Each session owns its own
+ * pipeline, webrtcbin and call state, so that several cameras can stream into
+ * the same process over a single signaling connection.
+ */
+struct CameraSession
+{
+    guint index;           /* 1-based number, used in the UI and in names */
+    gchar *peer_id;        /* camera's name in the SignalingServer */
+    gchar *remote_ufrag;   /* ICE ufrag of the camera's answer, for routing */
+    enum AppState state;   /* call state, PEER_* values */
+    GstElement *pipe;
+    GstElement *webrtc;    /* owned by pipe */
+    gboolean camera_ready;
+    gboolean camera_free;
+    std::atomic<guint64> frames_received; /* --headless, streaming thread */
+    guint64 frames_reported;              /* --headless, main loop */
+    std::vector<ViewOutput *> view_outputs; /* --reproject, owned by pipe */
+    EventRecorder *event_recorder;          /* --pre-event, owned by pipe */
+    gint64 call_start_time;   /* monotonic time of the call, for */
+    gint64 stream_start_time; /* time-to-first-frame reports     */
+    LatencyMeter *latency;    /* lives as long as the session */
+    LossController *protection; /* --fec auto, lives as long as the session */
+    IceCandidateBatcher *candidates; /* local candidates, lives as long as the session */
+    PtzController *ptz;         /* continuous pan and zoom, lives as long as the session */
+    ControlChannel *channel;    /* --control-channel, lives as long as the session */
+    ControlLatency *control[CONTROL_TRANSPORTS]; /* command round trips, by transport */
+    GstVideoInfo control_video;   /* of the decoded frames, for those; */
+    gboolean control_video_valid; /* streaming thread only             */
+    FramePublisher *publisher;  /* --frame-ring, lives as long as the session */
+    FrameSnapshot *snapshot;    /* --snapshot-port/-socket, one of snapshots */
+    guint64 rtx_reported;       /* --fec auto, counters of the previous */
+    guint64 pushed_reported;    /* update, for the retransmission share */
+    gboolean ice_restart;       /* an ICE restart offer is to be sent */
+    gint64 restart_deadline;    /* call again if no video by then, 0 = none */
+    std::atomic<guint> ice_check_source;   /* check_ice_connection(), 0 = none */
+    guint ice_restart_source;              /* check_ice_restart(), 0 = none */
+    std::atomic<gboolean> ice_connected;
+    std::atomic<gint64> recovery_start; /* time the video was lost, 0 = not lost */
+};
+
 static GMainLoop *loop;
-static GstElement *pipe1, *webrtc1;
-static GObject *send_channel, *receive_channel;
 
-static enum AppState app_state = APP_STATE_UNKNOWN;
+static enum AppState app_state = APP_STATE_UNKNOWN; /* SERVER_* state */
 static const gchar *own_id = "LiveSYNC Gstreamer";
-static const gchar *peer_id = nullptr;
 static const gchar *server_url = nullptr;
+static gchar **peer_ids = nullptr;
+static gint max_cameras = 1;
 static gboolean disable_ssl = FALSE;
 static gboolean remote_is_offerer = FALSE;
-static gboolean camera_ready = FALSE;
-static gboolean camera_free = FALSE;
+static gboolean headless = FALSE;
+static const gchar *frame_ring = nullptr;
+static gint frame_ring_slots = 4;
+static gboolean reproject = FALSE;
+static const gchar *view_size = "1280x720";
+static gdouble view_fov = 90.0;
+static gchar **view_specs = nullptr;
+static const gchar *roi_spec = nullptr;
+static gchar **output_specs = nullptr;
+static RegionOfInterest roi;
+static const gchar *record_dir = nullptr;
+static gint record_segment_seconds = 300;
+static gint record_segment_mb = 0;
+static gint pre_event_seconds = 0;
+static gint pre_event_mb = 64;
+static gint post_event_seconds = 30;
+static const gchar *event_dir = nullptr;
+static const gchar *decoder_mode = "auto";
+static const gchar *codec_list = "VP8";
+static const gchar *fec_mode = "full";
+static gint ice_batch_ms = 0;
+static gboolean ice_all_interfaces = FALSE;
+static gint control_rate = 20;
+static gboolean control_channel = FALSE;
+static gint reconnect_attempts = -1;
+static gint reconnect_delay = 1000;
+static gboolean prewarm = FALSE;
+static gint decoder_threads = 0;
+static gint latency_interval = 10;
+static const gchar *latency_file = nullptr;
+static gint stats_interval = 5;
+static gint stats_port = 0;
+static const gchar *stats_socket = nullptr;
+static gint snapshot_port = 0;
+static const gchar *snapshot_socket = nullptr;
+static const gchar *log_levels = "info";
+static gboolean log_sync = FALSE;
+static gboolean camera_free_default = FALSE;
 static gboolean init_completed = FALSE;
 
 static GOptionEntry entries[] = {
     {"server", 0, 0, G_OPTION_ARG_STRING, &server_url,
      "Signalling server to connect to", "URL"},
+    {"peer", 0, 0, G_OPTION_ARG_STRING_ARRAY, &peer_ids,
+     "Camera to receive from, repeat for several cameras (default: any)", "ID"},
+    {"max-cameras", 0, 0, G_OPTION_ARG_INT, &max_cameras,
+     "Maximum number of cameras to receive at once (default: 1)", "N"},
     {"disable-ssl", 0, 0, G_OPTION_ARG_NONE, &disable_ssl, "Disable ssl", nullptr},
     {"remote-offerer", 0, 0, G_OPTION_ARG_NONE, &remote_is_offerer,
      "Request that the peer generate the offer and we'll answer", nullptr},
+    {"headless", 0, 0, G_OPTION_ARG_NONE, &headless,
+     "Deliver decoded frames to the app instead of showing them", nullptr},
+    {"frame-ring", 0, 0, G_OPTION_ARG_STRING, &frame_ring,
+     "With --headless, also publish the frames of camera N in the shared memory ring /NAME-N, for other processes",
+     "NAME"},
+    {"frame-ring-slots", 0, 0, G_OPTION_ARG_INT, &frame_ring_slots,
+     "Frames the --frame-ring holds, the newest is read (default: 4)", "N"},
+    {"reproject", 0, 0, G_OPTION_ARG_NONE, &reproject,
+     "Render the perspective view locally instead of on the camera", nullptr},
+    {"view-size", 0, 0, G_OPTION_ARG_STRING, &view_size,
+     "Size of the --reproject view (default: 1280x720)", "WxH"},
+    {"fov", 0, 0, G_OPTION_ARG_DOUBLE, &view_fov,
+     "Initial horizontal field of view of the --reproject view (default: 90)", "DEGREES"},
+    {"view", 0, 0, G_OPTION_ARG_STRING_ARRAY, &view_specs,
+     "A fixed view to reproject, repeat for several views (implies --reproject)",
+     "NAME=YAW,PITCH[,FOV]"},
+    {"roi", 0, 0, G_OPTION_ARG_STRING, &roi_spec,
+     "Show or deliver only this region of the frame, in fractions of its size, e.g. 0,0.35,1,0.3 for the horizon band",
+     "LEFT,TOP,WIDTH,HEIGHT"},
+    {"output", 0, 0, G_OPTION_ARG_STRING_ARRAY, &output_specs,
+     "An output of its own size and frame rate from the same decoded video, repeat for several, e.g. preview=320@5 view=1920x1080 analytics=full; a window each, or frames with --headless",
+     "NAME=SIZE[@FPS]"},
+    {"record", 0, 0, G_OPTION_ARG_FILENAME, &record_dir,
+     "Record the received video as is into this directory", "DIR"},
+    {"record-segment", 0, 0, G_OPTION_ARG_INT, &record_segment_seconds,
+     "Start a new recording file after this many seconds, 0 = never (default: 300)", "SECONDS"},
+    {"record-segment-mb", 0, 0, G_OPTION_ARG_INT, &record_segment_mb,
+     "Start a new recording file after this many megabytes, 0 = never (default: 0)", "MB"},
+    {"pre-event", 0, 0, G_OPTION_ARG_INT, &pre_event_seconds,
+     "Keep this much video in memory, to be written out when an event is triggered", "SECONDS"},
+    {"pre-event-mb", 0, 0, G_OPTION_ARG_INT, &pre_event_mb,
+     "Memory for the --pre-event video, per camera (default: 64)", "MB"},
+    {"post-event", 0, 0, G_OPTION_ARG_INT, &post_event_seconds,
+     "Keep recording this long after an event (default: 30)", "SECONDS"},
+    {"codecs", 0, 0, G_OPTION_ARG_STRING, &codec_list,
+     "Video codecs to offer, most preferred first, e.g. VP9,VP8,H264 (default: VP8)", "LIST"},
+    {"fec", 0, 0, G_OPTION_ARG_STRING, &fec_mode,
+     "full = always offer FEC, off = NACK/RTX only, auto = switch NACK by the measured loss, and offer FEC by it from the next call (default: full)", "MODE"},
+    {"ice-batch", 0, 0, G_OPTION_ARG_INT, &ice_batch_ms,
+     "Send local ICE candidates in batches collected for this long, with end-of-candidates; the camera must support it (default: 0 = one at a time)", "MS"},
+    {"ice-all-interfaces", 0, 0, G_OPTION_ARG_NONE, &ice_all_interfaces,
+     "Also send the ICE candidates of loopback, Docker and veth interfaces, and duplicates", nullptr},
+    {"control-rate", 0, 0, G_OPTION_ARG_INT, &control_rate,
+     "Send pan and zoom commands to the camera at most this many times a second (default: 20)", "HZ"},
+    {"control-channel", 0, 0, G_OPTION_ARG_NONE, &control_channel,
+     "Send camera commands over a WebRTC data channel, through the SignalingServer while it isn't open; the camera must support it", nullptr},
+    {"reconnect-attempts", 0, 0, G_OPTION_ARG_INT, &reconnect_attempts,
+     "Reconnect to the SignalingServer this many times in a row, -1 = forever, 0 = quit instead (default: -1)", "N"},
+    {"reconnect-delay", 0, 0, G_OPTION_ARG_INT, &reconnect_delay,
+     "First delay before reconnecting, growing 1.5x per attempt up to 30 s (default: 1000)", "MS"},
+    {"prewarm", 0, 0, G_OPTION_ARG_NONE, &prewarm,
+     "Build the --peer cameras' pipelines and the DTLS certificate while connecting", nullptr},
+    {"decoder", 0, 0, G_OPTION_ARG_STRING, &decoder_mode,
+     "auto = decodebin, explicit = depayloader and decoder for the negotiated codec (default: auto)", "MODE"},
+    {"decoder-threads", 0, 0, G_OPTION_ARG_INT, &decoder_threads,
+     "Video decoder threads with --decoder explicit, 0 = decoder's default", "N"},
+    {"latency-interval", 0, 0, G_OPTION_ARG_INT, &latency_interval,
+     "Print glass-to-glass and signaling latency percentiles this often, 0 = don't (default: 10)", "SECONDS"},
+    {"latency-file", 0, 0, G_OPTION_ARG_FILENAME, &latency_file,
+     "Also write the latest latency percentiles to this file as JSON", "FILE"},
+    {"stats-port", 0, 0, G_OPTION_ARG_INT, &stats_port,
+     "Serve WebRTC stats for Prometheus on http://127.0.0.1:PORT/metrics", "PORT"},
+    {"stats-socket", 0, 0, G_OPTION_ARG_FILENAME, &stats_socket,
+     "Serve WebRTC stats for Prometheus on this UNIX socket", "PATH"},
+    {"snapshot-port", 0, 0, G_OPTION_ARG_INT, &snapshot_port,
+     "Serve the latest frame as an image on http://127.0.0.1:PORT/snapshot.jpg", "PORT"},
+    {"snapshot-socket", 0, 0, G_OPTION_ARG_FILENAME, &snapshot_socket,
+     "Serve the latest frame as an image on this UNIX socket", "PATH"},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Collect WebRTC stats this often (default: 5)", "SECONDS"},
+    {"event-dir", 0, 0, G_OPTION_ARG_FILENAME, &event_dir,
+     "Directory for event recordings (default: --record DIR or the current directory)", "DIR"},
+    {"log-level", 0, 0, G_OPTION_ARG_STRING, &log_levels,
+     "error, warning, info or debug, for all or per category, e.g. info,signaling=debug (default: info)", "LEVELS"},
+    {"log-sync", 0, 0, G_OPTION_ARG_NONE, &log_sync,
+     "Write the log from the logging thread instead of a background thread", nullptr},
     {nullptr},
 };
 
 using namespace std;
+
+// All camera sessions, in the order the cameras became ready. Sessions are
+// never freed before exit, so pointers to them stay valid in callbacks.
+static std::vector<CameraSession *> sessions;
+// The camera that keyboard commands are sent to.
+static CameraSession *active_session = nullptr;
+// The camera whose offer is waiting for an answer. The camera's messages do
+// not tell who sent them, so we negotiate with one camera at a time.
+static CameraSession *negotiating_session = nullptr;
+// The camera that most recently answered, for ICE candidates without ufrag.
+static CameraSession *answered_session = nullptr;
+
+/**
+ * A perspective view to render from each camera with --reproject.
+ */
+struct NamedView
+{
+    std::string name;
+    Viewport view;
+};
+
+// The views of --view, or a single one with plain --reproject.
+static std::vector<NamedView> views;
+// The view that keyboard commands move, index into views.
+static guint active_view = 0;
+
+// The outputs of --output, largest first is best: the first drives the
+// --headless frame rate and the latency measurement.
+static std::vector<LadderRung> ladder;
+
+// The codecs of --codecs, in order of preference.
+static std::vector<const VideoCodec *> codecs;
+
+// --stats-port and --stats-socket, or nullptr.
+static StatsExporter *stats_exporter = nullptr;
+
+// --snapshot-port and --snapshot-socket, or nullptr.
+static SnapshotServer *snapshot_server = nullptr;
+// The latest frame of each camera by index - 1, for --max-cameras. Made
+// before the server starts and not changed after, so that its threads can
+// look them up without a lock.
+static std::vector<FrameSnapshot *> snapshots;
+
+// What the wait for each camera's first frame consists of.
+static StartupTimeline timeline;
+
 std::mutex _lock;
 std::condition_variable_any _cond;
 bool connect_finish = false;
 sio::socket::ptr current_socket;
 static sio::client client;
 
+// The SignalServer's events, on their way from the client's thread to the
+// main loop. Outlives the client, which may still push while it closes.
+static SignalingQueue *signaling_queue = nullptr;
+
+// The pending start_next_call() idle source, 0 = none; under _lock.
+static guint next_call_source = 0;
+
 #define STUN_SERVER " stun-server=stun://stun.l.google.com:19302 "
 #define RTP_CAPS_OPUS "application/x-rtp,media=audio,encoding-name=OPUS,payload="
 #define RTP_CAPS_VP8 "application/x-rtp,media=video,encoding-name=VP8,payload="
 #define RTP_PAYLOAD_TYPE "96"
 
+// webrtcbin's default jitter buffer latency, the deadline for repairs.
+#define WEBRTC_LATENCY_MS 200
+// How often --fec auto looks at the loss.
+#define PROTECTION_INTERVAL 2
+// How long ICE may stay disconnected before we restart it, in seconds; it
+// often comes back by itself after a short Wi-Fi blip.
+#define ICE_DISCONNECT_GRACE 3
+// How long an ICE restart may take before we call the camera again.
+#define ICE_RESTART_TIMEOUT 15
+// Longest delay between reconnection attempts, in milliseconds.
+#define RECONNECT_DELAY_MAX 30000
+
+// Monotonic time the SignalingServer connection was lost, 0 = connected.
+static gint64 signaling_lost_time = 0;
+
 /**
  * Handle cleanup and quit running the app.
  */
@@ -98,7 +349,7 @@ static gboolean cleanup_and_quit_loop(const gchar *msg, enum AppState state)
 {
     // Notify user and set app final state.
     if (msg)
-        g_printerr("Quitting the app, reason: %s\n", msg);
+        LOG_WARNING(LOG_APP, "Quitting the app, reason: %s", msg);
     if (state > 0)
         app_state = state;
 
@@ -113,17 +364,196 @@ static gboolean cleanup_and_quit_loop(const gchar *msg, enum AppState state)
         loop = nullptr;
     }
 
-    // Cleanup.
-    if (peer_id)
+    // To allow usage as a GSourceFunc.
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Find the session of a camera, or nullptr if we don't have one.
+ */
+static CameraSession *find_session(const gchar *peer)
+{
+    for (CameraSession *session : sessions)
     {
-        delete peer_id;
-        peer_id = nullptr;
+        if (g_strcmp0(session->peer_id, peer) == 0)
+            return session;
     }
+    return nullptr;
+}
+
+static void send_ice_candidates(const std::vector<IceCandidate> &batch,
+                                gpointer user_data);
+static void send_ptz_command(const CameraCommand &command, gpointer user_data);
+static void resend_camera_command(const CameraCommand &command, gpointer user_data);
+
+/**
+ * Find the session of a camera, or create one if we want to receive from it.
+ * Returns nullptr if the camera is not in --peer list or all slots are taken.
+ */
+static CameraSession *get_or_create_session(const gchar *peer)
+{
+    CameraSession *session = find_session(peer);
+    if (session)
+        return session;
+
+    if (peer_ids && !g_strv_contains(peer_ids, peer))
+    {
+        LOG_INFO(LOG_APP, "Camera %s is not in the --peer list, ignoring", peer);
+        return nullptr;
+    }
+    if ((gint)sessions.size() >= max_cameras)
+    {
+        LOG_INFO(LOG_APP, "Already receiving %d camera(s), ignoring %s",
+                 max_cameras, peer);
+        return nullptr;
+    }
+
+    session = new CameraSession();
+    session->index = sessions.size() + 1;
+    session->peer_id = g_strdup(peer);
+    session->state = PEER_CALL_STOPPED;
+    session->camera_free = camera_free_default;
+    if (latency_interval > 0)
+        session->latency = new LatencyMeter();
+    if (g_strcmp0(fec_mode, "auto") == 0)
+        session->protection = new LossController(WEBRTC_LATENCY_MS);
+    session->candidates = new IceCandidateBatcher(ice_batch_ms, !ice_all_interfaces,
+                                                  send_ice_candidates, session);
+    session->ptz = new PtzController(control_rate, send_ptz_command, session);
+    if (control_channel)
+        session->channel = new ControlChannel(resend_camera_command, session);
+    for (ControlLatency *&control : session->control)
+        control = new ControlLatency(WEBRTC_LATENCY_MS);
+    if (frame_ring)
+    {
+        gchar *name = g_strdup_printf("/%s-%u", frame_ring, session->index);
+        session->publisher = new FramePublisher(name, frame_ring_slots);
+        g_free(name);
+    }
+    if (session->index <= snapshots.size())
+        session->snapshot = snapshots[session->index - 1];
+    sessions.push_back(session);
+
+    if (!active_session)
+        active_session = session;
+
+    LOG_INFO(LOG_APP, "Camera %u: %s", session->index, session->peer_id);
+    return session;
+}
+
+static void try_start_next_call();
+
+// Pipelines whose recording is still closing, released once it has.
+static guint pipelines_closing = 0;
+
+static void release_pipeline(GstElement *pipe)
+{
+    gst_element_set_state(pipe, GST_STATE_NULL);
+    gst_object_unref(pipe);
+}
+
+static void release_closed_pipeline(GstElement *pipe)
+{
+    pipelines_closing--;
+    release_pipeline(pipe);
+}
+
+/**
+ * Stop and release a camera's pipeline, closing its recording first. On the
+ * main loop, the recording closes in the background, and the pipeline is
+ * released when it has; at exit, this waits for it.
+ */
+static void stop_pipeline(GstElement *pipe)
+{
+    Recorder *recorder = (Recorder *)g_object_get_data(G_OBJECT(pipe), "recorder");
+
+    if (!recorder)
+        release_pipeline(pipe);
+    else if (loop && g_main_loop_is_running(loop))
+    {
+        pipelines_closing++;
+        recorder->finish_async(pipe, 3 * GST_SECOND, release_closed_pipeline);
+    }
+    else
+    {
+        recorder->finish(pipe, 3 * GST_SECOND);
+        release_pipeline(pipe);
+    }
+}
+
+/**
+ * Stop and release a pipeline of an ended call, then call the next camera
+ * that is waiting. Runs on the main loop, because state changes to NULL must
+ * not happen from the pipeline's own threads.
+ */
+static gboolean finish_end_session(gpointer user_data)
+{
+    GstElement *pipe = (GstElement *)user_data;
+
+    if (pipe)
+        stop_pipeline(pipe);
+
+    _lock.lock();
+    try_start_next_call();
+    _lock.unlock();
 
-    // To allow usage as a GSourceFunc.
     return G_SOURCE_REMOVE;
 }
 
+/**
+ * Let go of the pipeline of a call. It is stopped on the main loop.
+ */
+static void detach_call(CameraSession *session)
+{
+    g_free(session->remote_ufrag);
+    session->remote_ufrag = nullptr;
+    session->view_outputs.clear(); // they go with the pipeline
+    session->event_recorder = nullptr;
+
+    if (negotiating_session == session)
+        negotiating_session = nullptr;
+    if (answered_session == session)
+        answered_session = nullptr;
+
+    session->ice_restart = FALSE;
+    session->restart_deadline = 0;
+    session->candidates->reset();
+    if (session->channel)
+        session->channel->detach();
+
+    // Detach the pipeline now, so that a new call can get a fresh one.
+    g_idle_add(finish_end_session, session->pipe);
+    session->pipe = nullptr;
+    session->webrtc = nullptr;
+}
+
+/**
+ * End the call with one camera. The app quits when no camera is left.
+ */
+static void end_session(CameraSession *session, const gchar *msg,
+                        enum AppState state)
+{
+    if (msg)
+        LOG_WARNING(LOG_WEBRTC, "Closing camera %u (%s), reason: %s", session->index,
+                    session->peer_id, msg);
+    session->state = state;
+    session->camera_ready = FALSE;
+    session->recovery_start = 0;
+    detach_call(session);
+
+    // Keep running while some camera is still streaming or may still come.
+    if ((gint)sessions.size() < max_cameras)
+        return;
+    for (CameraSession *other : sessions)
+    {
+        // A pre-warmed pipeline is still waiting for its camera to come.
+        if (other->camera_ready || other->pipe ||
+            (other->state >= PEER_CONNECTING && other->state < PEER_CALL_STOPPING))
+            return;
+    }
+    cleanup_and_quit_loop(msg, state);
+}
+
 /**
  * Convert JSON object to string.
  */
@@ -146,71 +576,235 @@ static gchar *get_string_from_json_object(JsonObject *object)
 }
 
 /**
- * Convert a JSON string into a JSON node (root) for reading.
+ * Print help to console.
  */
-static JsonNode *get_json_node_from_string(JsonParser *parser,
-                                           const string data)
+static void print_help()
 {
-    GError *err = nullptr;
-    if (!json_parser_load_from_data(parser, data.c_str(), -1, &err))
+    g_print("Type a command and hit ENTER to control the camera:\n");
+    g_print("===================================================\n");
+    g_print("help = print this message\n");
+    if (reproject)
     {
-        g_printerr("Error in parsing JSON string %s: %s",
-                   data.c_str(), err->message);
-        g_error_free(err);
-        return nullptr;
+        g_print("equi = show the whole equirectangular frame\n");
+        g_print("rect = show the perspective view\n");
+        g_print("left, right, up, down, zoom-in, zoom-out = move the view\n");
+        g_print("views = list views\n");
+        g_print("view N = move view number N with the following commands\n");
     }
     else
     {
-        // Debug print parsed JSON fields?
-        if (false)
+        g_print("equi = switch camera to equirectangular projection\n");
+        g_print("rect = switch camera to rectilinear projection\n");
+    }
+    if (pre_event_seconds > 0)
+        g_print("trigger = save the last %d seconds of video and keep recording\n",
+                pre_event_seconds);
+    g_print("pan-vector [X Y] = pan at this velocity until told otherwise, 0 0 stops\n");
+    g_print("pan-tilt [X Y], zoom-delta [V] = move the camera by a step\n");
+    g_print("cameras = list connected cameras\n");
+    g_print("camera N = send following commands to camera number N\n");
+    g_print("exit = exit from video call and quit the program\n");
+    g_print("===================================================\n");
+}
+
+/**
+ * Simple prompt.
+ */
+static void prompt()
+{
+    g_print("LiveSYNC> ");
+}
+
+/**
+ * Start (or extend) an event recording of every camera, for --pre-event.
+ * This is what the keyboard, SIGUSR1 and other triggers call.
+ */
+static void trigger_event()
+{
+    gboolean any = FALSE;
+
+    if (pre_event_seconds <= 0)
+    {
+        g_print("Start with --pre-event SECONDS to record events\n");
+        return;
+    }
+
+    _lock.lock();
+    for (CameraSession *session : sessions)
+    {
+        if (session->event_recorder)
         {
-            JsonReader *reader = json_reader_new(json_parser_get_root(parser));
-            char **members = json_reader_list_members(reader);
-            int i = 0;
-            while (members[i] != 0)
-            {
-                std::string m = members[i];
-                g_print("Found JSON key: %s\n", m.c_str());
-                /*
-                // For parsing a value, we need to know its data type. Example:
-                if (m == "key1")
-                {
-                    json_reader_read_member(reader, members[i]);
-                    std::string value = json_reader_get_string_value(reader);
-                    json_reader_end_member(reader);
-                    printf("parse member %s\n", members[i]);
-                    printf("parse value %s\n", value.c_str());
-                }*/
-                i++;
-            }
-            g_strfreev(members);
-            g_object_unref(reader);
+            g_print("Event on camera %u: ", session->index);
+            session->event_recorder->trigger();
+            any = TRUE;
         }
+    }
+    _lock.unlock();
+
+    if (!any)
+        g_print("No camera is streaming, nothing to record\n");
+}
+
+/**
+ * Trigger an event recording on SIGUSR1.
+ */
+static gboolean on_sigusr1(gpointer user_data)
+{
+    g_print("SIGUSR1 received\n");
+    trigger_event();
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Apply a view command to the active --reproject view of the active camera.
+ * Returns FALSE if the command is not a view command.
+ */
+static gboolean handle_view_command(const string &op, const string &type)
+{
+    ViewOutput *output = nullptr;
+
+    _lock.lock();
+    if (active_session && active_view < active_session->view_outputs.size())
+        output = active_session->view_outputs[active_view];
+    _lock.unlock();
 
-        return json_parser_get_root(parser);
+    if (op == "projection")
+    {
+        if (output)
+            output->set_enabled(type == "rectilinear");
+        return TRUE;
     }
+    if (op != "left" && op != "right" && op != "up" && op != "down" &&
+        op != "zoom-in" && op != "zoom-out")
+        return FALSE;
+    if (!output)
+        return TRUE;
+
+    Viewport view = output->viewport();
+    if (op == "left")
+        view.yaw = fmodf(view.yaw - 10.0f + 540.0f, 360.0f) - 180.0f;
+    else if (op == "right")
+        view.yaw = fmodf(view.yaw + 10.0f + 540.0f, 360.0f) - 180.0f;
+    else if (op == "up")
+        view.pitch = MIN(view.pitch + 10.0f, 90.0f);
+    else if (op == "down")
+        view.pitch = MAX(view.pitch - 10.0f, -90.0f);
+    else if (op == "zoom-in")
+        view.fov = MAX(view.fov / 1.25f, 20.0f);
+    else if (op == "zoom-out")
+        view.fov = MIN(view.fov * 1.25f, 150.0f);
+    output->set_viewport(view);
+    g_print("View %s of camera %u: yaw %.0f, pitch %.0f, fov %.0f\n",
+            output->name(), active_session->index, view.yaw, view.pitch,
+            view.fov);
+    return TRUE;
 }
 
 /**
- * Print help to console.
+ * Send a command to a camera through the SignalingServer.
  */
-static void print_help()
+static void send_signaling_command(CameraSession *session, const CameraCommand &command)
 {
-    g_print("Type a command and hit ENTER to control the camera:\n");
-    g_print("===================================================\n");
-    g_print("help = print this message\n");
-    g_print("equi = switch camera to equirectangular projection\n");
-    g_print("rect = switch camera to rectilinear projection\n");
-    g_print("exit = exit from video call and quit the program\n");
-    g_print("===================================================\n");
+    JsonObject *msg;
+    gchar *text;
+
+    msg = json_object_new();
+    json_object_set_string_member(msg, "target", session->peer_id);
+    json_object_set_string_member(msg, "source", own_id);
+    json_object_set_string_member(msg, "op", command.op);
+    if (command.type && *command.type)
+    {
+        json_object_set_string_member(msg, "type", command.type);
+    }
+    if (command.value != 0)
+    {
+        json_object_set_double_member(msg, "value", command.value);
+    }
+    // A pan velocity of 0, 0 stops the camera, so it is always sent.
+    gboolean velocity = strcmp(command.op, "pan-vector") == 0;
+    if (command.x != 0 || velocity)
+    {
+        json_object_set_double_member(msg, "x", command.x);
+    }
+    if (command.y != 0 || velocity)
+    {
+        json_object_set_double_member(msg, "y", command.y);
+    }
+    text = get_string_from_json_object(msg);
+    json_object_unref(msg);
+    LOG_DEBUG(LOG_SIGNALING, "SEND: 'message', %s", text);
+    current_socket->emit("message", (std::string)text);
+    g_free(text);
 }
 
 /**
- * Simple prompt.
+ * Send a command to a camera over its --control-channel once the camera
+ * has acknowledged a command there, or else through the SignalingServer,
+ * and start timing its round trip. One command is timed at a time,
+ * whichever way it went.
  */
-static void prompt()
+static void send_camera_command(CameraSession *session, const CameraCommand &command)
 {
-    g_print("LiveSYNC> ");
+    ControlTransport transport = CONTROL_DATA_CHANNEL;
+
+    if (!session->channel || !session->channel->send(command))
+    {
+        transport = CONTROL_SIGNALING;
+        send_signaling_command(session, command);
+    }
+
+    for (ControlLatency *control : session->control)
+    {
+        if (control->measuring())
+            return;
+    }
+    session->control[transport]->command_sent();
+}
+
+/**
+ * A command the camera didn't acknowledge on the control channel in time:
+ * send it again through the SignalingServer.
+ */
+static void resend_camera_command(const CameraCommand &command, gpointer user_data)
+{
+    send_signaling_command((CameraSession *)user_data, command);
+}
+
+/**
+ * Send a pan or zoom command from a camera's PtzController, on its tick.
+ */
+static void send_ptz_command(const CameraCommand &command, gpointer user_data)
+{
+    send_camera_command((CameraSession *)user_data, command);
+}
+
+/**
+ * Match a camera command that takes numbers, e.g. "pan-tilt 0.01 -0.002",
+ * for a joystick piped to stdin. Numbers left out get the defaults.
+ */
+static gboolean parse_control_command(const gchar *sz, const gchar *name,
+                                      double default_first, double default_second,
+                                      double *first, double *second)
+{
+    gsize length = strlen(name);
+    gchar *end;
+
+    if (strncmp(sz, name, length) != 0 ||
+        (sz[length] != '\0' && !g_ascii_isspace(sz[length])))
+        return FALSE;
+
+    sz += length;
+    *first = g_ascii_strtod(sz, &end);
+    if (end == sz)
+        *first = default_first;
+    if (second)
+    {
+        sz = end;
+        *second = g_ascii_strtod(sz, &end);
+        if (end == sz)
+            *second = default_second;
+    }
+    return TRUE;
 }
 
 /**
@@ -218,18 +812,78 @@ static void prompt()
  */
 static void handlecommand(gchar *sz)
 {
-    gchar *text;
-    JsonObject *ice, *msg;
     string op;
     string type;
-    double value;
-    double x;
-    double y;
+    double value = 0;
+    double x = 0;
+    double y = 0;
 
     if (strcmp(sz, "help\n") == 0)
     {
         print_help();
     }
+    else if (strcmp(sz, "cameras\n") == 0)
+    {
+        _lock.lock();
+        for (CameraSession *session : sessions)
+        {
+            g_print("%c %u: %s%s\n", session == active_session ? '*' : ' ',
+                    session->index, session->peer_id,
+                    session->state == PEER_CALL_STARTED ? " (streaming)" : "");
+        }
+        _lock.unlock();
+    }
+    else if (g_str_has_prefix(sz, "camera "))
+    {
+        guint64 index = g_ascii_strtoull(sz + strlen("camera "), NULL, 10);
+        _lock.lock();
+        if (index >= 1 && index <= sessions.size())
+        {
+            active_session = sessions[index - 1];
+            g_print("Commands now go to camera %u: %s\n",
+                    active_session->index, active_session->peer_id);
+        }
+        else
+        {
+            g_print("No such camera: %s", sz + strlen("camera "));
+        }
+        _lock.unlock();
+    }
+    else if (strcmp(sz, "trigger\n") == 0)
+    {
+        trigger_event();
+    }
+    else if (strcmp(sz, "views\n") == 0)
+    {
+        _lock.lock();
+        for (guint i = 0; i < views.size(); i++)
+        {
+            g_print("%c %u: %s", i == active_view ? '*' : ' ', i + 1,
+                    views[i].name.c_str());
+            if (active_session && i < active_session->view_outputs.size())
+            {
+                ViewOutput *output = active_session->view_outputs[i];
+                g_print(", %" G_GUINT64_FORMAT " frames rendered, %" G_GUINT64_FORMAT " skipped",
+                        output->rendered(), output->skipped());
+            }
+            g_print("\n");
+        }
+        _lock.unlock();
+    }
+    else if (g_str_has_prefix(sz, "view "))
+    {
+        guint64 index = g_ascii_strtoull(sz + strlen("view "), NULL, 10);
+        if (index >= 1 && index <= views.size())
+        {
+            active_view = index - 1;
+            g_print("Commands now move view %u: %s\n", active_view + 1,
+                    views[active_view].name.c_str());
+        }
+        else
+        {
+            g_print("No such view: %s", sz + strlen("view "));
+        }
+    }
     else if (strcmp(sz, "equi\n") == 0)
     {
         op = "projection";
@@ -264,22 +918,20 @@ static void handlecommand(gchar *sz)
     {
         op = "zoom-out";
     }
-    else if (strcmp(sz, "zoom-delta\n") == 0)
+    else if (parse_control_command(sz, "zoom-delta", -4.000244140625, 0,
+                                   &value, nullptr))
     {
         op = "zoom-delta";
-        value = -4.000244140625;
     }
-    else if (strcmp(sz, "pan-vector\n") == 0)
+    else if (parse_control_command(sz, "pan-vector", 0.0028697826244212963,
+                                   0.17291244430158606, &x, &y))
     {
         op = "pan-vector";
-        x = 0.0028697826244212963;
-        y = 0.17291244430158606;
     }
-    else if (strcmp(sz, "pan-tilt\n") == 0)
+    else if (parse_control_command(sz, "pan-tilt", 0.011101582502542789,
+                                   -0.0024806650439698494, &x, &y))
     {
         op = "pan-tilt";
-        x = 0.011101582502542789;
-        y = -0.0024806650439698494;
     }
     else if (strcmp(sz, "exit\n") == 0)
     {
@@ -292,38 +944,31 @@ static void handlecommand(gchar *sz)
         print_help();
     }
 
-    if (!op.empty())
+    if (!op.empty() && !active_session)
     {
-        msg = json_object_new();
-        json_object_set_string_member(msg, "target", peer_id);
-        json_object_set_string_member(msg, "source", own_id);
-        json_object_set_string_member(msg, "op", op.c_str());
-        if (!type.empty())
-        {
-            json_object_set_string_member(msg, "type", type.c_str());
-        }
-        if (value != 0)
-        {
-            json_object_set_double_member(msg, "value", value);
-        }
-        if (x != 0)
-        {
-            json_object_set_double_member(msg, "x", x);
-        }
-        if (y != 0)
-        {
-            json_object_set_double_member(msg, "y", y);
-        }
-        text = get_string_from_json_object(msg);
-        json_object_unref(msg);
-        g_print("SEND: 'message', %s\n", text);
-        current_socket->emit(
-            "message", (std::string)text, [&](sio::message::list const &msg)
-            {
-                // Prevent flooding the log.
-                //g_print("ACK:  'new-ice-candidate', \n");
-            });
-        g_free(text);
+        g_print("No camera connected yet\n");
+    }
+    else if (reproject && handle_view_command(op, type))
+    {
+        // Looking around is done locally, the camera keeps sending equi.
+    }
+    else if (op == "pan-vector")
+    {
+        // Continuous control goes out on the camera's tick, merged.
+        active_session->ptz->pan(x, y);
+    }
+    else if (op == "pan-tilt")
+    {
+        active_session->ptz->pan_tilt(x, y);
+    }
+    else if (op == "zoom-delta")
+    {
+        active_session->ptz->zoom(value);
+    }
+    else if (!op.empty())
+    {
+        send_camera_command(active_session,
+                            CameraCommand{op.c_str(), type.c_str(), x, y, value});
     }
 
     prompt();
@@ -356,19 +1001,284 @@ static gboolean mycallback(GIOChannel *channel, GIOCondition cond, gpointer data
 }
 
 /**
- * Called when we need to handle a media stream.
+ * Measure the latency of the video reaching a sink, if enabled.
  */
-static void handle_media_stream(GstPad *pad, GstElement *pipe,
-                                const char *convert_name, const char *sink_name)
+static void watch_latency(CameraSession *session, GstElement *sink)
 {
-    GstPad *qpad;
-    GstElement *q, *conv, *resample, *sink;
-    GstPadLinkReturn ret;
+    GstPad *pad;
 
-    g_print("Trying to handle stream with %s ! %s\n", convert_name, sink_name);
+    if (!session->latency)
+        return;
 
-    q = gst_element_factory_make("queue", NULL);
-    g_assert_nonnull(q);
+    pad = gst_element_get_static_pad(sink, "sink");
+    session->latency->watch(pad);
+    gst_object_unref(pad);
+}
+
+/**
+ * Print the latency percentiles of each camera periodically, and write them
+ * to --latency-file for scripts.
+ */
+static gboolean report_latency(gpointer user_data)
+{
+    JsonObject *root = json_object_new();
+    JsonArray *cameras = json_array_new();
+
+    for (CameraSession *session : sessions)
+    {
+        for (guint transport = 0; transport < CONTROL_TRANSPORTS; transport++)
+        {
+            ControlLatencySummary control = session->control[transport]->take_window();
+            if (control.commands > 0)
+                LOG_INFO(LOG_STATS, "Camera %u control latency over %s: to video-format p50 %.0f ms, p99 %.0f ms (%" G_GUINT64_FORMAT "); to frame change p50 %.0f ms, p99 %.0f ms (%" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " not timed, picture moving); %" G_GUINT64_FORMAT " commands timed, %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " updates sent",
+                         session->index, control_transport_names[transport],
+                         control.to_format.p50, control.to_format.p99,
+                         control.to_format.count, control.to_frame.p50,
+                         control.to_frame.p99, control.to_frame.count,
+                         control.moving, control.commands, session->ptz->sent(),
+                         session->ptz->updates());
+        }
+        if (session->channel)
+        {
+            LatencySummary acks = session->channel->take_window();
+            if (acks.count > 0)
+                LOG_INFO(LOG_STATS, "Camera %u control channel: acknowledged p50 %.1f ms, p99 %.1f ms (%" G_GUINT64_FORMAT "); %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " commands so far, %" G_GUINT64_FORMAT " resent through the SignalingServer",
+                         session->index, acks.p50, acks.p99, acks.count,
+                         session->channel->acknowledged(), session->channel->sent(),
+                         session->channel->resent());
+        }
+
+        if (!session->latency)
+            continue;
+
+        LatencySummary window = session->latency->take_window();
+        LatencySummary total = session->latency->total();
+        if (window.count > 0)
+            LOG_INFO(LOG_STATS, "Camera %u latency: p50 %.0f ms, p95 %.0f ms, p99 %.0f ms (%" G_GUINT64_FORMAT " frames)",
+                     session->index, window.p50, window.p95, window.p99,
+                     window.count);
+
+        JsonObject *camera = json_object_new();
+        json_object_set_int_member(camera, "camera", session->index);
+        json_object_set_string_member(camera, "peer", session->peer_id);
+        json_object_set_int_member(camera, "frames", window.count);
+        json_object_set_double_member(camera, "p50_ms", window.p50);
+        json_object_set_double_member(camera, "p95_ms", window.p95);
+        json_object_set_double_member(camera, "p99_ms", window.p99);
+        json_object_set_int_member(camera, "total_frames", total.count);
+        json_object_set_double_member(camera, "total_p50_ms", total.p50);
+        json_object_set_double_member(camera, "total_p95_ms", total.p95);
+        json_object_set_double_member(camera, "total_p99_ms", total.p99);
+        json_object_set_int_member(camera, "unmeasured_frames",
+                                   session->latency->unmeasured());
+        json_array_add_object_element(cameras, camera);
+    }
+    json_object_set_array_member(root, "cameras", cameras);
+
+    if (latency_file)
+    {
+        // Replaced atomically, so a script never reads half a file.
+        gchar *text = get_string_from_json_object(root);
+        GError *error = nullptr;
+        if (!g_file_set_contents(latency_file, text, -1, &error))
+        {
+            LOG_WARNING(LOG_STATS, "Can't write %s: %s", latency_file, error->message);
+            g_error_free(error);
+        }
+        g_free(text);
+    }
+    json_object_unref(root);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Print how long the SignalServer's events waited for the main loop, and how
+ * long their handlers took, periodically.
+ */
+static gboolean report_signaling(gpointer user_data)
+{
+    if (!signaling_queue)
+        return G_SOURCE_CONTINUE;
+
+    for (const SignalingEventSummary &event : signaling_queue->take_window())
+    {
+        LOG_INFO(LOG_STATS, "Signaling '%s': %" G_GUINT64_FORMAT " events, waited p50 %.0f ms, p99 %.0f ms, max %.1f ms; handled p99 %.0f ms, max %.1f ms",
+                 event.name, event.count, event.wait_p50, event.wait_p99,
+                 event.wait_max, event.handling_p99, event.handling_max);
+    }
+
+    static guint64 waits_reported = 0;
+    guint64 waits = signaling_queue->waits();
+    if (waits != waits_reported)
+    {
+        LOG_WARNING(LOG_STATS, "Signaling events backed up %" G_GUINT64_FORMAT " times, the main loop can't keep up",
+                    waits - waits_reported);
+        waits_reported = waits;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Called on a webrtcbin thread with the reply to get-stats.
+ */
+static void on_stats(GstPromise *promise, gpointer user_data)
+{
+    const gchar *labels = (const gchar *)user_data;
+
+    if (gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED)
+    {
+        const GstStructure *reply = gst_promise_get_reply(promise);
+        if (reply)
+            stats_exporter->update_webrtc(labels, reply);
+    }
+    gst_promise_unref(promise);
+}
+
+/**
+ * Ask each camera's webrtcbin for its stats, periodically. The replies come
+ * back asynchronously, and the exporter serves whatever it has at the time
+ * of a scrape, so a slow scraper never waits for webrtcbin.
+ */
+static gboolean collect_stats(gpointer user_data)
+{
+    std::vector<std::pair<GstElement *, std::string>> targets;
+
+    _lock.lock();
+    for (CameraSession *session : sessions)
+    {
+        std::string labels = "camera=\"" + std::to_string(session->index) +
+                             "\",peer=" + StatsExporter::quote(session->peer_id);
+
+        stats_exporter->set_gauge("livesync_camera_frames_received", labels,
+                                  (double)session->frames_received);
+        if (session->latency)
+        {
+            // The lifetime percentiles; the window belongs to report_latency.
+            LatencySummary total = session->latency->total();
+            stats_exporter->set_gauge("livesync_latency_p50_ms", labels, total.p50);
+            stats_exporter->set_gauge("livesync_latency_p95_ms", labels, total.p95);
+            stats_exporter->set_gauge("livesync_latency_p99_ms", labels, total.p99);
+        }
+        for (guint transport = 0; transport < CONTROL_TRANSPORTS; transport++)
+        {
+            ControlLatencySummary control = session->control[transport]->total();
+            if (control.commands == 0)
+                continue;
+            std::string transport_labels =
+                labels + ",transport=" + StatsExporter::quote(control_transport_names[transport]);
+            stats_exporter->set_gauge("livesync_control_format_p99_ms",
+                                      transport_labels, control.to_format.p99);
+            stats_exporter->set_gauge("livesync_control_frame_p99_ms",
+                                      transport_labels, control.to_frame.p99);
+            stats_exporter->set_gauge("livesync_control_frame_untimed",
+                                      transport_labels, (double)control.moving);
+        }
+        if (session->channel && session->channel->acknowledged() > 0)
+            stats_exporter->set_gauge("livesync_control_ack_p99_ms", labels,
+                                      session->channel->total().p99);
+        if (session->publisher)
+            stats_exporter->set_gauge("livesync_frame_ring_published", labels,
+                                      (double)session->publisher->published());
+        if (session->snapshot)
+        {
+            stats_exporter->set_gauge("livesync_snapshots_encoded", labels,
+                                      (double)session->snapshot->encoded());
+            stats_exporter->set_gauge("livesync_snapshots_cached", labels,
+                                      (double)session->snapshot->cached());
+        }
+        RoiCrop *crop = session->pipe ? (RoiCrop *)g_object_get_data(
+                                            G_OBJECT(session->pipe), "roi-crop")
+                                      : nullptr;
+        if (crop)
+        {
+            stats_exporter->set_gauge("livesync_roi_frames_with_meta", labels,
+                                      (double)crop->frames_with_meta());
+            stats_exporter->set_gauge("livesync_roi_frames_copied", labels,
+                                      (double)crop->frames_copied());
+        }
+        OutputLadder *outputs = session->pipe ? (OutputLadder *)g_object_get_data(
+                                                    G_OBJECT(session->pipe), "output-ladder")
+                                              : nullptr;
+        for (guint rung = 0; outputs && rung < outputs->size(); rung++)
+        {
+            std::string rung_labels =
+                labels + ",output=" + StatsExporter::quote(outputs->rung(rung).name.c_str());
+            stats_exporter->set_gauge("livesync_output_frames", rung_labels,
+                                      (double)outputs->delivered(rung));
+            stats_exporter->set_gauge("livesync_output_dropped", rung_labels,
+                                      (double)outputs->dropped(rung));
+        }
+        if (session->webrtc)
+            targets.emplace_back((GstElement *)gst_object_ref(session->webrtc),
+                                 labels);
+    }
+    _lock.unlock();
+
+    if (signaling_queue)
+    {
+        for (const SignalingEventSummary &event : signaling_queue->total())
+        {
+            std::string labels = "event=" + StatsExporter::quote(event.name);
+            stats_exporter->set_gauge("livesync_signaling_events", labels,
+                                      (double)event.count);
+            stats_exporter->set_gauge("livesync_signaling_wait_p99_ms", labels,
+                                      event.wait_p99);
+            stats_exporter->set_gauge("livesync_signaling_handling_p99_ms", labels,
+                                      event.handling_p99);
+        }
+    }
+
+    for (auto &target : targets)
+    {
+        GstPromise *promise;
+
+        promise = gst_promise_new_with_change_func(on_stats,
+                                                   g_strdup(target.second.c_str()),
+                                                   g_free);
+        g_signal_emit_by_name(target.first, "get-stats", NULL, promise);
+        gst_object_unref(target.first);
+    }
+
+    // Drop the series of calls that have ended.
+    stats_exporter->expire(3 * stats_interval * G_USEC_PER_SEC);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Add a --roi crop to a camera's pipeline, or return nullptr without one.
+ * It lives as long as the pipeline.
+ */
+static GstElement *add_roi_crop(CameraSession *session)
+{
+    if (!roi_spec)
+        return nullptr;
+
+    RoiCrop *crop = new RoiCrop(roi);
+    g_object_set_data_full(G_OBJECT(session->pipe), "roi-crop", crop,
+                           [](gpointer data)
+                           { delete (RoiCrop *)data; });
+    gst_bin_add(GST_BIN(session->pipe), crop->element());
+    gst_element_sync_state_with_parent(crop->element());
+    return crop->element();
+}
+
+/**
+ * Called when we need to handle a media stream.
+ */
+static void handle_media_stream(GstPad *pad, CameraSession *session,
+                                const char *convert_name, const char *sink_name)
+{
+    GstPad *qpad;
+    GstElement *q, *conv, *resample, *sink, *crop;
+    GstPadLinkReturn ret;
+    GstElement *pipe = session->pipe;
+
+    LOG_INFO(LOG_MEDIA, "Trying to handle stream with %s ! %s", convert_name, sink_name);
+
+    q = gst_element_factory_make("queue", NULL);
+    g_assert_nonnull(q);
     conv = gst_element_factory_make(convert_name, NULL);
     g_assert_nonnull(conv);
     sink = gst_element_factory_make(sink_name, NULL);
@@ -393,7 +1303,14 @@ static void handle_media_stream(GstPad *pad, GstElement *pipe,
         gst_element_sync_state_with_parent(q);
         gst_element_sync_state_with_parent(conv);
         gst_element_sync_state_with_parent(sink);
-        gst_element_link_many(q, conv, sink, NULL);
+        // The crop goes before videoconvert, so that only the region is
+        // converted.
+        crop = add_roi_crop(session);
+        if (crop)
+            gst_element_link_many(q, crop, conv, sink, NULL);
+        else
+            gst_element_link_many(q, conv, sink, NULL);
+        watch_latency(session, sink);
     }
 
     qpad = gst_element_get_static_pad(q, "sink");
@@ -401,25 +1318,449 @@ static void handle_media_stream(GstPad *pad, GstElement *pipe,
     ret = gst_pad_link(pad, qpad);
     g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
 
-    g_print("\n*** We are LIVE and video stream from remote camera should be visible on screen! ***\n");
+    LOG_INFO(LOG_MEDIA, "*** We are LIVE and video stream from camera %u (%s) should be visible on screen! ***",
+             session->index, session->peer_id);
 
     print_help();
     prompt();
 }
 
+/**
+ * Called on the streaming thread for every decoded frame in --headless mode.
+ * This is where in-process consumers get the frames; the reference may be
+ * kept after returning, e.g. handed over to a worker thread.
+ */
+static void on_frame(CameraSession *session, const VideoFrameRef &frame)
+{
+    if (session->frames_received++ == 0)
+    {
+        LOG_INFO(LOG_MEDIA, "Camera %u: first frame %dx%d %s, stride %d, pts %" GST_TIME_FORMAT,
+                 session->index, frame->width(), frame->height(),
+                 gst_video_format_to_string(frame->format()), frame->stride(0),
+                 GST_TIME_ARGS(frame->pts()));
+    }
+    if (session->publisher)
+        session->publisher->publish(*frame);
+}
+
+/**
+ * Print the frame rate of each camera periodically in --headless mode.
+ */
+static gboolean report_frame_rates(gpointer user_data)
+{
+    guint interval = GPOINTER_TO_UINT(user_data);
+
+    for (CameraSession *session : sessions)
+    {
+        guint64 received = session->frames_received;
+        if (received == session->frames_reported)
+            continue;
+        LOG_INFO(LOG_STATS, "Camera %u: %.1f fps", session->index,
+                 (double)(received - session->frames_reported) / interval);
+        session->frames_reported = received;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Called when we need to deliver a video stream to the app (--headless).
+ */
+static void handle_frame_stream(GstPad *pad, CameraSession *session)
+{
+    GstPad *qpad;
+    GstElement *q, *crop;
+    FrameSink *frames;
+    GstPadLinkReturn ret;
+
+    LOG_INFO(LOG_MEDIA, "Trying to handle stream with appsink");
+
+    q = gst_element_factory_make("queue", NULL);
+    g_assert_nonnull(q);
+    frames = new FrameSink();
+    frames->set_callback([session](const VideoFrameRef &frame)
+                         { on_frame(session, frame); });
+
+    // The sink lives as long as the pipeline, so the callback can't outlive
+    // the streaming threads.
+    g_object_set_data_full(G_OBJECT(session->pipe), "frame-sink", frames,
+                           [](gpointer data)
+                           { delete (FrameSink *)data; });
+
+    gst_bin_add_many(GST_BIN(session->pipe), q, frames->element(), NULL);
+    gst_element_sync_state_with_parent(q);
+    gst_element_sync_state_with_parent(frames->element());
+    // The frame sink reads a --roi region in place, from the crop meta.
+    crop = add_roi_crop(session);
+    if (crop)
+        gst_element_link_many(q, crop, frames->element(), NULL);
+    else
+        gst_element_link(q, frames->element());
+    watch_latency(session, frames->element());
+
+    qpad = gst_element_get_static_pad(q, "sink");
+
+    ret = gst_pad_link(pad, qpad);
+    g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+    gst_object_unref(qpad);
+
+    LOG_INFO(LOG_MEDIA, "*** We are LIVE and frames from camera %u (%s) are delivered to the app! ***",
+             session->index, session->peer_id);
+
+    print_help();
+    prompt();
+}
+
+/**
+ * Called when the decoded video goes to the outputs of --output: decoded
+ * once, then every output scales its own copy on its own thread.
+ */
+static void handle_ladder_stream(GstPad *pad, CameraSession *session)
+{
+    GstPad *sinkpad;
+    GstElement *crop;
+    OutputLadder *outputs;
+    GstPadLinkReturn ret;
+
+    LOG_INFO(LOG_MEDIA, "Trying to handle stream with %u output(s)", (guint)ladder.size());
+
+    outputs = new OutputLadder(ladder, headless ? LADDER_FRAMES : LADDER_WINDOWS);
+    // The first output stands in for the whole stream in --headless mode.
+    outputs->set_callback([session](guint rung, const VideoFrameRef &frame)
+                          {
+                              if (rung == 0)
+                                  on_frame(session, frame);
+                          });
+    g_object_set_data_full(G_OBJECT(session->pipe), "output-ladder", outputs,
+                           [](gpointer data)
+                           { delete (OutputLadder *)data; });
+
+    gst_bin_add(GST_BIN(session->pipe), outputs->element());
+    gst_element_sync_state_with_parent(outputs->element());
+    // Every output gets the --roi region, cropped once.
+    crop = add_roi_crop(session);
+    if (crop)
+        gst_element_link(crop, outputs->element());
+    watch_latency(session, outputs->sink(0));
+
+    sinkpad = gst_element_get_static_pad(crop ? crop : outputs->element(), "sink");
+    ret = gst_pad_link(pad, sinkpad);
+    g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+    gst_object_unref(sinkpad);
+
+    for (guint rung = 0; rung < outputs->size(); rung++)
+    {
+        const LadderRung &output = outputs->rung(rung);
+        gchar *size = !output.width   ? g_strdup("full size")
+                      : output.height ? g_strdup_printf("%dx%d", output.width, output.height)
+                                      : g_strdup_printf("%d wide", output.width);
+        gchar *rate = output.fps ? g_strdup_printf("at most %d fps", output.fps)
+                                 : g_strdup("every frame");
+        LOG_INFO(LOG_MEDIA, "Camera %u output %s: %s, %s", session->index,
+                 output.name.c_str(), size, rate);
+        g_free(rate);
+        g_free(size);
+    }
+    LOG_INFO(LOG_MEDIA, "*** We are LIVE and camera %u (%s) goes to %u outputs! ***",
+             session->index, session->peer_id, outputs->size());
+
+    print_help();
+    prompt();
+}
+
+/**
+ * Ask a camera to send the full equirectangular frame, for --reproject.
+ */
+static void request_equirectangular(CameraSession *session)
+{
+    JsonObject *msg = json_object_new();
+    gchar *text;
+
+    json_object_set_string_member(msg, "target", session->peer_id);
+    json_object_set_string_member(msg, "source", own_id);
+    json_object_set_string_member(msg, "op", "projection");
+    json_object_set_string_member(msg, "type", "equirectangular");
+    text = get_string_from_json_object(msg);
+    json_object_unref(msg);
+    LOG_INFO(LOG_SIGNALING, "SEND: 'message', %s", text);
+    current_socket->emit("message", (std::string)text);
+    g_free(text);
+}
+
+/**
+ * Called when we need to show locally reprojected views (--reproject). The
+ * video is decoded once, and every view renders the same frames on its own
+ * worker thread.
+ */
+static void handle_view_stream(GstPad *pad, CameraSession *session)
+{
+    GstPad *qpad;
+    GstElement *q, *conv;
+    FrameSink *frames;
+    std::vector<ViewOutput *> outputs;
+    GstPadLinkReturn ret;
+
+    LOG_INFO(LOG_MEDIA, "Trying to handle stream with appsink ! %u reprojected view(s)",
+             (guint)views.size());
+
+    q = gst_element_factory_make("queue", NULL);
+    g_assert_nonnull(q);
+    conv = gst_element_factory_make("videoconvert", NULL);
+    g_assert_nonnull(conv);
+    frames = new FrameSink(2, "I420");
+    gst_bin_add_many(GST_BIN(session->pipe), q, conv, frames->element(), NULL);
+
+    // They all live as long as the pipeline, like the --headless frame sink.
+    g_object_set_data_full(G_OBJECT(session->pipe), "frame-sink", frames,
+                           [](gpointer data)
+                           { delete (FrameSink *)data; });
+    for (const NamedView &named : views)
+    {
+        ViewOutput *output = new ViewOutput(named.name.c_str(), named.view);
+        gchar *key = g_strdup_printf("view-output-%s", named.name.c_str());
+        g_object_set_data_full(G_OBJECT(session->pipe), key, output,
+                               [](gpointer data)
+                               { delete (ViewOutput *)data; });
+        g_free(key);
+        gst_bin_add(GST_BIN(session->pipe), output->element());
+        gst_element_sync_state_with_parent(output->element());
+        outputs.push_back(output);
+    }
+
+    // Fan out on the streaming thread is only handing over a reference.
+    frames->set_callback([outputs](const VideoFrameRef &frame)
+                         {
+                             for (ViewOutput *output : outputs)
+                                 output->push(frame);
+                         });
+
+    gst_element_sync_state_with_parent(q);
+    gst_element_sync_state_with_parent(conv);
+    gst_element_sync_state_with_parent(frames->element());
+    gst_element_link_many(q, conv, frames->element(), NULL);
+    watch_latency(session, frames->element());
+
+    qpad = gst_element_get_static_pad(q, "sink");
+
+    ret = gst_pad_link(pad, qpad);
+    g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+    gst_object_unref(qpad);
+
+    _lock.lock();
+    session->view_outputs = outputs;
+    _lock.unlock();
+
+    request_equirectangular(session);
+
+    LOG_INFO(LOG_MEDIA, "*** We are LIVE and camera %u (%s) is reprojected locally (%s) ***",
+             session->index, session->peer_id, EquirectReprojector::simd_name());
+
+    print_help();
+    prompt();
+}
+
+/**
+ * Create the --record branch for a stream from webrtcbin, or nullptr if it
+ * can't be recorded. The recorder is owned by the pipeline.
+ */
+static Recorder *create_recorder(GstPad *pad, CameraSession *session)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    const gchar *encoding = nullptr, *media = nullptr;
+    Recorder *recorder = nullptr;
+    gchar *prefix;
+
+    if (caps)
+    {
+        GstStructure *s = gst_caps_get_structure(caps, 0);
+        encoding = gst_structure_get_string(s, "encoding-name");
+        media = gst_structure_get_string(s, "media");
+    }
+    if (!encoding)
+    {
+        LOG_WARNING(LOG_MEDIA, "Stream without an RTP encoding, not recording");
+    }
+    else if (g_strcmp0(media, "video") == 0)
+    {
+        prefix = g_strdup_printf("camera-%u", session->index);
+        recorder = Recorder::create(encoding, record_dir, prefix,
+                                    (GstClockTime)record_segment_seconds * GST_SECOND,
+                                    (guint64)record_segment_mb * 1024 * 1024);
+        g_free(prefix);
+    }
+
+    if (recorder)
+        g_object_set_data_full(G_OBJECT(session->pipe), "recorder", recorder,
+                               [](gpointer data)
+                               { delete (Recorder *)data; });
+    if (caps)
+        gst_caps_unref(caps);
+    return recorder;
+}
+
+/**
+ * Create the --pre-event branch for a stream from webrtcbin, like
+ * create_recorder().
+ */
+static EventRecorder *create_event_recorder(GstPad *pad, CameraSession *session)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    const gchar *encoding = nullptr, *media = nullptr;
+    EventRecorder *recorder = nullptr;
+    gchar *prefix;
+
+    if (caps)
+    {
+        GstStructure *s = gst_caps_get_structure(caps, 0);
+        encoding = gst_structure_get_string(s, "encoding-name");
+        media = gst_structure_get_string(s, "media");
+    }
+    if (encoding && g_strcmp0(media, "video") == 0)
+    {
+        prefix = g_strdup_printf("camera-%u", session->index);
+        recorder = EventRecorder::create(encoding,
+                                         event_dir ? event_dir : record_dir ? record_dir : ".",
+                                         prefix,
+                                         (GstClockTime)pre_event_seconds * GST_SECOND,
+                                         (gsize)pre_event_mb * 1024 * 1024,
+                                         (GstClockTime)post_event_seconds * GST_SECOND);
+        g_free(prefix);
+    }
+
+    if (recorder)
+        g_object_set_data_full(G_OBJECT(session->pipe), "event-recorder", recorder,
+                               [](gpointer data)
+                               { delete (EventRecorder *)data; });
+    if (caps)
+        gst_caps_unref(caps);
+    return recorder;
+}
+
+/**
+ * Report the time to the first decoded frame, once.
+ */
+static GstPadProbeReturn on_first_decoded_frame(GstPad *pad, GstPadProbeInfo *info,
+                                                gpointer user_data)
+{
+    CameraSession *session = (CameraSession *)user_data;
+    gint64 now = g_get_monotonic_time();
+
+    LOG_INFO(LOG_MEDIA, "Camera %u: first frame from %s %.1f ms after the stream arrived, "
+             "%.1f ms after the call started", session->index,
+             (const gchar *)g_object_get_data(G_OBJECT(pad), "decoder-path"),
+             (now - session->stream_start_time) / 1000.0,
+             (now - session->call_start_time) / 1000.0);
+    timeline.mark(session->index, "first frame");
+    timeline.print(session->index);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * Report how long the video was gone, at the first decoded frame after the
+ * connection came back. Frames still draining from the jitter buffer while
+ * ICE is down don't count.
+ */
+static GstPadProbeReturn on_recovered_frame(GstPad *pad, GstPadProbeInfo *info,
+                                            gpointer user_data)
+{
+    CameraSession *session = (CameraSession *)user_data;
+    gint64 start = session->recovery_start.load(std::memory_order_relaxed);
+
+    if (start && session->ice_connected &&
+        session->recovery_start.compare_exchange_strong(start, 0))
+        LOG_INFO(LOG_MEDIA, "Camera %u: video back %.1f s after the connection was lost",
+                 session->index, (g_get_monotonic_time() - start) / 1e6);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Keep the video info of the decoded frames for the control latency, so
+ * that a frame doesn't have to parse the caps.
+ */
+static void set_control_video(CameraSession *session, GstCaps *caps)
+{
+    session->control_video_valid = caps &&
+                                   gst_video_info_from_caps(&session->control_video, caps);
+}
+
+/**
+ * Time the camera's reaction to a command from the decoded frames, while
+ * a command is waiting for one. Otherwise a frame costs a look at each
+ * transport's measurement.
+ */
+static GstPadProbeReturn on_control_frame(GstPad *pad, GstPadProbeInfo *info,
+                                          gpointer user_data)
+{
+    CameraSession *session = (CameraSession *)user_data;
+    ControlLatency *waiting = nullptr;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        GstCaps *caps;
+
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            gst_event_parse_caps(event, &caps);
+            set_control_video(session, caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    for (ControlLatency *control : session->control)
+    {
+        if (control->waiting_for_frame())
+            waiting = control;
+    }
+    if (waiting && session->control_video_valid)
+        waiting->frame(GST_PAD_PROBE_INFO_BUFFER(info), &session->control_video);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Show or deliver decoded video, whichever decoder produced it.
+ */
+static void handle_decoded_video(GstPad *pad, CameraSession *session,
+                                 const gchar *path)
+{
+    g_object_set_data(G_OBJECT(pad), "decoder-path", (gpointer)path);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_first_decoded_frame,
+                      session, NULL);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_recovered_frame,
+                      session, NULL);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    set_control_video(session, caps);
+    if (caps)
+        gst_caps_unref(caps);
+    gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                             GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_control_frame, session, NULL);
+    if (session->snapshot)
+        session->snapshot->watch(pad);
+
+    if (!ladder.empty())
+        handle_ladder_stream(pad, session);
+    else if (headless)
+        handle_frame_stream(pad, session);
+    else if (reproject)
+        handle_view_stream(pad, session);
+    else
+        handle_media_stream(pad, session, "videoconvert", "autovideosink");
+}
+
 /**
  * Called when we get an incoming stream (video/audio).
  */
 static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad,
-                                         GstElement *pipe)
+                                         CameraSession *session)
 {
     GstCaps *caps;
     const gchar *name;
 
     if (!gst_pad_has_current_caps(pad))
     {
-        g_printerr("Pad '%s' has no caps, can't do anything, ignoring\n",
-                   GST_PAD_NAME(pad));
+        LOG_WARNING(LOG_MEDIA, "Pad '%s' has no caps, can't do anything, ignoring",
+                    GST_PAD_NAME(pad));
         return;
     }
 
@@ -428,96 +1769,230 @@ static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad,
 
     if (g_str_has_prefix(name, "video"))
     {
-        handle_media_stream(pad, pipe, "videoconvert", "autovideosink");
+        handle_decoded_video(pad, session, "decodebin");
     }
     else if (g_str_has_prefix(name, "audio"))
     {
-        handle_media_stream(pad, pipe, "audioconvert", "autoaudiosink");
+        handle_media_stream(pad, session, "audioconvert", "autoaudiosink");
     }
     else
     {
-        g_printerr("Unknown pad %s, ignoring", GST_PAD_NAME(pad));
+        LOG_WARNING(LOG_MEDIA, "Unknown pad %s, ignoring", GST_PAD_NAME(pad));
     }
 }
 
+/**
+ * Build depayloader [! parser] ! decoder for the negotiated video codec,
+ * without decodebin's typefinding and autoplugging. Returns the chain's
+ * first element, or nullptr to fall back to decodebin.
+ */
+static GstElement *create_decoder_chain(GstPad *pad, CameraSession *session)
+{
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    const gchar *encoding = nullptr, *media = nullptr;
+    const gchar *depay_name, *parse_name, *dec_name;
+    const VideoCodec *codec;
+    GstElement *depay, *parse = nullptr, *dec;
+    GstPad *srcpad;
+
+    if (caps)
+    {
+        GstStructure *s = gst_caps_get_structure(caps, 0);
+        encoding = gst_structure_get_string(s, "encoding-name");
+        media = gst_structure_get_string(s, "media");
+    }
+
+    if (g_strcmp0(media, "video") != 0 || !encoding)
+    {
+        if (caps)
+            gst_caps_unref(caps);
+        return nullptr;
+    }
+    codec = find_video_codec(encoding);
+    if (!codec)
+    {
+        LOG_WARNING(LOG_MEDIA, "No explicit decoder for %s, using decodebin", encoding);
+        gst_caps_unref(caps);
+        return nullptr;
+    }
+    gst_caps_unref(caps);
+    depay_name = codec->depay;
+    parse_name = codec->parse;
+    dec_name = codec->dec;
+
+    depay = gst_element_factory_make(depay_name, NULL);
+    dec = gst_element_factory_make(dec_name, NULL);
+    if (parse_name)
+        parse = gst_element_factory_make(parse_name, NULL);
+    if (!depay || !dec || (parse_name && !parse))
+    {
+        LOG_WARNING(LOG_MEDIA, "Missing %s, %s or %s, using decodebin", depay_name,
+                    parse_name ? parse_name : "", dec_name);
+        for (GstElement *e : {depay, parse, dec})
+        {
+            if (e)
+                gst_object_unref(gst_object_ref_sink(e));
+        }
+        return nullptr;
+    }
+
+    if (decoder_threads > 0)
+        g_object_set(dec, codec->dec_threads, decoder_threads, NULL);
+
+    gst_bin_add_many(GST_BIN(session->pipe), depay, dec, NULL);
+    if (parse)
+    {
+        gst_bin_add(GST_BIN(session->pipe), parse);
+        gst_element_link_many(depay, parse, dec, NULL);
+        gst_element_sync_state_with_parent(parse);
+    }
+    else
+    {
+        gst_element_link(depay, dec);
+    }
+    gst_element_sync_state_with_parent(depay);
+    gst_element_sync_state_with_parent(dec);
+
+    LOG_INFO(LOG_MEDIA, "Decoding with %s%s%s ! %s", depay_name, parse ? " ! " : "",
+             parse ? parse_name : "", dec_name);
+
+    srcpad = gst_element_get_static_pad(dec, "src");
+    handle_decoded_video(srcpad, session, dec_name);
+    gst_object_unref(srcpad);
+
+    return depay;
+}
+
 /**
  * Called when we get an incoming stream.
  */
-static void on_incoming_stream(GstElement *webrtc, GstPad *pad, GstElement *pipe)
+static void on_incoming_stream(GstElement *webrtc, GstPad *pad,
+                               CameraSession *session)
 {
-    GstElement *decodebin;
+    GstElement *decoder = nullptr;
     GstPad *sinkpad;
+    Recorder *recorder = nullptr;
+    EventRecorder *event_recorder = nullptr;
+    std::vector<GstElement *> branches;
 
-    g_print("-> Incoming stream\n");
+    LOG_DEBUG(LOG_WEBRTC, "-> Incoming stream");
 
     if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC)
         return;
 
-    decodebin = gst_element_factory_make("decodebin", NULL);
-    g_signal_connect(decodebin, "pad-added",
-                     G_CALLBACK(on_incoming_decodebin_stream), pipe);
-    gst_bin_add(GST_BIN(pipe), decodebin);
-    gst_element_sync_state_with_parent(decodebin);
+    session->stream_start_time = g_get_monotonic_time();
+    timeline.mark(session->index, "stream arrived");
 
-    sinkpad = gst_element_get_static_pad(decodebin, "sink");
+    // Which of the --codecs won the negotiation.
+    {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        if (caps)
+        {
+            GstStructure *s = gst_caps_get_structure(caps, 0);
+            LOG_INFO(LOG_WEBRTC, "Camera %u: receiving %s %s", session->index,
+                     gst_structure_get_string(s, "media"),
+                     gst_structure_get_string(s, "encoding-name"));
+            gst_caps_unref(caps);
+        }
+    }
+
+    if (g_strcmp0(decoder_mode, "explicit") == 0)
+        decoder = create_decoder_chain(pad, session);
+    if (!decoder)
+    {
+        decoder = gst_element_factory_make("decodebin", NULL);
+        g_signal_connect(decoder, "pad-added",
+                         G_CALLBACK(on_incoming_decodebin_stream), session);
+        gst_bin_add(GST_BIN(session->pipe), decoder);
+        gst_element_sync_state_with_parent(decoder);
+    }
+
+    if (record_dir)
+        recorder = create_recorder(pad, session);
+    if (recorder)
+        branches.push_back(recorder->element());
+    if (pre_event_seconds > 0)
+        event_recorder = create_event_recorder(pad, session);
+    if (event_recorder)
+        branches.push_back(event_recorder->element());
+
+    if (!branches.empty())
+    {
+        // RTP goes both to the decoder and, still encoded, to the recorders.
+        GstElement *tee = gst_element_factory_make("tee", NULL);
+        GstElement *q = gst_element_factory_make("queue", NULL);
+        g_assert_nonnull(tee);
+        g_assert_nonnull(q);
+        gst_bin_add_many(GST_BIN(session->pipe), tee, q, NULL);
+        gst_element_sync_state_with_parent(tee);
+        gst_element_sync_state_with_parent(q);
+        gst_element_link_many(tee, q, decoder, NULL);
+        for (GstElement *branch : branches)
+        {
+            gst_bin_add(GST_BIN(session->pipe), branch);
+            gst_element_sync_state_with_parent(branch);
+            gst_element_link(tee, branch);
+        }
+        sinkpad = gst_element_get_static_pad(tee, "sink");
+    }
+    else
+    {
+        sinkpad = gst_element_get_static_pad(decoder, "sink");
+    }
     gst_pad_link(pad, sinkpad);
     gst_object_unref(sinkpad);
+
+    if (event_recorder)
+    {
+        _lock.lock();
+        session->event_recorder = event_recorder;
+        _lock.unlock();
+    }
 }
 
 /**
- * Send ICE candidate to peer (camera).
+ * Send ICE candidates to peer (camera): one per message, or with --ice-batch
+ * a batch of them. Called by the session's IceCandidateBatcher.
  */
-static void send_ice_candidate_message(GstElement *webrtc G_GNUC_UNUSED,
-                                       guint mlineindex,
-                                       gchar *candidate,
-                                       gpointer user_data G_GNUC_UNUSED)
+static void send_ice_candidates(const std::vector<IceCandidate> &batch,
+                                gpointer user_data)
 {
-    gchar *text;
-    JsonObject *ice, *msg;
+    CameraSession *session = (CameraSession *)user_data;
 
-    if (app_state < PEER_CALL_NEGOTIATING)
+    if (session->state < PEER_CALL_NEGOTIATING)
     {
-        cleanup_and_quit_loop("Can't send ICE, not in a call!", APP_STATE_ERROR);
+        end_session(session, "Can't send ICE, not in a call!", APP_STATE_ERROR);
         return;
     }
 
-    ice = json_object_new();
-    json_object_set_string_member(ice, "candidate", candidate);
-    json_object_set_int_member(ice, "sdpMid", 0);
-    json_object_set_int_member(ice, "sdpMLineIndex", mlineindex);
-
-    msg = json_object_new();
-    json_object_set_string_member(msg, "target", peer_id);
-    json_object_set_string_member(msg, "source", own_id);
-    json_object_set_string_member(msg, "type", "new-ice-candidate");
-    json_object_set_object_member(msg, "candidate", ice);
-
-    text = get_string_from_json_object(msg);
-    json_object_unref(msg);
-
-    g_print("SEND: 'new-ice-candidate', %s\n", text);
+    std::string text =
+        ice_batch_ms > 0
+            ? encode_ice_candidates(session->peer_id, own_id, batch)
+            : encode_ice_candidate(session->peer_id, own_id, batch[0].candidate.c_str(),
+                                   batch[0].mline_index);
+
+    LOG_DEBUG(LOG_SIGNALING, "SEND: 'new-ice-candidate', %s", text.c_str());
     current_socket->emit(
-        "new-ice-candidate", (std::string)text, [&](sio::message::list const &msg)
+        "new-ice-candidate", text, [&](sio::message::list const &msg)
         {
             // Prevent flooding the log.
             //g_print("ACK:  'new-ice-candidate', \n");
         });
-
-    g_free(text);
 }
 
 /**
  * Send video offer to peer (camera).
  */
-static void send_sdp_to_peer(GstWebRTCSessionDescription *desc)
+static void send_sdp_to_peer(CameraSession *session,
+                             GstWebRTCSessionDescription *desc)
 {
     gchar *text;
-    JsonObject *msg, *sdp;
+    const gchar *type;
 
-    if (app_state < PEER_CALL_NEGOTIATING)
+    if (session->state < PEER_CALL_NEGOTIATING)
     {
-        cleanup_and_quit_loop("Can't send SDP to peer, not in a call",
-                              APP_STATE_ERROR);
+        end_session(session, "Can't send SDP to peer, not in a call",
+                    APP_STATE_ERROR);
         return;
     }
 
@@ -537,41 +2012,31 @@ static void send_sdp_to_peer(GstWebRTCSessionDescription *desc)
     //text = new char[tmp.size() + 1];
     //std::strcpy(text, tmp.c_str());
 
-    sdp = json_object_new();
     if (desc->type == GST_WEBRTC_SDP_TYPE_OFFER)
     {
-        g_print("Sending offer:\n%s\n", text);
-        json_object_set_string_member(sdp, "type", "offer");
+        LOG_INFO(LOG_WEBRTC, "Sending offer to camera %u", session->index);
+        type = "offer";
     }
     else if (desc->type == GST_WEBRTC_SDP_TYPE_ANSWER)
     {
-        g_print("Sending answer:\n%s\n", text);
-        json_object_set_string_member(sdp, "type", "answer");
+        LOG_INFO(LOG_WEBRTC, "Sending answer to camera %u", session->index);
+        type = "answer";
     }
     else
     {
         g_assert_not_reached();
     }
 
-    json_object_set_string_member(sdp, "sdp", text);
+    std::string message = encode_sdp(session->peer_id, type, text);
     g_free(text);
 
-    msg = json_object_new();
-    json_object_set_string_member(msg, "target", peer_id);
-    json_object_set_object_member(msg, "sdp", sdp);
-
-    text = get_string_from_json_object(msg);
-    json_object_unref(msg);
-
-    g_print("SEND: 'video-offer', %s\n", text);
+    LOG_DEBUG(LOG_SIGNALING, "SEND: 'video-offer', %s", message.c_str());
     current_socket->emit(
-        "video-offer", (std::string)text, [&](sio::message::list const &msg)
+        "video-offer", message, [&](sio::message::list const &msg)
         {
             // Prevent flooding the log.
             //g_print("ACK:  'video-offer', \n");
         });
-
-    g_free(text);
 }
 
 /**
@@ -579,10 +2044,11 @@ static void send_sdp_to_peer(GstWebRTCSessionDescription *desc)
  */
 static void on_offer_created(GstPromise *promise, gpointer user_data)
 {
+    CameraSession *session = (CameraSession *)user_data;
     GstWebRTCSessionDescription *offer = NULL;
     const GstStructure *reply;
 
-    g_assert_cmphex(app_state, ==, PEER_CALL_NEGOTIATING);
+    g_assert_cmphex(session->state, ==, PEER_CALL_NEGOTIATING);
 
     g_assert_cmphex(gst_promise_wait(promise), ==, GST_PROMISE_RESULT_REPLIED);
     reply = gst_promise_get_reply(promise);
@@ -591,12 +2057,13 @@ static void on_offer_created(GstPromise *promise, gpointer user_data)
     gst_promise_unref(promise);
 
     promise = gst_promise_new();
-    g_signal_emit_by_name(webrtc1, "set-local-description", offer, promise);
+    g_signal_emit_by_name(session->webrtc, "set-local-description", offer, promise);
     gst_promise_interrupt(promise);
     gst_promise_unref(promise);
 
     // Send offer to peer (camera).
-    send_sdp_to_peer(offer);
+    timeline.mark(session->index, "offer sent");
+    send_sdp_to_peer(session, offer);
     gst_webrtc_session_description_free(offer);
 }
 
@@ -605,11 +2072,13 @@ static void on_offer_created(GstPromise *promise, gpointer user_data)
  */
 static void on_negotiation_needed(GstElement *element, gpointer user_data)
 {
-    app_state = PEER_CALL_NEGOTIATING;
+    CameraSession *session = (CameraSession *)user_data;
+
+    session->state = PEER_CALL_NEGOTIATING;
 
     if (remote_is_offerer)
     {
-        g_print("NOT SUPPORTED. Currently, the receiver creates the video offer.\n");
+        LOG_INFO(LOG_WEBRTC, "NOT SUPPORTED. Currently, the receiver creates the video offer.");
     }
     else
     {
@@ -617,103 +2086,320 @@ static void on_negotiation_needed(GstElement *element, gpointer user_data)
         promise =
             gst_promise_new_with_change_func(on_offer_created, user_data, NULL);
         ;
-        g_signal_emit_by_name(webrtc1, "create-offer", NULL, promise);
+        g_signal_emit_by_name(session->webrtc, "create-offer", NULL, promise);
     }
 }
 
 /**
- * Called when there has been an error on data channel.
+ * A local ICE candidate for the camera, on a webrtcbin thread. It is sent
+ * unless it is of no use to the camera, and with --ice-batch together with
+ * the others found at about the same time.
  */
-static void data_channel_on_error(GObject *dc, gpointer user_data)
+static void on_ice_candidate(GstElement *webrtc G_GNUC_UNUSED, guint mlineindex,
+                             gchar *candidate, CameraSession *session)
 {
-    cleanup_and_quit_loop("Data channel error", APP_STATE_UNKNOWN);
+    session->candidates->add(mlineindex, candidate);
 }
 
 /**
- * Called when data channel has been opened.
+ * Notify in which ICE gathering state we currently are. Once it is complete,
+ * the camera gets the candidates that are still waiting, and with
+ * --ice-batch the end of candidates.
  */
-static void data_channel_on_open(GObject *dc, gpointer user_data)
+static void on_ice_gathering_state_notify(GstElement *webrtcbin,
+                                          GParamSpec *pspec,
+                                          gpointer user_data)
 {
-    GBytes *bytes = g_bytes_new("data", strlen("data"));
-    g_print("data channel opened\n");
-    g_signal_emit_by_name(dc, "send-string", "Hi! from GStreamer");
-    g_signal_emit_by_name(dc, "send-data", bytes);
-    g_bytes_unref(bytes);
+    CameraSession *session = (CameraSession *)user_data;
+    GstWebRTCICEGatheringState ice_gather_state;
+    const gchar *new_state = "unknown";
+
+    g_object_get(webrtcbin, "ice-gathering-state", &ice_gather_state, NULL);
+    switch (ice_gather_state)
+    {
+    case GST_WEBRTC_ICE_GATHERING_STATE_NEW:
+        new_state = "new";
+        break;
+    case GST_WEBRTC_ICE_GATHERING_STATE_GATHERING:
+        new_state = "gathering";
+        break;
+    case GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE:
+        new_state = "complete";
+        if (webrtcbin == session->webrtc)
+        {
+            session->candidates->finish();
+            timeline.mark(session->index, "candidates gathered");
+        }
+        break;
+    }
+    LOG_INFO(LOG_WEBRTC, "ICE gathering state changed to %s", new_state);
 }
 
 /**
- * Called when data channel has been closed.
+ * Called on the main loop a while after ICE was lost. If it hasn't come
+ * back by itself, restart it as soon as we can signal the camera.
  */
-static void data_channel_on_close(GObject *dc, gpointer user_data)
+static gboolean check_ice_connection(gpointer user_data)
 {
-    cleanup_and_quit_loop("Data channel closed", APP_STATE_UNKNOWN);
+    CameraSession *session = (CameraSession *)user_data;
+
+    session->ice_check_source = 0;
+    _lock.lock();
+    if (session->webrtc && !session->ice_connected && session->recovery_start &&
+        session->state == PEER_CALL_STARTED)
+    {
+        LOG_INFO(LOG_WEBRTC, "Camera %u: ICE still down, restarting it", session->index);
+        session->ice_restart = TRUE;
+        try_start_next_call();
+    }
+    _lock.unlock();
+
+    return G_SOURCE_REMOVE;
 }
 
 /**
- * Called when we receive a message via the data channel. 
+ * Called on the main loop when an ICE restart has had its time. If the
+ * video still isn't back, e.g. because the camera dropped the call, call
+ * it again with a new pipeline; the process and its other cameras stay.
  */
-static void data_channel_on_message_string(GObject *dc, gchar *str, gpointer user_data)
+static gboolean check_ice_restart(gpointer user_data)
 {
-    g_print("Received data channel message: %s\n", str);
+    CameraSession *session = (CameraSession *)user_data;
+
+    _lock.lock();
+    session->ice_restart_source = 0;
+    if (session->restart_deadline &&
+        g_get_monotonic_time() >= session->restart_deadline &&
+        session->recovery_start && session->webrtc)
+    {
+        LOG_WARNING(LOG_WEBRTC, "Camera %u: no video after the ICE restart, calling it again",
+                    session->index);
+        session->state = PEER_CALL_STOPPED;
+        detach_call(session); // the camera stays ready for the new call
+    }
+    _lock.unlock();
+
+    return G_SOURCE_REMOVE;
 }
 
 /**
- * Connect data channel signals.
+ * Send an offer with new ICE credentials on the existing webrtcbin, so that
+ * the pipeline, decoder and recordings carry on once ICE reconnects.
  */
-static void connect_data_channel_signals(GObject *data_channel)
+static void restart_ice(CameraSession *session)
 {
-    g_signal_connect(data_channel, "on-error",
-                     G_CALLBACK(data_channel_on_error), NULL);
-    g_signal_connect(data_channel, "on-open", G_CALLBACK(data_channel_on_open),
-                     NULL);
-    g_signal_connect(data_channel, "on-close",
-                     G_CALLBACK(data_channel_on_close), NULL);
-    g_signal_connect(data_channel, "on-message-string",
-                     G_CALLBACK(data_channel_on_message_string), NULL);
+    GstStructure *options;
+    GstPromise *promise;
+
+    LOG_INFO(LOG_WEBRTC, "Restarting ICE with camera %u (%s) ...", session->index,
+             session->peer_id);
+    session->ice_restart = FALSE;
+    session->state = PEER_CALL_NEGOTIATING;
+    session->restart_deadline = g_get_monotonic_time() +
+                                ICE_RESTART_TIMEOUT * G_USEC_PER_SEC;
+    negotiating_session = session;
+    session->candidates->reset();
+    if (session->ice_restart_source)
+        g_source_remove(session->ice_restart_source);
+    session->ice_restart_source =
+        g_timeout_add_seconds(ICE_RESTART_TIMEOUT, check_ice_restart, session);
+
+    options = gst_structure_new("offer-options", "ice-restart", G_TYPE_BOOLEAN,
+                                TRUE, NULL);
+    promise = gst_promise_new_with_change_func(on_offer_created, session, NULL);
+    g_signal_emit_by_name(session->webrtc, "create-offer", options, promise);
+    gst_structure_free(options);
 }
 
 /**
- * Called when we get a data channel.
+ * Notice when the camera's media connection drops and comes back. Runs on
+ * a webrtcbin thread.
  */
-static void on_data_channel(GstElement *webrtc, GObject *data_channel,
-                            gpointer user_data)
+static void on_ice_connection_state_notify(GstElement *webrtcbin,
+                                           GParamSpec *pspec,
+                                           gpointer user_data)
 {
-    connect_data_channel_signals(data_channel);
-    receive_channel = data_channel;
+    CameraSession *session = (CameraSession *)user_data;
+    GstWebRTCICEConnectionState state;
+    gint64 lost = 0;
+
+    if (webrtcbin != session->webrtc)
+        return; // a call that is being stopped
+    g_object_get(webrtcbin, "ice-connection-state", &state, NULL);
+    switch (state)
+    {
+    case GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED:
+    case GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED:
+        if (!session->ice_connected.exchange(TRUE))
+        {
+            if (session->recovery_start)
+                LOG_INFO(LOG_WEBRTC, "Camera %u: ICE connected again", session->index);
+            else
+                LOG_INFO(LOG_WEBRTC, "Camera %u: ICE connected, %u of %u local candidates sent in %u messages",
+                         session->index, session->candidates->sent(),
+                         session->candidates->gathered(), session->candidates->messages());
+        }
+        timeline.mark(session->index, "ICE connected");
+        break;
+    case GST_WEBRTC_ICE_CONNECTION_STATE_DISCONNECTED:
+    case GST_WEBRTC_ICE_CONNECTION_STATE_FAILED:
+        session->ice_connected = FALSE;
+        if (session->recovery_start.compare_exchange_strong(lost, g_get_monotonic_time()))
+        {
+            LOG_WARNING(LOG_WEBRTC, "Camera %u: ICE connection lost", session->index);
+            guint source = g_timeout_add_seconds(ICE_DISCONNECT_GRACE, check_ice_connection, session);
+            source = session->ice_check_source.exchange(source);
+            if (source)
+                g_source_remove(source);
+        }
+        break;
+    default:
+        break;
+    }
 }
 
 /**
- * Notify in which ICE gathering state we currently are.
+ * Set the FEC and NACK the video transceiver offers from --fec. Whatever is
+ * negotiated is then used by the camera until the next negotiation; the
+ * camera decides how much FEC it actually sends, a receiver has no say in
+ * that. No negotiation is started for a new FEC decision: it would cost
+ * the video it is meant to protect, so it waits for the next call, or an
+ * ICE restart if the connection is lost meanwhile.
  */
-static void on_ice_gathering_state_notify(GstElement *webrtcbin,
-                                          GParamSpec *pspec,
-                                          gpointer user_data)
+static void set_protection(CameraSession *session, GstWebRTCRTPTransceiver *trans)
 {
-    GstWebRTCICEGatheringState ice_gather_state;
-    const gchar *new_state = "unknown";
+    if (g_strcmp0(fec_mode, "full") == 0)
+    {
+        g_object_set(trans, "fec-type", GST_WEBRTC_FEC_TYPE_ULP_RED, NULL);
+        return;
+    }
 
-    g_object_get(webrtcbin, "ice-gathering-state", &ice_gather_state, NULL);
-    switch (ice_gather_state)
+    // NACK is always negotiated, so that the jitter buffer can request
+    // retransmissions whenever they are worth it.
+    const gboolean fec = session->protection && session->protection->decision().fec;
+    g_object_set(trans, "do-nack", TRUE,
+                 "fec-type", fec ? GST_WEBRTC_FEC_TYPE_ULP_RED : GST_WEBRTC_FEC_TYPE_NONE,
+                 NULL);
+}
+
+/**
+ * Keep the first jitter buffer of a call, the video's, for --fec auto. Runs
+ * on a streaming thread; the reference goes with rtpbin.
+ */
+static void on_new_jitterbuffer(GstElement *rtpbin, GstElement *jitterbuffer,
+                                guint session_id, guint ssrc, gpointer user_data)
+{
+    if (!g_object_get_data(G_OBJECT(rtpbin), "video-jitterbuffer"))
+        g_object_set_data_full(G_OBJECT(rtpbin), "video-jitterbuffer",
+                               gst_object_ref(jitterbuffer), gst_object_unref);
+}
+
+/**
+ * Feed each camera's loss and RTT to its LossController, and apply the
+ * decisions: retransmissions are switched on and off in the jitter buffer
+ * right away, while FEC can only be offered or not in a negotiation, so it
+ * is set on the transceiver for the next one (an ICE restart or a new
+ * call). The controller lives as long as the session, so a new call starts
+ * with what was learned in the previous one.
+ */
+static gboolean control_protection(gpointer user_data)
+{
+    _lock.lock();
+    for (CameraSession *session : sessions)
     {
-    case GST_WEBRTC_ICE_GATHERING_STATE_NEW:
-        new_state = "new";
-        break;
-    case GST_WEBRTC_ICE_GATHERING_STATE_GATHERING:
-        new_state = "gathering";
-        break;
-    case GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE:
-        new_state = "complete";
-        break;
+        GstElement *rtpbin, *jitterbuffer;
+        GstStructure *stats = nullptr;
+        guint64 pushed = 0, lost = 0, rtx = 0, rtx_success = 0, rtx_rtt = 0;
+
+        if (!session->protection || !session->webrtc)
+            continue;
+        rtpbin = gst_bin_get_by_name(GST_BIN(session->webrtc), "rtpbin");
+        jitterbuffer = rtpbin ? (GstElement *)g_object_get_data(G_OBJECT(rtpbin),
+                                                                "video-jitterbuffer")
+                              : nullptr;
+        if (jitterbuffer)
+            g_object_get(jitterbuffer, "stats", &stats, NULL);
+        if (!stats)
+        {
+            // No video yet.
+            if (rtpbin)
+                gst_object_unref(rtpbin);
+            continue;
+        }
+        gst_structure_get(stats, "num-pushed", G_TYPE_UINT64, &pushed,
+                          "num-lost", G_TYPE_UINT64, &lost,
+                          "rtx-count", G_TYPE_UINT64, &rtx,
+                          "rtx-success-count", G_TYPE_UINT64, &rtx_success,
+                          "rtx-rtt", G_TYPE_UINT64, &rtx_rtt, NULL);
+        gst_structure_free(stats);
+
+        // Packets that came back with a retransmission were lost first.
+        LossController *control = session->protection;
+        const bool fec = control->decision().fec;
+        gboolean changed = control->update(pushed - rtx_success, lost + rtx_success,
+                                           rtx_rtt ? rtx_rtt / 1e6 : -1.0);
+        const ProtectionDecision &decision = control->decision();
+        double rtx_share = 0;
+        if (pushed < session->pushed_reported || rtx < session->rtx_reported)
+            session->pushed_reported = session->rtx_reported = 0;
+        if (pushed > session->pushed_reported)
+            rtx_share = (double)(rtx - session->rtx_reported) /
+                        (pushed - session->pushed_reported);
+        session->pushed_reported = pushed;
+        session->rtx_reported = rtx;
+
+        gboolean nack;
+        g_object_get(jitterbuffer, "do-retransmission", &nack, NULL);
+        if (nack != (gboolean)decision.nack)
+            g_object_set(jitterbuffer, "do-retransmission", (gboolean)decision.nack, NULL);
+
+        if (changed)
+        {
+            GstWebRTCRTPTransceiver *trans = nullptr;
+
+            LOG_INFO(LOG_STATS,
+                     "Camera %u: loss %.2f%%, RTT %.0f ms, retransmitted %.1f%% -> %s%s",
+                     session->index, control->loss() * 100, control->rtt(),
+                     rtx_share * 100, LossController::describe(decision),
+                     decision.fec != fec ? " (FEC from the next call)" : "");
+            if (decision.fec != fec)
+                g_signal_emit_by_name(session->webrtc, "get-transceiver", 0, &trans);
+            if (trans)
+            {
+                set_protection(session, trans);
+                gst_object_unref(trans);
+            }
+        }
+
+        if (stats_exporter)
+        {
+            std::string labels = "camera=\"" + std::to_string(session->index) +
+                                 "\",peer=" + StatsExporter::quote(session->peer_id);
+            stats_exporter->set_gauge("livesync_protection_loss_ratio", labels,
+                                      control->loss());
+            stats_exporter->set_gauge("livesync_protection_fec_offered", labels,
+                                      decision.fec ? 1 : 0);
+            stats_exporter->set_gauge("livesync_protection_nack", labels,
+                                      decision.nack ? 1 : 0);
+            stats_exporter->set_gauge("livesync_protection_rtx_ratio", labels,
+                                      rtx_share);
+        }
+        gst_object_unref(rtpbin);
     }
-    g_print("ICE gathering state changed to %s\n", new_state);
+    _lock.unlock();
+
+    return G_SOURCE_CONTINUE;
 }
 
 /**
- * Start WebRTC pipeline and try open streams with the other end.
+ * Build a camera's WebRTC pipeline up to READY, without starting the call:
+ * the ICE agent and the transceiver exist, but nothing is negotiated before
+ * the pipeline goes to PLAYING. Returns the pipeline, or nullptr.
  */
-static gboolean start_pipeline(void)
+static GstElement *build_pipeline(CameraSession *session, GstElement **webrtc_out)
 {
-    GstStateChangeReturn ret;
+    GstElement *pipe, *webrtc;
+    gchar *name;
 
     /*
     // Send-receive pipeline, from the original example (audio removed):
@@ -731,7 +2417,7 @@ static gboolean start_pipeline(void)
 
     if (error)
     {
-        g_printerr("Failed to parse launch: %s\n", error->message);
+        LOG_ERROR(LOG_WEBRTC, "Failed to parse launch: %s", error->message);
         g_error_free(error);
         goto err;
     }
@@ -745,228 +2431,355 @@ static gboolean start_pipeline(void)
     GstWebRTCRTPTransceiver *trans = NULL;
     GstCaps *video_caps;
 
-    pipe1 = gst_pipeline_new("test-pipeline");
+    name = g_strdup_printf("camera-%u", session->index);
+    pipe = gst_pipeline_new(name);
+    g_free(name);
 
-    webrtc1 = gst_element_factory_make("webrtcbin", "sendrecv");
-    g_assert_nonnull(pipe1);
+    webrtc = gst_element_factory_make("webrtcbin", "sendrecv");
+    g_assert_nonnull(pipe);
 
-    g_object_set(webrtc1, "bundle-policy", 3, NULL);
-    gst_bin_add_many(GST_BIN(pipe1), webrtc1, NULL);
-    gst_element_sync_state_with_parent(webrtc1);
+    g_object_set(webrtc, "bundle-policy", 3, NULL);
+    if (session->latency && !LatencyMeter::enable_ntp_meta(webrtc))
+        LOG_WARNING(LOG_MEDIA, "Latency can't be measured, needs GStreamer 1.22 or newer");
+    gst_bin_add_many(GST_BIN(pipe), webrtc, NULL);
+    gst_element_sync_state_with_parent(webrtc);
 
-    g_print("setting video transceiver\n");
+    LOG_DEBUG(LOG_WEBRTC, "setting video transceiver");
     direction = GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_RECVONLY;
 
-    // VP8 encoder (works with Labpano camera).
-    video_caps = gst_caps_from_string(RTP_CAPS_VP8 "96");
+    // The --codecs in order of preference; the camera answers with the
+    // first one it supports. The Labpano camera offers VP8, VP9 and H264.
+    video_caps = create_codec_caps(codecs);
 
-    // Or, H264 encoder (also works with Labpano camera).
-    //video_caps = gst_caps_from_string("application/x-rtp,media=video,encoding-name=H264,payload=" RTP_PAYLOAD_TYPE ",clock-rate=90000,packetization-mode=(string)1, profile-level-id=(string)42c016");
-
-    g_signal_emit_by_name(webrtc1, "add-transceiver", direction, video_caps, &trans);
+    g_signal_emit_by_name(webrtc, "add-transceiver", direction, video_caps, &trans);
 
     gst_caps_unref(video_caps);
-    g_object_set(trans, "fec-type", GST_WEBRTC_FEC_TYPE_ULP_RED, "fec-percentage", 100, NULL);
+    set_protection(session, trans);
     gst_object_unref(trans);
 
+    // The jitter buffer is where retransmissions are requested and counted.
+    if (session->protection)
+    {
+        GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(webrtc), "rtpbin");
+        g_signal_connect(rtpbin, "new-jitterbuffer",
+                         G_CALLBACK(on_new_jitterbuffer), NULL);
+        gst_object_unref(rtpbin);
+    }
+
     /* This is the gstwebrtc entry point where we create the offer and so on. It
      * will be called when the pipeline goes to PLAYING. */
-    g_signal_connect(webrtc1, "on-negotiation-needed",
-                     G_CALLBACK(on_negotiation_needed), NULL);
+    g_signal_connect(webrtc, "on-negotiation-needed",
+                     G_CALLBACK(on_negotiation_needed), session);
     /* We need to transmit this ICE candidate to the camera via the Socket.IO
      * signalling server. Incoming ice candidates from the camera need to be
      * added by us too, see on_server_message() */
-    g_signal_connect(webrtc1, "on-ice-candidate",
-                     G_CALLBACK(send_ice_candidate_message), NULL);
-    g_signal_connect(webrtc1, "notify::ice-gathering-state",
-                     G_CALLBACK(on_ice_gathering_state_notify), NULL);
+    g_signal_connect(webrtc, "on-ice-candidate",
+                     G_CALLBACK(on_ice_candidate), session);
+    g_signal_connect(webrtc, "notify::ice-gathering-state",
+                     G_CALLBACK(on_ice_gathering_state_notify), session);
+    g_signal_connect(webrtc, "notify::ice-connection-state",
+                     G_CALLBACK(on_ice_connection_state_notify), session);
 
-    gst_element_set_state(pipe1, GST_STATE_READY);
+    /* Incoming streams will be exposed via this signal */
+    g_signal_connect(webrtc, "pad-added", G_CALLBACK(on_incoming_stream),
+                     session);
 
-    // Below: commented out; we don't currently use data channels with LiveSYNC.
-    /*
-    g_signal_emit_by_name(webrtc1, "create-data-channel", "channel", NULL,
-                          &send_channel);
-    if (send_channel)
+    /* Lifetime is the same as the pipeline itself, the pipeline holds the
+     * only reference (factory_make's floating ref was sunk by bin_add). */
+
+    if (gst_element_set_state(pipe, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+    {
+        gst_object_unref(pipe);
+        return nullptr;
+    }
+    *webrtc_out = webrtc;
+    return pipe;
+}
+
+/**
+ * Start WebRTC pipeline and try open streams with the other end.
+ */
+static gboolean start_pipeline(CameraSession *session)
+{
+    GstStateChangeReturn ret;
+
+    if (session->pipe)
     {
-        g_print("Created data channel\n");
-        connect_data_channel_signals(send_channel);
+        LOG_INFO(LOG_WEBRTC, "Using the pre-warmed pipeline of camera %u", session->index);
     }
     else
     {
-        g_print("Could not create data channel, is usrsctp available?\n");
+        session->pipe = build_pipeline(session, &session->webrtc);
+        if (!session->pipe)
+            goto err;
+        timeline.mark(session->index, "pipeline ready");
     }
+    session->ice_connected = FALSE;
+    session->candidates->reset();
 
-    g_signal_connect(webrtc1, "on-data-channel", G_CALLBACK(on_data_channel),
-                     NULL);
-    */
-
-    /* Incoming streams will be exposed via this signal */
-    g_signal_connect(webrtc1, "pad-added", G_CALLBACK(on_incoming_stream),
-                     pipe1);
-
-    /* Lifetime is the same as the pipeline itself */
-    gst_object_unref(webrtc1);
+    // The control channel goes into the offer, so it is made before the
+    // pipeline leaves READY. Only here, on the pipeline the call uses: a
+    // pre-warmed one may still be thrown away.
+    if (session->channel)
+    {
+        _lock.lock();
+        gboolean attached = session->channel->attach(session->webrtc);
+        _lock.unlock();
+        if (!attached)
+            LOG_WARNING(LOG_WEBRTC, "Could not create the control channel, is SCTP available? Camera commands go through the SignalingServer");
+    }
 
-    g_print("Starting Gstreamer pipeline\n");
-    ret = gst_element_set_state(GST_ELEMENT(pipe1), GST_STATE_PLAYING);
+    LOG_INFO(LOG_WEBRTC, "Starting Gstreamer pipeline for camera %u", session->index);
+    ret = gst_element_set_state(GST_ELEMENT(session->pipe), GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE)
         goto err;
 
     return TRUE;
 
 err:
-    if (pipe1)
-        g_clear_object(&pipe1);
-    if (webrtc1)
-        webrtc1 = NULL;
+    if (session->channel)
+    {
+        _lock.lock();
+        session->channel->detach();
+        _lock.unlock();
+    }
+    if (session->pipe)
+        g_clear_object(&session->pipe);
+    if (session->webrtc)
+        session->webrtc = NULL;
     return FALSE;
 }
 
 /**
- * Check camera's incoming ICE candidate, and add or reject it.
+ * --prewarm: do the slow parts of a call while the signaling handshake runs,
+ * in a thread of its own. The DTLS certificate that webrtcbin's DTLS
+ * elements share is generated when the first of them is created; building
+ * each --peer camera's pipeline to READY loads the plugins and sets up the
+ * ICE agent and the transceiver. The call then only has to go to PLAYING.
  */
-static gboolean add_ice_candidate(const gchar *text)
+static gpointer prewarm_pipelines(gpointer data)
 {
-    g_print("Checking ICE candidate from %s...\n", peer_id);
-    g_print("'new-ice-candidate' message=%s\n", text);
+    GstElement *dtls = gst_element_factory_make("dtlsdec", NULL);
+    if (dtls)
+        gst_object_unref(dtls);
+    timeline.mark(0, "DTLS certificate");
 
-    JsonNode *root;
-    JsonObject *object, *child;
-    JsonParser *parser = json_parser_new();
-    if (!json_parser_load_from_data(parser, text, -1, NULL))
+    for (gchar **peer = peer_ids; peer && *peer; peer++)
     {
-        g_printerr("Unknown message '%s', ignoring", text);
-        g_object_unref(parser);
-        return FALSE;
-    }
+        _lock.lock();
+        CameraSession *session = get_or_create_session(*peer);
+        _lock.unlock();
+        if (!session)
+            continue;
 
-    root = json_parser_get_root(parser);
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-    {
-        g_printerr("Unknown json message '%s', ignoring", text);
-        g_object_unref(parser);
-        return FALSE;
+        GstElement *webrtc = nullptr;
+        GstElement *pipe = build_pipeline(session, &webrtc);
+        if (!pipe)
+        {
+            LOG_WARNING(LOG_WEBRTC, "Can't pre-warm the pipeline of camera %u", session->index);
+            continue;
+        }
+
+        // The camera may have been called meanwhile with a pipeline of its own,
+        // which the main loop sets up without the lock: look at the state
+        // first.
+        _lock.lock();
+        gboolean used = (session->state < PEER_CONNECTING ||
+                         session->state >= PEER_CALL_STOPPING) &&
+                        !session->pipe;
+        if (used)
+        {
+            session->pipe = pipe;
+            session->webrtc = webrtc;
+            timeline.mark(session->index, "pipeline ready");
+        }
+        _lock.unlock();
+
+        if (!used)
+        {
+            gst_element_set_state(pipe, GST_STATE_NULL);
+            gst_object_unref(pipe);
+        }
     }
+    return NULL;
+}
 
-    object = json_node_get_object(root);
-    if (json_object_has_member(object, "candidate"))
-    {
-        const gchar *candidate;
-        gint sdpmlineindex;
+/**
+ * Read the ICE username fragment from a session description.
+ */
+static gchar *get_ice_ufrag(const GstSDPMessage *sdp)
+{
+    const gchar *ufrag = gst_sdp_message_get_attribute_val(sdp, "ice-ufrag");
 
-        child = json_object_get_object_member(object, "candidate");
-        candidate = json_object_get_string_member(child, "candidate");
-        sdpmlineindex = json_object_get_int_member(child, "sdpMLineIndex");
+    if (!ufrag && gst_sdp_message_medias_len(sdp) > 0)
+        ufrag = gst_sdp_media_get_attribute_val(
+            gst_sdp_message_get_media(sdp, 0), "ice-ufrag");
 
-        // Add ice candidate sent by remote peer.
-        g_signal_emit_by_name(webrtc1, "add-ice-candidate", sdpmlineindex,
-                              candidate);
+    return g_strdup(ufrag);
+}
 
-        return TRUE;
-    }
-    else
+/**
+ * Pick the camera that sent an ICE candidate. The camera's messages only
+ * name the target (us), so unless a 'source' is given, match the candidate's
+ * ufrag to the camera's answer, or fall back to the camera that answered last.
+ */
+static CameraSession *find_session_for_candidate(const gchar *source,
+                                                 const gchar *candidate)
+{
+    const gchar *pos;
+
+    if (source)
+        return find_session(source);
+
+    pos = strstr(candidate, " ufrag ");
+    if (pos)
     {
-        g_printerr("Ignoring unknown JSON message:\n%s\n", text);
+        gchar *ufrag;
+        pos += strlen(" ufrag ");
+        ufrag = g_strndup(pos, strcspn(pos, " "));
+        for (CameraSession *session : sessions)
+        {
+            if (g_strcmp0(session->remote_ufrag, ufrag) == 0)
+            {
+                g_free(ufrag);
+                return session;
+            }
+        }
+        g_free(ufrag);
     }
-    g_object_unref(parser);
 
-    return FALSE;
+    return answered_session;
 }
 
 /**
- * Check camera's answer to our video offer, and accept or reject call.
+ * Check camera's incoming ICE candidate, and add or reject it. On failure,
+ * session is set if the candidate could be matched to a camera.
  */
-static gboolean accept_call(const gchar *text)
+static gboolean add_ice_candidate(const string &text, CameraSession **session)
 {
-    g_print("Checking video answer from %s...\n", peer_id);
-    g_print("'video-answer' message=%s\n", text);
+    // Kept between messages, and only used on the main loop, so that decoding
+    // a candidate reuses the strings of the previous one.
+    static IceCandidateMessage message;
 
-    JsonNode *root;
-    JsonObject *object, *child;
-    JsonParser *parser = json_parser_new();
-    if (!json_parser_load_from_data(parser, text, -1, NULL))
+    LOG_DEBUG(LOG_SIGNALING, "Checking ICE candidate...");
+    LOG_DEBUG(LOG_SIGNALING, "'new-ice-candidate' message=%s", text.c_str());
+
+    *session = nullptr;
+
+    if (!decode_ice_candidate(text, &message))
     {
-        g_printerr("Unknown message '%s', ignoring", text);
-        g_object_unref(parser);
+        LOG_WARNING(LOG_SIGNALING, "Ignoring unknown JSON message:\n%s", text.c_str());
         return FALSE;
     }
 
-    root = json_parser_get_root(parser);
-    if (!JSON_NODE_HOLDS_OBJECT(root))
+    *session = find_session_for_candidate(
+        message.has_source ? message.source.c_str() : nullptr,
+        message.candidate.c_str());
+    if (!*session || !(*session)->webrtc)
     {
-        g_printerr("Unknown json message '%s', ignoring", text);
-        g_object_unref(parser);
-        return FALSE;
+        // Not from any of our cameras, e.g. a camera that we are not
+        // receiving from. Harmless, so don't fail the call.
+        LOG_DEBUG(LOG_SIGNALING, "ICE candidate is not for any of our cameras, ignoring");
+        *session = nullptr;
+        return TRUE;
     }
 
-    object = json_node_get_object(root);
-    if (json_object_has_member(object, "sdp"))
-    {
-        int ret;
-        GstSDPMessage *sdp;
-        const gchar *text, *sdptype;
-        GstWebRTCSessionDescription *answer;
+    // Add ice candidate sent by remote peer.
+    g_signal_emit_by_name((*session)->webrtc, "add-ice-candidate",
+                          message.mline_index, message.candidate.c_str());
 
-        g_assert_cmphex(app_state, ==, PEER_CALL_NEGOTIATING);
+    return TRUE;
+}
 
-        child = json_object_get_object_member(object, "sdp");
+/**
+ * Check camera's answer to our video offer, and accept or reject call. On
+ * failure, session is set if the answer could be matched to a camera.
+ */
+static gboolean accept_call(const string &text, CameraSession **session)
+{
+    // Kept between messages, as in add_ice_candidate().
+    static SdpMessage message;
 
-        if (!json_object_has_member(child, "type"))
-        {
-            cleanup_and_quit_loop("ERROR: received SDP without 'type'",
-                                  PEER_CALL_ERROR);
-            return FALSE;
-        }
+    LOG_DEBUG(LOG_SIGNALING, "Checking video answer...");
+    LOG_DEBUG(LOG_SIGNALING, "'video-answer' message=%s", text.c_str());
 
-        sdptype = json_object_get_string_member(child, "type");
+    *session = nullptr;
 
-        text = json_object_get_string_member(child, "sdp");
-        ret = gst_sdp_message_new(&sdp);
-        g_assert_cmphex(ret, ==, GST_SDP_OK);
-        ret = gst_sdp_message_parse_buffer((guint8 *)text, strlen(text), sdp);
-        g_assert_cmphex(ret, ==, GST_SDP_OK);
+    if (!decode_sdp(text, &message))
+    {
+        LOG_WARNING(LOG_SIGNALING, "Unknown message '%s', ignoring", text.c_str());
+        return FALSE;
+    }
 
-        if (g_str_equal(sdptype, "answer"))
-        {
-            g_print("Parsed SDP from 'video-answer':\n%s\n", text);
-            answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER,
-                                                        sdp);
-            g_assert_nonnull(answer);
+    // We only have one offer out at a time, so that's what this answers.
+    if (message.has_source)
+        *session = find_session(message.source.c_str());
+    else
+        *session = negotiating_session;
+    if (!*session || (*session)->state != PEER_CALL_NEGOTIATING)
+    {
+        LOG_WARNING(LOG_SIGNALING, "Not negotiating with this camera, ignoring answer");
+        *session = nullptr;
+        return FALSE;
+    }
 
-            // Set remote description on our pipeline.
-            {
-                GstPromise *promise = gst_promise_new();
-                g_signal_emit_by_name(webrtc1, "set-remote-description", answer,
-                                      promise);
-                gst_promise_interrupt(promise);
-                gst_promise_unref(promise);
-            }
-            app_state = PEER_CALL_STARTED;
-            return TRUE;
-        }
-        else
-        {
-            g_printerr("Expected answer but received offer:\n%s\n", text);
-        }
+    if (!message.has_sdp)
+    {
+        LOG_WARNING(LOG_SIGNALING, "Ignoring unknown JSON message:\n%s", text.c_str());
+        return FALSE;
     }
-    else
+    if (message.type.empty())
+    {
+        LOG_ERROR(LOG_SIGNALING, "ERROR: received SDP without 'type'");
+        return FALSE;
+    }
+    if (message.type != "answer")
     {
-        g_printerr("Ignoring unknown JSON message:\n%s\n", text);
+        LOG_WARNING(LOG_SIGNALING, "Expected answer but received offer:\n%s", text.c_str());
+        return FALSE;
     }
-    g_object_unref(parser);
 
-    return FALSE;
+    int ret;
+    GstSDPMessage *sdp;
+    GstWebRTCSessionDescription *answer;
+
+    ret = gst_sdp_message_new(&sdp);
+    g_assert_cmphex(ret, ==, GST_SDP_OK);
+    ret = gst_sdp_message_parse_buffer((const guint8 *)message.sdp.data(),
+                                       message.sdp.size(), sdp);
+    g_assert_cmphex(ret, ==, GST_SDP_OK);
+
+    LOG_INFO(LOG_WEBRTC, "Answer from camera %u", (*session)->index);
+    LOG_DEBUG(LOG_WEBRTC, "Parsed SDP from 'video-answer' of camera %u:\n%s",
+              (*session)->index, message.sdp.c_str());
+    g_free((*session)->remote_ufrag);
+    (*session)->remote_ufrag = get_ice_ufrag(sdp);
+    answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+    g_assert_nonnull(answer);
+
+    // Set remote description on our pipeline.
+    {
+        GstPromise *promise = gst_promise_new();
+        g_signal_emit_by_name((*session)->webrtc, "set-remote-description",
+                              answer, promise);
+        gst_promise_interrupt(promise);
+        gst_promise_unref(promise);
+    }
+    gst_webrtc_session_description_free(answer);
+    (*session)->state = PEER_CALL_STARTED;
+    negotiating_session = nullptr;
+    answered_session = *session;
+    timeline.mark((*session)->index, "answer received");
+    return TRUE;
 }
 
 /**
  * Try to call to the camera device.
  */
-static gboolean setup_call()
+static gboolean setup_call(CameraSession *session)
 {
-    g_print("Trying to call to %s ...\n", peer_id);
-
-    app_state = PEER_CONNECTING;
+    LOG_INFO(LOG_WEBRTC, "Trying to call to camera %u (%s) ...", session->index,
+             session->peer_id);
 
     // Note: unlike webrtc-sendrecv example, we don't have any mechanism in
     // place for reserving a peer for an upcoming call via the SignalServer
@@ -976,18 +2789,129 @@ static gboolean setup_call()
     // In case of multiple clients competing for the same camera resource, we
     // could add a call-response system for reserving the camera in our use.
 
-    app_state = PEER_CONNECTED;
+    session->state = PEER_CONNECTED;
+    session->call_start_time = g_get_monotonic_time();
+    timeline.mark(session->index, "call started");
 
     // Start negotiation (exchange SDP and ICE candidates).
-    if (!start_pipeline())
-        cleanup_and_quit_loop("ERROR: failed to start pipeline",
-                              PEER_CALL_ERROR);
+    if (!start_pipeline(session))
+        return FALSE;
 
     return TRUE;
 }
 
 /**
- * Listener for connection events related to the signaling server.
+ * Call the next camera that is ready and free, unless we are still
+ * negotiating with another one. Runs on the main loop. The camera is picked
+ * under _lock, but called without it: building its pipeline and starting it
+ * takes a while, and the streaming threads of the other cameras take the
+ * lock.
+ */
+static gboolean start_next_call(gpointer user_data)
+{
+    CameraSession *call = nullptr;
+
+    _lock.lock();
+    next_call_source = 0;
+    if (!init_completed || negotiating_session)
+    {
+        _lock.unlock();
+        return G_SOURCE_REMOVE;
+    }
+
+    // Calls that are to be rescued come first.
+    for (CameraSession *session : sessions)
+    {
+        if (session->ice_restart && session->webrtc)
+        {
+            restart_ice(session);
+            _lock.unlock();
+            return G_SOURCE_REMOVE;
+        }
+    }
+
+    for (CameraSession *session : sessions)
+    {
+        if (session->camera_ready && session->camera_free &&
+            (session->state < PEER_CONNECTING || session->state >= PEER_CALL_STOPPING))
+        {
+            // Taken: --prewarm leaves the camera's pipeline alone from now.
+            session->state = PEER_CONNECTING;
+            negotiating_session = session;
+            call = session;
+            break;
+        }
+    }
+    _lock.unlock();
+
+    // On failure, ending the session tries the next camera.
+    if (call && !setup_call(call))
+    {
+        _lock.lock();
+        end_session(call, "ERROR: Failed to setup call!", PEER_CALL_ERROR);
+        _lock.unlock();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Have the next camera called from the main loop, see start_next_call().
+ * With _lock held.
+ */
+static void try_start_next_call()
+{
+    if (!next_call_source)
+        next_call_source = g_idle_add(start_next_call, NULL);
+}
+
+/**
+ * Pick the camera that a 'client-count' status is about. Unless the status
+ * names its source, assume it is about the camera we are negotiating with,
+ * or else the latest camera that is not in a call yet.
+ */
+static CameraSession *find_session_for_status(const gchar *source)
+{
+    if (source)
+        return find_session(source);
+    if (negotiating_session)
+        return negotiating_session;
+
+    for (auto it = sessions.rbegin(); it != sessions.rend(); ++it)
+    {
+        if ((*it)->state < PEER_CONNECTING || (*it)->state >= PEER_CALL_STOPPING)
+            return *it;
+    }
+    return nullptr;
+}
+
+/**
+ * The connection to the SignalingServer was lost, and the client is about
+ * to reconnect. The calls keep running meanwhile; we only have to register
+ * again, and redo any offer that may have been lost.
+ */
+static void on_reconnecting(const SignalingEvent &event)
+{
+    _lock.lock();
+    init_completed = FALSE;
+    if (negotiating_session)
+    {
+        CameraSession *session = negotiating_session;
+        negotiating_session = nullptr;
+        if (session->webrtc && session->state == PEER_CALL_NEGOTIATING)
+            session->ice_restart = TRUE;
+        else
+        {
+            session->state = PEER_CALL_STOPPED;
+            detach_call(session);
+        }
+    }
+    _lock.unlock();
+}
+
+/**
+ * Listener for connection events related to the signaling server. Runs on
+ * the Socket.IO client's thread; what touches the calls is queued for the
+ * main loop.
  */
 class connection_listener
 {
@@ -1001,30 +2925,89 @@ public:
         _lock.lock();
         _cond.notify_all();
         connect_finish = true;
-        _lock.unlock();
         app_state = SERVER_CONNECTED;
-        g_print("Successfully connected to SignalingServer\n");
+        if (signaling_lost_time)
+        {
+            LOG_INFO(LOG_SIGNALING, "Reconnected to SignalingServer after %.1f s",
+                     (g_get_monotonic_time() - signaling_lost_time) / 1e6);
+            signaling_lost_time = 0;
+        }
+        else
+        {
+            LOG_INFO(LOG_SIGNALING, "Successfully connected to SignalingServer");
+            timeline.mark(0, "connected to server");
+        }
+        _lock.unlock();
+    }
+
+    /**
+     * The connection dropped (or a reconnect failed) and the client will try
+     * again after delay ms. The state is set right away, as the server's
+     * 'init' after the reconnect checks it.
+     */
+    void on_reconnect(unsigned attempt, unsigned delay)
+    {
+        if (!signaling_lost_time)
+        {
+            LOG_WARNING(LOG_SIGNALING, "Lost connection to SignalingServer");
+            signaling_lost_time = g_get_monotonic_time();
+        }
+        app_state = SERVER_CONNECTING;
+        LOG_INFO(LOG_SIGNALING, "Reconnecting in %.1f s (attempt %u) ...", delay / 1000.0,
+                 attempt + 1);
+        signaling_queue->push(on_reconnecting, "reconnect", nullptr);
     }
+
+    /* Only when giving up: the client reconnects by itself until then. */
     void on_close(sio::client::close_reason const &reason)
     {
-        g_print("\nConnection to SignalingServer closed, reason: %d\n", reason);
+        LOG_INFO(LOG_SIGNALING, "Connection to SignalingServer closed, reason: %d", reason);
         // reason: 0=normal, 1=drop
 
-        //TODO Error handling/reconnect logic if needed (or use auto reconnect).
-
         app_state = SERVER_CLOSED;
         cleanup_and_quit_loop("Server connection closed", APP_STATE_UNKNOWN);
     }
 
     void on_fail()
     {
-        g_printerr("Connection to SignalingServer failed (is it running?)\n");
+        LOG_ERROR(LOG_SIGNALING, "Connection to SignalingServer failed (is it running?)");
 
         app_state = SERVER_CONNECTION_ERROR;
         cleanup_and_quit_loop("Server connection failed", APP_STATE_ERROR);
+
+        // Don't leave main waiting for the first connection.
+        _lock.lock();
+        connect_finish = true;
+        _cond.notify_all();
+        _lock.unlock();
     }
 };
 
+/**
+ * The SignalServer's ACK to our 'init': value is its boolean status.
+ */
+static void on_registered(const SignalingEvent &event)
+{
+    if (event.value)
+    {
+        LOG_INFO(LOG_SIGNALING, "ACK:  'init', registration OK");
+        app_state = SERVER_REGISTERED;
+        timeline.mark(0, "registered");
+
+        _lock.lock();
+        init_completed = TRUE;
+        try_start_next_call();
+        _lock.unlock();
+    }
+    else
+    {
+        LOG_ERROR(LOG_SIGNALING, "ACK:  'init', registration FAILED");
+        app_state = SERVER_REGISTRATION_ERROR;
+
+        cleanup_and_quit_loop("Server registration failed", APP_STATE_ERROR);
+    }
+}
+
 /**
  * Send a response to SignalServer's 'init' message (register us as a receiver).
  */
@@ -1039,12 +3022,11 @@ static void response_to_init(sio::socket::ptr current_socket)
     sio::message::ptr jsonObj = sio::object_message::create();
     jsonObj->get_map()["sub"] = sio::string_message::create(own_id);
     jsonObj->get_map()["role"] = sio::string_message::create("receiver");
-    g_print("SEND: 'init', {'sub':'%s', 'role': 'receiver'} \n", own_id);
+    LOG_INFO(LOG_SIGNALING, "SEND: 'init', {'sub':'%s', 'role': 'receiver'}", own_id);
     current_socket->emit(
         "init", jsonObj, [&](sio::message::list const &msg)
         {
             // The SignalServer will response with an ACK and a boolean status.
-            g_print("ACK:  'init', ");
             if (msg.size() > 0)
             {
                 sio::message::ptr ack = msg[0]; // There should be only one msg.
@@ -1053,29 +3035,8 @@ static void response_to_init(sio::socket::ptr current_socket)
                 case sio::message::flag_boolean:
                 {
                     // ACK to 'init' message should contain a boolean response.
-                    bool initialized = ack->get_bool();
-                    if (initialized)
-                    {
-                        g_print("registration OK\n");
-                        app_state = SERVER_REGISTERED;
-
-                        init_completed = TRUE;
-                        if (camera_free && camera_ready)
-                        {
-                            if (!setup_call())
-                            {
-                                cleanup_and_quit_loop("ERROR: Failed to setup call!\n",
-                                                      PEER_CALL_ERROR);
-                            }
-                        }
-                    }
-                    else
-                    {
-                        g_print("registration FAILED\n");
-                        app_state = SERVER_REGISTRATION_ERROR;
-
-                        cleanup_and_quit_loop("Server registration failed", APP_STATE_ERROR);
-                    }
+                    signaling_queue->push(on_registered, "init-ack", nullptr,
+                                          ack->get_bool());
                     break;
                 }
                 /*
@@ -1089,297 +3050,250 @@ static void response_to_init(sio::socket::ptr current_socket)
                 */
                 default:
                 {
-                    g_printerr("Unexpected response type from signaling server: %d",
-                               ack->get_flag());
+                    LOG_ERROR(LOG_SIGNALING, "Unexpected response type from signaling server: %d",
+                              ack->get_flag());
                     break;
                 }
                 }
             }
             else
             {
-                g_printerr("Unexpected response type from signaling server: empty ack\n");
+                LOG_ERROR(LOG_SIGNALING, "Unexpected response type from signaling server: empty ack");
             }
         });
 }
 
+/*
+ * Handlers of the SignalServer's events. They run on the main loop, one at a
+ * time and in the order the events came, so they only take _lock for what
+ * the prewarm and streaming threads share with them.
+ */
+
+/**
+ * Upon connect, the SignalServer sends 'init' request and we must respond.
+ * Keep listening: after a reconnect the server asks us to register again.
+ */
+static void on_init(const SignalingEvent &event)
+{
+    if (app_state == SERVER_CONNECTED)
+    {
+        LOG_INFO(LOG_SIGNALING, "RECV: 'init' -> Attempt to register...");
+        app_state = SERVER_REGISTERING;
+        response_to_init(current_socket);
+    }
+}
+
+/**
+ * When a camera device has successfully connected to the SignalServer.
+ */
+static void on_device_authenticated(const SignalingEvent &event)
+{
+    if (event.has_text)
+        LOG_INFO(LOG_SIGNALING, "RECV: 'device-authenticated', %s", event.text.c_str());
+    else
+        LOG_WARNING(LOG_SIGNALING, "RECV: invalid data, check API!");
+}
+
+/**
+ * When a camera device is ready for a call.
+ */
+static void on_device_ready(const SignalingEvent &event)
+{
+    if (!event.has_text)
+    {
+        LOG_WARNING(LOG_SIGNALING, "RECV: invalid data, check API!");
+        return;
+    }
+    LOG_INFO(LOG_SIGNALING, "RECV: 'device-ready', %s", event.text.c_str());
+
+    _lock.lock();
+    CameraSession *session = get_or_create_session(event.text.c_str());
+    if (session)
+    {
+        session->camera_ready = TRUE;
+        timeline.mark(session->index, "camera ready");
+        try_start_next_call();
+    }
+    _lock.unlock();
+}
+
+/**
+ * When a camera device has disconnected from the SignalServer.
+ */
+static void on_device_disconnected(const SignalingEvent &event)
+{
+    if (!event.has_text)
+    {
+        LOG_WARNING(LOG_SIGNALING, "RECV: invalid data, check API!");
+        return;
+    }
+    LOG_INFO(LOG_SIGNALING, "RECV: 'device-disconnected', %s", event.text.c_str());
+
+    _lock.lock();
+    CameraSession *session = find_session(event.text.c_str());
+    if (session)
+        session->camera_ready = FALSE;
+    _lock.unlock();
+}
+
+/**
+ * Number of clients the camera device supports and currently has.
+ */
+static void on_client_count(const SignalingEvent &event)
+{
+    // Kept between messages, as in add_ice_candidate().
+    static ClientCountMessage count;
+
+    if (!event.has_text || !decode_client_count(event.text, &count))
+    {
+        LOG_WARNING(LOG_SIGNALING, "RECV: invalid data, check API!");
+        return;
+    }
+    LOG_INFO(LOG_SIGNALING, "RECV: 'client-count', connected %d/%d, streaming %d/%d",
+             count.connected, count.max_connected, count.streaming, count.max_streaming);
+
+    gboolean free = count.connected < count.max_connected &&
+                    count.streaming < count.max_streaming;
+    _lock.lock();
+    CameraSession *session = find_session_for_status(
+        count.has_source ? count.source.c_str() : nullptr);
+    if (session)
+        session->camera_free = free;
+    else
+        camera_free_default = free;
+    if (session && free)
+        timeline.mark(session->index, "camera free");
+    if (free)
+        try_start_next_call();
+    _lock.unlock();
+
+    if (free)
+        LOG_INFO(LOG_SIGNALING, "Camera is currently free.");
+    else
+        LOG_INFO(LOG_SIGNALING, "Camera is currently reserved.");
+}
+
+/**
+ * The type of video format (projection) currently active on camera device.
+ */
+static void on_video_format(const SignalingEvent &event)
+{
+    static string projection;
+
+    if (event.has_text && decode_video_format(event.text, &projection))
+        LOG_INFO(LOG_SIGNALING, "RECV: 'video-format', projection=%s", projection.c_str());
+    else
+        LOG_WARNING(LOG_SIGNALING, "RECV: invalid data, check API!");
+
+    // The camera answers the commands of the active camera.
+    _lock.lock();
+    if (active_session)
+    {
+        for (ControlLatency *control : active_session->control)
+            control->video_format_received();
+    }
+    _lock.unlock();
+}
+
+static void on_video_answer(const SignalingEvent &event)
+{
+    _lock.lock();
+    if (negotiating_session)
+    {
+        LOG_INFO(LOG_SIGNALING, "RECV: 'video-answer' -> checking");
+
+        CameraSession *session;
+        if (accept_call(event.text, &session))
+        {
+            LOG_INFO(LOG_WEBRTC, "Video answer was accepted, waiting for ICE candidates...");
+            try_start_next_call();
+        }
+        else if (session)
+        {
+            LOG_WARNING(LOG_WEBRTC, "Video answer was rejected, closing camera %u...",
+                        session->index);
+            end_session(session, "ERROR: Failed to setup call!", PEER_CALL_ERROR);
+        }
+        else
+        {
+            LOG_ERROR(LOG_WEBRTC, "Video answer was rejected, now quitting...");
+            cleanup_and_quit_loop("ERROR: Failed to setup call!", PEER_CALL_ERROR);
+        }
+    }
+    else
+    {
+        LOG_WARNING(LOG_SIGNALING, "RECV: 'video'answer', but app is in wrong state!");
+    }
+    _lock.unlock();
+}
+
+static void on_new_ice_candidate(const SignalingEvent &event)
+{
+    LOG_DEBUG(LOG_SIGNALING, "RECV: 'new-ice-candidate' -> adding...");
+
+    _lock.lock();
+    CameraSession *session;
+    if (add_ice_candidate(event.text, &session))
+    {
+        LOG_DEBUG(LOG_SIGNALING, "ICE candidate was added");
+    }
+    else
+    {
+        LOG_ERROR(LOG_SIGNALING, "ICE candidate was rejected, now quitting...");
+        cleanup_and_quit_loop("ERROR: Failed to setup call!", PEER_CALL_ERROR);
+    }
+    _lock.unlock();
+}
+
+/**
+ * Events that we only log: 'ready', 'video-offer', 'hang-up', 'message'.
+ */
+static void on_unhandled(const SignalingEvent &event)
+{
+    LOG_INFO(LOG_SIGNALING, "RECV: '%s' -> ", event.name);
+}
+
+static void on_connect_error(const SignalingEvent &event)
+{
+    LOG_WARNING(LOG_SIGNALING, "RECV: 'connect_error' -> ");
+}
+
+/**
+ * Queue the SignalServer's event for handler, which runs on the main loop.
+ * The listener runs on the Socket.IO client's thread, and only copies the
+ * event's data if it is a string, the only kind the handlers use.
+ */
+static void bind_event(const gchar *name, SignalingHandler handler)
+{
+    current_socket->on(name, sio::socket::event_listener_aux(
+                                 [name, handler](string const &event, sio::message::ptr const &data,
+                                                 bool isAck, sio::message::list &ack_resp)
+                                 {
+                                     if (data && data->get_flag() == sio::message::flag_string)
+                                         signaling_queue->push(handler, name, &data->get_string());
+                                     else
+                                         signaling_queue->push(handler, name, nullptr);
+                                 }));
+}
+
 /**
  * Bind to known signals and handle them.
  */
 void bind_events()
 {
-    // Upon connect, the SignalServer sends 'init' request and we must respond.
-    // (VS Code auto-format does a bad job formatting here... sorry!)
-    current_socket->on("init", sio::socket::event_listener_aux(
-                                   [&](string const &name, sio::message::ptr const &data,
-                                       bool isAck, sio::message::list &ack_resp)
-                                   {
-                                       _lock.lock();
-
-                                       bool response = false;
-                                       if (app_state == SERVER_CONNECTED)
-                                       {
-                                           g_print("RECV: 'init' -> Attempt to register...\n");
-                                           app_state = SERVER_REGISTERING;
-                                           response = true;
-                                       }
-
-                                       _cond.notify_all();
-                                       _lock.unlock();
-
-                                       // No need to listen to "init" anymore.
-                                       current_socket->off("init");
-
-                                       if (response)
-                                       {
-                                           response_to_init(current_socket);
-                                       }
-                                   }));
-
-    // When a camera device has successfully connected to the SignalServer.
-    current_socket->on("device-authenticated", sio::socket::event_listener_aux(
-                                                   [&](string const &name, sio::message::ptr const &data,
-                                                       bool isAck, sio::message::list &ack_resp)
-                                                   {
-                                                       _lock.lock();
-                                                       if (data->get_flag() == sio::message::flag_string)
-                                                       {
-                                                           g_print("RECV: 'device-authenticated', %s\n",
-                                                                   data->get_string().c_str());
-                                                       }
-                                                       else
-                                                       {
-                                                           g_printerr("RECV: invalid data, check API!\n");
-                                                       }
-                                                       _lock.unlock();
-                                                   }));
-
-    // When a camera device is ready for a call.
-    current_socket->on("device-ready", sio::socket::event_listener_aux(
-                                           [&](string const &name, sio::message::ptr const &data,
-                                               bool isAck, sio::message::list &ack_resp)
-                                           {
-                                               _lock.lock();
-                                               if (data->get_flag() == sio::message::flag_string)
-                                               {
-                                                   g_print("RECV: 'device-ready', %s\n",
-                                                           data->get_string().c_str());
-
-                                                   peer_id = g_strdup(data->get_string().c_str());
-                                                   camera_ready = TRUE;
-
-                                                   if (camera_free && init_completed)
-                                                   {
-                                                       if (!setup_call())
-                                                       {
-                                                           cleanup_and_quit_loop("ERROR: Failed to setup call!\n",
-                                                                                 PEER_CALL_ERROR);
-                                                       }
-                                                   }
-                                               }
-                                               else
-                                               {
-                                                   g_printerr("RECV: invalid data, check API!\n");
-                                               }
-                                               _lock.unlock();
-                                           }));
-
-    // When a camera device has disconnected from the SignalServer.
-    current_socket->on("device-disconnected", sio::socket::event_listener_aux(
-                                                  [&](string const &name, sio::message::ptr const &data,
-                                                      bool isAck, sio::message::list &ack_resp)
-                                                  {
-                                                      _lock.lock();
-                                                      if (data->get_flag() == sio::message::flag_string)
-                                                      {
-                                                          g_print("RECV: 'device-disconnected', %s\n",
-                                                                  data->get_string().c_str());
-                                                      }
-                                                      else
-                                                      {
-                                                          g_printerr("RECV: invalid data, check API!\n");
-                                                      }
-
-                                                      _lock.unlock();
-                                                  }));
-
-    // Number of clients the camera device supports and currently has.
-    current_socket->on("client-count", sio::socket::event_listener_aux(
-                                           [&](string const &name, sio::message::ptr const &data,
-                                               bool isAck, sio::message::list &ack_resp)
-                                           {
-                                               _lock.lock();
-                                               if (data->get_flag() == sio::message::flag_string)
-                                               {
-                                                   //g_print("RECV: 'client-count', %s\n",
-                                                   //        data->get_string().c_str());
-                                                   JsonParser *parser = json_parser_new();
-                                                   JsonNode *root = get_json_node_from_string(parser,
-                                                                                              data->get_string());
-                                                   JsonReader *reader = json_reader_new(root);
-                                                   json_reader_read_member(reader, "connected-clients");
-                                                   int conClients = json_reader_get_int_value(reader);
-                                                   json_reader_end_member(reader);
-                                                   json_reader_read_member(reader, "max-connected-clients");
-                                                   int maxConClients = json_reader_get_int_value(reader);
-                                                   json_reader_end_member(reader);
-                                                   json_reader_read_member(reader, "streaming-clients");
-                                                   int strClients = json_reader_get_int_value(reader);
-                                                   json_reader_end_member(reader);
-                                                   json_reader_read_member(reader, "max-streaming-clients");
-                                                   int maxStrClients = json_reader_get_int_value(reader);
-                                                   json_reader_end_member(reader);
-                                                   g_object_unref(reader);
-                                                   g_object_unref(parser);
-                                                   g_print("RECV: 'client-count', connected %d/%d, streaming %d/%d\n",
-                                                           conClients, maxConClients, strClients, maxStrClients);
-
-                                                   if (conClients < maxConClients && strClients < maxStrClients)
-                                                   {
-                                                       g_print("Camera is currently free.\n");
-                                                       camera_free = TRUE;
-
-                                                       if (camera_ready && init_completed)
-                                                       {
-                                                           if (!setup_call())
-                                                           {
-                                                               cleanup_and_quit_loop("ERROR: Failed to setup call!\n",
-                                                                                     PEER_CALL_ERROR);
-                                                           }
-                                                       }
-                                                   }
-                                                   else
-                                                   {
-                                                       g_print("Camera is currently reserved.\n");
-                                                       camera_free = FALSE;
-                                                   }
-                                               }
-                                               else
-                                               {
-                                                   g_printerr("RECV: invalid data, check API!\n");
-                                               }
-                                               _lock.unlock();
-                                           }));
-
-    // The type of video format (projection) currently active on camera device.
-    current_socket->on("video-format", sio::socket::event_listener_aux(
-                                           [&](string const &name, sio::message::ptr const &data,
-                                               bool isAck, sio::message::list &ack_resp)
-                                           {
-                                               _lock.lock();
-                                               if (data->get_flag() == sio::message::flag_string)
-                                               {
-                                                   JsonParser *parser = json_parser_new();
-                                                   JsonNode *root = get_json_node_from_string(parser,
-                                                                                              data->get_string());
-                                                   JsonReader *reader = json_reader_new(root);
-                                                   json_reader_read_member(reader, "projection");
-                                                   string projection = json_reader_get_string_value(reader);
-                                                   json_reader_end_member(reader);
-                                                   g_object_unref(reader);
-                                                   g_object_unref(parser);
-                                                   g_print("RECV: 'video-format', projection=%s\n",
-                                                           projection.c_str());
-                                               }
-                                               else
-                                               {
-                                                   g_printerr("RECV: invalid data, check API!\n");
-                                               }
-
-                                               _lock.unlock();
-                                           }));
-
-    current_socket->on("ready", sio::socket::event_listener_aux(
-                                    [&](string const &name, sio::message::ptr const &data,
-                                        bool isAck, sio::message::list &ack_resp)
-                                    {
-                                        _lock.lock();
-                                        g_print("RECV: 'ready' -> \n");
-                                        _lock.unlock();
-                                    }));
-
-    current_socket->on("video-offer", sio::socket::event_listener_aux(
-                                          [&](string const &name, sio::message::ptr const &data,
-                                              bool isAck, sio::message::list &ack_resp)
-                                          {
-                                              _lock.lock();
-                                              g_print("RECV: 'video-offer' -> \n");
-                                              _lock.unlock();
-                                          }));
-
-    current_socket->on("video-answer", sio::socket::event_listener_aux(
-                                           [&](string const &name, sio::message::ptr const &data,
-                                               bool isAck, sio::message::list &ack_resp)
-                                           {
-                                               _lock.lock();
-                                               if (app_state == PEER_CALL_NEGOTIATING)
-                                               {
-                                                   g_print("RECV: 'video-answer' -> checking\n");
-
-                                                   if (accept_call(data->get_string().c_str()))
-                                                   {
-                                                       g_print("Video answer was accepted, waiting for ICE candidates...\n");
-                                                   }
-                                                   else
-                                                   {
-                                                       g_print("Video answer was rejected, now quitting...\n");
-                                                       cleanup_and_quit_loop("ERROR: Failed to setup call!",
-                                                                             PEER_CALL_ERROR);
-                                                   }
-                                               }
-                                               else
-                                               {
-                                                   g_printerr("RECV: 'video'answer', but app is in wrong state!\n");
-                                               }
-                                               _lock.unlock();
-                                           }));
-
-    current_socket->on("new-ice-candidate", sio::socket::event_listener_aux(
-                                                [&](string const &name, sio::message::ptr const &data,
-                                                    bool isAck, sio::message::list &ack_resp)
-                                                {
-                                                    _lock.lock();
-                                                    g_print("RECV: 'new-ice-candidate' -> adding...\n");
-
-                                                    if (add_ice_candidate(data->get_string().c_str()))
-                                                    {
-                                                        g_print("ICE candidate was added\n");
-                                                    }
-                                                    else
-                                                    {
-                                                        g_print("ICE candidate was rejected, now quitting...\n");
-                                                        cleanup_and_quit_loop("ERROR: Failed to setup call!",
-                                                                              PEER_CALL_ERROR);
-                                                    }
-
-                                                    _lock.unlock();
-                                                }));
-
-    current_socket->on("hang-up", sio::socket::event_listener_aux(
-                                      [&](string const &name, sio::message::ptr const &data,
-                                          bool isAck, sio::message::list &ack_resp)
-                                      {
-                                          _lock.lock();
-                                          g_print("RECV: 'hang-up' -> \n");
-                                          _lock.unlock();
-                                      }));
-
-    current_socket->on("message", sio::socket::event_listener_aux(
-                                      [&](string const &name, sio::message::ptr const &data,
-                                          bool isAck, sio::message::list &ack_resp)
-                                      {
-                                          _lock.lock();
-                                          g_print("RECV: 'message' -> \n");
-                                          _lock.unlock();
-                                      }));
-
-    current_socket->on("connect_error", sio::socket::event_listener_aux(
-                                            [&](string const &name, sio::message::ptr const &data,
-                                                bool isAck, sio::message::list &ack_resp)
-                                            {
-                                                _lock.lock();
-                                                g_print("RECV: 'connect_error' -> \n");
-                                                _lock.unlock();
-                                            }));
+    bind_event("init", on_init);
+    bind_event("device-authenticated", on_device_authenticated);
+    bind_event("device-ready", on_device_ready);
+    bind_event("device-disconnected", on_device_disconnected);
+    bind_event("client-count", on_client_count);
+    bind_event("video-format", on_video_format);
+    bind_event("ready", on_unhandled);
+    bind_event("video-offer", on_unhandled);
+    bind_event("video-answer", on_video_answer);
+    bind_event("new-ice-candidate", on_new_ice_candidate);
+    bind_event("hang-up", on_unhandled);
+    bind_event("message", on_unhandled);
+    bind_event("connect_error", on_connect_error);
 }
 
 /*
@@ -1394,15 +3308,34 @@ static void connect_to_socketio_server_async(void)
 
     app_state = SERVER_CONNECTING;
 
-    // First, setup connection listener for Socket.IO client.
-    connection_listener l(client);
+    // First, setup connection listener for Socket.IO client. It must outlive
+    // this function, as the client calls it for as long as it runs.
+    static connection_listener l(client);
     client.set_open_listener(std::bind(&connection_listener::on_connected, &l));
     client.set_close_listener(std::bind(&connection_listener::on_close, &l,
                                         std::placeholders::_1));
     client.set_fail_listener(std::bind(&connection_listener::on_fail, &l));
+    client.set_reconnect_listener(std::bind(&connection_listener::on_reconnect, &l,
+                                            std::placeholders::_1,
+                                            std::placeholders::_2));
+
+    // Reconnect with a growing delay, by default forever: a camera on Wi-Fi
+    // comes back, and so does the server after a restart.
+    if (reconnect_attempts >= 0)
+        client.set_reconnect_attempts(reconnect_attempts);
+    client.set_reconnect_delay(reconnect_delay);
+    client.set_reconnect_delay_max(MAX(reconnect_delay, RECONNECT_DELAY_MAX));
+
+    // Open socket for sending/receiving messages, and bind events to handle
+    // them. This is done before connecting: the client joins the namespace
+    // as soon as the connection opens, and the server may send 'init' right
+    // away, which would be lost if nobody listened yet.
+    current_socket = client.socket();
+    signaling_queue = new SignalingQueue();
+    bind_events();
 
     // Second, try to connect to the given server URL.
-    g_print("Connecting to SignalingServer %s ...\n", server_url);
+    LOG_INFO(LOG_SIGNALING, "Connecting to SignalingServer %s ...", server_url);
     //client.set_logs_verbose();
     client.connect(server_url);
 
@@ -1413,15 +3346,11 @@ static void connect_to_socketio_server_async(void)
         _cond.wait(_lock);
     }
     _lock.unlock();
-
-    // Open socket for sending/receiving messages.
-    current_socket = client.socket();
+    if (!loop)
+        return; // failed, and already cleaned up
 
     // The SignalServer uses the default namespace '/'.
-    g_print("Namespace: %s\n", current_socket->get_namespace().c_str());
-
-    // Bind events to handle them.
-    bind_events();
+    LOG_DEBUG(LOG_SIGNALING, "Namespace: %s", current_socket->get_namespace().c_str());
 }
 
 /**
@@ -1463,11 +3392,62 @@ static gboolean check_plugins(void)
     return ret;
 }
 
+/**
+ * Set up the --reproject views from the command line. Returns FALSE if an
+ * option is malformed.
+ */
+static gboolean parse_views(void)
+{
+    Viewport base = {0.0f, 0.0f, (float)view_fov, 0, 0};
+
+    if (sscanf(view_size, "%dx%d", &base.width, &base.height) != 2 ||
+        base.width < 2 || base.height < 2)
+    {
+        g_printerr("Invalid --view-size %s, expected e.g. 1280x720\n", view_size);
+        return FALSE;
+    }
+
+    if (!view_specs)
+    {
+        views.push_back({"main", base});
+        return TRUE;
+    }
+
+    for (gchar **spec = view_specs; *spec; spec++)
+    {
+        NamedView named = {"", base};
+        const gchar *angles = strchr(*spec, '=');
+        int n = angles ? sscanf(angles + 1, "%f,%f,%f", &named.view.yaw,
+                                &named.view.pitch, &named.view.fov)
+                       : 0;
+        if (n < 2 || angles == *spec)
+        {
+            g_printerr("Invalid --view %s, expected e.g. door=90,-10,70\n", *spec);
+            return FALSE;
+        }
+        named.name.assign(*spec, angles - *spec);
+        // The name keys the view's bin and output in the pipeline.
+        for (const NamedView &other : views)
+        {
+            if (other.name == named.name)
+            {
+                g_printerr("Duplicate --view name %s\n", named.name.c_str());
+                return FALSE;
+            }
+        }
+        views.push_back(named);
+    }
+    return TRUE;
+}
+
 /**
  * Main function - the program starts from here.
  */
 int main(int argc, char *argv[])
 {
+    // Line by line also when piped, e.g. into bench_startup or a log.
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
     g_print("*** LiveSYNC Gstreamer example ***\n");
     app_state = APP_STATE_INITIALIZING;
 
@@ -1497,6 +3477,113 @@ int main(int argc, char *argv[])
         g_printerr(" OK\n");
     }
 
+    // Each camera given with --peer gets its own slot.
+    if (peer_ids)
+        max_cameras = MAX(max_cameras, (gint)g_strv_length(peer_ids));
+
+    // Recordings go into an existing directory or one we create.
+    if (record_dir && g_mkdir_with_parents(record_dir, 0755) != 0)
+    {
+        g_printerr("Can't create --record directory %s: %s\n", record_dir,
+                   g_strerror(errno));
+        return -1;
+    }
+    if (event_dir && g_mkdir_with_parents(event_dir, 0755) != 0)
+    {
+        g_printerr("Can't create --event-dir directory %s: %s\n", event_dir,
+                   g_strerror(errno));
+        return -1;
+    }
+
+    if (!parse_codec_list(codec_list, &codecs))
+        return -1;
+
+    if (g_strcmp0(fec_mode, "full") != 0 && g_strcmp0(fec_mode, "off") != 0 &&
+        g_strcmp0(fec_mode, "auto") != 0)
+    {
+        g_printerr("--fec must be full, off or auto\n");
+        return -1;
+    }
+
+    if (g_strcmp0(decoder_mode, "auto") != 0 &&
+        g_strcmp0(decoder_mode, "explicit") != 0)
+    {
+        g_printerr("--decoder must be auto or explicit\n");
+        return -1;
+    }
+
+    // Fixed views are rendered locally.
+    if (view_specs)
+        reproject = TRUE;
+    if (reproject && !parse_views())
+        return -1;
+
+    if (roi_spec && !parse_region_of_interest(roi_spec, &roi))
+    {
+        g_printerr("Invalid --roi %s, expected fractions of the frame, e.g. 0,0.35,1,0.3\n",
+                   roi_spec);
+        return -1;
+    }
+    for (gchar **spec = output_specs; spec && *spec; spec++)
+    {
+        LadderRung rung;
+        if (!parse_ladder_rung(*spec, &rung))
+        {
+            g_printerr("Invalid --output %s, expected e.g. preview=320@5, view=1920x1080 or analytics=full\n",
+                       *spec);
+            return -1;
+        }
+        // The name keys the rung's branch in the pipeline.
+        for (const LadderRung &other : ladder)
+        {
+            if (other.name == rung.name)
+            {
+                g_printerr("Duplicate --output name %s\n", rung.name.c_str());
+                return -1;
+            }
+        }
+        ladder.push_back(rung);
+    }
+    if (frame_ring && (!headless || frame_ring_slots < 2 ||
+                       frame_ring_slots > FRAME_RING_MAX_SLOTS))
+    {
+        g_printerr("--frame-ring needs --headless, and 2 to %d --frame-ring-slots\n",
+                   FRAME_RING_MAX_SLOTS);
+        return -1;
+    }
+    if (!ladder.empty() && reproject)
+    {
+        g_printerr("--output can't be combined with --reproject\n");
+        return -1;
+    }
+
+    if (roi_spec && reproject)
+    {
+        // The views are rendered from the whole sphere.
+        g_printerr("--roi is ignored with --reproject\n");
+        roi_spec = nullptr;
+    }
+
+    if (stats_port < 0 || stats_port > 65535)
+    {
+        g_printerr("--stats-port must be 1..65535\n");
+        return -1;
+    }
+    if (snapshot_port < 0 || snapshot_port > 65535)
+    {
+        g_printerr("--snapshot-port must be 1..65535\n");
+        return -1;
+    }
+    if (stats_interval <= 0)
+        stats_interval = 5;
+
+    if (!log_set_levels(log_levels))
+    {
+        g_printerr("--log-level must be e.g. info or warning,signaling=debug; "
+                   "categories are app, signaling, webrtc, media and stats\n");
+        return -1;
+    }
+
     // Check required Gstreamer plugins.
     if (!check_plugins())
         return -1;
@@ -1520,25 +3607,116 @@ int main(int argc, char *argv[])
     //prompt();
     g_io_add_watch(channel, G_IO_IN, mycallback, NULL);
 
+    // Events can also be triggered from outside, with kill -USR1.
+    if (pre_event_seconds > 0)
+        g_unix_signal_add(SIGUSR1, on_sigusr1, NULL);
+
+    // Report how frames are coming in when nobody is watching them.
+    if (headless)
+        g_timeout_add_seconds(5, report_frame_rates, GUINT_TO_POINTER(5));
+    if (latency_interval > 0)
+    {
+        g_timeout_add_seconds(latency_interval, report_latency, NULL);
+        g_timeout_add_seconds(latency_interval, report_signaling, NULL);
+    }
+
+    if (g_strcmp0(fec_mode, "auto") == 0)
+        g_timeout_add_seconds(PROTECTION_INTERVAL, control_protection, NULL);
+
+    // Export stats for monitoring, with rates over the last minute or so.
+    if (stats_port > 0 || stats_socket)
+    {
+        stats_exporter = new StatsExporter(MAX(2, 60 / stats_interval));
+        if ((stats_port > 0 && !stats_exporter->listen_tcp(stats_port)) ||
+            (stats_socket && !stats_exporter->listen_unix(stats_socket)))
+            return -1;
+        g_timeout_add_seconds(stats_interval, collect_stats, NULL);
+    }
+
+    // Stills of the cameras on request, encoded only when asked for.
+    if (snapshot_port > 0 || snapshot_socket)
+    {
+        for (gint i = 0; i < max_cameras; i++)
+            snapshots.push_back(new FrameSnapshot());
+        snapshot_server = new SnapshotServer([](guint camera) -> FrameSnapshot * {
+            return camera >= 1 && camera <= snapshots.size() ? snapshots[camera - 1]
+                                                             : nullptr;
+        });
+        if ((snapshot_port > 0 && !snapshot_server->listen_tcp(snapshot_port)) ||
+            (snapshot_socket && !snapshot_server->listen_unix(snapshot_socket)))
+            return -1;
+    }
+
+    // The pipelines get ready while we connect and the cameras report in.
+    // The thread is joined before the sessions go away.
+    GThread *prewarm_thread = nullptr;
+    if (prewarm)
+        prewarm_thread = g_thread_new("prewarm", prewarm_pipelines, NULL);
+
+    // From here on, the signaling and streaming threads log; they shouldn't
+    // wait for the terminal.
+    log_start(!log_sync);
+
     // Begin operation by attempting to connect to the signal server.
     connect_to_socketio_server_async();
+    if (!loop)
+    {
+        if (prewarm_thread)
+            g_thread_join(prewarm_thread);
+        log_stop();
+        return -1;
+    }
 
     // Start the main loop and run it until we quit for some reason.
     g_main_loop_run(loop);
 
     // Main loop has stopped, cleanup.
     g_main_loop_unref(loop);
-    g_print("Stopping Gstreamer pipeline...");
-    if (pipe1)
+    if (prewarm_thread)
+        g_thread_join(prewarm_thread);
+    for (CameraSession *session : sessions)
     {
-        gst_element_set_state(GST_ELEMENT(pipe1), GST_STATE_NULL);
-        gst_object_unref(pipe1);
-        g_printerr(" OK\n");
+        g_print("Stopping Gstreamer pipeline of camera %u...", session->index);
+        if (session->pipe)
+        {
+            stop_pipeline(session->pipe);
+            g_printerr(" OK\n");
+        }
+        else
+        {
+            g_printerr(" Not found\n");
+        }
     }
-    else
+    // Recordings of calls that ended just before, and event files; they time
+    // out after all. Their probes and callbacks may still look at the
+    // sessions, so these go after.
+    while (pipelines_closing > 0 || EventRecorder::closing() > 0)
+        g_main_context_iteration(NULL, TRUE);
+    for (CameraSession *session : sessions)
     {
-        g_printerr(" Not found\n");
+        guint source = session->ice_check_source.exchange(0);
+        if (source)
+            g_source_remove(source);
+        if (session->ice_restart_source)
+            g_source_remove(session->ice_restart_source);
+        g_free(session->peer_id);
+        g_free(session->remote_ufrag);
+        delete session->latency;
+        delete session->protection;
+        delete session->candidates;
+        delete session->ptz;
+        delete session->channel;
+        for (ControlLatency *control : session->control)
+            delete control;
+        delete session->publisher;
+        delete session;
     }
+    sessions.clear();
+    delete snapshot_server;
+    for (FrameSnapshot *snapshot : snapshots)
+        delete snapshot;
+    delete stats_exporter;
+    log_stop();
 
     g_print("All done.\n");
 
@@ -0,0 +1,178 @@
+/*
+ * Output ladder: the decoded video of a camera fanned out to several
+ * outputs of their own size and frame rate, e.g. a small preview, a 1080p
+ * view and the full resolution for analytics, without decoding it again.
+ */
+
+#include "output_ladder.h"
+
+#include <cstdio>
+#include <cstring>
+
+gboolean parse_ladder_rung(const gchar *spec, LadderRung *rung)
+{
+    const gchar *size = strchr(spec, '=');
+    const gchar *rate;
+    int consumed = 0;
+
+    if (!size || size == spec)
+        return FALSE;
+    rung->name.assign(spec, size - spec);
+    rung->width = rung->height = rung->fps = 0;
+    size++;
+
+    rate = strchr(size, '@');
+    if (rate && (sscanf(rate + 1, "%d%n", &rung->fps, &consumed) != 1 ||
+                 rate[1 + consumed] != '\0' || rung->fps < 1))
+        return FALSE;
+
+    std::string dimensions = rate ? std::string(size, rate - size) : std::string(size);
+    if (dimensions == "full")
+        return TRUE;
+    if (sscanf(dimensions.c_str(), "%dx%d%n", &rung->width, &rung->height,
+               &consumed) == 2 &&
+        dimensions[consumed] == '\0')
+        return rung->width >= 2 && rung->height >= 2;
+    rung->height = 0;
+    if (sscanf(dimensions.c_str(), "%d%n", &rung->width, &consumed) == 1 &&
+        dimensions[consumed] == '\0')
+        return rung->width >= 2;
+    return FALSE;
+}
+
+OutputLadder::OutputLadder(const std::vector<LadderRung> &rungs, LadderOutput output)
+{
+    GstElement *tee;
+    GstPad *pad;
+
+    bin = gst_bin_new("output-ladder");
+    gst_object_ref_sink(bin);
+    tee = gst_element_factory_make("tee", NULL);
+    g_assert_nonnull(tee);
+    // A rung whose window was closed mustn't stop the others.
+    g_object_set(tee, "allow-not-linked", TRUE, NULL);
+    gst_bin_add(GST_BIN(bin), tee);
+
+    pad = gst_element_get_static_pad(tee, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+
+    for (const LadderRung &rung : rungs)
+        add_branch(tee, rung, output);
+}
+
+OutputLadder::~OutputLadder()
+{
+    gst_object_unref(bin);
+    // The frame sinks hold their own reference to the appsinks.
+    branches.clear();
+}
+
+void OutputLadder::add_branch(GstElement *tee, const LadderRung &rung,
+                              LadderOutput output)
+{
+    Branch *branch = new Branch();
+    GstElement *first, *q, *last;
+    GstPad *pad;
+
+    branch->rung = rung;
+    branch->delivered = 0;
+    branch->dropped = 0;
+    branches.emplace_back(branch);
+
+    q = gst_element_factory_make("queue", NULL);
+    g_assert_nonnull(q);
+    g_object_set(q, "max-size-buffers", 1, "max-size-bytes", 0,
+                 "max-size-time", (guint64)0, "leaky", 2 /* downstream */, NULL);
+    g_signal_connect(q, "overrun", G_CALLBACK(on_overrun), branch);
+    gst_bin_add(GST_BIN(bin), q);
+    first = last = q;
+
+    if (rung.fps)
+    {
+        GstElement *rate = gst_element_factory_make("videorate", NULL);
+        g_assert_nonnull(rate);
+        g_object_set(rate, "drop-only", TRUE, "max-rate", rung.fps, NULL);
+        gst_bin_add(GST_BIN(bin), rate);
+        gst_element_link(rate, q);
+        first = rate;
+    }
+
+    if (rung.width)
+    {
+        GstElement *scale = gst_element_factory_make("videoscale", NULL);
+        GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+        GstCaps *caps;
+
+        g_assert_nonnull(scale);
+        g_assert_nonnull(filter);
+        caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, rung.width, NULL);
+        // With only the width fixed, videoscale picks the height that keeps
+        // the picture's aspect ratio on square pixels.
+        if (rung.height)
+            gst_caps_set_simple(caps, "height", G_TYPE_INT, rung.height, NULL);
+        else
+            gst_caps_set_simple(caps, "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+        g_object_set(filter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+        gst_bin_add_many(GST_BIN(bin), scale, filter, NULL);
+        gst_element_link_many(last, scale, filter, NULL);
+        last = filter;
+    }
+
+    if (output == LADDER_FRAMES)
+    {
+        branch->frames.reset(new FrameSink(1));
+        branch->sink = branch->frames->element();
+        gst_bin_add(GST_BIN(bin), branch->sink);
+        gst_element_link(last, branch->sink);
+    }
+    else
+    {
+        GstElement *conv = gst_element_factory_make("videoconvert", NULL);
+        gchar *name = g_strdup_printf("ladder-%s", rung.name.c_str());
+
+        g_assert_nonnull(conv);
+        branch->sink = gst_element_factory_make("autovideosink", name);
+        g_assert_nonnull(branch->sink);
+        g_free(name);
+        gst_bin_add_many(GST_BIN(bin), conv, branch->sink, NULL);
+        gst_element_link_many(last, conv, branch->sink, NULL);
+    }
+
+    pad = gst_element_get_static_pad(branch->sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_delivered, branch, NULL);
+    gst_object_unref(pad);
+
+    gst_element_link(tee, first);
+}
+
+void OutputLadder::set_callback(RungCallback callback)
+{
+    for (guint index = 0; index < branches.size(); index++)
+    {
+        if (!branches[index]->frames)
+            continue;
+        branches[index]->frames->set_callback([callback, index](const VideoFrameRef &frame)
+                                              { callback(index, frame); });
+    }
+}
+
+/**
+ * The queue is full, so the oldest frame in it is about to be dropped.
+ */
+void OutputLadder::on_overrun(GstElement *queue, gpointer user_data)
+{
+    Branch *branch = (Branch *)user_data;
+
+    branch->dropped++;
+}
+
+GstPadProbeReturn OutputLadder::on_delivered(GstPad *pad, GstPadProbeInfo *info,
+                                             gpointer user_data)
+{
+    Branch *branch = (Branch *)user_data;
+
+    branch->delivered++;
+    return GST_PAD_PROBE_OK;
+}
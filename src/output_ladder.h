@@ -0,0 +1,101 @@
+/*
+ * Output ladder: the decoded video of a camera fanned out to several
+ * outputs of their own size and frame rate, e.g. a small preview, a 1080p
+ * view and the full resolution for analytics, without decoding it again.
+ */
+
+#ifndef LIVESYNC_OUTPUT_LADDER_H
+#define LIVESYNC_OUTPUT_LADDER_H
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frame_sink.h"
+
+/**
+ * One output of the ladder.
+ */
+struct LadderRung
+{
+    std::string name;
+    gint width;  /* 0 = as decoded */
+    gint height; /* 0 = keep the aspect ratio */
+    gint fps;    /* the most, 0 = as decoded */
+};
+
+/* Parse "NAME=WIDTHxHEIGHT[@FPS]", "NAME=WIDTH[@FPS]" (keeping the aspect
+ * ratio) or "NAME=full[@FPS]", e.g. "preview=320@5". Returns FALSE if it
+ * is malformed. */
+gboolean parse_ladder_rung(const gchar *spec, LadderRung *rung);
+
+/* Where the rungs go: a window each, or frames to the application. */
+enum LadderOutput
+{
+    LADDER_WINDOWS,
+    LADDER_FRAMES,
+};
+
+typedef std::function<void(guint rung, const VideoFrameRef &frame)> RungCallback;
+
+/**
+ * A bin with one sink pad for the decoded video: a tee, and a branch per
+ * rung of [videorate !] queue ! [videoscale ! capsfilter !] output.
+ *
+ * The queue of each branch holds a single frame and is leaky, and the
+ * scaling and the output run on its thread. So the rungs scale in parallel,
+ * and a slow output only drops its own frames: neither the decoder nor the
+ * other rungs ever wait for it. videorate only drops frames, upstream of
+ * the queue, so that a rung at a lower rate isn't scaled for nothing.
+ */
+class OutputLadder
+{
+public:
+    OutputLadder(const std::vector<LadderRung> &rungs, LadderOutput output);
+    ~OutputLadder();
+
+    /* The bin, to be added to a pipeline and linked to the decoder. */
+    GstElement *element() const { return bin; }
+
+    guint size() const { return branches.size(); }
+    const LadderRung &rung(guint index) const { return branches[index]->rung; }
+
+    /* The output element of a rung, e.g. for its latency. */
+    GstElement *sink(guint index) const { return branches[index]->sink; }
+
+    /* LADDER_FRAMES: called on the rung's own thread for each of its
+     * frames. Must be set before the pipeline starts. */
+    void set_callback(RungCallback callback);
+
+    /* Frames that reached a rung's output, and that its queue dropped. */
+    guint64 delivered(guint index) const { return branches[index]->delivered; }
+    guint64 dropped(guint index) const { return branches[index]->dropped; }
+
+private:
+    OutputLadder(const OutputLadder &) = delete;
+    OutputLadder &operator=(const OutputLadder &) = delete;
+
+    struct Branch
+    {
+        LadderRung rung;
+        GstElement *sink;
+        std::unique_ptr<FrameSink> frames; /* LADDER_FRAMES */
+        std::atomic<guint64> delivered;
+        std::atomic<guint64> dropped;
+    };
+
+    void add_branch(GstElement *tee, const LadderRung &rung, LadderOutput output);
+
+    static void on_overrun(GstElement *queue, gpointer user_data);
+    static GstPadProbeReturn on_delivered(GstPad *pad, GstPadProbeInfo *info,
+                                          gpointer user_data);
+
+    GstElement *bin;
+    std::vector<std::unique_ptr<Branch>> branches;
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Pass-through recording: writes the camera's encoded video to disk as it
+ * arrives over RTP, without decoding or re-encoding it.
+ */
+
+#include "recorder.h"
+
+#include "codecs.h"
+#include "logger.h"
+
+#include <initializer_list>
+
+gboolean get_recording_elements(const gchar *encoding_name,
+                                RecordingElements *elements)
+{
+    const VideoCodec *codec = find_video_codec(encoding_name);
+
+    if (!codec)
+        return FALSE;
+    // For H264, the parser converts to avc and marks the keyframes for the
+    // muxer.
+    *elements = {codec->depay, codec->parse, codec->mux, codec->extension};
+    return TRUE;
+}
+
+Recorder *Recorder::create(const gchar *encoding_name, const gchar *directory,
+                           const gchar *prefix, GstClockTime max_time,
+                           guint64 max_bytes)
+{
+    RecordingElements names;
+    GstElement *bin, *q, *depay, *parse = nullptr, *mux, *splitmux;
+    GstPad *pad;
+    GDateTime *now;
+    gchar *stamp, *location;
+
+    if (!get_recording_elements(encoding_name, &names))
+    {
+        LOG_ERROR(LOG_MEDIA, "Can't record %s video", encoding_name);
+        return nullptr;
+    }
+
+    q = gst_element_factory_make("queue", NULL);
+    depay = gst_element_factory_make(names.depay, NULL);
+    if (names.parse)
+        parse = gst_element_factory_make(names.parse, NULL);
+    mux = gst_element_factory_make(names.mux, NULL);
+    splitmux = gst_element_factory_make("splitmuxsink", NULL);
+    if (!q || !depay || (names.parse && !parse) || !mux || !splitmux)
+    {
+        LOG_ERROR(LOG_MEDIA, "Missing plugins for recording %s video, need %s, %s%s%s "
+                  "and splitmuxsink", encoding_name, names.depay,
+                  names.parse ? names.parse : "", names.parse ? ", " : "",
+                  names.mux);
+        for (GstElement *e : {q, depay, parse, mux, splitmux})
+        {
+            if (e)
+                gst_object_unref(gst_object_ref_sink(e));
+        }
+        return nullptr;
+    }
+
+    // Keep up to a second of RTP while the disk is busy, then drop the
+    // oldest packets; never block the tee.
+    g_object_set(q, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+                 "max-size-time", GST_SECOND, NULL);
+
+    now = g_date_time_new_now_local();
+    stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    location = g_strdup_printf("%s/%s-%s-%%05d.%s", directory, prefix, stamp,
+                               names.extension);
+    g_object_set(splitmux, "location", location, "muxer", mux,
+                 "max-size-time", max_time, "max-size-bytes", max_bytes, NULL);
+    LOG_INFO(LOG_MEDIA, "Recording to %s", location);
+    g_free(location);
+    g_free(stamp);
+    g_date_time_unref(now);
+
+    bin = gst_bin_new(NULL);
+    gst_object_ref_sink(bin);
+    gst_bin_add_many(GST_BIN(bin), q, depay, splitmux, NULL);
+    if (parse)
+    {
+        gst_bin_add(GST_BIN(bin), parse);
+        gst_element_link_many(q, depay, parse, splitmux, NULL);
+    }
+    else
+    {
+        gst_element_link_many(q, depay, splitmux, NULL);
+    }
+
+    pad = gst_element_get_static_pad(q, "sink");
+    gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+    gst_object_unref(pad);
+
+    return new Recorder(bin, splitmux);
+}
+
+Recorder::~Recorder()
+{
+    gst_object_unref(bin);
+}
+
+/**
+ * Send EOS into the recording branch only. Messages of segments closed
+ * earlier are dropped from the bus first; nobody else reads it.
+ */
+void Recorder::send_eos(GstBus *bus)
+{
+    GstPad *pad = gst_element_get_static_pad(bin, "sink");
+    GstMessage *msg;
+
+    while ((msg = gst_bus_pop(bus)))
+        gst_message_unref(msg);
+
+    gst_pad_send_event(pad, gst_event_new_eos());
+    gst_object_unref(pad);
+}
+
+/**
+ * Whether splitmuxsink has finalized the last segment, or given up on it.
+ * Errors come from the muxer or file sink inside splitmuxsink.
+ */
+gboolean Recorder::is_closed(GstMessage *msg) const
+{
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+        return gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg), GST_OBJECT(splitmux));
+    return GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ELEMENT &&
+           GST_MESSAGE_SRC(msg) == GST_OBJECT(splitmux) &&
+           gst_message_has_name(msg, "splitmuxsink-fragment-closed");
+}
+
+/**
+ * Wait until the last segment is closed. For when the main loop doesn't run
+ * any more, e.g. at exit.
+ */
+void Recorder::finish(GstElement *pipeline, GstClockTime timeout)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstClockTime deadline = gst_util_get_timestamp() + timeout;
+    GstMessage *msg;
+
+    send_eos(bus);
+    for (;;)
+    {
+        GstClockTime now = gst_util_get_timestamp();
+        if (now >= deadline)
+        {
+            LOG_WARNING(LOG_MEDIA, "Timed out waiting for the recording to close");
+            break;
+        }
+        msg = gst_bus_timed_pop_filtered(bus, deadline - now,
+                                         (GstMessageType)(GST_MESSAGE_ELEMENT |
+                                                          GST_MESSAGE_ERROR));
+        if (!msg)
+            continue;
+        gboolean done = is_closed(msg);
+        gst_message_unref(msg);
+        if (done)
+            break;
+    }
+
+    gst_object_unref(bus);
+}
+
+/**
+ * A finish_async() in progress: a bus watch and a timeout, whichever comes
+ * first.
+ */
+struct Recorder::Closing
+{
+    Recorder *recorder;
+    GstElement *pipeline;
+    DoneFunc done;
+    guint watch;
+    guint timer;
+};
+
+void Recorder::finish_async(GstElement *pipeline, GstClockTime timeout, DoneFunc done)
+{
+    GstBus *bus = gst_element_get_bus(pipeline);
+    Closing *closing = new Closing{this, pipeline, done, 0, 0};
+
+    send_eos(bus);
+    closing->watch = gst_bus_add_watch(bus, on_closing_message, closing);
+    closing->timer = g_timeout_add(GST_TIME_AS_MSECONDS(timeout), on_closing_timeout,
+                                   closing);
+    gst_object_unref(bus);
+}
+
+gboolean Recorder::on_closing_message(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    Closing *closing = (Closing *)user_data;
+
+    if (!closing->recorder->is_closed(msg))
+        return G_SOURCE_CONTINUE;
+    closing->watch = 0;
+    closed(closing);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean Recorder::on_closing_timeout(gpointer user_data)
+{
+    Closing *closing = (Closing *)user_data;
+
+    LOG_WARNING(LOG_MEDIA, "Timed out waiting for the recording to close");
+    closing->timer = 0;
+    closed(closing);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Stop waiting, and hand the pipeline back. The recorder may be gone after
+ * done().
+ */
+void Recorder::closed(Closing *closing)
+{
+    if (closing->watch)
+        g_source_remove(closing->watch);
+    if (closing->timer)
+        g_source_remove(closing->timer);
+    closing->done(closing->pipeline);
+    delete closing;
+}
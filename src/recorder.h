@@ -0,0 +1,78 @@
+/*
+ * Pass-through recording: writes the camera's encoded video to disk as it
+ * arrives over RTP, without decoding or re-encoding it.
+ */
+
+#ifndef LIVESYNC_RECORDER_H
+#define LIVESYNC_RECORDER_H
+
+#include <gst/gst.h>
+
+/**
+ * The elements that turn an RTP encoding into a file: depayloader, optional
+ * parser and muxer factory names, and the file extension.
+ */
+struct RecordingElements
+{
+    const gchar *depay;
+    const gchar *parse;
+    const gchar *mux;
+    const gchar *extension;
+};
+
+/* Returns FALSE if the encoding (e.g. "VP8", "H264") can't be recorded.
+ * The elements come from the codec table, see codecs.h. */
+gboolean get_recording_elements(const gchar *encoding_name,
+                                RecordingElements *elements);
+
+/**
+ * queue ! depayloader [! parser] ! splitmuxsink, in a bin with an RTP sink
+ * pad, to hang off a tee in front of the decoder.
+ *
+ * VP8 and VP9 go to WebM and H264 to Matroska segments, which are rotated
+ * by time and/or size; a new segment always starts at a keyframe. The queue
+ * leaks, so a slow disk drops recorded frames instead of stalling the live
+ * video.
+ */
+class Recorder
+{
+public:
+    /* encoding_name is the RTP encoding, e.g. "VP8" or "H264". Segments are
+     * named <directory>/<prefix>-<start time>-NNNNN.webm (or .mkv). A zero
+     * limit means no limit. Returns nullptr for unsupported encodings. */
+    static Recorder *create(const gchar *encoding_name, const gchar *directory,
+                            const gchar *prefix, GstClockTime max_time,
+                            guint64 max_bytes);
+    ~Recorder();
+
+    /* The bin, to be added to a pipeline and linked to a tee. */
+    GstElement *element() const { return bin; }
+
+    /* Close the current segment properly (so that it's seekable) before the
+     * pipeline is stopped. Waits at most timeout. */
+    void finish(GstElement *pipeline, GstClockTime timeout);
+
+    /* The same without waiting, for the main loop: returns at once, and
+     * calls done(pipeline) on the main loop once the segment is closed or
+     * timeout has passed. done may stop the pipeline, and with it delete
+     * the recorder. */
+    typedef void (*DoneFunc)(GstElement *pipeline);
+    void finish_async(GstElement *pipeline, GstClockTime timeout, DoneFunc done);
+
+private:
+    Recorder(GstElement *bin, GstElement *splitmux) : bin(bin), splitmux(splitmux) {}
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    struct Closing;
+    void send_eos(GstBus *bus);
+    gboolean is_closed(GstMessage *msg) const;
+    static gboolean on_closing_message(GstBus *bus, GstMessage *msg, gpointer user_data);
+    static gboolean on_closing_timeout(gpointer user_data);
+    static void closed(Closing *closing);
+
+    GstElement *bin;
+    GstElement *splitmux; // owned by bin
+};
+
+#endif
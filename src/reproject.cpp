@@ -0,0 +1,318 @@
+/*
+ * Equirectangular to rectilinear (perspective) reprojection on the CPU.
+ */
+
+#include "reproject.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAVE_SSSE3_KERNEL 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+// Bilinear weights are 6-bit fixed point, so that a weight of 1.0 (64) still
+// fits a signed byte for the SIMD multiply-adds.
+#define FRAC_BITS 6
+#define FRAC_ONE (1 << FRAC_BITS)
+
+typedef void (*RemapRowFunc)(const uint8_t *src, int stride,
+                             const uint32_t *offset, const uint8_t *fx,
+                             const uint8_t *fy, uint8_t *dst, int n);
+
+/**
+ * Bilinear sample one row of output pixels, portable version.
+ */
+static void remap_row_scalar(const uint8_t *src, int stride,
+                             const uint32_t *offset, const uint8_t *fx,
+                             const uint8_t *fy, uint8_t *dst, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const uint8_t *p = src + offset[i];
+        int x = fx[i], y = fy[i];
+        int top = p[0] * (FRAC_ONE - x) + p[1] * x;
+        int bottom = p[stride] * (FRAC_ONE - x) + p[stride + 1] * x;
+        dst[i] = (uint8_t)((top * (FRAC_ONE - y) + bottom * y +
+                            (1 << (2 * FRAC_BITS - 1))) >>
+                           (2 * FRAC_BITS));
+    }
+}
+
+#ifdef HAVE_SSSE3_KERNEL
+/**
+ * Bilinear sample one row of output pixels, 8 at a time with SSSE3. The
+ * neighbour pairs are gathered with scalar loads (there is no byte gather),
+ * the interpolation itself is two multiply-add passes.
+ */
+__attribute__((target("ssse3"))) static void
+remap_row_ssse3(const uint8_t *src, int stride, const uint32_t *offset,
+                const uint8_t *fx, const uint8_t *fy, uint8_t *dst, int n)
+{
+    const __m128i one8 = _mm_set1_epi8(FRAC_ONE);
+    const __m128i one16 = _mm_set1_epi16(FRAC_ONE);
+    const __m128i round = _mm_set1_epi32(1 << (2 * FRAC_BITS - 1));
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i top = _mm_setzero_si128(), bottom = _mm_setzero_si128();
+#define GATHER_PAIR(k)                                                   \
+    {                                                                    \
+        const uint8_t *p = src + offset[i + k];                          \
+        uint16_t pair;                                                   \
+        memcpy(&pair, p, 2);                                             \
+        top = _mm_insert_epi16(top, pair, k);                            \
+        memcpy(&pair, p + stride, 2);                                    \
+        bottom = _mm_insert_epi16(bottom, pair, k);                      \
+    }
+        GATHER_PAIR(0) GATHER_PAIR(1) GATHER_PAIR(2) GATHER_PAIR(3)
+        GATHER_PAIR(4) GATHER_PAIR(5) GATHER_PAIR(6) GATHER_PAIR(7)
+#undef GATHER_PAIR
+
+        // Horizontal: left * (1 - fx) + right * fx, as 16-bit.
+        __m128i x = _mm_loadl_epi64((const __m128i *)(fx + i));
+        __m128i wx = _mm_unpacklo_epi8(_mm_sub_epi8(one8, x), x);
+        __m128i t = _mm_maddubs_epi16(top, wx);
+        __m128i b = _mm_maddubs_epi16(bottom, wx);
+
+        // Vertical: top * (1 - fy) + bottom * fy, as 32-bit.
+        __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(fy + i)),
+                                      _mm_setzero_si128());
+        __m128i wy = _mm_sub_epi16(one16, y);
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(t, b), _mm_unpacklo_epi16(wy, y));
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(t, b), _mm_unpackhi_epi16(wy, y));
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 2 * FRAC_BITS);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 2 * FRAC_BITS);
+
+        __m128i px = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(px, px));
+    }
+
+    remap_row_scalar(src, stride, offset + i, fx + i, fy + i, dst + i, n - i);
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+/**
+ * Bilinear sample one row of output pixels, 8 at a time with NEON.
+ */
+static void remap_row_neon(const uint8_t *src, int stride,
+                           const uint32_t *offset, const uint8_t *fx,
+                           const uint8_t *fy, uint8_t *dst, int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        uint8_t tl[8], tr[8], bl[8], br[8];
+        for (int k = 0; k < 8; k++)
+        {
+            const uint8_t *p = src + offset[i + k];
+            tl[k] = p[0];
+            tr[k] = p[1];
+            bl[k] = p[stride];
+            br[k] = p[stride + 1];
+        }
+
+        uint8x8_t x = vld1_u8(fx + i);
+        uint8x8_t wx = vsub_u8(vdup_n_u8(FRAC_ONE), x);
+        uint16x8_t t = vmlal_u8(vmull_u8(vld1_u8(tl), wx), vld1_u8(tr), x);
+        uint16x8_t b = vmlal_u8(vmull_u8(vld1_u8(bl), wx), vld1_u8(br), x);
+
+        uint16x8_t y = vmovl_u8(vld1_u8(fy + i));
+        uint16x8_t wy = vsubq_u16(vdupq_n_u16(FRAC_ONE), y);
+        uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(t), vget_low_u16(wy)),
+                                  vget_low_u16(b), vget_low_u16(y));
+        uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(t), vget_high_u16(wy)),
+                                  vget_high_u16(b), vget_high_u16(y));
+
+        uint16x8_t px = vcombine_u16(vrshrn_n_u32(lo, 2 * FRAC_BITS),
+                                     vrshrn_n_u32(hi, 2 * FRAC_BITS));
+        vst1_u8(dst + i, vqmovn_u16(px));
+    }
+
+    remap_row_scalar(src, stride, offset + i, fx + i, fy + i, dst + i, n - i);
+}
+#endif
+
+static bool scalar_only = false;
+
+/**
+ * Pick the fastest row kernel this CPU supports.
+ */
+static RemapRowFunc get_remap_row()
+{
+    if (scalar_only)
+        return remap_row_scalar;
+#ifdef HAVE_NEON_KERNEL
+    return remap_row_neon;
+#endif
+#ifdef HAVE_SSSE3_KERNEL
+    if (__builtin_cpu_supports("ssse3"))
+        return remap_row_ssse3;
+#endif
+    return remap_row_scalar;
+}
+
+void EquirectReprojector::force_scalar(bool scalar)
+{
+    scalar_only = scalar;
+}
+
+const char *EquirectReprojector::simd_name()
+{
+    RemapRowFunc f = get_remap_row();
+#ifdef HAVE_NEON_KERNEL
+    if (f == remap_row_neon)
+        return "NEON";
+#endif
+#ifdef HAVE_SSSE3_KERNEL
+    if (f == remap_row_ssse3)
+        return "SSSE3";
+#endif
+    (void)f;
+    return "scalar";
+}
+
+EquirectReprojector::EquirectReprojector()
+    : view{0.0f, 0.0f, 90.0f, 1280, 720}, built_view{}, built_src_w(0),
+      built_src_h(0), built_stride{0, 0, 0}, rebuild_count(0)
+{
+}
+
+void EquirectReprojector::set_viewport(const Viewport &viewport)
+{
+    view = viewport;
+    // 4:2:0 chroma needs even sizes.
+    view.width &= ~1;
+    view.height &= ~1;
+}
+
+/**
+ * atan2f() to within 1e-5 radians (a hundredth of a pixel at 4K), which is
+ * several times faster than the libm one and dominates the table build.
+ */
+static inline float fast_atan2f(float y, float x)
+{
+    const float ax = fabsf(x), ay = fabsf(y);
+    const float mx = ax > ay ? ax : ay;
+    if (mx == 0.0f)
+        return 0.0f;
+    const float a = (ax > ay ? ay : ax) / mx;
+    const float s = a * a;
+    float r = ((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s +
+                0.19354346f) * s - 0.33262347f) * s * a + 0.99997726f * a;
+    if (ay > ax)
+        r = (float)M_PI_2 - r;
+    if (x < 0.0f)
+        r = (float)M_PI - r;
+    return y < 0.0f ? -r : r;
+}
+
+/**
+ * Compute the remap table of one plane. Works in normalised coordinates, so
+ * the same function serves the full resolution luma and half resolution
+ * chroma planes.
+ */
+void EquirectReprojector::build(RemapTable &table, int out_w, int out_h,
+                                int src_w, int src_h, int src_stride) const
+{
+    const float deg = (float)M_PI / 180.0f;
+    const float half_w = tanf(view.fov * 0.5f * deg);
+    const float half_h = half_w * view.height / view.width;
+    const float cy = cosf(view.yaw * deg), sy = sinf(view.yaw * deg);
+    const float cp = cosf(view.pitch * deg), sp = sinf(view.pitch * deg);
+    const size_t n = (size_t)out_w * out_h;
+
+    table.width = out_w;
+    table.height = out_h;
+    table.offset.resize(n);
+    table.fx.resize(n);
+    table.fy.resize(n);
+
+    for (int v = 0; v < out_h; v++)
+    {
+        // Ray through the pixel centre: x right, y down, z forward.
+        const float y = ((v + 0.5f) / out_h * 2.0f - 1.0f) * half_h;
+
+        for (int u = 0; u < out_w; u++)
+        {
+            const float x = ((u + 0.5f) / out_w * 2.0f - 1.0f) * half_w;
+
+            // Pitch (around x), then yaw (around y).
+            const float y1 = y * cp - sp;
+            const float z1 = y * sp + cp;
+            const float x2 = x * cy + z1 * sy;
+            const float z2 = z1 * cy - x * sy;
+
+            const float lon = fast_atan2f(x2, z2);
+            const float lat = fast_atan2f(y1, sqrtf(x2 * x2 + z2 * z2));
+
+            float sx = (lon / (2.0f * (float)M_PI) + 0.5f) * src_w - 0.5f;
+            float sy_ = (lat / (float)M_PI + 0.5f) * src_h - 0.5f;
+
+            // Clamp at the edges; the last column doesn't blend with the
+            // first one across the seam, which is not visible in practice.
+            int x0 = (int)floorf(sx), y0 = (int)floorf(sy_);
+            int fx = (int)((sx - x0) * FRAC_ONE + 0.5f);
+            int fy = (int)((sy_ - y0) * FRAC_ONE + 0.5f);
+            if (x0 < 0)
+                x0 = 0, fx = 0;
+            if (x0 >= src_w - 1)
+                x0 = src_w - 2, fx = FRAC_ONE;
+            if (y0 < 0)
+                y0 = 0, fy = 0;
+            if (y0 >= src_h - 1)
+                y0 = src_h - 2, fy = FRAC_ONE;
+
+            const size_t i = (size_t)v * out_w + u;
+            table.offset[i] = (uint32_t)y0 * src_stride + x0;
+            table.fx[i] = (uint8_t)fx;
+            table.fy[i] = (uint8_t)fy;
+        }
+    }
+}
+
+void EquirectReprojector::process(const PlanarImage &src, PlanarImage &dst)
+{
+    const RemapRowFunc remap_row = get_remap_row();
+
+    if (dst.width != view.width || dst.height != view.height)
+        return;
+
+    if (view != built_view || src.width != built_src_w ||
+        src.height != built_src_h || src.stride[0] != built_stride[0] ||
+        src.stride[1] != built_stride[1] || src.stride[2] != built_stride[2])
+    {
+        build(luma, view.width, view.height, src.width, src.height,
+              src.stride[0]);
+        // U and V share the table, I420 planes have the same stride.
+        build(chroma, view.width / 2, view.height / 2, src.width / 2,
+              src.height / 2, src.stride[1]);
+        built_view = view;
+        built_src_w = src.width;
+        built_src_h = src.height;
+        memcpy(built_stride, src.stride, sizeof(built_stride));
+        rebuild_count++;
+    }
+
+    for (int plane = 0; plane < 3; plane++)
+    {
+        const RemapTable &table = plane == 0 ? luma : chroma;
+
+        for (int v = 0; v < table.height; v++)
+        {
+            const size_t i = (size_t)v * table.width;
+            remap_row(src.data[plane], src.stride[plane], &table.offset[i],
+                      &table.fx[i], &table.fy[i],
+                      dst.data[plane] + (size_t)v * dst.stride[plane],
+                      table.width);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Equirectangular to rectilinear (perspective) reprojection on the CPU.
+ *
+ * The mapping from output pixels to source pixels only depends on the view
+ * direction, field of view and image sizes, so it is precomputed into remap
+ * lookup tables, and each frame is then just a table-driven bilinear sample.
+ */
+
+#ifndef LIVESYNC_REPROJECT_H
+#define LIVESYNC_REPROJECT_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A perspective view into the 360 sphere. Angles are in degrees: yaw turns
+ * right, pitch turns up, fov is the horizontal field of view.
+ */
+struct Viewport
+{
+    float yaw;
+    float pitch;
+    float fov;
+    int width;
+    int height;
+
+    bool operator==(const Viewport &o) const
+    {
+        return yaw == o.yaw && pitch == o.pitch && fov == o.fov &&
+               width == o.width && height == o.height;
+    }
+    bool operator!=(const Viewport &o) const { return !(*this == o); }
+};
+
+/**
+ * An 8-bit planar YUV 4:2:0 (I420) image, not owned.
+ */
+struct PlanarImage
+{
+    int width;
+    int height;
+    uint8_t *data[3];
+    int stride[3];
+};
+
+/**
+ * Renders a viewport from equirectangular I420 frames. Not thread safe, use
+ * one instance per thread.
+ */
+class EquirectReprojector
+{
+public:
+    EquirectReprojector();
+
+    /* Changes take effect on the next frame; tables are rebuilt only when
+     * the viewport really changes. */
+    void set_viewport(const Viewport &viewport);
+    const Viewport &viewport() const { return view; }
+
+    /* Render dst (viewport sized) from src. Rebuilds the tables first if the
+     * viewport or the source's size or strides have changed. */
+    void process(const PlanarImage &src, PlanarImage &dst);
+
+    /* Number of table rebuilds so far, for diagnostics. */
+    unsigned rebuilds() const { return rebuild_count; }
+
+    /* Use the portable code even if SIMD is available (benchmarking). */
+    static void force_scalar(bool scalar);
+    static const char *simd_name();
+
+private:
+    /* Remap table of one plane, structure of arrays: per output pixel, the
+     * offset of the top-left source pixel and 6-bit fractions to the right
+     * and down neighbours. */
+    struct RemapTable
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<uint32_t> offset;
+        std::vector<uint8_t> fx;
+        std::vector<uint8_t> fy;
+    };
+
+    void build(RemapTable &table, int out_w, int out_h,
+               int src_w, int src_h, int src_stride) const;
+
+    Viewport view;
+    Viewport built_view;
+    int built_src_w;
+    int built_src_h;
+    int built_stride[3];
+    RemapTable luma;
+    RemapTable chroma;
+    unsigned rebuild_count;
+};
+
+#endif
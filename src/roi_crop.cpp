@@ -0,0 +1,113 @@
+/*
+ * Region-of-interest cropping: only a part of the decoded frame, e.g. the
+ * horizon band of the equirectangular video, goes on downstream. Where the
+ * consumer understands GstVideoCropMeta, the crop is just that meta on the
+ * buffer; the region is copied out only for consumers that don't.
+ */
+
+#include "roi_crop.h"
+#include "logger.h"
+
+#include <cstdio>
+
+gboolean parse_region_of_interest(const gchar *text, RegionOfInterest *roi)
+{
+    int consumed = 0;
+
+    if (sscanf(text, "%lf,%lf,%lf,%lf%n", &roi->left, &roi->top, &roi->width,
+               &roi->height, &consumed) != 4 ||
+        text[consumed] != '\0')
+        return FALSE;
+    return roi->left >= 0 && roi->top >= 0 && roi->width > 0 && roi->height > 0 &&
+           roi->left + roi->width <= 1 && roi->top + roi->height <= 1;
+}
+
+RoiCrop::RoiCrop(const RegionOfInterest &roi)
+    : roi(roi), frame_size(0), region_size(0), mode(-1), count_meta(0),
+      count_copied(0), bytes_frame(0), bytes_region(0)
+{
+    GstPad *pad;
+
+    crop = gst_element_factory_make("videocrop", NULL);
+    g_assert_nonnull(crop);
+    gst_object_ref_sink(crop);
+
+    pad = gst_element_get_static_pad(crop, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_caps, this, NULL);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(crop, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_buffer, this, NULL);
+    gst_object_unref(pad);
+}
+
+RoiCrop::~RoiCrop()
+{
+    gst_object_unref(crop);
+}
+
+/**
+ * Set videocrop's margins for a new frame size, before it sees the caps.
+ * Even numbers, so that the region starts and ends on whole chroma samples.
+ */
+GstPadProbeReturn RoiCrop::on_caps(GstPad *pad, GstPadProbeInfo *info,
+                                   gpointer user_data)
+{
+    RoiCrop *self = (RoiCrop *)user_data;
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    GstVideoInfo video_info;
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+        return GST_PAD_PROBE_OK;
+    gst_event_parse_caps(event, &caps);
+    if (!gst_video_info_from_caps(&video_info, caps))
+        return GST_PAD_PROBE_OK;
+
+    gint width = GST_VIDEO_INFO_WIDTH(&video_info);
+    gint height = GST_VIDEO_INFO_HEIGHT(&video_info);
+    gint left = (gint)(self->roi.left * width) & ~1;
+    gint top = (gint)(self->roi.top * height) & ~1;
+    gint region_width = MAX((gint)(self->roi.width * width + 0.5) & ~1, 2);
+    gint region_height = MAX((gint)(self->roi.height * height + 0.5) & ~1, 2);
+    region_width = MIN(region_width, width - left);
+    region_height = MIN(region_height, height - top);
+
+    g_object_set(self->crop, "left", left, "top", top,
+                 "right", width - left - region_width,
+                 "bottom", height - top - region_height, NULL);
+    self->frame_size = GST_VIDEO_INFO_SIZE(&video_info);
+    self->region_size = (gsize)((double)GST_VIDEO_INFO_SIZE(&video_info) *
+                                region_width * region_height / width / height);
+    LOG_INFO(LOG_MEDIA, "Region of interest: %dx%d at %d,%d of %dx%d", region_width,
+             region_height, left, top, width, height);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * Count the frames by what videocrop did with them.
+ */
+GstPadProbeReturn RoiCrop::on_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data)
+{
+    RoiCrop *self = (RoiCrop *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    // A region of the whole frame goes through as is, nothing is copied.
+    gint with_meta = gst_buffer_get_video_crop_meta(buffer) != nullptr ||
+                     self->region_size == self->frame_size;
+
+    if (with_meta)
+        self->count_meta++;
+    else
+        self->count_copied++;
+    self->bytes_frame += self->frame_size;
+    self->bytes_region += self->region_size;
+
+    if (self->mode.exchange(with_meta) != with_meta)
+    {
+        if (with_meta)
+            LOG_INFO(LOG_MEDIA, "Region of interest: zero-copy, downstream reads the crop meta");
+        else
+            LOG_INFO(LOG_MEDIA, "Region of interest: copied, downstream can't use the crop meta");
+    }
+    return GST_PAD_PROBE_OK;
+}
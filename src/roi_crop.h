@@ -0,0 +1,76 @@
+/*
+ * Region-of-interest cropping: only a part of the decoded frame, e.g. the
+ * horizon band of the equirectangular video, goes on downstream. Where the
+ * consumer understands GstVideoCropMeta, the crop is just that meta on the
+ * buffer; the region is copied out only for consumers that don't.
+ */
+
+#ifndef LIVESYNC_ROI_CROP_H
+#define LIVESYNC_ROI_CROP_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <atomic>
+
+/**
+ * A region of the frame, in fractions of its size, so that it fits any
+ * resolution the camera sends.
+ */
+struct RegionOfInterest
+{
+    double left;
+    double top;
+    double width;
+    double height;
+};
+
+/* Parse "LEFT,TOP,WIDTH,HEIGHT", e.g. "0,0.35,1,0.3" for the horizon band.
+ * Returns FALSE if it isn't a region inside the frame. */
+gboolean parse_region_of_interest(const gchar *text, RegionOfInterest *roi);
+
+/**
+ * A videocrop element set to the region whenever the frame size changes.
+ * videocrop decides per negotiation: if the elements downstream accept
+ * both GstVideoMeta and GstVideoCropMeta in the allocation query, the
+ * buffers go through untouched with a crop meta added; otherwise the
+ * region is copied into new buffers. Counts which it was, and the bytes.
+ */
+class RoiCrop
+{
+public:
+    explicit RoiCrop(const RegionOfInterest &roi);
+    ~RoiCrop();
+
+    /* The videocrop element, to be added to and linked in a pipeline. */
+    GstElement *element() const { return crop; }
+
+    /* Frames that went out with a crop meta, and copied. */
+    guint64 frames_with_meta() const { return count_meta; }
+    guint64 frames_copied() const { return count_copied; }
+
+    /* Bytes of the whole frames, and of their regions, so far. */
+    guint64 frame_bytes() const { return bytes_frame; }
+    guint64 region_bytes() const { return bytes_region; }
+
+private:
+    RoiCrop(const RoiCrop &) = delete;
+    RoiCrop &operator=(const RoiCrop &) = delete;
+
+    static GstPadProbeReturn on_caps(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data);
+    static GstPadProbeReturn on_buffer(GstPad *pad, GstPadProbeInfo *info,
+                                       gpointer user_data);
+
+    GstElement *crop;
+    RegionOfInterest roi;
+    std::atomic<gsize> frame_size;  /* of the current caps */
+    std::atomic<gsize> region_size;
+    std::atomic<gint> mode;         /* of the last frame: 1 = meta, 0 = copied */
+    std::atomic<guint64> count_meta;
+    std::atomic<guint64> count_copied;
+    std::atomic<guint64> bytes_frame;
+    std::atomic<guint64> bytes_region;
+};
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * Signaling message codec: reads and writes the JSON of the call's
+ * Socket.IO messages (ICE candidates, offers and answers, client counts)
+ * directly, without building a json-glib tree for each message.
+ */
+
+#include "signaling_codec.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+/**
+ * A JSON reader over the message text. Only what the decoders need: walk an
+ * object's members, read strings and numbers into place, skip the rest.
+ */
+class Scanner
+{
+public:
+    explicit Scanner(const std::string &text)
+        : p(text.c_str()), end(text.c_str() + text.size())
+    {
+    }
+
+    /* Member names are read into the same string every time, so a name that
+     * doesn't fit in a std::string allocates only once per thread. */
+    static thread_local std::string name;
+
+    void space()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    bool consume(char c)
+    {
+        space();
+        if (p == end || *p != c)
+            return false;
+        p++;
+        return true;
+    }
+
+    bool at_end()
+    {
+        space();
+        return p == end;
+    }
+
+    /**
+     * Read an object, calling member(name) at each member's value; member
+     * reads or skips the value and returns false on bad input. The name is
+     * only good until the next member.
+     */
+    template <class F>
+    bool object(F member)
+    {
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        do
+        {
+            space();
+            if (!string(&name) || !consume(':') || !member(name))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    /**
+     * Read a string into value, unescaped, or skip it if value is null. null
+     * reads as an empty string, as json-glib's getters return for it.
+     */
+    bool string(std::string *value)
+    {
+        if (value)
+            value->clear();
+        space();
+        if (literal("null"))
+            return true;
+        if (p == end || *p != '"')
+            return false;
+        p++;
+
+        while (p < end)
+        {
+            // Copy the run up to the next quote or escape in one go.
+            const char *run = p;
+            while (p < end && *p != '"' && *p != '\\')
+                p++;
+            if (value)
+                value->append(run, p - run);
+            if (p == end)
+                return false;
+            if (*p++ == '"')
+                return true;
+            if (p == end)
+                return false;
+
+            switch (*p++)
+            {
+            case '"': put(value, '"'); break;
+            case '\\': put(value, '\\'); break;
+            case '/': put(value, '/'); break;
+            case 'b': put(value, '\b'); break;
+            case 'f': put(value, '\f'); break;
+            case 'n': put(value, '\n'); break;
+            case 'r': put(value, '\r'); break;
+            case 't': put(value, '\t'); break;
+            case 'u':
+            {
+                unsigned long code;
+                if (!hex4(&code))
+                    return false;
+                if (code >= 0xd800 && code < 0xdc00)
+                {
+                    // A surrogate pair for a character beyond the BMP.
+                    unsigned long low;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                        return false;
+                    p += 2;
+                    if (!hex4(&low) || low < 0xdc00 || low >= 0xe000)
+                        return false;
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                utf8(code, value);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Read a number as an int, truncating as json_object_get_int_member()
+     * does for a double. null reads as 0.
+     */
+    bool integer(int *value)
+    {
+        char *after;
+
+        space();
+        if (literal("null"))
+        {
+            *value = 0;
+            return true;
+        }
+        if (p == end || !(*p == '-' || (*p >= '0' && *p <= '9')))
+            return false;
+        // The text is a std::string, so this stops at its terminating 0 at
+        // the latest.
+        double number = strtod(p, &after);
+        if (after == p || after > end)
+            return false;
+        p = after;
+        *value = (int)number;
+        return true;
+    }
+
+    /**
+     * Skip any value.
+     */
+    bool skip()
+    {
+        space();
+        if (p == end)
+            return false;
+        switch (*p)
+        {
+        case '"':
+            return string(nullptr);
+        case '{':
+            return object([this](const std::string &) { return skip(); });
+        case '[':
+            p++;
+            if (consume(']'))
+                return true;
+            do
+            {
+                if (!skip())
+                    return false;
+            } while (consume(','));
+            return consume(']');
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        case 'n':
+            return literal("null");
+        default:
+        {
+            int ignored;
+            return integer(&ignored);
+        }
+        }
+    }
+
+private:
+    static void put(std::string *value, char c)
+    {
+        if (value)
+            value->push_back(c);
+    }
+
+    bool literal(const char *word)
+    {
+        size_t length = strlen(word);
+        if ((size_t)(end - p) < length || memcmp(p, word, length) != 0)
+            return false;
+        p += length;
+        return true;
+    }
+
+    bool hex4(unsigned long *code)
+    {
+        *code = 0;
+        for (int i = 0; i < 4; i++, p++)
+        {
+            if (p == end)
+                return false;
+            char c = *p;
+            int digit = c >= '0' && c <= '9'   ? c - '0'
+                        : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                        : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                               : -1;
+            if (digit < 0)
+                return false;
+            *code = *code << 4 | digit;
+        }
+        return true;
+    }
+
+    static void utf8(unsigned long code, std::string *value)
+    {
+        if (!value)
+            return;
+        if (code < 0x80)
+        {
+            value->push_back((char)code);
+        }
+        else if (code < 0x800)
+        {
+            value->push_back((char)(0xc0 | code >> 6));
+            value->push_back((char)(0x80 | (code & 0x3f)));
+        }
+        else if (code < 0x10000)
+        {
+            value->push_back((char)(0xe0 | code >> 12));
+            value->push_back((char)(0x80 | (code >> 6 & 0x3f)));
+            value->push_back((char)(0x80 | (code & 0x3f)));
+        }
+        else
+        {
+            value->push_back((char)(0xf0 | code >> 18));
+            value->push_back((char)(0x80 | (code >> 12 & 0x3f)));
+            value->push_back((char)(0x80 | (code >> 6 & 0x3f)));
+            value->push_back((char)(0x80 | (code & 0x3f)));
+        }
+    }
+
+    const char *p;
+    const char *end;
+};
+
+thread_local std::string Scanner::name;
+
+/**
+ * Append text as a JSON string, escaped as json-glib does.
+ */
+void append_string(std::string *out, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out->push_back('"');
+    for (const char *p = text; *p; p++)
+    {
+        // Copy the run that needs no escaping in one go.
+        const char *run = p;
+        while (*p && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            p++;
+        out->append(run, p - run);
+        if (!*p)
+            break;
+
+        switch (*p)
+        {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\b': out->append("\\b"); break;
+        case '\f': out->append("\\f"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            out->append("\\u00");
+            out->push_back(hex[(unsigned char)*p >> 4]);
+            out->push_back(hex[*p & 0xf]);
+            break;
+        }
+    }
+    out->push_back('"');
+}
+
+/**
+ * Room for text once escaped, assuming little needs escaping: SDP and
+ * candidates only have their line breaks.
+ */
+size_t escaped_size(const char *text)
+{
+    return strlen(text) + strlen(text) / 8 + 2;
+}
+
+} // namespace
+
+bool decode_ice_candidate(const std::string &text, IceCandidateMessage *message)
+{
+    Scanner scanner(text);
+    bool has_candidate = false;
+
+    message->has_source = false;
+    message->candidate.clear();
+    message->mline_index = 0;
+
+    bool ok = scanner.object(
+        [&](const std::string &name)
+        {
+            if (name == "source")
+            {
+                message->has_source = true;
+                return scanner.string(&message->source);
+            }
+            if (name != "candidate")
+                return scanner.skip();
+
+            has_candidate = true;
+            return scanner.object(
+                [&](const std::string &name)
+                {
+                    if (name == "candidate")
+                        return scanner.string(&message->candidate);
+                    if (name == "sdpMLineIndex")
+                        return scanner.integer(&message->mline_index);
+                    return scanner.skip();
+                });
+        });
+    return ok && scanner.at_end() && has_candidate;
+}
+
+bool decode_sdp(const std::string &text, SdpMessage *message)
+{
+    Scanner scanner(text);
+
+    message->has_source = false;
+    message->has_sdp = false;
+    message->type.clear();
+    message->sdp.clear();
+
+    bool ok = scanner.object(
+        [&](const std::string &name)
+        {
+            if (name == "source")
+            {
+                message->has_source = true;
+                return scanner.string(&message->source);
+            }
+            if (name != "sdp")
+                return scanner.skip();
+
+            message->has_sdp = true;
+            return scanner.object(
+                [&](const std::string &name)
+                {
+                    if (name == "type")
+                        return scanner.string(&message->type);
+                    if (name == "sdp")
+                        return scanner.string(&message->sdp);
+                    return scanner.skip();
+                });
+        });
+    return ok && scanner.at_end();
+}
+
+bool decode_client_count(const std::string &text, ClientCountMessage *message)
+{
+    Scanner scanner(text);
+
+    message->connected = 0;
+    message->max_connected = 0;
+    message->streaming = 0;
+    message->max_streaming = 0;
+    message->has_source = false;
+
+    bool ok = scanner.object(
+        [&](const std::string &name)
+        {
+            if (name == "connected-clients")
+                return scanner.integer(&message->connected);
+            if (name == "max-connected-clients")
+                return scanner.integer(&message->max_connected);
+            if (name == "streaming-clients")
+                return scanner.integer(&message->streaming);
+            if (name == "max-streaming-clients")
+                return scanner.integer(&message->max_streaming);
+            if (name == "source")
+            {
+                message->has_source = true;
+                return scanner.string(&message->source);
+            }
+            return scanner.skip();
+        });
+    // An empty source names no camera.
+    message->has_source = message->has_source && !message->source.empty();
+    return ok && scanner.at_end();
+}
+
+bool decode_video_format(const std::string &text, std::string *projection)
+{
+    Scanner scanner(text);
+
+    projection->clear();
+    bool ok = scanner.object(
+        [&](const std::string &name)
+        {
+            if (name == "projection")
+                return scanner.string(projection);
+            return scanner.skip();
+        });
+    return ok && scanner.at_end();
+}
+
+/**
+ * {"target":...,"source":...,"type":"new-ice-candidate","candidate":
+ * {"candidate":...,"sdpMid":0,"sdpMLineIndex":n}}
+ */
+std::string encode_ice_candidate(const char *target, const char *source,
+                                 const char *candidate, unsigned mline_index)
+{
+    std::string out;
+
+    out.reserve(128 + escaped_size(target) + escaped_size(source) +
+                escaped_size(candidate));
+    out.append("{\"target\":");
+    append_string(&out, target);
+    out.append(",\"source\":");
+    append_string(&out, source);
+    out.append(",\"type\":\"new-ice-candidate\",\"candidate\":{\"candidate\":");
+    append_string(&out, candidate);
+    out.append(",\"sdpMid\":0,\"sdpMLineIndex\":");
+    out.append(std::to_string(mline_index));
+    out.append("}}");
+    return out;
+}
+
+/**
+ * {"target":...,"source":...,"type":"new-ice-candidate","candidates":
+ * [{"candidate":...,"sdpMid":0,"sdpMLineIndex":n},...]}
+ */
+std::string encode_ice_candidates(const char *target, const char *source,
+                                  const std::vector<IceCandidate> &candidates)
+{
+    std::string out;
+    size_t size = 128 + escaped_size(target) + escaped_size(source);
+
+    for (const IceCandidate &candidate : candidates)
+        size += 64 + escaped_size(candidate.candidate.c_str());
+    out.reserve(size);
+    out.append("{\"target\":");
+    append_string(&out, target);
+    out.append(",\"source\":");
+    append_string(&out, source);
+    out.append(",\"type\":\"new-ice-candidate\",\"candidates\":[");
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (i > 0)
+            out.push_back(',');
+        out.append("{\"candidate\":");
+        append_string(&out, candidates[i].candidate.c_str());
+        out.append(",\"sdpMid\":0,\"sdpMLineIndex\":");
+        out.append(std::to_string(candidates[i].mline_index));
+        out.push_back('}');
+    }
+    out.append("]}");
+    return out;
+}
+
+/**
+ * {"target":...,"sdp":{"type":...,"sdp":...}}
+ */
+std::string encode_sdp(const char *target, const char *type, const char *sdp)
+{
+    std::string out;
+
+    out.reserve(64 + escaped_size(target) + escaped_size(type) + escaped_size(sdp));
+    out.append("{\"target\":");
+    append_string(&out, target);
+    out.append(",\"sdp\":{\"type\":");
+    append_string(&out, type);
+    out.append(",\"sdp\":");
+    append_string(&out, sdp);
+    out.append("}}");
+    return out;
+}
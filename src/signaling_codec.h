@@ -0,0 +1,80 @@
+/*
+ * Signaling message codec: reads and writes the JSON of the call's
+ * Socket.IO messages (ICE candidates, offers and answers, client counts)
+ * directly, without building a json-glib tree for each message.
+ */
+
+#ifndef LIVESYNC_SIGNALING_CODEC_H
+#define LIVESYNC_SIGNALING_CODEC_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Decoded messages. Decoding into the same message again reuses the
+ * capacity of its strings, so a message kept for the next one doesn't
+ * allocate once it has seen a message of the same size.
+ */
+
+/* 'new-ice-candidate': {"source"?, "candidate": {"candidate",
+ * "sdpMLineIndex"}}. */
+struct IceCandidateMessage
+{
+    bool has_source;
+    std::string source;
+    std::string candidate;
+    int mline_index;
+};
+
+/* 'video-answer': {"source"?, "sdp": {"type", "sdp"}}. type is empty if
+ * the sdp object had none. */
+struct SdpMessage
+{
+    bool has_source;
+    std::string source;
+    bool has_sdp;
+    std::string type;
+    std::string sdp;
+};
+
+/* 'client-count': {"connected-clients", "max-connected-clients",
+ * "streaming-clients", "max-streaming-clients", "source"?}. Missing counts
+ * are 0. */
+struct ClientCountMessage
+{
+    int connected;
+    int max_connected;
+    int streaming;
+    int max_streaming;
+    bool has_source;
+    std::string source;
+};
+
+/* Return false if text isn't a JSON object, or the message lacks what it
+ * can't do without (the candidate of a 'new-ice-candidate'). Members that
+ * aren't needed are skipped without being decoded. */
+bool decode_ice_candidate(const std::string &text, IceCandidateMessage *message);
+bool decode_sdp(const std::string &text, SdpMessage *message);
+bool decode_client_count(const std::string &text, ClientCountMessage *message);
+bool decode_video_format(const std::string &text, std::string *projection);
+
+/* Encoders, into one string sized up front: the same JSON as json-glib
+ * generates for these messages, member order included. */
+std::string encode_ice_candidate(const char *target, const char *source,
+                                 const char *candidate, unsigned mline_index);
+std::string encode_sdp(const char *target, const char *type, const char *sdp);
+
+/* A local ICE candidate. An empty candidate marks the end of candidates, as
+ * in WebRTC. */
+struct IceCandidate
+{
+    unsigned mline_index;
+    std::string candidate;
+};
+
+/* 'new-ice-candidate' with several candidates: {"target", "source", "type",
+ * "candidates": [{"candidate", "sdpMid", "sdpMLineIndex"}, ...]}. */
+std::string encode_ice_candidates(const char *target, const char *source,
+                                  const std::vector<IceCandidate> &candidates);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Signaling event queue: hands the Socket.IO client's events over from its
+ * thread to the GLib main loop, through a lock-free single-producer,
+ * single-consumer ring, and measures how long each kind of event waits and
+ * takes to handle.
+ */
+
+#include "signaling_queue.h"
+
+// Events handled per dispatch at most, before the main loop gets to its
+// other sources (timers, stdin, bus watches) again.
+#define DISPATCH_BATCH 16
+
+// How long push() sleeps between looks at a full ring, in microseconds.
+#define FULL_WAIT_US 500
+
+/**
+ * The GSource that runs the handlers: ready whenever the ring isn't empty.
+ * push() wakes the context up after each event, so no timeout is needed.
+ */
+struct QueueSource
+{
+    GSource source;
+    SignalingQueue *queue;
+};
+
+GSourceFuncs SignalingQueue::source_funcs = {
+    SignalingQueue::prepare_source,
+    SignalingQueue::check_source,
+    SignalingQueue::dispatch_source,
+    nullptr,
+};
+
+SignalingQueue::SignalingQueue(GMainContext *context)
+    : tail(0), head(0), full_waits(0), context(context)
+{
+    for (SignalingEvent &event : ring)
+    {
+        event.handler = nullptr;
+        event.name = nullptr;
+        event.has_text = FALSE;
+        event.value = 0;
+        event.queued = 0;
+    }
+
+    source = g_source_new(&source_funcs, sizeof(QueueSource));
+    ((QueueSource *)source)->queue = this;
+    g_source_set_name(source, "signaling events");
+    g_source_attach(source, context);
+}
+
+SignalingQueue::~SignalingQueue()
+{
+    g_source_destroy(source);
+    g_source_unref(source);
+}
+
+void SignalingQueue::push(SignalingHandler handler, const gchar *name,
+                          const std::string *text, gint64 value)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+
+    // Room once the consumer is less than a ring behind.
+    if (position - head.load(std::memory_order_acquire) >= SLOTS)
+    {
+        full_waits.fetch_add(1, std::memory_order_relaxed);
+        do
+        {
+            g_usleep(FULL_WAIT_US);
+        } while (position - head.load(std::memory_order_acquire) >= SLOTS);
+    }
+
+    SignalingEvent &event = ring[position & (SLOTS - 1)];
+    event.handler = handler;
+    event.name = name;
+    event.has_text = text != nullptr;
+    if (text)
+        event.text.assign(*text);
+    else
+        event.text.clear();
+    event.value = value;
+    event.queued = g_get_monotonic_time();
+    tail.store(position + 1, std::memory_order_release);
+
+    g_main_context_wakeup(context);
+}
+
+gboolean SignalingQueue::pending() const
+{
+    return head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire);
+}
+
+/**
+ * Run the handlers of the events in the ring, oldest first. The slot is
+ * given back only after its handler has returned, as the handler reads the
+ * event in place.
+ */
+void SignalingQueue::dispatch_some()
+{
+    size_t position = head.load(std::memory_order_relaxed);
+    size_t end = tail.load(std::memory_order_acquire);
+
+    for (int i = 0; i < DISPATCH_BATCH && position != end; i++, position++)
+    {
+        const SignalingEvent &event = ring[position & (SLOTS - 1)];
+        gint64 start = g_get_monotonic_time();
+
+        event.handler(event);
+
+        double wait = (start - event.queued) / 1000.0;
+        double handling = (g_get_monotonic_time() - start) / 1000.0;
+        Stats &times = stats[event.name];
+        record(&times.window, wait, handling);
+        record(&times.lifetime, wait, handling);
+        head.store(position + 1, std::memory_order_release);
+    }
+}
+
+void SignalingQueue::record(Times *times, double wait, double handling)
+{
+    times->wait.record(wait);
+    times->handling.record(handling);
+    times->count++;
+    times->wait_max = MAX(times->wait_max, wait);
+    times->handling_max = MAX(times->handling_max, handling);
+}
+
+SignalingEventSummary SignalingQueue::summarize(const gchar *name, const Times &times)
+{
+    SignalingEventSummary summary;
+
+    summary.name = name;
+    summary.count = times.count;
+    summary.wait_p50 = times.wait.percentile(50);
+    summary.wait_p99 = times.wait.percentile(99);
+    summary.wait_max = times.wait_max;
+    summary.handling_p99 = times.handling.percentile(99);
+    summary.handling_max = times.handling_max;
+    return summary;
+}
+
+std::vector<SignalingEventSummary> SignalingQueue::take_window()
+{
+    std::vector<SignalingEventSummary> summaries;
+
+    for (auto &entry : stats)
+    {
+        Times &window = entry.second.window;
+        if (window.count == 0)
+            continue;
+        summaries.push_back(summarize(entry.first, window));
+        window.wait.reset();
+        window.handling.reset();
+        window.count = 0;
+        window.wait_max = 0;
+        window.handling_max = 0;
+    }
+    return summaries;
+}
+
+std::vector<SignalingEventSummary> SignalingQueue::total() const
+{
+    std::vector<SignalingEventSummary> summaries;
+
+    for (const auto &entry : stats)
+        summaries.push_back(summarize(entry.first, entry.second.lifetime));
+    return summaries;
+}
+
+gboolean SignalingQueue::prepare_source(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return ((QueueSource *)source)->queue->pending();
+}
+
+gboolean SignalingQueue::check_source(GSource *source)
+{
+    return ((QueueSource *)source)->queue->pending();
+}
+
+gboolean SignalingQueue::dispatch_source(GSource *source, GSourceFunc callback,
+                                         gpointer user_data)
+{
+    ((QueueSource *)source)->queue->dispatch_some();
+    return G_SOURCE_CONTINUE;
+}
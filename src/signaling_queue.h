@@ -0,0 +1,132 @@
+/*
+ * Signaling event queue: hands the Socket.IO client's events over from its
+ * thread to the GLib main loop, through a lock-free single-producer,
+ * single-consumer ring, and measures how long each kind of event waits and
+ * takes to handle.
+ */
+
+#ifndef LIVESYNC_SIGNALING_QUEUE_H
+#define LIVESYNC_SIGNALING_QUEUE_H
+
+#include "latency.h"
+
+#include <glib.h>
+
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+struct SignalingEvent;
+
+typedef void (*SignalingHandler)(const SignalingEvent &event);
+
+/**
+ * An event in the ring. Its strings are reused by the events that come
+ * through the same slot later, so queueing doesn't allocate once the ring
+ * has seen messages of the size.
+ */
+struct SignalingEvent
+{
+    SignalingHandler handler;
+    const gchar *name; /* a string constant, e.g. "video-answer" */
+    gboolean has_text; /* the event's data was a string, in text */
+    std::string text;
+    gint64 value;      /* a number that goes with the event, e.g. an ack's */
+    gint64 queued;     /* monotonic time */
+};
+
+/**
+ * Wait and handling times of one kind of event, in milliseconds.
+ */
+struct SignalingEventSummary
+{
+    const gchar *name;
+    guint64 count;
+    double wait_p50;
+    double wait_p99;
+    double wait_max;
+    double handling_p99;
+    double handling_max;
+};
+
+class SignalingQueue
+{
+public:
+    /* Events are handled on context, or on the default main context. */
+    explicit SignalingQueue(GMainContext *context = nullptr);
+    ~SignalingQueue();
+
+    /* Queue an event, to be passed to handler on the main context. Only
+     * one thread may push, the Socket.IO client's. text is copied, unless
+     * it is nullptr. When the ring is full, this waits for room: the
+     * client then stops reading from the server, rather than losing or
+     * reordering events. */
+    void push(SignalingHandler handler, const gchar *name,
+              const std::string *text, gint64 value = 0);
+
+    /* Times push() had to wait for room so far. */
+    guint64 waits() const { return full_waits; }
+
+    /* The summary of each kind of event since the previous call, or since
+     * the start. Main context only. */
+    std::vector<SignalingEventSummary> take_window();
+    std::vector<SignalingEventSummary> total() const;
+
+private:
+    SignalingQueue(const SignalingQueue &) = delete;
+    SignalingQueue &operator=(const SignalingQueue &) = delete;
+
+    struct Times
+    {
+        Times() : count(0), wait_max(0), handling_max(0) {}
+
+        LatencyHistogram wait;
+        LatencyHistogram handling;
+        guint64 count;
+        double wait_max;
+        double handling_max;
+    };
+
+    struct Stats
+    {
+        Times window;
+        Times lifetime;
+    };
+
+    struct NameLess
+    {
+        bool operator()(const gchar *a, const gchar *b) const
+        {
+            return strcmp(a, b) < 0;
+        }
+    };
+
+    static gboolean prepare_source(GSource *source, gint *timeout);
+    static gboolean check_source(GSource *source);
+    static gboolean dispatch_source(GSource *source, GSourceFunc callback,
+                                    gpointer user_data);
+    static GSourceFuncs source_funcs;
+
+    gboolean pending() const;
+    void dispatch_some();
+    static void record(Times *times, double wait, double handling);
+    static SignalingEventSummary summarize(const gchar *name, const Times &times);
+
+    static const size_t SLOTS = 256; // a power of two
+
+    SignalingEvent ring[SLOTS];
+    // Next slot to write, by the producer, and to read, by the consumer; a
+    // cache line apart, so that the two threads don't write to the same one.
+    std::atomic<size_t> tail;
+    gchar padding[64];
+    std::atomic<size_t> head;
+    std::atomic<guint64> full_waits;
+
+    GMainContext *context;
+    GSource *source;
+    std::map<const gchar *, Stats, NameLess> stats; // main context only
+};
+
+#endif
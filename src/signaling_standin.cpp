@@ -0,0 +1,364 @@
+/*
+ * A local stand-in for the SignalingServer, for benchmarks without a real
+ * camera: just enough Socket.IO over a WebSocket for livesync_gstreamer's
+ * flow (init, device-ready, client-count, video-offer/video-answer and
+ * new-ice-candidate), relaying between the app and emulated cameras.
+ */
+
+#include "signaling_standin.h"
+#include "camera_emulator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// Engine.IO heartbeat, the Socket.IO server defaults.
+#define PING_INTERVAL 25000
+#define PING_TIMEOUT 20000
+
+SignalingStandIn::SignalingStandIn()
+    : server(nullptr), next_client_id(1), received(0), sent(0)
+{
+}
+
+SignalingStandIn::~SignalingStandIn()
+{
+    while (!clients.empty())
+        close_client(clients.back());
+    if (server)
+    {
+        soup_server_disconnect(server);
+        g_object_unref(server);
+    }
+}
+
+gboolean SignalingStandIn::listen(guint16 port)
+{
+    GError *error = nullptr;
+
+    server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "livesync-standin", NULL);
+    // The client connects to /socket.io/?EIO=4&transport=websocket.
+    soup_server_add_websocket_handler(server, "/socket.io", NULL, NULL,
+                                      on_websocket, this, NULL);
+    if (!soup_server_listen_local(server, port, SOUP_SERVER_LISTEN_IPV4_ONLY,
+                                  &error))
+    {
+        g_printerr("Can't listen on port %u: %s\n", port, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void SignalingStandIn::add_camera(CameraEmulator *camera)
+{
+    cameras.push_back(camera);
+}
+
+void SignalingStandIn::announce(CameraEmulator *camera)
+{
+    for (StandInClient *client : clients)
+    {
+        if (client->sub)
+            send_camera_state(client, camera);
+    }
+}
+
+void SignalingStandIn::emit(guint id, const gchar *event, JsonObject *object)
+{
+    StandInClient *client = find_client(id);
+    if (!client)
+        return;
+
+    JsonNode *root = json_node_init_object(json_node_alloc(), object);
+    gchar *text = json_to_string(root, FALSE);
+    send_event(client, event, text);
+    g_free(text);
+    json_node_free(root);
+}
+
+const gchar *SignalingStandIn::client_name(guint id)
+{
+    StandInClient *client = find_client(id);
+    return client ? client->sub : nullptr;
+}
+
+void SignalingStandIn::on_websocket(SoupServer *server,
+                                    SoupWebsocketConnection *connection,
+                                    const char *path, SoupClientContext *context,
+                                    gpointer user_data)
+{
+    SignalingStandIn *self = (SignalingStandIn *)user_data;
+    StandInClient *client = new StandInClient();
+
+    client->id = self->next_client_id++;
+    client->connection = (SoupWebsocketConnection *)g_object_ref(connection);
+    client->owner = self;
+    self->clients.push_back(client);
+
+    g_signal_connect(connection, "message", G_CALLBACK(on_message), client);
+    g_signal_connect(connection, "closed", G_CALLBACK(on_close), client);
+
+    // Engine.IO open packet; WebSocket only, no upgrades.
+    gchar *open = g_strdup_printf("0{\"sid\":\"standin%u\",\"upgrades\":[],"
+                                  "\"pingInterval\":%d,\"pingTimeout\":%d,"
+                                  "\"maxPayload\":1000000}",
+                                  client->id, PING_INTERVAL, PING_TIMEOUT);
+    soup_websocket_connection_send_text(connection, open);
+    g_free(open);
+    client->ping_source = g_timeout_add(PING_INTERVAL, ping, client);
+}
+
+gboolean SignalingStandIn::ping(gpointer user_data)
+{
+    StandInClient *client = (StandInClient *)user_data;
+
+    soup_websocket_connection_send_text(client->connection, "2");
+    return G_SOURCE_CONTINUE;
+}
+
+void SignalingStandIn::on_message(SoupWebsocketConnection *connection, gint type,
+                                  GBytes *message, gpointer user_data)
+{
+    StandInClient *client = (StandInClient *)user_data;
+    gsize size;
+    const gchar *data = (const gchar *)g_bytes_get_data(message, &size);
+
+    if (type != SOUP_WEBSOCKET_DATA_TEXT)
+        return;
+    gchar *packet = g_strndup(data, size);
+    client->owner->handle_packet(client, packet);
+    g_free(packet);
+}
+
+void SignalingStandIn::on_close(SoupWebsocketConnection *connection,
+                                gpointer user_data)
+{
+    StandInClient *client = (StandInClient *)user_data;
+
+    client->owner->close_client(client);
+}
+
+void SignalingStandIn::close_client(StandInClient *client)
+{
+    clients.erase(std::remove(clients.begin(), clients.end(), client),
+                  clients.end());
+    for (CameraEmulator *camera : cameras)
+        camera->hang_up(client->id);
+    if (on_closed)
+        on_closed(client);
+
+    g_source_remove(client->ping_source);
+    g_signal_handlers_disconnect_by_data(client->connection, client);
+    if (soup_websocket_connection_get_state(client->connection) ==
+        SOUP_WEBSOCKET_STATE_OPEN)
+        soup_websocket_connection_close(client->connection,
+                                        SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    g_object_unref(client->connection);
+    g_free(client->sub);
+    delete client;
+}
+
+/**
+ * An Engine.IO packet: a type digit, and for messages a Socket.IO packet of
+ * its own: a type digit, an optional "/namespace," and ack id, then JSON.
+ */
+void SignalingStandIn::handle_packet(StandInClient *client, const gchar *packet)
+{
+    switch (packet[0])
+    {
+    case '2': // ping, older clients send these
+        soup_websocket_connection_send_text(client->connection, "3");
+        return;
+    case '4': // message
+        break;
+    default: // pong, noop, close (the WebSocket closes too)
+        return;
+    }
+    if (!packet[1])
+        return;
+
+    const gchar *p = packet + 2;
+    if (*p == '/')
+    {
+        // Only the default namespace is served.
+        const gchar *comma = strchr(p, ',');
+        if (!comma || strncmp(p, "/,", 2) != 0)
+            return;
+        p = comma + 1;
+    }
+    gint ack_id = -1;
+    if (g_ascii_isdigit(*p))
+        ack_id = (gint)strtol(p, (gchar **)&p, 10);
+
+    switch (packet[1])
+    {
+    case '0': // connect to the namespace, then the server asks to register
+    {
+        gchar *reply = g_strdup_printf("40{\"sid\":\"standin%u\"}", client->id);
+        soup_websocket_connection_send_text(client->connection, reply);
+        g_free(reply);
+        send_event(client, "init", nullptr);
+        break;
+    }
+    case '2': // event
+    {
+        JsonParser *parser = json_parser_new();
+        if (json_parser_load_from_data(parser, p, -1, NULL) &&
+            JSON_NODE_HOLDS_ARRAY(json_parser_get_root(parser)))
+            handle_event(client, json_node_get_array(json_parser_get_root(parser)),
+                         ack_id);
+        else
+            g_printerr("Stand-in: can't parse '%s'\n", packet);
+        g_object_unref(parser);
+        break;
+    }
+    default: // acks to our events, disconnect
+        break;
+    }
+}
+
+void SignalingStandIn::handle_event(StandInClient *client, JsonArray *args,
+                                    gint ack_id)
+{
+    const gchar *event = json_array_get_length(args) > 0
+                             ? json_array_get_string_element(args, 0)
+                             : nullptr;
+    JsonNode *arg = json_array_get_length(args) > 1
+                        ? json_array_get_element(args, 1)
+                        : nullptr;
+    gboolean registered = FALSE;
+
+    received++;
+    if (g_strcmp0(event, "init") == 0)
+    {
+        // {"sub": name, "role": "receiver"}
+        if (arg && JSON_NODE_HOLDS_OBJECT(arg))
+        {
+            JsonObject *object = json_node_get_object(arg);
+            g_free(client->sub);
+            client->sub = g_strdup(json_object_has_member(object, "sub")
+                                       ? json_object_get_string_member(object, "sub")
+                                       : "receiver");
+            registered = TRUE;
+        }
+    }
+    else if (arg && JSON_NODE_HOLDS_VALUE(arg) &&
+             json_node_get_value_type(arg) == G_TYPE_STRING)
+    {
+        // The call's messages are JSON objects in a string.
+        JsonParser *parser = json_parser_new();
+        if (json_parser_load_from_data(parser, json_node_get_string(arg), -1, NULL) &&
+            JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+        {
+            JsonObject *object = json_node_get_object(json_parser_get_root(parser));
+            CameraEmulator *camera =
+                json_object_has_member(object, "target")
+                    ? find_camera(json_object_get_string_member(object, "target"))
+                    : nullptr;
+            if (!camera)
+                g_printerr("Stand-in: no camera for '%s'\n", event);
+            else if (g_strcmp0(event, "video-offer") == 0)
+                camera->handle_offer(client->id, object);
+            else if (g_strcmp0(event, "new-ice-candidate") == 0)
+                camera->handle_ice_candidate(client->id, object);
+            else if (g_strcmp0(event, "hang-up") == 0)
+                camera->hang_up(client->id);
+            else if (g_strcmp0(event, "message") == 0)
+                camera->handle_command(client->id, object);
+        }
+        g_object_unref(parser);
+    }
+
+    if (ack_id >= 0)
+    {
+        gchar *ack = g_strdup_printf("43%d[%s]", ack_id,
+                                     g_strcmp0(event, "init") == 0
+                                         ? (registered ? "true" : "false")
+                                         : "");
+        soup_websocket_connection_send_text(client->connection, ack);
+        g_free(ack);
+    }
+
+    if (registered)
+    {
+        if (on_registered)
+            on_registered(client);
+        for (CameraEmulator *camera : cameras)
+        {
+            if (camera->is_ready())
+                send_camera_state(client, camera);
+        }
+    }
+}
+
+/**
+ * What the server says about a camera: whether it is connected, and how
+ * many are streaming from it.
+ */
+void SignalingStandIn::send_camera_state(StandInClient *client,
+                                         CameraEmulator *camera)
+{
+    if (!camera->is_ready())
+    {
+        send_event(client, "device-disconnected", camera->name());
+        return;
+    }
+    send_event(client, "device-ready", camera->name());
+
+    JsonObject *count = json_object_new();
+    json_object_set_int_member(count, "connected-clients", camera->is_free() ? 0 : 1);
+    json_object_set_int_member(count, "max-connected-clients", 1);
+    json_object_set_int_member(count, "streaming-clients", camera->is_free() ? 0 : 1);
+    json_object_set_int_member(count, "max-streaming-clients", 1);
+    json_object_set_string_member(count, "source", camera->name());
+    JsonNode *root = json_node_init_object(json_node_alloc(), count);
+    gchar *text = json_to_string(root, FALSE);
+    send_event(client, "client-count", text);
+    g_free(text);
+    json_node_free(root);
+    json_object_unref(count);
+}
+
+/**
+ * 42["event"] or 42["event","argument"], the argument sent as a string.
+ */
+void SignalingStandIn::send_event(StandInClient *client, const gchar *event,
+                                  const gchar *argument)
+{
+    JsonArray *array = json_array_new();
+    json_array_add_string_element(array, event);
+    if (argument)
+        json_array_add_string_element(array, argument);
+    JsonNode *root = json_node_init_array(json_node_alloc(), array);
+    gchar *text = json_to_string(root, FALSE);
+    gchar *packet = g_strconcat("42", text, NULL);
+
+    soup_websocket_connection_send_text(client->connection, packet);
+    sent++;
+
+    g_free(packet);
+    g_free(text);
+    json_node_free(root);
+    json_array_unref(array);
+}
+
+StandInClient *SignalingStandIn::find_client(guint id)
+{
+    for (StandInClient *client : clients)
+    {
+        if (client->id == id)
+            return client;
+    }
+    return nullptr;
+}
+
+CameraEmulator *SignalingStandIn::find_camera(const gchar *name)
+{
+    for (CameraEmulator *camera : cameras)
+    {
+        if (g_strcmp0(camera->name(), name) == 0)
+            return camera;
+    }
+    return nullptr;
+}
@@ -0,0 +1,101 @@
+/*
+ * A local stand-in for the SignalingServer, for benchmarks without a real
+ * camera: just enough Socket.IO over a WebSocket for livesync_gstreamer's
+ * flow (init, device-ready, client-count, video-offer/video-answer and
+ * new-ice-candidate), relaying between the app and emulated cameras.
+ */
+
+#ifndef LIVESYNC_SIGNALING_STANDIN_H
+#define LIVESYNC_SIGNALING_STANDIN_H
+
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+
+#include <functional>
+#include <vector>
+
+class CameraEmulator;
+class SignalingStandIn;
+
+/**
+ * One receiver (livesync_gstreamer) connected to the stand-in.
+ */
+struct StandInClient
+{
+    guint id;            /* cameras refer to clients by id, as they may go */
+    SoupWebsocketConnection *connection;
+    gchar *sub;          /* the name it registered with, or nullptr */
+    guint ping_source;
+    SignalingStandIn *owner;
+};
+
+/**
+ * Speaks Engine.IO 4 / Socket.IO 5 on ws://127.0.0.1:PORT/socket.io/, which
+ * is what socket.io-client-cpp 3 talks, on the default namespace and over
+ * the WebSocket transport only. Runs on the GLib main loop, like the
+ * cameras.
+ *
+ * A registered client is told about every camera that is ready (and free),
+ * as the real server does. Offers and candidates go to the camera named as
+ * their target; the camera's answers and candidates go back to the client
+ * that called it.
+ */
+class SignalingStandIn
+{
+public:
+    SignalingStandIn();
+    ~SignalingStandIn();
+
+    /* Listen on 127.0.0.1:port. Returns FALSE and prints why on failure. */
+    gboolean listen(guint16 port);
+
+    /* Cameras are not owned. */
+    void add_camera(CameraEmulator *camera);
+
+    /* From a camera: its state changed, tell the clients. */
+    void announce(CameraEmulator *camera);
+
+    /* From a camera: send an event whose argument is a JSON object as a
+     * string, as the camera app does. The client may have gone already. */
+    void emit(guint client, const gchar *event, JsonObject *object);
+
+    /* The name a client registered with, or nullptr. */
+    const gchar *client_name(guint client);
+
+    /* Socket.IO events received from and sent to the clients so far. */
+    guint64 events_received() const { return received; }
+    guint64 events_sent() const { return sent; }
+
+    /* Called when a client has registered, and when one disconnects. */
+    std::function<void(StandInClient *)> on_registered;
+    std::function<void(StandInClient *)> on_closed;
+
+private:
+    SignalingStandIn(const SignalingStandIn &) = delete;
+    SignalingStandIn &operator=(const SignalingStandIn &) = delete;
+
+    static void on_websocket(SoupServer *server, SoupWebsocketConnection *connection,
+                             const char *path, SoupClientContext *context,
+                             gpointer user_data);
+    static void on_message(SoupWebsocketConnection *connection, gint type,
+                           GBytes *message, gpointer user_data);
+    static void on_close(SoupWebsocketConnection *connection, gpointer user_data);
+    static gboolean ping(gpointer user_data);
+
+    StandInClient *find_client(guint id);
+    CameraEmulator *find_camera(const gchar *name);
+    void handle_packet(StandInClient *client, const gchar *packet);
+    void handle_event(StandInClient *client, JsonArray *args, gint ack_id);
+    void send_event(StandInClient *client, const gchar *event, const gchar *argument);
+    void send_camera_state(StandInClient *client, CameraEmulator *camera);
+    void close_client(StandInClient *client);
+
+    SoupServer *server;
+    guint next_client_id;
+    guint64 received;
+    guint64 sent;
+    std::vector<StandInClient *> clients;
+    std::vector<CameraEmulator *> cameras;
+};
+
+#endif
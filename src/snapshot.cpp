@@ -0,0 +1,248 @@
+/*
+ * Snapshots on demand: a still of what a camera sees right now, as a JPEG
+ * or PNG over HTTP on a local port or UNIX socket. Each camera keeps a
+ * reference to its latest decoded frame, and encodes it only when asked.
+ */
+
+#include "snapshot.h"
+#include "logger.h"
+
+#include <gst/video/video.h>
+
+#include <cstdlib>
+#include <cstring>
+
+static const gchar *const snapshot_types[SNAPSHOT_FORMATS] = {"image/jpeg", "image/png"};
+
+FrameSnapshot::FrameSnapshot()
+    : buffer(nullptr), caps(nullptr), sequence(0), count_encoded(0), count_cached(0)
+{
+    for (guint format = 0; format < SNAPSHOT_FORMATS; format++)
+    {
+        images[format] = nullptr;
+        image_sequence[format] = 0;
+    }
+}
+
+FrameSnapshot::~FrameSnapshot()
+{
+    if (buffer)
+        gst_buffer_unref(buffer);
+    if (caps)
+        gst_caps_unref(caps);
+    for (GBytes *image : images)
+    {
+        if (image)
+            g_bytes_unref(image);
+    }
+}
+
+void FrameSnapshot::watch(GstPad *pad)
+{
+    GstCaps *current = gst_pad_get_current_caps(pad);
+
+    if (current)
+    {
+        std::lock_guard<std::mutex> guard(frame_lock);
+        gst_caps_replace(&caps, current);
+        gst_caps_unref(current);
+    }
+    gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+                                             GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_data, this, NULL);
+}
+
+/**
+ * Called on the streaming thread for every frame: swap in a reference to
+ * it. The old frame is released outside the lock, as that may hand it back
+ * to the decoder's pool.
+ */
+GstPadProbeReturn FrameSnapshot::on_data(GstPad *pad, GstPadProbeInfo *info,
+                                         gpointer user_data)
+{
+    FrameSnapshot *self = (FrameSnapshot *)user_data;
+    GstBuffer *old;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER)
+    {
+        GstBuffer *frame = gst_buffer_ref(GST_PAD_PROBE_INFO_BUFFER(info));
+        {
+            std::lock_guard<std::mutex> guard(self->frame_lock);
+            old = self->buffer;
+            self->buffer = frame;
+            self->sequence++;
+        }
+    }
+    else
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        GstCaps *new_caps;
+
+        if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+            return GST_PAD_PROBE_OK;
+        gst_event_parse_caps(event, &new_caps);
+        // The frame we have doesn't go with the new caps.
+        std::lock_guard<std::mutex> guard(self->frame_lock);
+        gst_caps_replace(&self->caps, new_caps);
+        old = self->buffer;
+        self->buffer = nullptr;
+    }
+
+    if (old)
+        gst_buffer_unref(old);
+    return GST_PAD_PROBE_OK;
+}
+
+GBytes *FrameSnapshot::image(SnapshotFormat format, GError **error)
+{
+    // One encoding at a time, so that requests for the same frame wait for
+    // the image instead of encoding it again.
+    std::lock_guard<std::mutex> encoding(encode_lock);
+    GstBuffer *frame = nullptr;
+    GstCaps *frame_caps = nullptr;
+    guint64 frame_sequence;
+
+    {
+        std::lock_guard<std::mutex> guard(frame_lock);
+        if (buffer && caps)
+        {
+            frame = gst_buffer_ref(buffer);
+            frame_caps = gst_caps_ref(caps);
+        }
+        frame_sequence = sequence;
+    }
+
+    if (!frame)
+    {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No frame yet");
+        return nullptr;
+    }
+    if (images[format] && image_sequence[format] == frame_sequence)
+    {
+        gst_buffer_unref(frame);
+        gst_caps_unref(frame_caps);
+        count_cached++;
+        return g_bytes_ref(images[format]);
+    }
+
+    // videoconvert ! jpegenc or pngenc, in a pipeline of its own.
+    GstSample *sample = gst_sample_new(frame, frame_caps, NULL, NULL);
+    GstCaps *to_caps = gst_caps_new_empty_simple(snapshot_types[format]);
+    gint64 start = g_get_monotonic_time();
+    GstSample *converted = gst_video_convert_sample(sample, to_caps, 5 * GST_SECOND, error);
+    gst_caps_unref(to_caps);
+    gst_sample_unref(sample);
+    gst_buffer_unref(frame);
+    gst_caps_unref(frame_caps);
+    if (!converted)
+        return nullptr;
+
+    GstMapInfo map;
+    GstBuffer *encoded = gst_sample_get_buffer(converted);
+    if (!encoded || !gst_buffer_map(encoded, &map, GST_MAP_READ))
+    {
+        gst_sample_unref(converted);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Can't read the encoded image");
+        return nullptr;
+    }
+    if (images[format])
+        g_bytes_unref(images[format]);
+    images[format] = g_bytes_new(map.data, map.size);
+    image_sequence[format] = frame_sequence;
+    gst_buffer_unmap(encoded, &map);
+    gst_sample_unref(converted);
+    count_encoded++;
+
+    LOG_DEBUG(LOG_MEDIA, "Snapshot: %s of %" G_GSIZE_FORMAT " bytes in %.1f ms",
+              snapshot_types[format], g_bytes_get_size(images[format]),
+              (g_get_monotonic_time() - start) / 1000.0);
+    return g_bytes_ref(images[format]);
+}
+
+SnapshotServer::SnapshotServer(SnapshotLookup lookup)
+    : lookup(lookup),
+      server("snapshots", "/snapshot.jpg", [this](const gchar *path, GOutputStream *out) {
+          serve(path, out);
+      })
+{
+}
+
+/**
+ * The camera and format of a path like /snapshot.jpg or /snapshot/2.png.
+ */
+static gboolean parse_path(const gchar *path, guint *camera, SnapshotFormat *format)
+{
+    const gchar *extension;
+    gchar *end;
+
+    *camera = 1;
+    if (g_str_has_prefix(path, "/snapshot/"))
+    {
+        *camera = strtoul(path + strlen("/snapshot/"), &end, 10);
+        extension = end;
+    }
+    else if (g_str_has_prefix(path, "/snapshot"))
+    {
+        extension = path + strlen("/snapshot");
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    if (strcmp(extension, ".jpg") == 0 || strcmp(extension, ".jpeg") == 0)
+        *format = SNAPSHOT_JPEG;
+    else if (strcmp(extension, ".png") == 0)
+        *format = SNAPSHOT_PNG;
+    else
+        return FALSE;
+    return TRUE;
+}
+
+/**
+ * Serve one request, on one of the server's threads.
+ */
+void SnapshotServer::serve(const gchar *path, GOutputStream *out)
+{
+    guint camera;
+    SnapshotFormat format;
+    FrameSnapshot *snapshot;
+
+    if (!parse_path(path, &camera, &format))
+    {
+        HttpServer::respond_text(out, "404 Not Found",
+                                 "Try /snapshot.jpg, /snapshot.png or /snapshot/N.jpg");
+        return;
+    }
+    if (!(snapshot = lookup(camera)))
+    {
+        HttpServer::respond_text(out, "404 Not Found", "No such camera");
+        return;
+    }
+
+    GError *error = nullptr;
+    GBytes *image = snapshot->image(format, &error);
+    if (image)
+    {
+        gsize size;
+        gconstpointer data = g_bytes_get_data(image, &size);
+        HttpServer::respond(out, "200 OK", snapshot_types[format], data, size);
+        g_bytes_unref(image);
+    }
+    else
+    {
+        LOG_DEBUG(LOG_MEDIA, "Snapshot of camera %u: %s", camera, error->message);
+        HttpServer::respond_text(out, "503 Service Unavailable", error->message);
+        g_error_free(error);
+    }
+}
+
+gboolean SnapshotServer::listen_tcp(guint16 port)
+{
+    return server.listen_tcp(port);
+}
+
+gboolean SnapshotServer::listen_unix(const gchar *path)
+{
+    return server.listen_unix(path);
+}
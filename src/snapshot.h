@@ -0,0 +1,97 @@
+/*
+ * Snapshots on demand: a still of what a camera sees right now, as a JPEG
+ * or PNG over HTTP on a local port or UNIX socket. Each camera keeps a
+ * reference to its latest decoded frame, and encodes it only when asked.
+ */
+
+#ifndef LIVESYNC_SNAPSHOT_H
+#define LIVESYNC_SNAPSHOT_H
+
+#include "http_server.h"
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+enum SnapshotFormat
+{
+    SNAPSHOT_JPEG,
+    SNAPSHOT_PNG,
+    SNAPSHOT_FORMATS
+};
+
+/**
+ * The latest decoded frame of a camera. Keeping it costs a buffer
+ * reference per frame on the streaming thread, and nothing else: the
+ * frame is encoded on the first request after it arrived, on the
+ * requester's thread, and the image is kept for further requests until
+ * the next frame replaces it.
+ */
+class FrameSnapshot
+{
+public:
+    FrameSnapshot();
+    ~FrameSnapshot();
+
+    /* Keep the frames going through a raw video pad. */
+    void watch(GstPad *pad);
+
+    /* The latest frame as an image, or nullptr if there is none yet or it
+     * can't be encoded (error says why). Any thread; may take a while. */
+    GBytes *image(SnapshotFormat format, GError **error);
+
+    /* Images encoded, and served from the cache. */
+    guint64 encoded() const { return count_encoded; }
+    guint64 cached() const { return count_cached; }
+
+private:
+    FrameSnapshot(const FrameSnapshot &) = delete;
+    FrameSnapshot &operator=(const FrameSnapshot &) = delete;
+
+    static GstPadProbeReturn on_data(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer user_data);
+
+    std::mutex frame_lock; // protects the frame, held for a reference swap
+    GstBuffer *buffer;
+    GstCaps *caps;
+    guint64 sequence; /* of the frame, 0 = none yet */
+
+    std::mutex encode_lock; // protects the images, held while encoding
+    GBytes *images[SNAPSHOT_FORMATS];
+    guint64 image_sequence[SNAPSHOT_FORMATS];
+
+    std::atomic<guint64> count_encoded;
+    std::atomic<guint64> count_cached;
+};
+
+/* The snapshot of a camera, by its 1-based number, or nullptr. */
+typedef std::function<FrameSnapshot *(guint camera)> SnapshotLookup;
+
+/**
+ * Serves GET /snapshot.jpg and /snapshot.png for the first camera, and
+ * /snapshot/N.jpg and /snapshot/N.png for camera N.
+ */
+class SnapshotServer
+{
+public:
+    explicit SnapshotServer(SnapshotLookup lookup);
+
+    /* Serve on 127.0.0.1:port, or on a UNIX socket. Returns FALSE and
+     * prints why on failure. */
+    gboolean listen_tcp(guint16 port);
+    gboolean listen_unix(const gchar *path);
+
+private:
+    SnapshotServer(const SnapshotServer &) = delete;
+    SnapshotServer &operator=(const SnapshotServer &) = delete;
+
+    void serve(const gchar *path, GOutputStream *out);
+
+    SnapshotLookup lookup;
+    HttpServer server; // last, so that it stops first
+};
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * WebRTC statistics for monitoring: flattens webrtcbin's get-stats into
+ * counters and gauges and serves them in the Prometheus text format.
+ */
+
+#include "stats_exporter.h"
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+#include <cstring>
+
+#define METRIC_PREFIX "livesync_webrtc_"
+
+/**
+ * The running totals among webrtcbin's stats fields, by name; everything
+ * else numeric (jitter, round-trip time, fraction-lost, frames-per-second,
+ * ...) is a gauge. Listed rather than matched by pattern, since the names
+ * don't tell them apart.
+ */
+static bool is_counter(const gchar *field)
+{
+    static const gchar *const counters[] = {
+        // RTP, both directions, and transports and candidate pairs.
+        "packets-sent", "packets-received", "bytes-sent", "bytes-received",
+        "header-bytes-sent", "header-bytes-received",
+        "packets-lost", "packets-duplicated", "packets-discarded",
+        "packets-repaired", "fir-count", "pli-count", "nack-count",
+        "retransmitted-packets-sent", "retransmitted-bytes-sent",
+        "retransmitted-packets-received", "retransmitted-bytes-received",
+        "frames-sent", "frames-received", "frames-decoded", "frames-dropped",
+        "key-frames-decoded", "reports-sent", "reports-received",
+        // Candidate pairs.
+        "total-round-trip-time", "requests-sent", "requests-received",
+        "responses-sent", "responses-received", "consent-requests-sent",
+        // Data channels and the peer connection.
+        "messages-sent", "messages-received", "data-channels-opened",
+        "data-channels-closed",
+        NULL};
+
+    return g_strv_contains(counters, field);
+}
+
+/**
+ * A metric name from a stats type and field, e.g. inbound-rtp and
+ * packets-lost give livesync_webrtc_inbound_rtp_packets_lost.
+ */
+static std::string metric_name(const gchar *type, const gchar *field)
+{
+    std::string name = METRIC_PREFIX;
+    name += type;
+    name += "_";
+    name += field;
+    for (char &c : name)
+    {
+        if (!g_ascii_isalnum(c) && c != '_')
+            c = '_';
+    }
+    return name;
+}
+
+static bool get_number(const GValue *value, double *number)
+{
+    switch (G_VALUE_TYPE(value))
+    {
+    case G_TYPE_INT:
+        *number = g_value_get_int(value);
+        return true;
+    case G_TYPE_UINT:
+        *number = g_value_get_uint(value);
+        return true;
+    case G_TYPE_INT64:
+        *number = (double)g_value_get_int64(value);
+        return true;
+    case G_TYPE_UINT64:
+        *number = (double)g_value_get_uint64(value);
+        return true;
+    case G_TYPE_DOUBLE:
+        *number = g_value_get_double(value);
+        return true;
+    case G_TYPE_FLOAT:
+        *number = g_value_get_float(value);
+        return true;
+    case G_TYPE_BOOLEAN:
+        *number = g_value_get_boolean(value) ? 1 : 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+StatsExporter::StatsExporter(guint window)
+    : window(window > 1 ? window : 2),
+      server("stats", "/metrics", [this](const gchar *path, GOutputStream *out) {
+          serve(out);
+      })
+{
+}
+
+std::string StatsExporter::quote(const gchar *value)
+{
+    std::string quoted = "\"";
+    for (const gchar *p = value ? value : ""; *p; p++)
+    {
+        if (*p == '\\' || *p == '"')
+            quoted += '\\';
+        if (*p == '\n')
+            quoted += "\\n";
+        else
+            quoted += *p;
+    }
+    return quoted + "\"";
+}
+
+void StatsExporter::set(const std::string &name, const std::string &labels,
+                        bool counter, double value, gint64 now)
+{
+    Series &series = metrics[name][labels];
+    series.counter = counter;
+    series.updated = now;
+    series.samples.emplace_back(now, value);
+    // Only counters need history, for their rates.
+    while (series.samples.size() > (counter ? window : 1))
+        series.samples.pop_front();
+}
+
+/**
+ * Add the numeric fields of one stats entry, e.g. one inbound-rtp stream.
+ */
+void StatsExporter::flatten(const std::string &labels, const GstStructure *stat,
+                            gint64 now)
+{
+    GstWebRTCStatsType type;
+    const gchar *type_name = "unknown";
+    const gchar *id = gst_structure_get_string(stat, "id");
+
+    if (gst_structure_get(stat, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, NULL))
+    {
+        GEnumClass *enum_class = (GEnumClass *)g_type_class_ref(GST_TYPE_WEBRTC_STATS_TYPE);
+        GEnumValue *value = g_enum_get_value(enum_class, type);
+        if (value)
+            type_name = value->value_nick;
+        g_type_class_unref(enum_class);
+    }
+
+    std::string series_labels = labels + ",id=" + quote(id);
+    for (gint i = 0; i < gst_structure_n_fields(stat); i++)
+    {
+        const gchar *field = gst_structure_nth_field_name(stat, i);
+        double number;
+
+        if (strcmp(field, "timestamp") == 0 ||
+            !get_number(gst_structure_get_value(stat, field), &number))
+            continue;
+        set(metric_name(type_name, field), series_labels, is_counter(field),
+            number, now);
+    }
+}
+
+void StatsExporter::update_webrtc(const std::string &labels,
+                                  const GstStructure *stats)
+{
+    gint64 now = g_get_monotonic_time();
+    std::lock_guard<std::mutex> guard(lock);
+
+    // The reply has one field per stats entry, each a structure.
+    for (gint i = 0; i < gst_structure_n_fields(stats); i++)
+    {
+        const GValue *value = gst_structure_get_value(stats,
+                                                      gst_structure_nth_field_name(stats, i));
+        if (G_VALUE_HOLDS(value, GST_TYPE_STRUCTURE))
+            flatten(labels, gst_value_get_structure(value), now);
+    }
+}
+
+void StatsExporter::set_gauge(const std::string &name, const std::string &labels,
+                              double value)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    set(name, labels, false, value, g_get_monotonic_time());
+}
+
+void StatsExporter::expire(gint64 max_age)
+{
+    gint64 now = g_get_monotonic_time();
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto metric = metrics.begin(); metric != metrics.end();)
+    {
+        for (auto series = metric->second.begin(); series != metric->second.end();)
+        {
+            if (now - series->second.updated > max_age)
+                series = metric->second.erase(series);
+            else
+                ++series;
+        }
+        if (metric->second.empty())
+            metric = metrics.erase(metric);
+        else
+            ++metric;
+    }
+}
+
+std::string StatsExporter::render()
+{
+    std::string text;
+    gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (const auto &metric : metrics)
+    {
+        const bool counter = metric.second.begin()->second.counter;
+
+        text += "# TYPE " + metric.first + (counter ? " counter\n" : " gauge\n");
+        for (const auto &series : metric.second)
+        {
+            g_ascii_dtostr(number, sizeof(number), series.second.samples.back().second);
+            text += metric.first + "{" + series.first + "} " + number + "\n";
+        }
+
+        if (!counter)
+            continue;
+
+        // The rate over the rolling window, for dashboards without PromQL.
+        text += "# TYPE " + metric.first + "_per_second gauge\n";
+        for (const auto &series : metric.second)
+        {
+            const auto &first = series.second.samples.front();
+            const auto &last = series.second.samples.back();
+            double rate = last.first > first.first
+                              ? (last.second - first.second) * 1e6 / (last.first - first.first)
+                              : 0.0;
+            g_ascii_dtostr(number, sizeof(number), rate);
+            text += metric.first + "_per_second{" + series.first + "} " + number + "\n";
+        }
+    }
+    return text;
+}
+
+/**
+ * Serve one scrape, on one of the server's threads, whatever it asks for.
+ */
+void StatsExporter::serve(GOutputStream *out)
+{
+    std::string body = render();
+    HttpServer::respond(out, "200 OK", "text/plain; version=0.0.4",
+                        body.data(), body.size());
+}
+
+gboolean StatsExporter::listen_tcp(guint16 port)
+{
+    return server.listen_tcp(port);
+}
+
+gboolean StatsExporter::listen_unix(const gchar *path)
+{
+    return server.listen_unix(path);
+}
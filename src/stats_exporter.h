@@ -0,0 +1,82 @@
+/*
+ * WebRTC statistics for monitoring: flattens webrtcbin's get-stats into
+ * counters and gauges and serves them in the Prometheus text format.
+ */
+
+#ifndef LIVESYNC_STATS_EXPORTER_H
+#define LIVESYNC_STATS_EXPORTER_H
+
+#include "http_server.h"
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * Keeps the latest values of all metrics, plus a short rolling window of
+ * samples per counter, from which per-second rates are derived (bitrate,
+ * packets lost per second and so on).
+ *
+ * Metrics are updated from any thread (get-stats replies come from
+ * webrtcbin's threads) and scraped from the server's own threads.
+ */
+class StatsExporter
+{
+public:
+    /* window: how many samples of each counter to keep for the rates. */
+    explicit StatsExporter(guint window);
+
+    /* Serve GET /metrics (any path, really) on 127.0.0.1:port, or on a
+     * UNIX socket. Returns FALSE and prints why on failure. */
+    gboolean listen_tcp(guint16 port);
+    gboolean listen_unix(const gchar *path);
+
+    /* Flatten a get-stats reply. labels are added to every series, in the
+     * Prometheus syntax without braces, e.g. camera="1",peer="Camera". */
+    void update_webrtc(const std::string &labels, const GstStructure *stats);
+
+    /* Set a gauge from elsewhere in the app. */
+    void set_gauge(const std::string &name, const std::string &labels,
+                   double value);
+
+    /* Forget series that haven't been updated for max_age microseconds,
+     * e.g. of cameras that have gone away. */
+    void expire(gint64 max_age);
+
+    /* The whole exposition, as served. */
+    std::string render();
+
+    /* Escape a label value. */
+    static std::string quote(const gchar *value);
+
+private:
+    StatsExporter(const StatsExporter &) = delete;
+    StatsExporter &operator=(const StatsExporter &) = delete;
+
+    struct Series
+    {
+        bool counter;
+        gint64 updated; // monotonic, microseconds
+        std::deque<std::pair<gint64, double>> samples;
+    };
+
+    void set(const std::string &name, const std::string &labels, bool counter,
+             double value, gint64 now);
+    void flatten(const std::string &labels, const GstStructure *stat,
+                 gint64 now);
+    void serve(GOutputStream *out);
+
+    guint window;
+
+    std::mutex lock; // protects metrics
+    // metric name -> labels -> series, sorted for a stable output
+    std::map<std::string, std::map<std::string, Series>> metrics;
+
+    HttpServer server; // last, so that it stops first
+};
+
+#endif
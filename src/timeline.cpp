@@ -0,0 +1,56 @@
+/*
+ * Startup timeline: when each phase from starting the app to the first
+ * decoded frame of a camera was reached, to see what the wait is made of.
+ */
+
+#include "timeline.h"
+
+#include <algorithm>
+
+StartupTimeline::StartupTimeline() : start(g_get_monotonic_time())
+{
+}
+
+void StartupTimeline::mark(guint camera, const gchar *phase)
+{
+    gint64 now = g_get_monotonic_time();
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (std::find(printed.begin(), printed.end(), camera) != printed.end())
+        return;
+    for (const Mark &m : marks)
+    {
+        if (m.camera == camera && g_str_equal(m.phase, phase))
+            return;
+    }
+    marks.push_back({camera, phase, now});
+}
+
+void StartupTimeline::print(guint camera)
+{
+    std::vector<Mark> shown;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (std::find(printed.begin(), printed.end(), camera) != printed.end())
+            return;
+        printed.push_back(camera);
+        for (const Mark &m : marks)
+        {
+            if (m.camera == 0 || m.camera == camera)
+                shown.push_back(m);
+        }
+    }
+    std::stable_sort(shown.begin(), shown.end(), [](const Mark &a, const Mark &b)
+                     { return a.time < b.time; });
+
+    // Phases may overlap (e.g. the pipeline is built while we register),
+    // so the step is the wait since the previous mark, whatever it was.
+    g_print("Camera %u startup timeline (ms since start, step):\n", camera);
+    gint64 previous = start;
+    for (const Mark &m : shown)
+    {
+        g_print("  %8.1f %+8.1f  %s\n", (m.time - start) / 1000.0,
+                (m.time - previous) / 1000.0, m.phase);
+        previous = m.time;
+    }
+}
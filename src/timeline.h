@@ -0,0 +1,46 @@
+/*
+ * Startup timeline: when each phase from starting the app to the first
+ * decoded frame of a camera was reached, to see what the wait is made of.
+ */
+
+#ifndef LIVESYNC_TIMELINE_H
+#define LIVESYNC_TIMELINE_H
+
+#include <glib.h>
+
+#include <mutex>
+#include <vector>
+
+/**
+ * Marks of the app (camera 0) and of each camera, in monotonic time. Each
+ * phase is recorded once, the first time it is reached, so reconnects and
+ * later calls don't move it. Marks can come from any thread.
+ */
+class StartupTimeline
+{
+public:
+    StartupTimeline();
+
+    /* phase must be a string constant. */
+    void mark(guint camera, const gchar *phase);
+
+    /* Print the app's and the camera's marks in time order, with the time
+     * since the start and since the previous mark. Only the first time for
+     * each camera; later marks of the camera are ignored. */
+    void print(guint camera);
+
+private:
+    struct Mark
+    {
+        guint camera;
+        const gchar *phase;
+        gint64 time;
+    };
+
+    std::mutex lock;
+    gint64 start;
+    std::vector<Mark> marks;
+    std::vector<guint> printed;
+};
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Local reprojection of the 360 video: renders a perspective view from the
+ * decoded equirectangular frames and shows it in a window, so that looking
+ * around doesn't need a round-trip to the camera.
+ */
+
+#include "view_output.h"
+#include "logger.h"
+
+ViewOutput::ViewOutput(const gchar *name, const Viewport &view)
+    : view_name(name), pool(nullptr), current_caps(nullptr), frames_rendered(0),
+      frames_skipped(0), stopping(FALSE), requested_view(view), enabled(TRUE)
+{
+    GstElement *conv, *sink;
+    gchar *bin_name = g_strdup_printf("view-%s", name);
+
+    bin = gst_bin_new(bin_name);
+    g_free(bin_name);
+    gst_object_ref_sink(bin);
+    src = gst_element_factory_make("appsrc", NULL);
+    g_assert_nonnull(src);
+    conv = gst_element_factory_make("videoconvert", NULL);
+    g_assert_nonnull(conv);
+    sink = gst_element_factory_make("autovideosink", NULL);
+    g_assert_nonnull(sink);
+
+    // Buffers are timestamped when pushed, the frames are already late by
+    // the time it takes to decode and reproject them.
+    g_object_set(src, "is-live", TRUE, "format", GST_FORMAT_TIME,
+                 "do-timestamp", TRUE, NULL);
+
+    gst_bin_add_many(GST_BIN(bin), src, conv, sink, NULL);
+    gst_element_link_many(src, conv, sink, NULL);
+    gst_video_info_init(&pool_info);
+
+    worker = std::thread(&ViewOutput::run, this);
+}
+
+ViewOutput::~ViewOutput()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = TRUE;
+        pending = nullptr;
+    }
+    wake.notify_one();
+    worker.join();
+
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+    }
+    if (current_caps)
+        gst_caps_unref(current_caps);
+    gst_object_unref(bin);
+}
+
+Viewport ViewOutput::viewport()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return requested_view;
+}
+
+void ViewOutput::set_viewport(const Viewport &view)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    requested_view = view;
+}
+
+void ViewOutput::set_enabled(gboolean enable)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    enabled = enable;
+}
+
+/**
+ * Tell downstream about a new frame size or format, if it changed.
+ */
+void ViewOutput::set_caps(const GstVideoInfo *info)
+{
+    GstCaps *caps = gst_video_info_to_caps((GstVideoInfo *)info);
+
+    if (current_caps && gst_caps_is_equal(caps, current_caps))
+    {
+        gst_caps_unref(caps);
+        return;
+    }
+
+    gst_app_src_set_caps(GST_APP_SRC(src), caps);
+    if (current_caps)
+        gst_caps_unref(current_caps);
+    current_caps = caps;
+}
+
+/**
+ * (Re)create the output buffer pool when the view's size changes. Pooled
+ * buffers come back when the display is done with them, so rendering a frame
+ * doesn't allocate.
+ */
+gboolean ViewOutput::configure_pool(const Viewport &view)
+{
+    GstVideoInfo info;
+    GstStructure *config;
+    GstCaps *caps;
+
+    if (pool && GST_VIDEO_INFO_WIDTH(&pool_info) == view.width &&
+        GST_VIDEO_INFO_HEIGHT(&pool_info) == view.height)
+        return TRUE;
+
+    if (pool)
+    {
+        gst_buffer_pool_set_active(pool, FALSE);
+        gst_object_unref(pool);
+        pool = nullptr;
+    }
+
+    gst_video_info_set_format(&info, GST_VIDEO_FORMAT_I420, view.width,
+                              view.height);
+    caps = gst_video_info_to_caps(&info);
+    pool = gst_video_buffer_pool_new();
+    config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&info),
+                                      2, 0);
+    gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+    gst_caps_unref(caps);
+
+    if (!gst_buffer_pool_set_config(pool, config) ||
+        !gst_buffer_pool_set_active(pool, TRUE))
+    {
+        LOG_ERROR(LOG_MEDIA, "Failed to set up a %dx%d buffer pool for the view",
+                  view.width, view.height);
+        gst_object_unref(pool);
+        pool = nullptr;
+        return FALSE;
+    }
+
+    pool_info = info;
+    return TRUE;
+}
+
+void ViewOutput::push(const VideoFrameRef &frame)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (pending)
+            frames_skipped++;
+        pending = frame;
+    }
+    wake.notify_one();
+}
+
+/**
+ * The worker: render the newest frame whenever there is one.
+ */
+void ViewOutput::run()
+{
+    for (;;)
+    {
+        VideoFrameRef frame;
+        Viewport view;
+        gboolean reproject;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]
+                      { return pending || stopping; });
+            if (stopping)
+                break;
+            frame = std::move(pending);
+            pending = nullptr;
+            view = requested_view;
+            reproject = enabled;
+        }
+
+        render(frame, view, reproject);
+        frames_rendered++;
+    }
+}
+
+void ViewOutput::render(const VideoFrameRef &frame, const Viewport &requested,
+                        gboolean reproject)
+{
+    GstBuffer *buffer = nullptr;
+    GstVideoFrame out;
+    Viewport view;
+
+    if (frame->format() != GST_VIDEO_FORMAT_I420)
+    {
+        LOG_WARNING(LOG_MEDIA, "View needs I420 frames, got %s",
+                    gst_video_format_to_string(frame->format()));
+        return;
+    }
+
+    if (!reproject)
+    {
+        // A new buffer that shares the decoder's memory, as appsrc takes
+        // ownership and sets the timestamps.
+        set_caps(frame->info());
+        buffer = gst_buffer_copy_region(frame->buffer(),
+                                        (GstBufferCopyFlags)(GST_BUFFER_COPY_MEMORY |
+                                                             GST_BUFFER_COPY_META),
+                                        0, -1);
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+        return;
+    }
+
+    reprojector.set_viewport(requested);
+    view = reprojector.viewport(); // rounded to even sizes
+    if (!configure_pool(view) ||
+        gst_buffer_pool_acquire_buffer(pool, &buffer, NULL) != GST_FLOW_OK)
+        return;
+
+    if (!gst_video_frame_map(&out, &pool_info, buffer, GST_MAP_WRITE))
+    {
+        gst_buffer_unref(buffer);
+        return;
+    }
+
+    PlanarImage src_image, dst_image;
+    src_image.width = frame->width();
+    src_image.height = frame->height();
+    dst_image.width = view.width;
+    dst_image.height = view.height;
+    for (guint plane = 0; plane < 3; plane++)
+    {
+        src_image.data[plane] = (uint8_t *)frame->data(plane);
+        src_image.stride[plane] = frame->stride(plane);
+        dst_image.data[plane] = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&out, plane);
+        dst_image.stride[plane] = GST_VIDEO_FRAME_PLANE_STRIDE(&out, plane);
+    }
+    reprojector.process(src_image, dst_image);
+    gst_video_frame_unmap(&out);
+
+    set_caps(&pool_info);
+    gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+}
@@ -0,0 +1,90 @@
+/*
+ * Local reprojection of the 360 video: renders a perspective view from the
+ * decoded equirectangular frames and shows it in a window, so that looking
+ * around doesn't need a round-trip to the camera.
+ */
+
+#ifndef LIVESYNC_VIEW_OUTPUT_H
+#define LIVESYNC_VIEW_OUTPUT_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "frame_sink.h"
+#include "reproject.h"
+
+/**
+ * appsrc ! videoconvert ! autovideosink, fed with I420 frames from a
+ * FrameSink. Each frame is reprojected into a buffer from our own pool, or
+ * passed through as is when reprojection is off ("equi").
+ *
+ * Every view renders on its own worker thread, so several views of the same
+ * decoded frame run in parallel. The frames are shared read-only; a view
+ * that falls behind skips to the newest frame instead of queueing.
+ *
+ * The viewport can be changed from any thread, push() is called from the
+ * FrameSink's streaming thread.
+ */
+class ViewOutput
+{
+public:
+    ViewOutput(const gchar *name, const Viewport &view);
+    ~ViewOutput();
+
+    /* A bin with the appsrc and the display, to be added to a pipeline. */
+    GstElement *element() const { return bin; }
+    const gchar *name() const { return view_name.c_str(); }
+
+    Viewport viewport();
+    void set_viewport(const Viewport &view);
+
+    /* FALSE shows the equirectangular frames without reprojecting them. */
+    void set_enabled(gboolean enabled);
+
+    /* Hand a frame to the worker and return at once. Must be I420. */
+    void push(const VideoFrameRef &frame);
+
+    /* Frames rendered and frames skipped because the worker was busy. */
+    guint64 rendered() const { return frames_rendered; }
+    guint64 skipped() const { return frames_skipped; }
+
+private:
+    ViewOutput(const ViewOutput &) = delete;
+    ViewOutput &operator=(const ViewOutput &) = delete;
+
+    void run();
+    void render(const VideoFrameRef &frame, const Viewport &view,
+                gboolean reproject);
+    void set_caps(const GstVideoInfo *info);
+    gboolean configure_pool(const Viewport &view);
+
+    std::string view_name;
+    GstElement *bin;
+    GstElement *src;
+
+    // Worker thread only.
+    GstBufferPool *pool;
+    GstVideoInfo pool_info;
+    GstCaps *current_caps;
+    EquirectReprojector reprojector;
+    std::thread worker;
+
+    std::atomic<guint64> frames_rendered;
+    std::atomic<guint64> frames_skipped;
+
+    std::mutex lock; // protects the fields below
+    std::condition_variable wake;
+    VideoFrameRef pending; // newest frame not rendered yet
+    gboolean stopping;
+    Viewport requested_view;
+    gboolean enabled;
+};
+
+#endif